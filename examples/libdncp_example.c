@@ -10,6 +10,20 @@
  *
  * In this example, we just include code from hncp, where these functions
  * are implemented.
+ *
+ * Several instances, each with its own sockets, buffers, timeouts and
+ * runtime metrics (dncp_get_stats), may be created in the same process.
+ * No state of an instance is kept in globals. The following state is
+ * however shared by the whole process:
+ *  - log_level and hnetd_log, defined by the program (as below),
+ *  - the uloop event loop, of which libubox has a single one per process,
+ *  - the event trace (hnetd_trace.c), when tracing is enabled. It belongs
+ *    to the event loop rather than to an instance, as it times every uloop
+ *    callback, whichever module (or instance) it belongs to,
+ *  - with DTLS, the OpenSSL initialization flag (dtls.c) and the state of
+ *    OpenSSL itself.
+ * None of it is locked, so the library is not reentrant: all instances must
+ * be created, used and destroyed from the thread running uloop_run.
  */
 
 int log_level = 7;
@@ -25,7 +39,9 @@ static void example_log(__unused int priority, const char *format, ...) {
 
 void (*hnetd_log)(int priority, const char *format, ...) = example_log;
 
-/* In this example, we just use hncp's functions */
+/* In this example, we just use hncp's functions (but not its traffic
+ * capture) */
+#define DISABLE_HNCP_CAPTURE
 #include "udp46.c"
 #include "hncp_io.c"
 #include "hncp.c"
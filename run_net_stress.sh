@@ -12,17 +12,16 @@
 # Edit time:     12 min
 #
 
-ITERATIONS=1000
-JOBS=13
+# Run test_hncp_net with ITERATIONS different random seeds, on all
+# cores; extra arguments are passed to test_hncp_net (e.g. test names).
+# The first failure stops the run, and the seed is printed.
+
+ITERATIONS=${ITERATIONS:-1000}
 
 cmake -DL_LEVEL=1 .
-make test_hncp_net
-for i in `seq $ITERATIONS`
-do
-    ( ./test_hncp_net -r $i $* 2>&1 | grep -q SUCCESS && echo -n "." || echo $i ) &
-    if (( $i % $JOBS == 0)) ; then wait ; fi
-done
-echo
+make test_hncp_net net_sim_runner
+RC=0
+./net_sim_runner -n $ITERATIONS -t 600 ./test_hncp_net $* || RC=$?
 cmake -DL_LEVEL=7 .
 make test_hncp_net
-
+exit $RC
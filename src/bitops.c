@@ -142,50 +142,128 @@ int bmemcmp_s(const uint8_t *m1, const uint8_t *m2, size_t start, size_t nbits)
 	return nbits?bmemcmp(m1, m2, nbits):0;
 }
 
+static const uint64_t hff = 0xffffffffffffffff; //binary: all ones
+
+#ifdef __GNUC__
+
+/* Let the compiler pick the popcnt/lzcnt instructions when the target has them
+ * (e.g. -mpopcnt, -march=native), or its own portable implementation. */
+#define popcount64(x) __builtin_popcountll(x)
+#define clz64(x) __builtin_clzll(x)
+
+#else
+
 static const uint64_t m1  = 0x5555555555555555; //binary: 0101...
 static const uint64_t m2  = 0x3333333333333333; //binary: 00110011..
 static const uint64_t m4  = 0x0f0f0f0f0f0f0f0f; //binary:  4 zeros,  4 ones ...
-static const uint64_t hff = 0xffffffffffffffff; //binary: all ones
 static const uint64_t h01 = 0x0101010101010101; //the sum of 256 to the power of 0,1,2,3...
-static inline int popcount_3(uint64_t x) {
+static inline int popcount64(uint64_t x) {
     x -= (x >> 1) & m1;             //put count of each 2 bits into those 2 bits
     x = (x & m2) + ((x >> 2) & m2); //put count of each 4 bits into those 4 bits
     x = (x + (x >> 4)) & m4;        //put count of each 8 bits into those 8 bits
     return (x * h01)>>56;  //returns left 8 bits of x + (x<<8) + (x<<16) + (x<<24) + ...
 }
 
+/* x must not be 0 */
+static inline int clz64(uint64_t x) {
+	int n = 0;
+	while(!(x & 0xffffffff00000000)) { n += 32; x <<= 32; }
+	while(!(x & 0xff00000000000000)) { n += 8; x <<= 8; }
+	while(!(x & 0x8000000000000000)) { n += 1; x <<= 1; }
+	return n;
+}
+
+#endif
+
 size_t hamming_distance_64(const uint64_t *m1, const uint64_t *m2, size_t nbits)
 {
+	if(nbits == 128) //Whole IPv6 addresses
+		return popcount64(m1[0] ^ m2[0]) + popcount64(m1[1] ^ m2[1]);
+
 	size_t dst = 0;
 	size_t n = nbits / 64;
 	size_t rem = nbits % 64;
 	size_t i;
 	for(i = 0; i < n; i++)
-		dst += popcount_3(m1[i] ^ m2[i]);
+		dst += popcount64(m1[i] ^ m2[i]);
 
 	if(rem)
-		dst += popcount_3(be64_to_cpu(m1[n] ^ m2[n]) & (hff << (64 - rem)));
+		dst += popcount64(be64_to_cpu(m1[n] ^ m2[n]) & (hff << (64 - rem)));
 
 	return dst;
 }
 
+/* Number of bits set in m, from bit 'start' to 'start + nbits'. */
+static size_t bpopcount(const uint8_t *m, size_t start, size_t nbits)
+{
+	size_t cnt = 0;
+	uint64_t w;
+	if(!nbits)
+		return 0;
+
+	m += start >> 3;
+	start &= 0x07;
+	if(start) {
+		uint8_t b = *m++ & (0xff >> start);
+		size_t n = 8 - start;
+		if(nbits < n)
+			return popcount64(b & (uint8_t)(0xff << (n - nbits)));
+		cnt += popcount64(b);
+		nbits -= n;
+	}
+
+	for(; nbits >= 64; nbits -= 64, m += 8) {
+		memcpy(&w, m, sizeof(w)); //Byte order does not matter
+		cnt += popcount64(w);
+	}
+	for(; nbits >= 8; nbits -= 8)
+		cnt += popcount64(*m++);
+	if(nbits)
+		cnt += popcount64(*m & (uint8_t)(0xff << (8 - nbits)));
+	return cnt;
+}
+
+/* Offset, relative to 'start', of the first bit set in m.
+ * Returns nbits if none is set within 'nbits' bits. */
+static size_t bfirst_set(const uint8_t *m, size_t start, size_t nbits)
+{
+	size_t off = 0;
+	uint64_t w;
+
+	m += start >> 3;
+	start &= 0x07;
+	if(start) {
+		uint8_t b = *m++ & (0xff >> start);
+		if(b) {
+			off = clz64(b) - 56 - start;
+			return (off < nbits)?off:nbits;
+		}
+		off = 8 - start;
+	}
+
+	for(; off + 64 <= nbits; off += 64, m += 8) {
+		memcpy(&w, m, sizeof(w));
+		if(w)
+			return off + clz64(be64_to_cpu(w));
+	}
+	for(; off < nbits; off += 8, m++) {
+		if(*m) {
+			off += clz64(*m) - 56;
+			return (off < nbits)?off:nbits;
+		}
+	}
+	return nbits;
+}
+
 size_t hamming_minimize(const uint8_t *max, const uint8_t *target,
 		uint8_t *dst, size_t start_len, size_t nbits)
 {
-	//todo: We actually don't need getbit/setbit
-	//A better approach would be to look for the first bit
-	//set to 1 in max, and see whether the target
-	//is greater or lower at that point. If greater
-	//just flip that bit and copy the rest of the target.
-
-	size_t ret = 0;
+	//Leading bits set to 0 in max must be 0 in dst, and cost one for each
+	//bit set in target. Past the first bit set in max, the target can be
+	//copied, with at most that bit flipped if the target is too big.
 	size_t end = start_len + nbits;
-	size_t n = start_len;
-	while(n != end && !(max[n/8] & (0x80 >> (n%8)))) {
-		if(target[n/8] & (0x80 >> (n%8)))
-			ret ++;
-		n++;
-	}
+	size_t n = start_len + bfirst_set(max, start_len, nbits);
+	size_t ret = bpopcount(target, start_len, n - start_len);
 	bmemcpy(dst, max, start_len, n - start_len);
 
 	nbits = end - n;
@@ -103,7 +103,13 @@ static struct btrie *btrie_node_lookup(struct btrie *n, const pkey_t *key, plen_
 	return n->parent;
 }
 
-static inline struct btrie *btrie_new_node(struct btrie *parent, struct btrie **child)
+static void btrie_node_free(struct btrie *n)
+{
+	free(n->counts);
+	free(n);
+}
+
+static inline struct btrie *btrie_new_node(struct btrie *parent, struct btrie **child, plen_t plen)
 {
 	struct btrie *node;
 	if(!(node = malloc(sizeof(struct btrie))))
@@ -113,11 +119,146 @@ static inline struct btrie *btrie_new_node(struct btrie *parent, struct btrie **
 	node->parent = parent;
 	node->child[0] = NULL;
 	node->child[1] = NULL;
+	node->counts = NULL;
+	node->avail = 0;
+	node->plen = plen;
 	*child = node;
 	return node;
 }
 
-static void btrie_delete_maybe(struct btrie *n)
+/* Number of available keys located on the path leading to c, of length in [from, c->plen]. */
+static inline uint32_t btrie_avail_path_len(struct btrie *c, unsigned int from)
+{
+	unsigned int to = (c->plen < BTRIE_AVAIL_LEN)?c->plen:(BTRIE_AVAIL_LEN - 1);
+	return (to >= from)?(to - from + 1):0;
+}
+
+/* Computes the number of available keys contained in n from its children. */
+static uint32_t btrie_avail_node(struct btrie *n)
+{
+	uint32_t avail = 0;
+	int i;
+	if(!list_empty(&n->elements.l) || n->plen >= BTRIE_AVAIL_LEN)
+		return 0;
+
+	if(!n->child[0] && !n->child[1])
+		return 1;
+
+	for(i = 0; i < 2; i++) {
+		if(n->child[i]) {
+			avail += btrie_avail_path_len(n->child[i], n->plen + 2) + n->child[i]->avail;
+		} else if(n->plen + 1 < BTRIE_AVAIL_LEN) {
+			avail++;
+		}
+	}
+	return avail;
+}
+
+static unsigned int btrie_avail_sum(struct btrie *n, uint32_t *counts, unsigned int base);
+
+/* Adds available keys located on the path leading to c, of length in [from, c->plen],
+ * and available keys contained in c, to counters indexed from key length base. */
+static unsigned int btrie_avail_path(struct btrie *c, unsigned int from, uint32_t *counts, unsigned int base)
+{
+	for(; from <= c->plen && from < BTRIE_AVAIL_LEN; from++)
+		counts[from - base]++;
+	return btrie_avail_sum(c, counts, base);
+}
+
+/* Adds available keys contained in n to counters indexed from key length base,
+ * computing them from n's children. Returns the number of visited nodes. */
+static unsigned int btrie_avail_compute(struct btrie *n, uint32_t *counts, unsigned int base)
+{
+	unsigned int visited = 1;
+	int i;
+	if(!list_empty(&n->elements.l) || n->plen >= BTRIE_AVAIL_LEN)
+		return visited;
+
+	if(!n->child[0] && !n->child[1]) {
+		counts[n->plen - base]++;
+		return visited;
+	}
+
+	for(i = 0; i < 2; i++) {
+		if(n->child[i]) {
+			visited += btrie_avail_path(n->child[i], n->plen + 2, counts, base);
+		} else if(n->plen + 1 < BTRIE_AVAIL_LEN) {
+			counts[n->plen + 1 - base]++;
+		}
+	}
+	return visited;
+}
+
+/* Adds available keys contained in n to counters indexed from key length base.
+ * Counts are kept by n when computing them is costly enough.
+ * Returns the number of visited nodes. */
+static unsigned int btrie_avail_sum(struct btrie *n, uint32_t *counts, unsigned int base)
+{
+	unsigned int l, visited;
+	if(!n->avail)
+		return 0;
+
+	if(n->counts) {
+		for(l = n->plen; l < BTRIE_AVAIL_LEN; l++)
+			counts[l - base] += n->counts[l - n->plen];
+		return 1;
+	}
+
+	visited = btrie_avail_compute(n, counts, base);
+#if BTRIE_AVAIL_CACHE
+	if(visited >= BTRIE_AVAIL_CACHE && (n->counts = calloc(BTRIE_AVAIL_LEN - n->plen, sizeof(uint32_t))))
+		btrie_avail_compute(n, n->counts, n->plen); //Costly descendants now keep their counts
+#endif
+	return visited;
+}
+
+/* Returns the available keys counts of n, indexed from n's key length.
+ * tmp is used when n does not keep its counts. */
+static const uint32_t *btrie_avail_get(struct btrie *n, uint32_t *tmp)
+{
+	if(n->counts)
+		return n->counts;
+
+	memset(tmp, 0, (BTRIE_AVAIL_LEN - n->plen) * sizeof(uint32_t));
+	btrie_avail_sum(n, tmp, n->plen);
+	return tmp;
+}
+
+/* Updates available keys counters after a modification.
+ * Counters of nodes from n up to top (which are the nodes which were created or
+ * had their elements or children modified) are recomputed from their children.
+ * The resulting difference is then added to the counters of top's ancestors.
+ * Ancestors of a node containing elements do not account for the keys below it,
+ * and are therefore left unchanged. */
+static void btrie_avail_update(struct btrie *n, struct btrie *top)
+{
+	uint32_t delta = 0;
+	int above = 0;
+	for(; n; n = n->parent) {
+		if(above && !list_empty(&n->elements.l))
+			return;
+
+		if(n->counts) {
+			free(n->counts);
+			n->counts = NULL;
+		}
+
+		if(above) {
+			n->avail += delta; //Modular arithmetic
+		} else if(n == top) {
+			delta = n->avail;
+			n->avail = btrie_avail_node(n);
+			delta = n->avail - delta;
+			above = 1;
+		} else {
+			n->avail = btrie_avail_node(n);
+		}
+	}
+}
+
+/* Deletes useless nodes, starting from n and going up.
+ * Returns the first remaining node on the path. */
+static struct btrie *btrie_delete_maybe(struct btrie *n)
 {
 	struct btrie *o, **c, *p;
 	while(list_empty(&n->elements.l) && n->parent && (!n->child[0] || !n->child[1])) {
@@ -126,7 +267,7 @@ static void btrie_delete_maybe(struct btrie *n)
 			o = n->child[1];
 
 		if(o && !(n->plen & remain_mask))
-			return;
+			return n;
 
 		c = &n->parent->child[0];
 		if(*c != n)
@@ -134,35 +275,35 @@ static void btrie_delete_maybe(struct btrie *n)
 
 		*c = o;
 		p = n->parent;
-		free(n);
+		btrie_node_free(n);
 
 		if(o) {
 			o->parent = p;
-			return;
+			return p;
 		}
 		n = p;
 	}
+	return n;
 }
 
 static struct btrie *btrie_add_leaf(struct btrie *parent, struct btrie **child,
 		const pkey_t *key, plen_t plen)
 {
 	struct btrie *node;
+	plen_t next_i = index(parent->plen);
+	plen_t index = index(plen - 1);
 	*child = NULL;
-	if(!(node = btrie_new_node(parent, child))) {
-		btrie_delete_maybe(parent); //Maybe parent(s) can be deleted
+	if(!(node = btrie_new_node(parent, child,
+			(index == next_i)?plen:((next_i + 1) << index_shift)))) { //Last element or maximum plen for this element
+		parent = btrie_delete_maybe(parent); //Maybe parent(s) can be deleted, others are unchanged
+		btrie_avail_update(parent, parent);
 		return NULL;
 	}
 
-	plen_t next_i = index(parent->plen);
-	plen_t index = index(plen - 1);
 	node->key = ntohk(key[next_i]);
-	if(index == next_i) { //Last element
-		node->plen = plen;
+	if(index == next_i)
 		return node;
-	}
 
-	node->plen = ((next_i + 1) << index_shift); //Maximum plen for this element
 	if(ntohk(key[next_i + 1]) & first_bit_mask) { //First bit of the next block
 		return btrie_add_leaf(node, &node->child[1], key, plen);
 	} else {
@@ -197,10 +338,9 @@ static struct btrie *btrie_solve_conflict(struct btrie *current, struct btrie **
 	struct btrie *node;
 	plen_t match_len = btrie_longest_match_node(current, key, plen, min_match);
 
-	if(!(node = btrie_new_node(current->parent, child)))
+	if(!(node = btrie_new_node(current->parent, child, match_len)))
 		return NULL;
 
-	node->plen = match_len;
 	node->key = ntohk(key[index(match_len - 1)]);
 	current->parent = node;
 
@@ -245,6 +385,7 @@ void btrie_init(struct btrie *root) {
 	memset(root, 0, sizeof(struct btrie));
 	INIT_LIST_HEAD(&root->elements.l);
 	root->elements.node = NULL;
+	root->avail = 1;
 }
 
 #define node(element) ((struct btrie *) (element)) //elements is first field in btrie
@@ -253,10 +394,13 @@ void btrie_init(struct btrie *root) {
 
 int btrie_add(struct btrie *root, struct btrie_element *e, const pkey_t *key, plen_t len)
 {
-	struct btrie *n = btrie_node_goc(root, key, len, 1);
+	struct btrie *p = btrie_node_lookup(root, key, len); //Deepest existing node modified by the addition
+	struct btrie *n = (p->plen == len)?p:btrie_node_add(p, key, len);
 	if(n) {
 		e->node = n;
 		list_add_tail(&e->l, &n->elements.l);
+		if(e->l.prev == &n->elements.l) //First element
+			btrie_avail_update(n, p);
 		return 0;
 	}
 	return -1;
@@ -264,9 +408,12 @@ int btrie_add(struct btrie *root, struct btrie_element *e, const pkey_t *key, pl
 
 void btrie_remove(struct btrie_element *e)
 {
+	struct btrie *n;
 	list_del(&e->l);
-	if(list_empty(&e->node->elements.l))
-		btrie_delete_maybe(e->node);
+	if(list_empty(&e->node->elements.l)) {
+		n = btrie_delete_maybe(e->node);
+		btrie_avail_update(n, n);
+	}
 }
 
 void btrie_get_key(struct btrie_element *e, btrie_key_t *key)
@@ -697,60 +844,258 @@ struct btrie *btrie_next_available_loop(struct btrie *prev,
 
 uint64_t btrie_available_space(struct btrie *root, const btrie_key_t *key, btrie_plen_t len, btrie_plen_t target_len)
 {
-	uint64_t count = 0;
-	plen_t next_len, max;
-	struct btrie *node = btrie_longest_match_available(root, key, len, len, &next_len);
-	if(!node)
+	uint32_t counts[BTRIE_AVAIL_LEN];
+	uint64_t space = 0;
+	unsigned int l, max = target_len;
+
+	if(max > (unsigned int)len + 63)
+		max = len + 63;
+
+	if(max >= BTRIE_AVAIL_LEN)
+		max = BTRIE_AVAIL_LEN - 1;
+
+	btrie_available_count(root, key, len, counts, max);
+	for(l = len; l <= max; l++)
+		space += counts[l] * (BTRIE_AVAILABLE_ALL >> (l - len));
+
+	return space;
+}
+
+enum bt_avail_lookup {
+	BT_AVAILLK_NONE, //The key is not available
+	BT_AVAILLK_ALL,  //The whole key is available
+	BT_AVAILLK_NODE, //The node has the key length
+	BT_AVAILLK_PATH, //The node is the first below the key
+};
+
+/* Finds the node which counters give the available keys contained in the given key. */
+static enum bt_avail_lookup btrie_avail_lookup(struct btrie *root, const btrie_key_t *key, btrie_plen_t len,
+		struct btrie **node)
+{
+	struct btrie *n = btrie_node_lookup(root, key, len);
+	struct btrie *p, *child;
+	for(p = n; p; p = p->parent) {
+		if(!list_empty(&p->elements.l))
+			return BT_AVAILLK_NONE;
+	}
+
+	if(n->plen == len) {
+		*node = n;
+		return BT_AVAILLK_NODE;
+	}
+
+	if(nthbit(ntohk(key[index(n->plen)]), remain(n->plen))) {
+		child = n->child[1];
+	} else {
+		child = n->child[0];
+	}
+
+	if(!child || len >= child->plen || ((ntohk(key[index(n->plen)]) ^ child->key) & mask(remain(len - 1))))
+		return BT_AVAILLK_ALL;
+
+	*node = child;
+	return BT_AVAILLK_PATH;
+}
+
+void btrie_available_count(struct btrie *root, const btrie_key_t *key, btrie_plen_t len,
+		uint32_t *counts, btrie_plen_t max_len)
+{
+	uint32_t c[BTRIE_AVAIL_LEN];
+	struct btrie *node;
+	unsigned int l;
+
+	memset(c, 0, sizeof(c));
+	switch (btrie_avail_lookup(root, key, len, &node)) {
+		case BT_AVAILLK_NODE:
+			btrie_avail_sum(node, c, 0);
+			break;
+		case BT_AVAILLK_PATH:
+			btrie_avail_path(node, len + 1, c, 0);
+			break;
+		case BT_AVAILLK_ALL:
+			if(len < BTRIE_AVAIL_LEN)
+				c[len] = 1;
+			break;
+		case BT_AVAILLK_NONE:
+		default:
+			break;
+	}
+
+	for(l = 0; l <= max_len; l++)
+		counts[l] = (l < BTRIE_AVAIL_LEN)?c[l]:0;
+}
+
+struct bt_nth {
+	pkey_t *key;
+	plen_t *len;
+	plen_t min_len;
+	plen_t max_len;
+	plen_t target_len;
+	uint64_t n;
+};
+
+enum bt_nth_res {
+	BT_NTH_NEXT,
+	BT_NTH_FOUND,
+	BT_NTH_DESCEND,
+};
+
+/* Number of keys of length target_len contained in count available keys of length l. */
+static uint64_t btrie_nth_weight(struct bt_nth *s, unsigned int l, uint32_t count)
+{
+	unsigned int sh;
+	if(!count || l < s->min_len || l > s->max_len)
 		return 0;
 
-	if(next_len < len)
+	sh = s->target_len - l;
+	if(sh >= 63 || count > (BTRIE_AVAILABLE_ALL >> sh))
 		return BTRIE_AVAILABLE_ALL;
 
-	if(target_len - len > 63)
-		target_len = len + 63;
+	return ((uint64_t)count) << sh;
+}
 
-node:
-	if(next_len < node->plen) {
-		max = (node->plen > target_len)?len + 63:node->plen;
-		plen_t left = next_len - len + 1;
-		plen_t right = 64 - (max - len + 1);
-		count += (((0xffffffffffffffffu << (left)) >> (left + right)) << (right));
+/* Returns 1 if the available key of length l contains the nth key. */
+static int btrie_nth_key(struct bt_nth *s, unsigned int l)
+{
+	uint64_t w = btrie_nth_weight(s, l, 1);
+	if(s->n < w)
+		return 1;
+
+	s->n -= w;
+	return 0;
+}
+
+/* Walks the available keys on the path leading to c and contained in c, in key order. */
+static enum bt_nth_res btrie_nth_path(struct bt_nth *s, struct btrie *c, unsigned int from)
+{
+	unsigned int l, first, last;
+	uint32_t tmp[BTRIE_AVAIL_LEN];
+	const uint32_t *counts;
+	uint64_t w = 0, wl;
+
+	first = (from < s->min_len)?s->min_len:from;
+	last = (c->plen > s->max_len)?s->max_len:c->plen;
+
+	//Keys on the left of the path
+	for(l = first; l <= last; l++) {
+		if(nthbit(c->key, remain(l - 1)) && btrie_nth_key(s, l))
+			goto found;
 	}
 
-	if(!list_empty(&node->elements.l) || node->plen >= target_len)
-		goto up;
+	//Keys contained in c
+	if(c->avail && c->plen <= s->max_len) {
+		counts = btrie_avail_get(c, tmp);
+		for(l = (c->plen > s->min_len)?c->plen:s->min_len; l <= s->max_len; l++) {
+			wl = btrie_nth_weight(s, l, counts[l - c->plen]);
+			w = (wl >= BTRIE_AVAILABLE_ALL - w)?BTRIE_AVAILABLE_ALL:(w + wl);
+		}
+	}
 
-	//Only root can have no child. But root plen is 0, so no bound problem.
+	if(s->n < w) {
+		s->key[index(c->plen - 1)] = htonk(c->key & mask(remain(c->plen - 1)));
+		return BT_NTH_DESCEND;
+	}
+	s->n -= w;
 
-//left:
-	if(node->child[0]) {
-		next_len = node->plen + 1;
-		node = node->child[0];
-		goto node;
-	} else {
-		count += BTRIE_AVAILABLE_ALL >> (node->plen + 1 - len);
+	//Keys on the right of the path
+	for(l = last; l >= first; l--) {
+		if(!nthbit(c->key, remain(l - 1)) && btrie_nth_key(s, l))
+			goto found;
 	}
+	return BT_NTH_NEXT;
 
-right:
-	if(node->child[1]) {
-		next_len = node->plen + 1;
-		node = node->child[1];
-		goto node;
-	} else {
-		count += BTRIE_AVAILABLE_ALL >> (node->plen + 1 - len);
+found:
+	s->key[index(l - 1)] = htonk((c->key & mask(remain(l - 1))) ^ (first_bit_mask >> remain(l - 1)));
+	*s->len = l;
+	return BT_NTH_FOUND;
+}
+
+/* Walks the available keys contained in n, in key order. */
+static int btrie_nth_node(struct bt_nth *s, struct btrie *n)
+{
+	struct btrie *c;
+	pkey_t k;
+	int i;
+
+node:
+	if(!list_empty(&n->elements.l))
+		return 0;
+
+	if(!n->child[0] && !n->child[1]) {
+		if(!btrie_nth_key(s, n->plen))
+			return 0;
+		*s->len = n->plen;
+		return 1;
 	}
 
-up:
-	if(!node->parent || node->parent->plen < len)
-		return count;
+	for(i = 0; i < 2; i++) {
+		if((c = n->child[i])) {
+			switch (btrie_nth_path(s, c, n->plen + 2)) {
+				case BT_NTH_FOUND:
+					return 1;
+				case BT_NTH_DESCEND:
+					n = c;
+					goto node;
+				case BT_NTH_NEXT:
+				default:
+					break;
+			}
+		} else if(btrie_nth_key(s, n->plen + 1)) {
+			k = remain(n->plen)?(ntohk(s->key[index(n->plen)]) & mask(remain(n->plen) - 1)):0;
+			if(i)
+				k |= first_bit_mask >> remain(n->plen);
+			s->key[index(n->plen)] = htonk(k);
+			*s->len = n->plen + 1;
+			return 1;
+		}
+	}
+	return 0;
+}
 
-	if(node == node->parent->child[0]) {
-		node = node->parent;
-		goto right;
-	} else {
-		node = node->parent;
-		goto up;
+int btrie_available_nth(struct btrie *root, btrie_key_t *iter_key, btrie_plen_t *iter_len,
+		const btrie_key_t *contain_key, btrie_plen_t contain_len,
+		btrie_plen_t min_len, btrie_plen_t max_len, btrie_plen_t target_len, uint64_t *n)
+{
+	struct btrie *node;
+	int found = 0;
+	struct bt_nth s = {
+			.key = iter_key,
+			.len = iter_len,
+			.min_len = min_len,
+			.max_len = max_len,
+			.target_len = target_len,
+			.n = *n
+	};
+
+	if(contain_len)
+		memcpy(iter_key, contain_key, ((contain_len - 1) >> 3) + 1);
+
+	switch (btrie_avail_lookup(root, contain_key, contain_len, &node)) {
+		case BT_AVAILLK_NODE:
+			found = btrie_nth_node(&s, node);
+			break;
+		case BT_AVAILLK_PATH:
+			switch (btrie_nth_path(&s, node, contain_len + 1)) {
+				case BT_NTH_FOUND:
+					found = 1;
+					break;
+				case BT_NTH_DESCEND:
+					found = btrie_nth_node(&s, node);
+					break;
+				case BT_NTH_NEXT:
+				default:
+					break;
+			}
+			break;
+		case BT_AVAILLK_ALL:
+			if((found = btrie_nth_key(&s, contain_len)))
+				*iter_len = contain_len;
+			break;
+		case BT_AVAILLK_NONE:
+		default:
+			break;
 	}
 
-	return 0; //Avoid warning
+	*n = s.n;
+	return found?0:-1;
 }
@@ -49,6 +49,18 @@
  * It can take values 8, 16, 32 or 64 (64 is not available in network byte order). */
 #define BTRIE_KEY 32
 
+/* Each node maintains the number of available keys (See btrie_for_each_available)
+ * contained in the node's key. Available keys of length greater or equal to
+ * BTRIE_AVAIL_LEN are not accounted by counting functions. */
+#define BTRIE_AVAIL_LEN 129
+
+/* Counts of available keys by key length are computed when needed, by visiting the
+ * nodes containing available keys. Nodes for which it required visiting at least
+ * BTRIE_AVAIL_CACHE nodes keep their counts until a key below them is modified,
+ * which costs (BTRIE_AVAIL_LEN - node key length) * 4 bytes.
+ * Set to 0 in order to never keep counts. */
+#define BTRIE_AVAIL_CACHE 64
+
 /* As keys are bit sequences provided as possibly non single byte elements, endianness matters.
  * Defining this value specifies that the key is stored in network byte order. If not defined,
  * each key array element is considered as an integer of BTRIE_KEY bits in home byte order. */
@@ -214,7 +226,7 @@ struct btrie *btrie_next_available_loop(struct btrie *prev,
  * BTRIE_AVAILABLE_ALL is returned when the given prefix is available.
  * BTRIE_AVAILABLE_ALL >> 1 if one half is available and the other half is not,
  * BTRIE_AVAILABLE_ALL >> 1 + BTRIE_AVAILABLE_ALL >> 2 if one half plus one quarter are available, etc...
- * Available prefixes of length > target_len or length >= 64 + len are ignored. */
+ * Available prefixes of length > target_len, length >= 64 + len or length >= BTRIE_AVAIL_LEN are ignored. */
 #define BTRIE_AVAILABLE_ALL 0x8000000000000000u
 uint64_t btrie_available_space(struct btrie *root, const btrie_key_t *key, btrie_plen_t len, btrie_plen_t target_len);
 
@@ -222,11 +234,36 @@ uint64_t btrie_available_space(struct btrie *root, const btrie_key_t *key, btrie
 #define btrie_available_prefixes_count(root, key, len, target_len) \
 			(btrie_available_space(root, key, len, target_len) >> (63 - (target_len - len)))
 
+/* Counts the available keys contained in the given key, by key length.
+ * counts[l] is set to the number of available keys of length l, for l in [0, max_len].
+ * Gives the same result as counting keys returned by btrie_for_each_available,
+ * except that keys of length >= BTRIE_AVAIL_LEN are not counted.
+ * Subtrees containing no available key are skipped, and kept counts are used
+ * when present (See BTRIE_AVAIL_CACHE). */
+void btrie_available_count(struct btrie *root, const btrie_key_t *key, btrie_plen_t len,
+		uint32_t *counts, btrie_plen_t max_len);
+
+/* Looks for the available key containing the nth key of length target_len.
+ * Only available keys of length in [min_len, max_len] and contained in contain_key are
+ * considered, in the same order as btrie_for_each_available. Each of them contains
+ * 2^(target_len - iter_len) keys of length target_len (saturated to 2^63).
+ * max_len must be lower or equal to target_len, and lower than BTRIE_AVAIL_LEN.
+ * *n must be lower than 2^63 (Sums are saturated as well).
+ * Returns 0 when found, in which case iter_key and iter_len are set to the available key
+ * and *n to the index of the key of length target_len inside the available key.
+ * Returns -1 otherwise, in which case the total number of considered keys was subtracted from *n.
+ * Uses the node counters in order to descend the tree toward the key. */
+int btrie_available_nth(struct btrie *root, btrie_key_t *iter_key, btrie_plen_t *iter_len,
+		const btrie_key_t *contain_key, btrie_plen_t contain_len,
+		btrie_plen_t min_len, btrie_plen_t max_len, btrie_plen_t target_len, uint64_t *n);
+
 /***************Private**************/
 struct btrie {
 	struct btrie_element elements; //Must be first for cast
 	struct btrie *parent;
 	struct btrie *child[2];
+	uint32_t *counts; //Kept available keys counts by key length, starting at plen, or NULL
+	uint32_t avail; //Available keys count
 	btrie_plen_t plen;
 	btrie_key_t key;
 };
@@ -560,6 +560,9 @@ void dncp_calculate_network_hash(dncp o)
   if (!o->network_hash_dirty)
     return;
 
+  HNETD_STATS_TIMER(t);
+  hnetd_stats_inc(&o->stats, HNETD_STATS_DNCP_NETWORK_HASH);
+
   /* Store original network hash for future study. */
   dncp_hash_s old_hash = o->network_hash;
 
@@ -590,6 +593,7 @@ void dncp_calculate_network_hash(dncp o)
     dncp_trickle_reset(o);
 
   o->network_hash_dirty = false;
+  HNETD_STATS_RECORD(&o->stats, HNETD_STATS_H_DNCP_NETWORK_HASH, t);
 }
 
 bool dncp_add_tlv_index(dncp o, uint16_t type)
@@ -814,6 +818,11 @@ dncp_ext dncp_get_ext(dncp o)
   return o->ext;
 }
 
+hnetd_stats dncp_get_stats(dncp o)
+{
+  return &o->stats;
+}
+
 hnetd_time_t dncp_node_get_origination_time(dncp_node n)
 {
   return n->origination_time;
@@ -15,6 +15,7 @@
 
 #include "hnetd.h"
 #include "tlv.h"
+#include "hnetd_stats.h"
 
 /* in6_addr */
 #include <netinet/in.h>
@@ -341,6 +342,7 @@ void dncp_unsubscribe(dncp o, dncp_subscriber s);
 /* Accessors */
 dncp_ext dncp_get_ext(dncp o);
 dncp_node dncp_get_own_node(dncp o);
+hnetd_stats dncp_get_stats(dncp o);
 
 /************************************************************** Per-node API */
 
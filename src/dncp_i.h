@@ -22,6 +22,7 @@
 #include "dncp_util.h"
 
 #include "dns_util.h"
+#include "hnetd_stats.h"
 
 /* ADDR_REPR etc. */
 #include "prefix.h"
@@ -118,6 +119,9 @@ struct dncp_struct {
 
   /* Number of times neighbor has been dropped. */
   int num_neighbor_dropped;
+
+  /* Runtime metrics of this instance (and of the modules using it). */
+  hnetd_stats_s stats;
 };
 
 typedef struct dncp_trickle_struct dncp_trickle_s, *dncp_trickle;
@@ -171,6 +175,10 @@ struct dncp_ep_i_struct {
 
   /* The per-ep Trickle state. */
   dncp_trickle_s trickle;
+
+  /* Traffic counters (see stats in dncp for the per-instance ones). */
+  uint64_t num_recv_packets, num_recv_bytes;
+  uint64_t num_sent_packets, num_sent_bytes;
 };
 
 typedef struct dncp_peer_struct dncp_peer_s, *dncp_peer;
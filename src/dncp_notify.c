@@ -92,6 +92,13 @@ void dncp_unsubscribe(dncp o, dncp_subscriber s)
       break;                                    \
     }
 
+static inline void _tlv_change(dncp_subscriber s, dncp_node n,
+                               struct tlv_attr *a, bool add)
+{
+  hnetd_stats_inc(&n->dncp->stats, HNETD_STATS_DNCP_TLV_CALLBACKS);
+  s->tlv_change_cb(s, n, a, add);
+}
+
 void dncp_notify_subscribers_tlvs_changed(dncp_node n,
                                           struct tlv_attr *a_old,
                                           struct tlv_attr *a_new)
@@ -100,6 +107,7 @@ void dncp_notify_subscribers_tlvs_changed(dncp_node n,
   void *old_end = (void *)a_old + (a_old ? tlv_pad_len(a_old) : 0);
   void *new_end = (void *)a_new + (a_new ? tlv_pad_len(a_new) : 0);
   int r;
+  HNETD_STATS_TIMER(t);
 
   /* There are two distinct steps here: First we remove missing, and
    * then we add new ones. Otherwise, there may be confusion if we get
@@ -130,7 +138,7 @@ void dncp_notify_subscribers_tlvs_changed(dncp_node n,
           else if (r < 0)
             {
               /* op < np => op deleted */
-              s->tlv_change_cb(s, n, op, false);
+              _tlv_change(s, n, op, false);
               op = tlv_next(op);
             }
           else
@@ -144,7 +152,7 @@ void dncp_notify_subscribers_tlvs_changed(dncp_node n,
       while (op)
         {
           ENSURE_VALID(op, old_end);
-          s->tlv_change_cb(s, n, op, false);
+          _tlv_change(s, n, op, false);
           op = tlv_next(op);
         }
     }
@@ -179,7 +187,7 @@ void dncp_notify_subscribers_tlvs_changed(dncp_node n,
           else
             {
               /* op > np => np added */
-              s->tlv_change_cb(s, n, np, true);
+              _tlv_change(s, n, np, true);
               np = tlv_next(np);
             }
         }
@@ -187,10 +195,11 @@ void dncp_notify_subscribers_tlvs_changed(dncp_node n,
       while (np)
         {
           ENSURE_VALID(np, new_end);
-          s->tlv_change_cb(s, n, np, true);
+          _tlv_change(s, n, np, true);
           np = tlv_next(np);
         }
     }
+  HNETD_STATS_RECORD(&n->dncp->stats, HNETD_STATS_H_DNCP_TLV_NOTIFY, t);
 }
 
 void dncp_notify_subscribers_local_tlv_changed(dncp o,
@@ -208,9 +208,13 @@ void dncp_ep_i_send_buf(dncp_ep_i l,
                         struct tlv_buf *buf)
 {
   dncp o = l->dncp;
+  int len = tlv_len(buf->head);
 
-  o->ext->cb.send(o->ext, &l->conf, src, dst,
-                  tlv_data(buf->head), tlv_len(buf->head));
+  o->ext->cb.send(o->ext, &l->conf, src, dst, tlv_data(buf->head), len);
+  l->num_sent_packets++;
+  l->num_sent_bytes += len;
+  hnetd_stats_inc(&o->stats, HNETD_STATS_DNCP_SENT_PACKETS);
+  hnetd_stats_add(&o->stats, HNETD_STATS_DNCP_SENT_BYTES, len);
   tlv_buf_free(buf);
 }
 
@@ -605,6 +609,10 @@ void dncp_ext_readable(dncp o)
       tlv_init(msg, 0, read + sizeof(struct tlv_attr));
 
       l = container_of(ep, dncp_ep_i_s, conf);
+      l->num_recv_packets++;
+      l->num_recv_bytes += read;
+      hnetd_stats_inc(&o->stats, HNETD_STATS_DNCP_RECV_PACKETS);
+      hnetd_stats_add(&o->stats, HNETD_STATS_DNCP_RECV_BYTES, read);
 
       /* This is raw */
       list_for_each_entry(s, &o->subscribers[DNCP_CALLBACK_SOCKET_MSG],
@@ -55,6 +55,7 @@ static void trickle_upgrade(dncp_trickle t, dncp_ep_i l)
 static void trickle_send_nocheck(dncp_trickle t, dncp_ep_i l, dncp_peer ne)
 {
   t->num_sent++;
+  hnetd_stats_inc(&l->dncp->stats, HNETD_STATS_DNCP_TRICKLE_SENT);
   t->last_sent = dncp_time(l->dncp);
   int maximum_size = ne ? 0 : l->conf.maximum_multicast_size;
   /* If Trickle has backed off, just send the short form, i.e. at most
@@ -73,7 +74,10 @@ static void trickle_send(dncp_trickle t, dncp_ep_i l, dncp_peer ne)
           t->i == l->conf.trickle_imin))
     trickle_send_nocheck(t, l, ne);
   else
-    t->num_skipped++;
+    {
+      t->num_skipped++;
+      hnetd_stats_inc(&l->dncp->stats, HNETD_STATS_DNCP_TRICKLE_SKIPPED);
+    }
   t->send_time = 0;
 }
 
@@ -300,8 +304,12 @@ void dncp_ext_timeout(dncp o)
 
       if (o->next_prune && o->next_prune <= now)
         {
+          HNETD_STATS_TIMER(t);
+
           o->graph_dirty = false;
           dncp_prune(o);
+          hnetd_stats_inc(&o->stats, HNETD_STATS_DNCP_PRUNE);
+          HNETD_STATS_RECORD(&o->stats, HNETD_STATS_H_DNCP_PRUNE, t);
         }
 
       /* next_prune may be set _by_ dncp_prune, therefore redundant
@@ -384,6 +392,7 @@ void dncp_ext_timeout(dncp o)
 #endif /* L_LEVEL >= 7 */
         dncp_remove_tlv(o, t);
         o->num_neighbor_dropped++;
+        hnetd_stats_inc(&o->stats, HNETD_STATS_DNCP_NEIGHBOR_DROPPED);
       }
 
   if (next && !o->immediate_scheduled)
@@ -58,8 +58,11 @@
 #include "dncp_i.h"
 
 #include <libubox/md5.h>
-#include <openssl/sha.h>
 #include <openssl/ssl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /* in milliseconds, how long we have to be quiet before save */
 #define SAVE_INTERVAL 1000
@@ -86,6 +89,13 @@ struct dncp_trust_struct {
   /* Verdict store (both cached and configured ones) */
   struct vlist_tree tree;
 
+  /* XOR of md5 hashes of the non-neutral stored records; maintained
+   * incrementally as the records change. */
+  unsigned char content_hash[16];
+
+  /* Verdicts published by other nodes (dncp_trust_remote), by hash */
+  struct avl_tree remote;
+
   /* Change notification subscription for the dncp_trust module */
   dncp_subscriber_s subscriber;
 
@@ -98,6 +108,9 @@ struct dncp_trust_struct {
   /* Until what point in time default verdict is configured-positive. */
   hnetd_time_t trust_until;
 
+  /* DTLS instance to notify of verdict changes, if any */
+  dtls d;
+
   /* RPC methods */
   struct platform_rpc_method rpc_trust_list;
   struct platform_rpc_method rpc_trust_set;
@@ -109,13 +122,26 @@ typedef struct __packed {
   char cname[64];
 } dncp_trust_stored_s, *dncp_trust_stored;
 
-typedef struct __packed {
+/* Only the stored part (which is also the TLV payload) is packed. */
+typedef struct {
   struct vlist_node in_tree;
 
+  /* The local TLV we have published for this, if any */
+  dncp_tlv published;
+
   dncp_trust_stored_s stored;
 
 } dncp_trust_node_s, *dncp_trust_node;
 
+typedef struct {
+  struct avl_node in_remote;
+
+  dncp_sha256_s hash;
+  dncp_node node;
+  uint8_t verdict;
+  char cname[DNCP_T_TRUST_VERDICT_CNAME_LEN];
+} dncp_trust_remote_s, *dncp_trust_remote;
+
 typedef struct {
   /* When was the TLV published */
   hnetd_time_t tlv_time;
@@ -123,67 +149,82 @@ typedef struct {
 
 static void _trust_publish_maybe(dncp_trust t, dncp_trust_node n);
 
-static void _trust_calculate_hash(dncp_trust t, dncp_hash rh)
+/* Add (or remove, it is the same thing) record's contribution to the
+ * content hash. */
+static void _trust_hash_toggle(dncp_trust t, dncp_trust_node tn)
 {
+  unsigned char buf[16];
   md5_ctx_t ctx;
-  dncp_trust_node tn;
+  int i;
 
+  if (tn->stored.tlv.verdict == DNCP_VERDICT_NEUTRAL)
+    return;
   md5_begin(&ctx);
-  vlist_for_each_element(&t->tree, tn, in_tree)
-    {
-      if (tn->stored.tlv.verdict == DNCP_VERDICT_NEUTRAL)
-        continue;
-      md5_hash(&tn->stored, sizeof(tn->stored), &ctx);
-    }
-  char buf[16];
-  memset(rh, 0, sizeof(*rh));
+  md5_hash(&tn->stored, sizeof(tn->stored), &ctx);
   md5_end(buf, &ctx);
-  memcpy(rh, buf, sizeof(*rh) < 16 ? sizeof(*rh) : 16);
+  for (i = 0; i < (int)sizeof(buf); i++)
+    t->content_hash[i] ^= buf[i];
+}
+
+static void _trust_calculate_hash(dncp_trust t, dncp_hash rh)
+{
+  memset(rh, 0, sizeof(*rh));
+  memcpy(rh, t->content_hash,
+         sizeof(*rh) < sizeof(t->content_hash) ?
+         sizeof(*rh) : sizeof(t->content_hash));
 }
 
+/* The file is a version byte followed by fixed-size
+ * dncp_trust_stored_s records; it is mapped and walked in place. */
 static void _trust_load(dncp_trust t)
 {
+  struct stat st;
+  unsigned char *p;
+  size_t n, i;
+  int fd;
+
   if (!t->filename)
     return;
-  FILE *f = fopen(t->filename, "rb");
-  if (!f)
+  if ((fd = open(t->filename, O_RDONLY)) < 0)
     {
       L_ERR("trust load failed to open %s", t->filename);
       return;
     }
-  char buf[sizeof(dncp_trust_stored_s)];
-  int r;
-
-  r = fread(buf, 1, 1, f);
-  if (r != 1)
+  if (fstat(fd, &st) < 0 || st.st_size < 1)
     {
       L_ERR("trust load - immediate eof");
-      goto done;
+      close(fd);
+      return;
+    }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    {
+      L_ERR("trust load - mmap failed");
+      return;
     }
-  if (buf[0] != SAVE_VERSION)
+  if (p[0] != SAVE_VERSION)
     {
       L_INFO("wrong version # -> skipping");
       goto done;
     }
-  while ((r = fread(buf, 1, sizeof(buf), f)))
+  n = (st.st_size - 1) / sizeof(dncp_trust_stored_s);
+  if ((st.st_size - 1) % sizeof(dncp_trust_stored_s))
+    L_ERR("trust load - partial read of record");
+  for (i = 0; i < n; i++)
     {
-      if (r != sizeof(buf))
-        {
-          L_ERR("trust load - partial read of record");
-          break;
-        }
       dncp_trust_node tn = calloc(1, sizeof(*tn));
       if (!tn)
         {
           L_ERR("trust load - eom");
           break;
         }
-      memcpy(&tn->stored, buf, sizeof(buf));
+      memcpy(&tn->stored, p + 1 + i * sizeof(tn->stored), sizeof(tn->stored));
       vlist_add(&t->tree, &tn->in_tree, tn);
-      _trust_publish_maybe(t, tn);
+      _trust_hash_toggle(t, tn);
     }
  done:
-  fclose(f);
+  munmap(p, st.st_size);
 }
 
 static void _trust_save(dncp_trust t)
@@ -244,35 +285,76 @@ _compare_trust_node(const void *a, const void *b, void *ptr __unused)
                 sizeof(n2->stored.tlv.sha256_hash));
 }
 
+static int
+_compare_trust_remote(const void *a, const void *b, void *ptr __unused)
+{
+  return memcmp(a, b, sizeof(dncp_sha256_s));
+}
+
+static void _trust_remote_update(dncp_trust t, dncp_node n,
+                                 dncp_t_trust_verdict tv, bool add)
+{
+  dncp_trust_remote r, r2;
+
+  if (add)
+    {
+      if (!(r = calloc(1, sizeof(*r))))
+        {
+          L_ERR("oom when indexing remote verdict");
+          return;
+        }
+      r->hash = tv->sha256_hash;
+      r->node = n;
+      r->verdict = tv->verdict;
+      strncpy(r->cname, tv->cname, sizeof(r->cname) - 1);
+      r->in_remote.key = &r->hash;
+      avl_insert(&t->remote, &r->in_remote);
+      return;
+    }
+  r = avl_find_element(&t->remote, &tv->sha256_hash, r, in_remote);
+  if (!r)
+    return;
+  /* Duplicates follow the first one in the list. */
+  avl_for_element_to_last(&t->remote, r, r2, in_remote)
+    {
+      if (memcmp(&r2->hash, &tv->sha256_hash, sizeof(r2->hash)))
+        break;
+      if (r2->node == n && r2->verdict == tv->verdict)
+        {
+          avl_delete(&t->remote, &r2->in_remote);
+          free(r2);
+          return;
+        }
+    }
+}
+
 static int _trust_get_remote_verdict(dncp_trust t, dncp_sha256 h,
                                      dncp_node *remote_node_return,
                                      char *cname)
 {
   int remote_verdict = DNCP_VERDICT_NONE;
   dncp_node remote_node = NULL;
-  dncp_node node;
-  struct tlv_attr *a;
-  dncp_t_trust_verdict tv;
-  dncp o = t->dncp;
+  dncp_trust_remote r, r2;
 
   if (cname)
     *cname = 0;
-  dncp_for_each_node(o, node)
-    if (node != o->own_node)
-      dncp_node_for_each_tlv_with_t_v(node, a, DNCP_T_TRUST_VERDICT, false)
-        if ((tv = dncp_tlv_trust_verdict(a)))
+  r = avl_find_element(&t->remote, h, r, in_remote);
+  if (r)
+    avl_for_element_to_last(&t->remote, r, r2, in_remote)
+      {
+        if (memcmp(&r2->hash, h, sizeof(*h)))
+          break;
+        /* Ties are won by the lowest node (first in node order). */
+        if (r2->verdict > remote_verdict
+            || (r2->verdict == remote_verdict
+                && dncp_node_cmp(r2->node, remote_node) < 0))
           {
-            if (memcmp(&tv->sha256_hash, h, sizeof(*h)) == 0)
-              {
-                if (tv->verdict > remote_verdict)
-                  {
-                    remote_verdict = tv->verdict;
-                    remote_node = node;
-                    if (cname)
-                      strcpy(cname, tv->cname);
-                  }
-              }
+            remote_verdict = r2->verdict;
+            remote_node = r2->node;
+            if (cname)
+              strcpy(cname, r2->cname);
           }
+      }
   if (remote_node_return)
     *remote_node_return = remote_node;
   return remote_verdict;
@@ -299,27 +381,13 @@ int dncp_trust_get_verdict(dncp_trust t, const dncp_sha256 h, char *cname)
   return verdict2;
 }
 
-static dncp_tlv _find_local_tlv(dncp d, dncp_sha256 hash)
-{
-  dncp_tlv tlv;
-  dncp_t_trust_verdict tv;
-
-  dncp_for_each_tlv(d, tlv)
-    if ((tv = dncp_tlv_trust_verdict(&tlv->tlv)))
-      {
-        if (memcmp(hash, &tv->sha256_hash, sizeof(*hash)) == 0)
-          return tlv;
-      }
-  return NULL;
-}
-
 static void _trust_publish_maybe(dncp_trust t, dncp_trust_node n)
 {
   int len = sizeof(n->stored.tlv) + strlen(n->stored.cname) + 1;
   dncp_node rn;
   int remote_verdict =
     _trust_get_remote_verdict(t, &n->stored.tlv.sha256_hash, &rn, NULL);
-  dncp_tlv tlv = _find_local_tlv(t->dncp, &n->stored.tlv.sha256_hash);
+  dncp_tlv tlv = n->published;
 
   /*
    * Either our verdict is _better_, or it is _same_ and our router id
@@ -339,6 +407,9 @@ static void _trust_publish_maybe(dncp_trust t, dncp_trust_node n)
       dncp_local_tlv_extra le;
       int elen = sizeof(*le);
       tlv = dncp_add_tlv(t->dncp, DNCP_T_TRUST_VERDICT, &n->stored, len, elen);
+      n->published = tlv;
+      if (!tlv)
+        return;
       le = dncp_tlv_get_extra(tlv);
       le->tlv_time = hnetd_time();
     }
@@ -347,6 +418,7 @@ static void _trust_publish_maybe(dncp_trust t, dncp_trust_node n)
       /* Or it is not worth keeping published at all.. */
       if (tlv)
         dncp_remove_tlv(t->dncp, tlv);
+      n->published = NULL;
     }
 }
 
@@ -362,20 +434,36 @@ static void _update_trust_node(struct vlist_tree *tr,
     return;
   if (t_old)
     {
-      int len = sizeof(t_old->stored.tlv) + strlen(t_old->stored.cname) + 1;
-      dncp_remove_tlv_matching(t->dncp,
-                               DNCP_T_TRUST_VERDICT, &t_old->stored, len);
+      if (t_old->published)
+        dncp_remove_tlv(t->dncp, t_old->published);
+      _trust_hash_toggle(t, t_old);
       if (t_old->stored.tlv.verdict == DNCP_VERDICT_NEUTRAL)
         t->num_neutral--;
       free(t_old);
     }
 }
 
+static bool _verdict_positive(int verdict)
+{
+  return verdict == DNCP_VERDICT_CACHED_POSITIVE ||
+    verdict == DNCP_VERDICT_CONFIGURED_POSITIVE;
+}
+
+/* DTLS only cares about certificates that are no longer trusted. */
+static void _trust_changed(dncp_trust t, const dncp_sha256 h,
+                           bool was_positive)
+{
+  if (t->d && was_positive
+      && !_verdict_positive(dncp_trust_get_verdict(t, h, NULL)))
+    dtls_trust_revoked(t->d, h->buf);
+}
+
 static bool _trust_set(dncp_trust t, const dncp_sha256 h,
                        uint8_t verdict, const char *cname)
 {
   dncp_trust_node tn = _trust_node_find(t, h);
-  static char empty[1] = {0};
+  static const char empty[1] = {0};
+  bool was_positive = _verdict_positive(dncp_trust_get_verdict(t, h, NULL));
 
   if (!cname)
     cname = empty;
@@ -388,6 +476,7 @@ static bool _trust_set(dncp_trust t, const dncp_sha256 h,
         return false;
       if (tn->stored.tlv.verdict == DNCP_VERDICT_NEUTRAL)
         t->num_neutral--;
+      _trust_hash_toggle(t, tn);
     }
   else
     {
@@ -405,13 +494,15 @@ static bool _trust_set(dncp_trust t, const dncp_sha256 h,
     t->num_neutral++;
   if (*cname)
     strcpy(tn->stored.cname, cname);
+  _trust_hash_toggle(t, tn);
   uloop_timeout_set(&t->timeout, SAVE_INTERVAL);
+  _trust_changed(t, h, was_positive);
   return true;
 }
 
 
 static void _tlv_cb(dncp_subscriber s,
-                    dncp_node n, struct tlv_attr *tlv, bool add __unused)
+                    dncp_node n, struct tlv_attr *tlv, bool add)
 {
   dncp_trust t = container_of(s, dncp_trust_s, subscriber);
   dncp_t_trust_verdict tv = dncp_tlv_trust_verdict(tlv);
@@ -422,6 +513,10 @@ static void _tlv_cb(dncp_subscriber s,
   /* Local changes are not interesting */
   if (n == t->dncp->own_node)
     return;
+  bool was_positive =
+    _verdict_positive(dncp_trust_get_verdict(t, &tv->sha256_hash, NULL));
+  _trust_remote_update(t, n, tv, add);
+  _trust_changed(t, &tv->sha256_hash, was_positive);
   dncp_trust_node tn = _trust_node_find(t, &tv->sha256_hash);
   int local_verdict = DNCP_VERDICT_NEUTRAL;
   if (tv->verdict == DNCP_VERDICT_CONFIGURED_POSITIVE)
@@ -462,19 +557,9 @@ void dncp_trust_set(dncp_trust t, const dncp_sha256 h,
 
 static int _trust_get_cert_verdict(dncp_trust t, dtls_cert cert)
 {
-  unsigned char buf[2048];
-  int r = dtls_cert_to_der_buf(cert, buf, sizeof(buf));
-
-  if (r <= 0 || r >= (int)sizeof(buf))
-    {
-      L_ERR("too huge DER output?!?");
-      return DNCP_VERDICT_NONE;
-    }
   dncp_sha256_s h;
-  SHA256_CTX ctx;
-  SHA256_Init(&ctx);
-  SHA256_Update(&ctx, buf, r);
-  SHA256_Final(h.buf, &ctx);
+
+  dtls_cert_hash_sha256(cert, h.buf);
 
   int verdict = dncp_trust_get_verdict(t, &h, NULL);
 
@@ -521,7 +606,7 @@ void dncp_trust_request_verdict(dncp_trust t,
            * us. */
           if (tn->stored.tlv.verdict != DNCP_VERDICT_NEUTRAL)
             continue;
-          dncp_tlv tlv = _find_local_tlv(t->dncp, &tn->stored.tlv.sha256_hash);
+          dncp_tlv tlv = tn->published;
           if (tlv)
             {
               le = dncp_tlv_get_extra(tlv);
@@ -548,8 +633,12 @@ bool dncp_trust_dtls_unknown_cb(dtls d __unused,
   dncp_trust t = context;
   int verdict = _trust_get_cert_verdict(t, cert);
 
-  return verdict == DNCP_VERDICT_CACHED_POSITIVE ||
-    verdict == DNCP_VERDICT_CONFIGURED_POSITIVE;
+  return _verdict_positive(verdict);
+}
+
+void dncp_trust_set_dtls(dncp_trust t, dtls d)
+{
+  t->d = d;
 }
 
 #define T_A(x) if (!(x)) return -ENOMEM
@@ -631,12 +720,19 @@ dncp_trust dncp_trust_create(dncp o, const char *filename)
   t->tree.keep_old = true;
   t->timeout.cb = _trust_write_cb;
   t->subscriber.tlv_change_cb = _tlv_cb;
+  avl_init(&t->remote, _compare_trust_remote, true, NULL);
   if (filename)
     t->filename = strdup(filename);
   _trust_load(t);
   _trust_calculate_hash(t, &t->file_hash);
   dncp_subscribe(o, &t->subscriber);
 
+  /* Publish what was loaded in one go, now that remote verdicts
+   * are known too. */
+  dncp_trust_node tn;
+  vlist_for_each_element(&t->tree, tn, in_tree)
+    _trust_publish_maybe(t, tn);
+
   t->rpc_trust_set_timer.cb = _rpc_set_timer;
   t->rpc_trust_set_timer.name = "trust-set-timer";
   t->rpc_trust_list.cb = _rpc_list;
@@ -663,6 +759,9 @@ void dncp_trust_destroy(dncp_trust t)
     }
   dncp_unsubscribe(o, &t->subscriber);
   vlist_flush_all(&t->tree);
+  dncp_trust_remote r, r2;
+  avl_remove_all_elements(&t->remote, r, in_remote, r2)
+    free(r);
   uloop_timeout_cancel(&t->timeout);
   free(t);
 }
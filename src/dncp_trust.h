@@ -83,4 +83,11 @@ void dncp_trust_register_multicall(void);
  * (context must be dncp_trust instance)
  */
 bool dncp_trust_dtls_unknown_cb(dtls d, dtls_cert cert, void *context);
+
+/*
+ * Call dtls_trust_revoked on d whenever a certificate loses its
+ * positive verdict (typically the dtls instance using
+ * dncp_trust_dtls_unknown_cb).
+ */
+void dncp_trust_set_dtls(dncp_trust t, dtls d);
 #endif /* DTLS */
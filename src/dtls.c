@@ -20,8 +20,11 @@
  * Notable points:
  * - OpenSSL-only
  *
- * - wrap OpenSSL's DTLS instances with their own memory-BIOs, and do
- * NOT let them deal with actual sockets at all.
+ * - wrap OpenSSL's DTLS instances with our own datagram BIO, and do
+ * NOT let them deal with actual sockets at all. The BIO reads the
+ * datagram straight from the receive buffer (queueing a copy only if
+ * it is not consumed immediately), and writes coalesce records to a
+ * single datagram that is sent when the BIO is flushed.
  *
  * The I/O code should be adoptable easily enough to DTLS
  * implementations that provide some way of dealing with not-quite-raw
@@ -35,12 +38,17 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <arpa/inet.h>
 #include <string.h>
 #include <openssl/crypto.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 #include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
 #include <libubox/list.h>
+#include <libubox/avl.h>
 #include <libubox/md5.h>
 #include <errno.h>
 #include <net/if.h>
@@ -66,6 +74,58 @@
 /* How long cookies are valid (in seconds) */
 #define COOKIE_VALIDITY_PERIOD 10
 
+/* Session id context for server-side session caching */
+#define SESSION_ID_CONTEXT "hnetd"
+
+#endif /* DTLS_OPENSSL */
+
+/* Records are coalesced into datagrams of at most this size (the IPv6
+ * minimum link MTU), to avoid IP fragmentation. */
+#define DTLS_COALESCE_SIZE 1280
+
+/* How long we wait after a session cache change before saving it */
+#define SESSION_SAVE_DELAY_MS 5000
+
+/* Session cache file magic ('hnS2'; 'hnS1' files lack ticket keys) */
+#define SESSION_FILE_MAGIC 0x686e5332
+#define SESSION_FILE_MAGIC_V1 0x686e5331
+
+/* Largest ticket key block we save (OpenSSL >= 1.1 uses 80 bytes) */
+#define SESSION_TICKET_KEYS_MAX 128
+
+#ifdef DTLS_OPENSSL
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+/* OpenSSL 1.1 made BIO and BIO_METHOD opaque; provide its accessors
+ * for older versions. */
+static BIO_METHOD *BIO_meth_new(int type, const char *name)
+{
+  BIO_METHOD *m = calloc(1, sizeof(*m));
+
+  if (m)
+    {
+      m->type = type;
+      m->name = name;
+    }
+  return m;
+}
+
+#define BIO_meth_free(m) free(m)
+#define BIO_meth_set_write(m, f) ((m)->bwrite = (f))
+#define BIO_meth_set_read(m, f) ((m)->bread = (f))
+#define BIO_meth_set_puts(m, f) ((m)->bputs = (f))
+#define BIO_meth_set_ctrl(m, f) ((m)->ctrl = (f))
+#define BIO_meth_set_create(m, f) ((m)->create = (f))
+#define BIO_meth_set_destroy(m, f) ((m)->destroy = (f))
+#define BIO_get_data(b) ((b)->ptr)
+#define BIO_set_data(b, p) ((b)->ptr = (p))
+#define BIO_set_init(b, i) ((b)->init = (i))
+#define SSL_SESSION_get0_peer(s) ((s)->peer)
+#define DTLS_COOKIE_CONST
+#else
+#define DTLS_COOKIE_CONST const
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+
 #endif /* DTLS_OPENSSL */
 
 /* Do we want to use arbitrary client ports? */
@@ -83,7 +143,7 @@
 #define USE_ONE_CONTEXT
 
 /* These lurk in queue, waiting for connection to finish (outbound). */
-typedef struct {
+typedef struct dtls_queued_buffer_s {
   struct list_head in_queued_buffers;
   int len;
   unsigned char buf[0];
@@ -94,6 +154,9 @@ typedef struct {
 
   struct list_head queued_buffers;
 
+  /* Received datagrams not yet consumed by the SSL (dtls_queued_buffer) */
+  struct list_head pending_datagrams;
+
   dtls d;
 
   struct sockaddr_in6 remote_addr;
@@ -110,14 +173,37 @@ typedef struct {
 
   struct uloop_timeout uto;
 
+  /* Non-DATA connections with input waiting for a handshake step. */
+  struct list_head in_handshakes;
+  bool handshake_queued;
+
   bool is_client;
   SSL *ssl;
-  BIO *rbio;
-  BIO *wbio;
+  BIO *bio;
 
   time_t last_use;
+
+  /* Non-SHUTDOWN connections are indexed by (remote_addr, is_client),
+   * and kept in per-state LRU list (least recently used first). */
+  bool indexed;
+  struct avl_node in_index;
+  struct list_head in_lru;
 } dtls_connection_s, *dtls_connection;
 
+/* Client-side cache of sessions to resume, one per remote address. */
+typedef struct {
+  struct avl_node in_sessions;
+  struct list_head in_lru;
+
+  struct sockaddr_in6 remote_addr;
+
+  /* SHA-256 of the peer certificate (as used by dncp_trust), or all
+   * zeroes if there was none. */
+  unsigned char cert_hash[SHA256_DIGEST_LENGTH];
+
+  SSL_SESSION *session;
+} dtls_session_s, *dtls_session;
+
 typedef struct dtls_struct {
   /* Client provided - (optional) callback to call when something
    * readable available. */
@@ -132,12 +218,43 @@ typedef struct dtls_struct {
 
   SSL_CTX *ssl_server_ctx;
 
+  /* Datagram BIO bound to our connections */
+  BIO_METHOD *bio_method;
+
   udp46 u46_server;
 
   udp46 u46_client;
 
   struct list_head connections;
 
+  /* Index of non-SHUTDOWN connections, and their LRU lists. */
+  struct avl_tree connection_index;
+  struct list_head lru_data;
+  struct list_head lru_non_data;
+
+  /* Fires when the least recently used connection becomes idle. */
+  struct uloop_timeout idle_uto;
+
+  /* Datagram buffers (of buf_size bytes). in_buf contains the
+   * datagram being processed for connection in_dc, and out_buf the
+   * records written (but not yet sent) by connection out_dc. */
+  size_t buf_size;
+  unsigned char *in_buf;
+  int in_len;
+  dtls_connection in_dc;
+  unsigned char *out_buf;
+  int out_len;
+  dtls_connection out_dc;
+
+  /* Session cache (enabled if max_sessions > 0), least recently
+   * used first. */
+  struct avl_tree sessions;
+  struct list_head session_lru;
+  int num_sessions;
+  int max_sessions;
+  char *session_file;
+  struct uloop_timeout session_uto;
+
 #ifdef DTLS_OPENSSL
   unsigned char cookie_secret[COOKIE_SECRET_LENGTH];
 #endif /* DTLS_OPENSSL */
@@ -153,15 +270,27 @@ typedef struct dtls_struct {
   int num_non_data_connections;
   int num_data_connections;
 
+  /* Current second (of hnetd_time), and input packets received in it. */
   time_t t;
   int pps;
+
+  /* Handshake steps are not run within the socket callback; instead,
+   * they are queued here and run in bounded batches from hs_uto so
+   * that expensive (certificate, key exchange) steps of several peers
+   * do not stall the rest of uloop. */
+  struct list_head handshakes;
+  struct uloop_timeout hs_uto;
+  int hs_steps;
 } dtls_s;
 
-static dtls_limits_s _default_limits = {
+static const dtls_limits_s _default_limits = {
   .input_pps = 100,
   .connection_idle_limit_seconds = 1800,
   .num_non_data_connections = 10,
   .num_data_connections = 100,
+  .handshake_steps_per_poll = 2,
+  .handshake_steps_per_second = 50,
+  .max_datagram_size = 65535,
 };
 
 #define DTLS_LIMIT(x) (d->limits.x ? d->limits.x : _default_limits.x)
@@ -230,7 +359,8 @@ static int _cookie_gen_cb(SSL *ssl,
 }
 
 static int _cookie_verify_cb(SSL *ssl,
-                             unsigned char *cookie, unsigned int cookie_len)
+                             DTLS_COOKIE_CONST unsigned char *cookie,
+                             unsigned int cookie_len)
 {
   unsigned char tbuf[COOKIE_LENGTH];
   unsigned int tbuf_len = sizeof(tbuf);
@@ -244,7 +374,7 @@ static int _cookie_verify_cb(SSL *ssl,
     }
 
   nt = time(NULL);
-  ct = *((time_t *)cookie);
+  ct = *((const time_t *)cookie);
 
   /* If our clock is really moving backwards, we might as well pretend
    * it is fake, for now. (Little loss, UDP _is_ lossy after all.)*/
@@ -281,6 +411,29 @@ static void _qb_free(dtls_queued_buffer qb)
   free(qb);
 }
 
+static int _connection_index_cmp(const void *k1, const void *k2,
+                                 void *ptr __unused)
+{
+  const dtls_connection_s *dc1 = k1, *dc2 = k2;
+  int r = memcmp(&dc1->remote_addr, &dc2->remote_addr,
+                 sizeof(dc1->remote_addr));
+
+  if (r)
+    return r;
+  return (int)!!dc1->is_client - (int)!!dc2->is_client;
+}
+
+static void _connection_unindex(dtls_connection dc)
+{
+  if (!dc->indexed)
+    return;
+  avl_delete(&dc->d->connection_index, &dc->in_index);
+  list_del(&dc->in_lru);
+  dc->indexed = false;
+}
+
+static void _dtls_flush(dtls d);
+
 static void _connection_free(dtls_connection dc)
 {
   dtls_queued_buffer qb, qb2;
@@ -295,34 +448,231 @@ static void _connection_free(dtls_connection dc)
     }
   list_for_each_entry_safe(qb, qb2, &dc->queued_buffers, in_queued_buffers)
     _qb_free(qb);
+  list_for_each_entry_safe(qb, qb2, &dc->pending_datagrams, in_queued_buffers)
+    _qb_free(qb);
+  if (dc->d->out_dc == dc)
+    _dtls_flush(dc->d);
+  if (dc->d->in_dc == dc)
+    dc->d->in_dc = NULL;
+  if (dc->handshake_queued)
+    list_del(&dc->in_handshakes);
+  _connection_unindex(dc);
   list_del(&dc->in_connections);
   SSL_free(dc->ssl);
   uloop_timeout_cancel(&dc->uto);
   free(dc);
 }
 
-static bool _connection_poll_write(dtls_connection dc)
+static void _connection_send(dtls_connection dc, const void *buf, int len)
+{
+  udp46 s = dc->is_client ? dc->d->u46_client : dc->d->u46_server;
+  int r = udp46_send(s, dc->has_local_addr ? &dc->local_addr : NULL,
+                     &dc->remote_addr, (void *)buf, len);
+  if (r != len)
+    {
+      if (r < 0)
+        L_DEBUG("send error");
+      else
+        L_DEBUG("short send?!? %d != %d", r, len);
+    }
+}
+
+static void _dtls_flush(dtls d)
+{
+  if (!d->out_dc)
+    return;
+  if (d->out_len)
+    _connection_send(d->out_dc, d->out_buf, d->out_len);
+  d->out_dc = NULL;
+  d->out_len = 0;
+}
+
+static bool _dtls_alloc_buffers(dtls d)
 {
-  while (BIO_ctrl_pending(dc->wbio) > 0)
+  size_t size = DTLS_LIMIT(max_datagram_size);
+
+  if (d->buf_size == size)
+    return true;
+  _dtls_flush(d);
+  d->in_dc = NULL;
+  free(d->in_buf);
+  free(d->out_buf);
+  d->in_buf = malloc(size);
+  d->out_buf = malloc(size);
+  if (!d->in_buf || !d->out_buf)
     {
-      char buf[2048];
-      int outsize = BIO_read(dc->wbio, buf, sizeof(buf));
-      udp46 s = dc->is_client ? dc->d->u46_client : dc->d->u46_server;
-      int r = udp46_send(s, dc->has_local_addr ? &dc->local_addr : NULL,
-                         &dc->remote_addr, buf, outsize);
-      if (r != outsize)
+      L_ERR("unable to allocate %d byte datagram buffers", (int)size);
+      free(d->in_buf);
+      free(d->out_buf);
+      d->in_buf = d->out_buf = NULL;
+      d->buf_size = 0;
+      return false;
+    }
+  d->buf_size = size;
+  return true;
+}
+
+static bool _connection_push_datagram(dtls_connection dc,
+                                      const void *buf, int len)
+{
+  dtls_queued_buffer qb = malloc(sizeof(*qb) + len);
+
+  if (!qb)
+    {
+      L_ERR("malloc datagram");
+      return false;
+    }
+  memcpy(qb->buf, buf, len);
+  qb->len = len;
+  list_add_tail(&qb->in_queued_buffers, &dc->pending_datagrams);
+  return true;
+}
+
+/*
+ * Datagram BIO bound to a connection (BIO_get_data). Each read returns
+ * one whole datagram; each flush sends the records written so far as
+ * one datagram of at most DTLS_COALESCE_SIZE bytes (unless a single
+ * record is larger).
+ */
+
+static int _bio_write(BIO *b, const char *in, int inl)
+{
+  dtls_connection dc = BIO_get_data(b);
+  dtls d = dc->d;
+
+  BIO_clear_retry_flags(b);
+  if (d->out_dc && (d->out_dc != dc || d->out_len + inl > DTLS_COALESCE_SIZE
+                    || (size_t)(d->out_len + inl) > d->buf_size))
+    _dtls_flush(d);
+  if (!_dtls_alloc_buffers(d) || (size_t)inl > d->buf_size)
+    {
+      /* Nothing to coalesce it with anyway. */
+      _connection_send(dc, in, inl);
+      return inl;
+    }
+  memcpy(d->out_buf + d->out_len, in, inl);
+  d->out_len += inl;
+  d->out_dc = dc;
+  return inl;
+}
+
+static int _bio_read(BIO *b, char *out, int outl)
+{
+  dtls_connection dc = BIO_get_data(b);
+  dtls d = dc->d;
+  dtls_queued_buffer qb;
+  const unsigned char *buf;
+  int len;
+
+  BIO_clear_retry_flags(b);
+  while (1)
+    {
+      qb = NULL;
+      if (!list_empty(&dc->pending_datagrams))
         {
-          if (r < 0)
-            L_DEBUG("send error");
-          else
-            L_DEBUG("short send?!? %d != %d", r, outsize);
+          qb = list_first_entry(&dc->pending_datagrams,
+                                struct dtls_queued_buffer_s,
+                                in_queued_buffers);
+          buf = qb->buf;
+          len = qb->len;
+        }
+      else if (d->in_dc == dc)
+        {
+          buf = d->in_buf;
+          len = d->in_len;
+          d->in_dc = NULL;
+        }
+      else
+        {
+          BIO_set_retry_read(b);
+          return -1;
         }
+      if (len <= outl)
+        break;
+      /* A truncated record would fail anyway; drop it, and let the
+       * SSL wait for the next one as if it had never arrived. */
+      L_DEBUG("dropping %d byte datagram (room for %d)", len, outl);
+      if (qb)
+        _qb_free(qb);
     }
+  memcpy(out, buf, len);
+  if (qb)
+    _qb_free(qb);
+  return len;
+}
+
+static int _bio_puts(BIO *b, const char *str)
+{
+  return _bio_write(b, str, strlen(str));
+}
+
+static long _bio_ctrl(BIO *b, int cmd, long num __unused, void *ptr __unused)
+{
+  dtls_connection dc = BIO_get_data(b);
+  dtls d = dc ? dc->d : NULL;
+
+  if (!dc)
+    return 0;
+  switch (cmd)
+    {
+    case BIO_CTRL_FLUSH:
+      if (d->out_dc == dc)
+        _dtls_flush(d);
+      return 1;
+    case BIO_CTRL_PENDING:
+      if (!list_empty(&dc->pending_datagrams))
+        return list_first_entry(&dc->pending_datagrams,
+                                struct dtls_queued_buffer_s,
+                                in_queued_buffers)->len;
+      return d->in_dc == dc ? d->in_len : 0;
+    case BIO_CTRL_WPENDING:
+      return d->out_dc == dc ? d->out_len : 0;
+    case BIO_CTRL_DUP:
+      return 1;
+    }
+  /* MTU queries etc. are answered the same way as by memory BIOs. */
+  return 0;
+}
+
+static int _bio_create(BIO *b)
+{
+  BIO_set_init(b, 1);
+  BIO_set_data(b, NULL);
+  return 1;
+}
+
+static int _bio_destroy(BIO *b)
+{
+  /* The data is the connection, which is not ours to free. */
+  return b != NULL;
+}
+
+static BIO_METHOD *_bio_method_create(void)
+{
+  BIO_METHOD *m = BIO_meth_new(99 | BIO_TYPE_SOURCE_SINK,
+                               "hnetd dtls datagram");
+
+  if (!m)
+    return NULL;
+  BIO_meth_set_write(m, _bio_write);
+  BIO_meth_set_read(m, _bio_read);
+  BIO_meth_set_puts(m, _bio_puts);
+  BIO_meth_set_ctrl(m, _bio_ctrl);
+  BIO_meth_set_create(m, _bio_create);
+  BIO_meth_set_destroy(m, _bio_destroy);
+  return m;
+}
+
+static bool _connection_poll_write(dtls_connection dc)
+{
+  (void)BIO_flush(dc->bio);
   /* We do not close sockets here. */
   return true;
 }
 
 static bool _connection_poll_read(dtls_connection dc);
+static void _session_store(dtls_connection dc);
+static bool _session_check_resumed(dtls_connection dc);
 
 static bool _connection_shutdown(dtls_connection dc)
 {
@@ -332,6 +682,7 @@ static bool _connection_shutdown(dtls_connection dc)
     dc->d->num_data_connections--;
   else
     dc->d->num_non_data_connections--;
+  _connection_unindex(dc);
   dc->state = STATE_SHUTDOWN;
   /* The SSL_shutdown needs to be called 2+ times; first time, it
    * does local bookkeeping, and second time confirms receipt of
@@ -343,31 +694,35 @@ static bool _connection_shutdown(dtls_connection dc)
   return _connection_poll_write(dc) && _connection_poll_read(dc);
 }
 
-static void _connection_drop(dtls d, bool is_data)
+/* Shut down idle connections at the head of the LRU list; returns
+ * the number of connections shut down. */
+static int _connection_expire(dtls d, struct list_head *lru)
 {
-  dtls_connection dc, dc2, lru = NULL;
+  dtls_connection dc;
   int dropped = 0;
 
-  list_for_each_entry_safe(dc, dc2, &d->connections, in_connections)
+  while (!list_empty(lru))
     {
-      if (dc->state == STATE_SHUTDOWN)
-        continue;
-      if ((d->t - dc->last_use) >= DTLS_LIMIT(connection_idle_limit_seconds))
-        {
-          if ((dc->state == STATE_DATA) == !!is_data)
-            dropped++;
-          _connection_shutdown(dc);
-          continue;
-        }
-      if ((dc->state == STATE_DATA) == !is_data)
-        continue;
-      if (lru && lru->last_use <= dc->last_use)
-        continue;
-      lru = dc;
+      dc = list_first_entry(lru, dtls_connection_s, in_lru);
+      if ((d->t - dc->last_use) < DTLS_LIMIT(connection_idle_limit_seconds))
+        break;
+      /* Removes dc from the LRU list (and possibly frees it). */
+      _connection_shutdown(dc);
+      dropped++;
     }
-  if (dropped || !lru)
+  return dropped;
+}
+
+static void _connection_drop(dtls d, bool is_data)
+{
+  struct list_head *lru = is_data ? &d->lru_data : &d->lru_non_data;
+  int dropped;
+
+  dropped = _connection_expire(d, lru);
+  (void)_connection_expire(d, is_data ? &d->lru_non_data : &d->lru_data);
+  if (dropped || list_empty(lru))
     return;
-  _connection_shutdown(lru);
+  _connection_shutdown(list_first_entry(lru, dtls_connection_s, in_lru));
 }
 
 static bool _connection_poll_read(dtls_connection dc)
@@ -386,11 +741,15 @@ static bool _connection_poll_read(dtls_connection dc)
         {
           L_DEBUG("connection %p accept->data", dc);
         to_data:
+          if (!_session_check_resumed(dc))
+            return _connection_shutdown(dc);
           if (dc->d->num_data_connections == DTLS_LIMIT(num_data_connections))
             _connection_drop(d, true);
           dc->d->num_non_data_connections--;
           dc->d->num_data_connections++;
           dc->state = STATE_DATA;
+          list_move_tail(&dc->in_lru, &dc->d->lru_data);
+          _session_store(dc);
           goto redo;
         }
       break;
@@ -519,31 +878,492 @@ static void _connection_uto_cb(struct uloop_timeout *t)
 }
 
 static dtls_connection
-_connection_find(dtls d, int is_client, const struct sockaddr_in6 *dst)
+_connection_lookup(dtls d, bool is_client, const struct sockaddr_in6 *dst)
 {
+  dtls_connection_s key;
   dtls_connection dc;
 
+  key.remote_addr = *dst;
+  key.is_client = is_client;
+  return avl_find_element(&d->connection_index, &key, dc, in_index);
+}
+
+static dtls_connection
+_connection_find(dtls d, int is_client, const struct sockaddr_in6 *dst)
+{
+  dtls_connection dc, dc2;
+
   L_DEBUG("_connection_find dst:%s", HEX_REPR(dst, sizeof(*dst)));
-  list_for_each_entry(dc, &d->connections, in_connections)
-    if (dc->state != STATE_SHUTDOWN
-        && (is_client < 0 || (!is_client == !dc->is_client)))
-      if (memcmp(dst, &dc->remote_addr, sizeof(*dst)) == 0)
-        {
-          dc->last_use = d->t;
-          return dc;
-        }
-  return NULL;
+  if (is_client < 0)
+    {
+      /* Either will do, but prefer one that can carry data. */
+      dc = _connection_lookup(d, true, dst);
+      dc2 = _connection_lookup(d, false, dst);
+      if (!dc || (dc2 && dc2->state == STATE_DATA))
+        dc = dc2;
+    }
+  else
+    dc = _connection_lookup(d, is_client, dst);
+  if (!dc)
+    return NULL;
+  dc->last_use = d->t;
+  list_move_tail(&dc->in_lru, dc->state == STATE_DATA ?
+                 &d->lru_data : &d->lru_non_data);
+  return dc;
 }
 
 static void _dtls_update_t(dtls d)
 {
-  time_t t = time(NULL);
+  time_t t = hnetd_time() / HNETD_TIME_PER_SECOND;
 
   if (t == d->t)
     return;
 
   d->t = t;
   d->pps = 0;
+  d->hs_steps = 0;
+}
+
+static void _dtls_idle_schedule(dtls d)
+{
+  dtls_connection dc;
+  time_t oldest = 0;
+  bool found = false;
+
+  if (!list_empty(&d->lru_data))
+    {
+      dc = list_first_entry(&d->lru_data, dtls_connection_s, in_lru);
+      oldest = dc->last_use;
+      found = true;
+    }
+  if (!list_empty(&d->lru_non_data))
+    {
+      dc = list_first_entry(&d->lru_non_data, dtls_connection_s, in_lru);
+      if (!found || dc->last_use < oldest)
+        oldest = dc->last_use;
+      found = true;
+    }
+  if (!found)
+    {
+      uloop_timeout_cancel(&d->idle_uto);
+      return;
+    }
+  time_t left = oldest + DTLS_LIMIT(connection_idle_limit_seconds) - d->t;
+  uloop_timeout_set(&d->idle_uto, left > 0 ? left * 1000 : 0);
+}
+
+static void _dtls_idle_cb(struct uloop_timeout *t)
+{
+  dtls d = container_of(t, dtls_s, idle_uto);
+
+  _dtls_update_t(d);
+  (void)_connection_expire(d, &d->lru_data);
+  (void)_connection_expire(d, &d->lru_non_data);
+  _dtls_idle_schedule(d);
+}
+
+static void _dtls_handshake_schedule(dtls d)
+{
+  if (list_empty(&d->handshakes))
+    return;
+  if (d->hs_steps >= DTLS_LIMIT(handshake_steps_per_second))
+    {
+      L_DEBUG("handshake rate limit reached, deferring to next second");
+      uloop_timeout_set(&d->hs_uto, 1000);
+    }
+  else
+    uloop_timeout_set(&d->hs_uto, 0);
+}
+
+static void _dtls_handshake_cb(struct uloop_timeout *t)
+{
+  dtls d = container_of(t, dtls_s, hs_uto);
+  dtls_connection dc;
+  int steps = 0;
+
+  _dtls_update_t(d);
+  while (!list_empty(&d->handshakes)
+         && steps < DTLS_LIMIT(handshake_steps_per_poll)
+         && d->hs_steps < DTLS_LIMIT(handshake_steps_per_second))
+    {
+      dc = list_first_entry(&d->handshakes, dtls_connection_s, in_handshakes);
+      list_del(&dc->in_handshakes);
+      dc->handshake_queued = false;
+      steps++;
+      d->hs_steps++;
+      /* May free dc, or any other connection; hence restart from the
+       * head of the queue every time. */
+      _connection_poll(dc);
+    }
+  _dtls_handshake_schedule(d);
+}
+
+static void _connection_queue_handshake(dtls_connection dc)
+{
+  dtls d = dc->d;
+
+  if (dc->handshake_queued)
+    return;
+  dc->handshake_queued = true;
+  list_add_tail(&dc->in_handshakes, &d->handshakes);
+  if (!d->hs_uto.pending)
+    _dtls_handshake_schedule(d);
+}
+
+static int _session_cmp(const void *k1, const void *k2, void *ptr __unused)
+{
+  return memcmp(k1, k2, sizeof(struct sockaddr_in6));
+}
+
+static dtls_session _session_find(dtls d, const struct sockaddr_in6 *addr)
+{
+  dtls_session ds;
+
+  if (!d->max_sessions)
+    return NULL;
+  return avl_find_element(&d->sessions, addr, ds, in_sessions);
+}
+
+static void _session_free(dtls d, dtls_session ds)
+{
+  avl_delete(&d->sessions, &ds->in_sessions);
+  list_del(&ds->in_lru);
+  SSL_SESSION_free(ds->session);
+  d->num_sessions--;
+  free(ds);
+}
+
+static void _session_changed(dtls d)
+{
+  if (d->session_file)
+    uloop_timeout_set(&d->session_uto, SESSION_SAVE_DELAY_MS);
+}
+
+/* Is the certificate valid according to the verify locations? */
+static bool _session_cert_verified(dtls d, X509 *cert)
+{
+  X509_STORE_CTX *ctx = X509_STORE_CTX_new();
+  bool ok;
+
+  if (!ctx)
+    return false;
+  ok = X509_STORE_CTX_init(ctx, SSL_CTX_get_cert_store(d->ssl_server_ctx),
+                           cert, NULL) == 1
+    && X509_verify_cert(ctx) == 1;
+  X509_STORE_CTX_free(ctx);
+  _drain_errors();
+  return ok;
+}
+
+/* Resumed handshakes do not carry certificates, and therefore skip
+ * the verification callbacks entirely; instead, the certificate of
+ * the cached session (which has to match cert_hash, if given) is
+ * checked again the same way as in a full handshake: first against
+ * the verify locations, and only if that fails, by the unknown
+ * certificate callback. */
+static bool _session_trusted(dtls d, SSL_SESSION *session,
+                             const unsigned char *cert_hash)
+{
+  X509 *cert = SSL_SESSION_get0_peer(session);
+  unsigned char h[SHA256_DIGEST_LENGTH];
+
+  if (!cert)
+    return true;
+  if (cert_hash)
+    {
+      dtls_cert_hash_sha256(cert, h);
+      if (memcmp(h, cert_hash, sizeof(h)))
+        return false;
+    }
+  if (_session_cert_verified(d, cert))
+    return true;
+  return !d->unknown_cb || d->unknown_cb(d, cert, d->unknown_cb_context);
+}
+
+/* Connection dc just finished its handshake; if it resumed a session
+ * that is no longer trusted, drop the session and return false. */
+static bool _session_check_resumed(dtls_connection dc)
+{
+  dtls d = dc->d;
+  SSL_SESSION *session;
+  dtls_session ds;
+
+  if (!SSL_session_reused(dc->ssl))
+    return true;
+  session = SSL_get_session(dc->ssl);
+  if (session && _session_trusted(d, session, NULL))
+    return true;
+  L_INFO("rejecting resumed session of an untrusted peer");
+  if (session)
+    SSL_CTX_remove_session(SSL_get_SSL_CTX(dc->ssl), session);
+  if (dc->is_client && (ds = _session_find(d, &dc->remote_addr)))
+    {
+      _session_free(d, ds);
+      _session_changed(d);
+    }
+  return false;
+}
+
+void dtls_trust_revoked(dtls d, const unsigned char *cert_hash)
+{
+  dtls_session ds, ds2;
+  int dropped = 0;
+
+  /* Server side sessions are checked again (and dropped) when the
+   * peer tries to resume them, by _session_check_resumed. */
+  list_for_each_entry_safe(ds, ds2, &d->session_lru, in_lru)
+    if (!memcmp(ds->cert_hash, cert_hash, sizeof(ds->cert_hash)))
+      {
+        _session_free(d, ds);
+        dropped++;
+      }
+  if (dropped)
+    {
+      L_DEBUG("dropped %d sessions of a no longer trusted peer", dropped);
+      _session_changed(d);
+    }
+}
+
+static bool _session_add(dtls d, const struct sockaddr_in6 *addr,
+                         const unsigned char *cert_hash, SSL_SESSION *session)
+{
+  dtls_session ds = _session_find(d, addr);
+
+  if (ds)
+    {
+      SSL_SESSION_free(ds->session);
+      list_move_tail(&ds->in_lru, &d->session_lru);
+    }
+  else
+    {
+      if (!(ds = calloc(1, sizeof(*ds))))
+        return false;
+      while (d->num_sessions >= d->max_sessions)
+        _session_free(d, list_first_entry(&d->session_lru,
+                                          dtls_session_s, in_lru));
+      ds->remote_addr = *addr;
+      ds->in_sessions.key = &ds->remote_addr;
+      avl_insert(&d->sessions, &ds->in_sessions);
+      list_add_tail(&ds->in_lru, &d->session_lru);
+      d->num_sessions++;
+    }
+  memcpy(ds->cert_hash, cert_hash, sizeof(ds->cert_hash));
+  ds->session = session;
+  return true;
+}
+
+/* Remember the session of a client connection which just entered
+ * DATA state, so that the next connection to the same peer can be
+ * resumed instead of doing a full handshake. */
+static void _session_store(dtls_connection dc)
+{
+  dtls d = dc->d;
+  unsigned char cert_hash[SHA256_DIGEST_LENGTH];
+
+  if (!d->max_sessions || !dc->is_client)
+    return;
+  if (SSL_session_reused(dc->ssl))
+    {
+      dtls_session ds = _session_find(d, &dc->remote_addr);
+      if (ds)
+        list_move_tail(&ds->in_lru, &d->session_lru);
+      return;
+    }
+  SSL_SESSION *session = SSL_get1_session(dc->ssl);
+  if (!session)
+    return;
+  memset(cert_hash, 0, sizeof(cert_hash));
+  X509 *cert = SSL_get_peer_certificate(dc->ssl);
+  if (cert)
+    {
+      dtls_cert_hash_sha256(cert, cert_hash);
+      X509_free(cert);
+    }
+  if (!_session_add(d, &dc->remote_addr, cert_hash, session))
+    {
+      SSL_SESSION_free(session);
+      return;
+    }
+  L_DEBUG("stored session for %s",
+          HEX_REPR(&dc->remote_addr, sizeof(dc->remote_addr)));
+  _session_changed(d);
+}
+
+/*
+ * Session file consists of the magic, the server's session ticket
+ * keys (16-bit network order length, and that many bytes), followed
+ * by per-session records of remote address, certificate hash, 16-bit
+ * (network order) length and that many bytes of DER encoded session.
+ *
+ * The ticket keys let the server resume sessions it issued before
+ * a restart, as the client side can.
+ */
+
+static void _session_save(dtls d)
+{
+  dtls_session ds;
+  uint32_t magic = htonl(SESSION_FILE_MAGIC);
+  char tmp[strlen(d->session_file) + 5];
+  unsigned char keys[SESSION_TICKET_KEYS_MAX];
+  long klen = SSL_CTX_get_tlsext_ticket_keys(d->ssl_server_ctx, NULL, 0);
+  uint16_t nklen;
+  FILE *f;
+  int fd;
+
+  if (klen <= 0 || klen > (long)sizeof(keys)
+      || SSL_CTX_get_tlsext_ticket_keys(d->ssl_server_ctx, keys, klen) != 1)
+    klen = 0;
+  nklen = htons(klen);
+
+  sprintf(tmp, "%s.tmp", d->session_file);
+  /* Sessions contain the master secrets; keep them private. */
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0
+      || !(f = fdopen(fd, "w")))
+    {
+      L_ERR("unable to open %s for writing", tmp);
+      if (fd >= 0)
+        close(fd);
+      return;
+    }
+  fwrite(&magic, sizeof(magic), 1, f);
+  fwrite(&nklen, sizeof(nklen), 1, f);
+  fwrite(keys, klen, 1, f);
+  OPENSSL_cleanse(keys, sizeof(keys));
+  list_for_each_entry(ds, &d->session_lru, in_lru)
+    {
+      unsigned char buf[2048], *p = buf;
+      int len = i2d_SSL_SESSION(ds->session, NULL);
+      if (len <= 0 || len > (int)sizeof(buf))
+        continue;
+      len = i2d_SSL_SESSION(ds->session, &p);
+      uint16_t nlen = htons(len);
+      fwrite(&ds->remote_addr, sizeof(ds->remote_addr), 1, f);
+      fwrite(ds->cert_hash, sizeof(ds->cert_hash), 1, f);
+      fwrite(&nlen, sizeof(nlen), 1, f);
+      fwrite(buf, len, 1, f);
+    }
+  if (fclose(f) || rename(tmp, d->session_file))
+    {
+      L_ERR("unable to save sessions to %s", d->session_file);
+      unlink(tmp);
+      return;
+    }
+  L_DEBUG("saved %d sessions to %s", d->num_sessions, d->session_file);
+}
+
+static void _session_uto_cb(struct uloop_timeout *t)
+{
+  dtls d = container_of(t, dtls_s, session_uto);
+
+  _session_save(d);
+}
+
+static void _session_load(dtls d)
+{
+  struct sockaddr_in6 addr;
+  unsigned char cert_hash[SHA256_DIGEST_LENGTH];
+  unsigned char buf[2048];
+  uint32_t magic;
+  uint16_t nlen;
+  long klen = 0;
+  FILE *f;
+  int loaded = 0;
+
+  if (!(f = fopen(d->session_file, "r")))
+    {
+      /* Save the (random) ticket keys we started with. */
+      _session_changed(d);
+      return;
+    }
+  if (fread(&magic, sizeof(magic), 1, f) != 1
+      || (ntohl(magic) != SESSION_FILE_MAGIC
+          && ntohl(magic) != SESSION_FILE_MAGIC_V1))
+    {
+      L_ERR("invalid session file %s", d->session_file);
+      goto done;
+    }
+  if (ntohl(magic) == SESSION_FILE_MAGIC)
+    {
+      if (fread(&nlen, sizeof(nlen), 1, f) != 1
+          || (klen = ntohs(nlen)) > sizeof(buf)
+          || (klen && fread(buf, klen, 1, f) != 1))
+        {
+          L_ERR("truncated session file %s", d->session_file);
+          goto done;
+        }
+      if (klen != SSL_CTX_get_tlsext_ticket_keys(d->ssl_server_ctx, NULL, 0)
+          || SSL_CTX_set_tlsext_ticket_keys(d->ssl_server_ctx,
+                                            buf, klen) != 1)
+        klen = 0;
+    }
+  if (!klen)
+    {
+      /* E.g. from a different OpenSSL version; save our keys instead. */
+      L_INFO("no usable ticket keys in %s", d->session_file);
+      _drain_errors();
+      _session_changed(d);
+    }
+  while (fread(&addr, sizeof(addr), 1, f) == 1
+         && fread(cert_hash, sizeof(cert_hash), 1, f) == 1
+         && fread(&nlen, sizeof(nlen), 1, f) == 1)
+    {
+      size_t len = ntohs(nlen);
+      const unsigned char *p = buf;
+      if (len > sizeof(buf) || fread(buf, len, 1, f) != 1)
+        break;
+      SSL_SESSION *session = d2i_SSL_SESSION(NULL, &p, len);
+      if (!session)
+        {
+          _drain_errors();
+          continue;
+        }
+      if (!_session_add(d, &addr, cert_hash, session))
+        SSL_SESSION_free(session);
+      else
+        loaded++;
+    }
+  L_DEBUG("loaded %d sessions from %s", loaded, d->session_file);
+ done:
+  fclose(f);
+}
+
+bool dtls_set_session_cache(dtls d, int max_sessions, const char *filename)
+{
+  dtls_session ds, ds2;
+
+  list_for_each_entry_safe(ds, ds2, &d->session_lru, in_lru)
+    _session_free(d, ds);
+  uloop_timeout_cancel(&d->session_uto);
+  free(d->session_file);
+  d->session_file = NULL;
+  d->max_sessions = max_sessions < 0 ? 0 :
+    max_sessions ? max_sessions : DTLS_LIMIT(num_data_connections);
+#ifdef DTLS_OPENSSL
+  if (!d->max_sessions)
+    {
+      SSL_CTX_set_session_cache_mode(d->ssl_server_ctx, SSL_SESS_CACHE_OFF);
+      SSL_CTX_set_options(d->ssl_server_ctx, SSL_OP_NO_TICKET);
+      return true;
+    }
+  /* Server side uses the OpenSSL internal cache (and tickets). */
+  SSL_CTX_set_session_cache_mode(d->ssl_server_ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_clear_options(d->ssl_server_ctx, SSL_OP_NO_TICKET);
+  /* Required for resumption when peer certificates are verified. */
+  SSL_CTX_set_session_id_context(d->ssl_server_ctx,
+                                 (const unsigned char *)SESSION_ID_CONTEXT,
+                                 strlen(SESSION_ID_CONTEXT));
+  SSL_CTX_sess_set_cache_size(d->ssl_server_ctx, d->max_sessions);
+#else
+  if (!d->max_sessions)
+    return true;
+#endif /* DTLS_OPENSSL */
+  if (filename)
+    {
+      if (!(d->session_file = strdup(filename)))
+        return false;
+      _session_load(d);
+    }
+  return true;
 }
 
 static dtls_connection
@@ -557,13 +1377,13 @@ _connection_create(dtls d, bool is_client,
   if (d->num_non_data_connections == DTLS_LIMIT(num_non_data_connections))
     _connection_drop(d, false);
   INIT_LIST_HEAD(&dc->queued_buffers);
+  INIT_LIST_HEAD(&dc->pending_datagrams);
   dc->d = d;
   _dtls_update_t(d);
   dc->last_use = d->t;
   dc->uto.cb = _connection_uto_cb;
   dc->remote_addr = *remote_addr;
   dc->is_client = is_client;
-  d->num_non_data_connections++;
   if (is_client)
     dc->state = STATE_CONNECT;
   else
@@ -577,14 +1397,44 @@ _connection_create(dtls d, bool is_client,
     }
   SSL_set_ex_data(ssl, 0, dc);
   SSL_set_options(ssl, SSL_OP_COOKIE_EXCHANGE);
+  if (is_client)
+    {
+      dtls_session ds = _session_find(d, remote_addr);
+      if (ds && !_session_trusted(d, ds->session, ds->cert_hash))
+        {
+          L_DEBUG("not resuming session of an untrusted peer");
+          _session_free(d, ds);
+          _session_changed(d);
+          ds = NULL;
+        }
+      if (ds && SSL_set_session(ssl, ds->session) == 1)
+        L_DEBUG("attempting to resume session");
+    }
 
-  dc->rbio = BIO_new(BIO_s_mem());
-  dc->wbio = BIO_new(BIO_s_mem());
-  BIO_set_mem_eof_return(dc->rbio, -1);
-  BIO_set_mem_eof_return(dc->wbio, -1);
-
-  SSL_set_bio(ssl, dc->rbio, dc->wbio);
+  dc->bio = BIO_new(d->bio_method);
+  if (!dc->bio)
+    {
+      L_ERR("BIO_new failed");
+      SSL_free(ssl);
+      free(dc);
+      return NULL;
+    }
+  BIO_set_data(dc->bio, dc);
+  SSL_set_bio(ssl, dc->bio, dc->bio);
+  dc->in_index.key = dc;
+  if (avl_insert(&d->connection_index, &dc->in_index))
+    {
+      L_ERR("duplicate %s connection", is_client ? "client" : "server");
+      SSL_free(ssl); /* Frees the BIO too */
+      free(dc);
+      return NULL;
+    }
+  d->num_non_data_connections++;
   list_add(&dc->in_connections, &d->connections);
+  list_add_tail(&dc->in_lru, &d->lru_non_data);
+  dc->indexed = true;
+  if (!d->idle_uto.pending)
+    _dtls_idle_schedule(d);
 
   dc->ssl = ssl;
   L_DEBUG("Created new %s connection %p to %s",
@@ -597,10 +1447,12 @@ static void _dtls_poll(dtls d, bool is_client)
 {
   struct sockaddr_in6 remote_addr, local_addr;
   int rv;
-  char buf[2048];
   udp46 s = is_client ? d->u46_client : d->u46_server;
 
-  if ((rv = udp46_recv(s, &remote_addr, &local_addr, buf, sizeof(buf))) <= 0)
+  if (!_dtls_alloc_buffers(d))
+    return;
+  unsigned char *buf = d->in_buf;
+  if ((rv = udp46_recv(s, &remote_addr, &local_addr, buf, d->buf_size)) <= 0)
     {
       L_DEBUG("recvfrom did not return anything");
       return;
@@ -635,12 +1487,31 @@ static void _dtls_poll(dtls d, bool is_client)
   dc->has_local_addr = true;
   dc->local_addr = local_addr;
 
-  /* Feed in the data to the BIO */
-  L_DEBUG("adding %d bytes to rbio", rv);
-  BIO_write(dc->rbio, buf, rv);
+  /* Handshake steps are deferred (and rate limited); established
+   * connections are dealt with immediately. */
+  if (dc->state == STATE_ACCEPT || dc->state == STATE_CONNECT)
+    {
+      L_DEBUG("queueing %d bytes for handshake", rv);
+      if (_connection_push_datagram(dc, buf, rv))
+        _connection_queue_handshake(dc);
+      return;
+    }
 
-  /* Let the connection do what it feels like. */
+  /* Let the BIO read the datagram in place, and the connection do
+   * what it feels like. */
+  L_DEBUG("providing %d bytes to bio", rv);
+  d->in_dc = dc;
+  d->in_len = rv;
   _connection_poll(dc);
+
+  /* If the SSL did not want it yet (e.g. earlier data is still
+   * unread), keep a copy around; the buffer is reused. */
+  if (d->in_dc)
+    {
+      L_DEBUG("datagram not consumed, queueing %d bytes", rv);
+      (void)_connection_push_datagram(d->in_dc, buf, rv);
+      d->in_dc = NULL;
+    }
 }
 
 static void
@@ -689,10 +1560,21 @@ dtls dtls_create(uint16_t port)
     }
   if (!d)
     goto fail;
+  INIT_LIST_HEAD(&d->connections);
+  INIT_LIST_HEAD(&d->handshakes);
+  d->hs_uto.cb = _dtls_handshake_cb;
+  avl_init(&d->connection_index, _connection_index_cmp, false, NULL);
+  INIT_LIST_HEAD(&d->lru_data);
+  INIT_LIST_HEAD(&d->lru_non_data);
+  d->idle_uto.cb = _dtls_idle_cb;
+  avl_init(&d->sessions, _session_cmp, false, NULL);
+  INIT_LIST_HEAD(&d->session_lru);
+  d->session_uto.cb = _session_uto_cb;
+
+  if (!(d->bio_method = _bio_method_create()))
+    goto fail;
   if (!(d->u46_server = udp46_create(port)))
     goto fail;
-  INIT_LIST_HEAD(&d->connections);
-
   if (!(d->u46_client = udp46_create(0)))
     goto fail;
 
@@ -712,6 +1594,9 @@ dtls dtls_create(uint16_t port)
   SSL_CTX_set_cookie_generate_cb(ctx, _cookie_gen_cb);
   SSL_CTX_set_cookie_verify_cb(ctx, _cookie_verify_cb);
   RAND_bytes(d->cookie_secret, COOKIE_SECRET_LENGTH);
+  /* No resumption unless dtls_set_session_cache enables it. */
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+  SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
 #endif /* DTLS_OPENSSL */
   d->ssl_server_ctx = ctx;
 
@@ -725,6 +1610,7 @@ dtls dtls_create(uint16_t port)
   SSL_CTX_set_ex_data(ctx, 0, d);
 #ifdef DTLS_OPENSSL
   SSL_CTX_set_read_ahead(ctx, 1);
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
 #endif /* DTLS_OPENSSL */
 #endif /* !USE_ONE_CONTEXT */
   d->ssl_client_ctx = ctx;
@@ -743,6 +1629,11 @@ void dtls_set_limits(dtls d, dtls_limits limits)
   d->limits = *limits;
 }
 
+void dtls_get_limits(dtls d, dtls_limits limits)
+{
+  *limits = d->limits;
+}
+
 
 void dtls_start(dtls d)
 {
@@ -755,7 +1646,14 @@ void dtls_start(dtls d)
 void dtls_destroy(dtls d)
 {
   dtls_connection dc, dc2;
+  dtls_session ds, ds2;
 
+  /* Saving needs the ticket keys of the context. */
+  if (d->session_uto.pending)
+    {
+      uloop_timeout_cancel(&d->session_uto);
+      _session_save(d);
+    }
   if (d->psk)
     free(d->psk);
   SSL_CTX_free(d->ssl_server_ctx);
@@ -764,8 +1662,19 @@ void dtls_destroy(dtls d)
 #endif /* USE_ONE_CONTEXT */
   list_for_each_entry_safe(dc, dc2, &d->connections, in_connections)
     _connection_free(dc);
-  udp46_destroy(d->u46_server);
-  udp46_destroy(d->u46_client);
+  uloop_timeout_cancel(&d->hs_uto);
+  uloop_timeout_cancel(&d->idle_uto);
+  list_for_each_entry_safe(ds, ds2, &d->session_lru, in_lru)
+    _session_free(d, ds);
+  free(d->session_file);
+  if (d->bio_method)
+    BIO_meth_free(d->bio_method);
+  if (d->u46_server)
+    udp46_destroy(d->u46_server);
+  if (d->u46_client)
+    udp46_destroy(d->u46_client);
+  free(d->in_buf);
+  free(d->out_buf);
   free(d);
 }
 
@@ -863,7 +1772,9 @@ ssize_t dtls_send(dtls d,
 
 static int _verify_cert_cb(int ok, X509_STORE_CTX *ctx)
 {
-  dtls d = CRYPTO_get_ex_data(&ctx->ctx->ex_data, 0);
+  SSL *ssl = X509_STORE_CTX_get_ex_data(ctx,
+                                        SSL_get_ex_data_X509_STORE_CTX_idx());
+  dtls d = ssl ? SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), 0) : NULL;
 
   if (!d)
     {
@@ -916,7 +1827,6 @@ bool dtls_set_local_cert(dtls d, const char *certfile, const char *pkfile)
                      |SSL_VERIFY_FAIL_IF_NO_PEER_CERT
 #endif /* DTLS_OPENSSL */
                      , _verify_cert_cb);
-  CRYPTO_set_ex_data(&d->ssl_server_ctx->cert_store->ex_data, 0, d);
 
 #ifndef USE_ONE_CONTEXT
   R1("client cert",
@@ -928,7 +1838,6 @@ bool dtls_set_local_cert(dtls d, const char *certfile, const char *pkfile)
                      |SSL_VERIFY_PEER_FAIL_IF_NO_PEER_CERT
 #endif /* DTLS_OPENSSL */
                      , _verify_cert_cb);
-  CRYPTO_set_ex_data(&d->ssl_client_ctx->cert_store->ex_data, 0, d);
 #endif /* !USE_ONE_CONTEXT */
 
   return true;
@@ -999,6 +1908,19 @@ bool dtls_set_psk(dtls d, const char *psk, size_t psk_len)
   return true;
 }
 
+void dtls_cert_hash_sha256(dtls_cert cert, unsigned char *buf)
+{
+  unsigned char *der = NULL;
+  int r = i2d_X509(cert, &der);
+
+  if (r > 0)
+    EVP_Digest(der, r, buf, NULL, EVP_sha256(), NULL);
+  else
+    EVP_Digest("", 0, buf, NULL, EVP_sha256(), NULL);
+  if (der)
+    OPENSSL_free(der);
+}
+
 bool dtls_cert_to_pem_buf(dtls_cert cert, char *buf, int buf_len)
 {
 #ifdef DTLS_OPENSSL
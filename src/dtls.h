@@ -82,10 +82,48 @@ typedef struct {
    */
   int num_data_connections;
 
+  /*
+   * Handshake steps (SSL_accept/SSL_connect) are not run directly in
+   * the socket callback, but deferred to a zero-delay timeout. This is
+   * the maximum number of steps run per single timeout invocation,
+   * before yielding back to uloop.
+   */
+  int handshake_steps_per_poll;
+
+  /*
+   * Maximum number of handshake steps run per second; the rest stay
+   * queued until the next second.
+   */
+  int handshake_steps_per_second;
+
+  /*
+   * Largest datagram received or sent; records written together are
+   * coalesced into datagrams of at most this size.
+   */
+  int max_datagram_size;
+
 } dtls_limits_s, *dtls_limits;
 
 void dtls_set_limits(dtls d, dtls_limits limits);
+void dtls_get_limits(dtls d, dtls_limits limits);
+
+
+/*
+ * Enable session resumption. Sessions of up to max_sessions peers are
+ * kept (0 = as many as num_data_connections, negative = disable
+ * caching), and optionally persisted in filename so that they survive
+ * restarts; the file also keeps the server's session ticket keys, so
+ * that peers can resume with us after we restart too. Without this,
+ * neither session cache nor tickets are used. Resumed handshakes
+ * carry no certificates; the certificate of the cached session is
+ * checked again instead.
+ */
+bool dtls_set_session_cache(dtls d, int max_sessions, const char *filename);
 
+/* Notify that the unknown cert callback no longer trusts the peer
+ * with the given certificate (SHA-256 hash of it, as computed by
+ * dtls_cert_hash_sha256); the sessions cached for it are dropped. */
+void dtls_trust_revoked(dtls d, const unsigned char *cert_hash);
 
 /* Callback to call when dtls has new data. */
 void dtls_set_readable_cb(dtls d, dtls_readable_cb cb, void *cb_context);
@@ -13,6 +13,7 @@
 #include <errno.h>
 
 #include "hnetd.h"
+#include "hnetd_trace.h"
 
 /* One eweq task in the queue */
 struct exeq_task {
@@ -37,6 +38,8 @@ static void exeq_start_maybe(struct exeq *e)
 		L_ERR("execv error: %s\n", strerror(errno));
 		_exit(128);
 	}
+	if(e->stats)
+		hnetd_stats_inc(e->stats, HNETD_STATS_SCRIPT_SPAWN);
 	L_DEBUG("exeq_run %s", t->args[0]);
 	for (int i = 1 ; t->args[i] ; i++)
 		L_DEBUG(" %s", t->args[i]);
@@ -55,7 +58,8 @@ static  void _process_handler(struct uloop_process *c, int ret)
 		L_WARN("Child process %d exited with status %d", c->pid, ret);
 	else
 		L_DEBUG("Child process %d terminated normally.", c->pid, ret);
-	exeq_start_maybe(e);
+	HNETD_TRACE_CALL(HNETD_TRACE_PROCESS, "exeq", _process_handler,
+			 exeq_start_maybe(e));
 }
 
 /* Add a task to the queue.
@@ -89,7 +93,7 @@ int exeq_add(struct exeq *e, char **args)
 
 void exeq_init(struct exeq *e)
 {
-	memset(&e->process, 0, sizeof(*e));
+	memset(e, 0, sizeof(*e));
 	e->process.cb = _process_handler;
 	INIT_LIST_HEAD(&e->tasks);
 }
@@ -14,10 +14,13 @@
 #include <libubox/uloop.h>
 #include <libubox/list.h>
 
+#include "hnetd_stats.h"
+
 /* A single execution queue structure */
 struct exeq {
 	struct uloop_process process;
 	struct list_head tasks;
+	hnetd_stats stats; /* Runtime metrics spawns are accounted in, or NULL. */
 };
 
 /* Initializes a queue structure */
@@ -0,0 +1,338 @@
+/*
+ * $Id: hncp_capture.c $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+/* The capture file consists of a header, followed by the ring. The
+ * ring holds 8-byte aligned records; a record with zero length marks
+ * the (unused) rest of the ring before it wraps. head and tail are
+ * logical offsets (that only grow) of the end of the newest and the
+ * start of the oldest record. head is only updated once a record has
+ * been completely written, so a crash in the middle of writing loses
+ * at most that record. */
+
+#include "hncp_capture.h"
+
+#include <fcntl.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HNCP_CAPTURE_MAGIC "HNCPCAP"
+#define HNCP_CAPTURE_VERSION 1
+
+#define HNCP_CAPTURE_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+/* Which addresses follow the record header */
+#define HNCP_CAPTURE_A_SRC 0x1
+#define HNCP_CAPTURE_A_DST 0x2
+
+/* No endpoint */
+#define HNCP_CAPTURE_NO_EP 0xff
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t ring_size;
+  uint64_t head, tail;
+  uint64_t dropped;
+  uint8_t node_id_len;
+  uint8_t num_eps;
+  uint8_t node_id[DNCP_NI_MAX_LEN];
+  char eps[HNCP_CAPTURE_MAX_EPS][IFNAMSIZ];
+} hncp_capture_header_s, *hncp_capture_header;
+
+typedef struct {
+  uint32_t len;
+  uint8_t type;
+  uint8_t ep;
+  uint8_t flags;
+  uint8_t addrs;
+  int64_t time;
+  uint32_t payload_len;
+  uint32_t reserved;
+} hncp_capture_record_s, *hncp_capture_record;
+
+typedef struct {
+  struct in6_addr addr;
+  uint16_t port;
+} hncp_capture_addr_s;
+
+struct hncp_capture_struct {
+  hncp_capture_header h;
+  unsigned char *ring;
+  size_t map_size;
+  bool writable;
+
+  /* Read cursor */
+  uint64_t pos;
+};
+
+static hncp_capture _map(int fd, size_t size, bool writable)
+{
+  hncp_capture c = calloc(1, sizeof(*c));
+  void *p;
+
+  if (!c)
+    return NULL;
+  p = mmap(NULL, size, PROT_READ | (writable ? PROT_WRITE : 0),
+           MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    {
+      L_ERR("hncp_capture mmap failed: %s", strerror(errno));
+      free(c);
+      return NULL;
+    }
+  c->h = p;
+  c->ring = (unsigned char *)p + sizeof(*c->h);
+  c->map_size = size;
+  c->writable = writable;
+  return c;
+}
+
+hncp_capture hncp_capture_open(const char *filename, size_t size)
+{
+  hncp_capture c;
+  int fd;
+
+  size &= ~(size_t)7;
+  if (size < sizeof(hncp_capture_record_s) * 16)
+    return NULL;
+  if ((fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0)
+    {
+      L_ERR("hncp_capture unable to open %s: %s", filename, strerror(errno));
+      return NULL;
+    }
+  if (ftruncate(fd, sizeof(hncp_capture_header_s) + size) < 0)
+    {
+      L_ERR("hncp_capture unable to size %s: %s", filename, strerror(errno));
+      close(fd);
+      return NULL;
+    }
+  c = _map(fd, sizeof(hncp_capture_header_s) + size, true);
+  close(fd);
+  if (!c)
+    return NULL;
+  memcpy(c->h->magic, HNCP_CAPTURE_MAGIC, sizeof(HNCP_CAPTURE_MAGIC));
+  c->h->version = HNCP_CAPTURE_VERSION;
+  c->h->header_size = sizeof(*c->h);
+  c->h->ring_size = size;
+  return c;
+}
+
+hncp_capture hncp_capture_load(const char *filename)
+{
+  hncp_capture c;
+  struct stat st;
+  int fd;
+
+  if ((fd = open(filename, O_RDONLY)) < 0)
+    {
+      L_ERR("hncp_capture unable to open %s: %s", filename, strerror(errno));
+      return NULL;
+    }
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(hncp_capture_header_s))
+    {
+      L_ERR("hncp_capture %s is too short", filename);
+      close(fd);
+      return NULL;
+    }
+  c = _map(fd, st.st_size, false);
+  close(fd);
+  if (!c)
+    return NULL;
+  if (memcmp(c->h->magic, HNCP_CAPTURE_MAGIC, sizeof(HNCP_CAPTURE_MAGIC))
+      || c->h->version != HNCP_CAPTURE_VERSION
+      || c->h->header_size != sizeof(*c->h)
+      || c->h->ring_size + sizeof(*c->h) > (uint64_t)st.st_size
+      || c->h->head < c->h->tail
+      || c->h->head - c->h->tail > c->h->ring_size
+      || c->h->num_eps > HNCP_CAPTURE_MAX_EPS
+      || c->h->node_id_len > DNCP_NI_MAX_LEN)
+    {
+      L_ERR("hncp_capture %s is not a valid capture file", filename);
+      hncp_capture_close(c);
+      return NULL;
+    }
+  c->pos = c->h->tail;
+  return c;
+}
+
+void hncp_capture_close(hncp_capture c)
+{
+  if (!c)
+    return;
+  munmap(c->h, c->map_size);
+  free(c);
+}
+
+static int _ep_index(hncp_capture c, const char *ifname)
+{
+  int i;
+
+  if (!ifname)
+    return HNCP_CAPTURE_NO_EP;
+  for (i = 0 ; i < c->h->num_eps ; i++)
+    if (!strncmp(c->h->eps[i], ifname, IFNAMSIZ))
+      return i;
+  if (c->h->num_eps == HNCP_CAPTURE_MAX_EPS)
+    return HNCP_CAPTURE_NO_EP;
+  strncpy(c->h->eps[i], ifname, IFNAMSIZ - 1);
+  return c->h->num_eps++;
+}
+
+static unsigned char *_put_addr(unsigned char *p, struct sockaddr_in6 *sa)
+{
+  hncp_capture_addr_s a = { .addr = sa->sin6_addr, .port = sa->sin6_port };
+
+  memcpy(p, &a, sizeof(a));
+  return p + sizeof(a);
+}
+
+void hncp_capture_add(hncp_capture c, hncp_capture_event e)
+{
+  hncp_capture_header h = c->h;
+  uint64_t start = h->head, phys = start % h->ring_size, end;
+  size_t len = sizeof(hncp_capture_record_s) + e->len;
+  hncp_capture_record r;
+  unsigned char *p;
+
+  if (!c->writable)
+    return;
+  if (e->src)
+    len += sizeof(hncp_capture_addr_s);
+  if (e->dst)
+    len += sizeof(hncp_capture_addr_s);
+  len = HNCP_CAPTURE_ALIGN(len);
+  if (len > h->ring_size / 2)
+    {
+      h->dropped++;
+      return;
+    }
+  /* Does not fit in the end of the ring -> wrap */
+  if (phys + len > h->ring_size)
+    start += h->ring_size - phys;
+  end = start + len;
+
+  /* Drop the oldest records until there is room */
+  while (end - h->tail > h->ring_size)
+    {
+      uint64_t tphys = h->tail % h->ring_size;
+
+      r = (hncp_capture_record)(c->ring + tphys);
+      if (!r->len)
+        h->tail += h->ring_size - tphys;
+      else
+        h->tail += r->len;
+    }
+
+  if (start != h->head)
+    ((hncp_capture_record)(c->ring + phys))->len = 0;
+  r = (hncp_capture_record)(c->ring + start % h->ring_size);
+  r->len = len;
+  r->type = e->type;
+  r->ep = _ep_index(c, e->ifname);
+  r->flags = e->flags;
+  r->addrs = (e->src ? HNCP_CAPTURE_A_SRC : 0)
+    | (e->dst ? HNCP_CAPTURE_A_DST : 0);
+  r->time = e->time;
+  r->payload_len = e->len;
+  r->reserved = 0;
+  p = (unsigned char *)(r + 1);
+  if (e->src)
+    p = _put_addr(p, e->src);
+  if (e->dst)
+    p = _put_addr(p, e->dst);
+  if (e->len)
+    memcpy(p, e->buf, e->len);
+  h->head = end;
+}
+
+void hncp_capture_set_node_id(hncp_capture c, const void *ni, int len)
+{
+  if (!c->writable || len < 0 || len > DNCP_NI_MAX_LEN)
+    return;
+  memcpy(c->h->node_id, ni, len);
+  c->h->node_id_len = len;
+}
+
+int hncp_capture_get_node_id(hncp_capture c, const void **ni)
+{
+  *ni = c->h->node_id;
+  return c->h->node_id_len;
+}
+
+void hncp_capture_rewind(hncp_capture c)
+{
+  c->pos = c->h->tail;
+}
+
+static unsigned char *
+_get_addr(unsigned char *p, struct sockaddr_in6 *sa)
+{
+  hncp_capture_addr_s a;
+
+  memcpy(&a, p, sizeof(a));
+  memset(sa, 0, sizeof(*sa));
+  sa->sin6_family = AF_INET6;
+  sa->sin6_addr = a.addr;
+  sa->sin6_port = a.port;
+  return p + sizeof(a);
+}
+
+bool hncp_capture_next(hncp_capture c, hncp_capture_event e)
+{
+  hncp_capture_header h = c->h;
+  hncp_capture_record r;
+  uint64_t phys;
+  unsigned char *p;
+  size_t len;
+
+  while (c->pos < h->head)
+    {
+      phys = c->pos % h->ring_size;
+      r = (hncp_capture_record)(c->ring + phys);
+      if (!r->len)
+        {
+          c->pos += h->ring_size - phys;
+          continue;
+        }
+      len = sizeof(*r) + r->payload_len
+        + ((r->addrs & HNCP_CAPTURE_A_SRC) ? sizeof(hncp_capture_addr_s) : 0)
+        + ((r->addrs & HNCP_CAPTURE_A_DST) ? sizeof(hncp_capture_addr_s) : 0);
+      if (r->len < len || phys + r->len > h->ring_size
+          || c->pos + r->len > h->head)
+        {
+          L_ERR("hncp_capture corrupt record at %llu",
+                (unsigned long long)c->pos);
+          c->pos = h->head;
+          return false;
+        }
+      c->pos += r->len;
+      memset(e, 0, sizeof(*e));
+      e->type = r->type;
+      e->time = r->time;
+      if (r->ep < h->num_eps)
+        e->ifname = h->eps[r->ep];
+      e->flags = r->flags;
+      p = (unsigned char *)(r + 1);
+      if (r->addrs & HNCP_CAPTURE_A_SRC)
+        {
+          p = _get_addr(p, &e->src_s);
+          e->src = &e->src_s;
+        }
+      if (r->addrs & HNCP_CAPTURE_A_DST)
+        {
+          p = _get_addr(p, &e->dst_s);
+          e->dst = &e->dst_s;
+        }
+      e->buf = p;
+      e->len = r->payload_len;
+      return true;
+    }
+  return false;
+}
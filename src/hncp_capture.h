@@ -0,0 +1,95 @@
+/*
+ * $Id: hncp_capture.h $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+#pragma once
+
+#include "hncp.h"
+
+#include <netinet/in.h>
+
+/* Binary capture of the DNCP I/O of a hncp instance (received and
+ * sent packets, timeouts and endpoint state changes), so that it can
+ * be replayed offline against a fresh dncp instance.
+ *
+ * The capture file is a fixed size ring buffer mapped to memory; the
+ * most recent events are always there, even if hnetd crashes. Payloads
+ * are stored after DTLS decryption. Everything is in host byte order,
+ * so captures are meant to be replayed on the same architecture. */
+
+#define HNCP_CAPTURE_DEFAULT_SIZE (4 * 1024 * 1024)
+#define HNCP_CAPTURE_MAX_SIZE (1024 * 1024 * 1024)
+
+/* Endpoint names are stored once in the file header. */
+#define HNCP_CAPTURE_MAX_EPS 32
+
+enum hncp_capture_type {
+  HNCP_CAPTURE_RECV = 1,
+  HNCP_CAPTURE_SEND,
+  HNCP_CAPTURE_TIMEOUT,
+  HNCP_CAPTURE_EP_READY
+};
+
+typedef struct hncp_capture_struct hncp_capture_s, *hncp_capture;
+
+typedef struct {
+  enum hncp_capture_type type;
+  hnetd_time_t time;
+
+  /* NULL for timeouts (or if the endpoint table was full) */
+  const char *ifname;
+
+  /* DNCP_RECV_FLAG_* for received packets, ready state for
+   * HNCP_CAPTURE_EP_READY */
+  int flags;
+
+  /* As in dncp_ext recv/send; NULL dst means multicast. When reading,
+   * they point to the _s fields below (or are NULL). */
+  struct sockaddr_in6 *src, *dst;
+  struct sockaddr_in6 src_s, dst_s;
+
+  void *buf;
+  size_t len;
+} hncp_capture_event_s, *hncp_capture_event;
+
+/**
+ * Create (or truncate) a capture file with a ring of size bytes.
+ */
+hncp_capture hncp_capture_open(const char *filename, size_t size);
+
+/**
+ * Open an existing capture file for reading.
+ */
+hncp_capture hncp_capture_load(const char *filename);
+
+void hncp_capture_close(hncp_capture c);
+
+/**
+ * Append an event to the ring, overwriting the oldest ones if needed.
+ */
+void hncp_capture_add(hncp_capture c, hncp_capture_event e);
+
+/**
+ * Store the node identifier of the capturing node.
+ */
+void hncp_capture_set_node_id(hncp_capture c, const void *ni, int len);
+
+/**
+ * Get the stored node identifier; returns its length (0 if none).
+ */
+int hncp_capture_get_node_id(hncp_capture c, const void **ni);
+
+/**
+ * Iterate through the events, oldest first. The event (and its buffer)
+ * is valid until the next call.
+ */
+void hncp_capture_rewind(hncp_capture c);
+bool hncp_capture_next(hncp_capture c, hncp_capture_event e);
+
+/**
+ * Capture all I/O of the hncp instance from now on (NULL to stop).
+ */
+void hncp_set_capture(hncp o, hncp_capture c);
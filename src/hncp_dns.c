@@ -0,0 +1,724 @@
+/*
+ * $Id: hncp_dns.c $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+/* This module implements a minimal in-process DNS responder for the
+ * home domain.
+ *
+ * It answers <routername>.<domain> host records and the
+ * (l)b._dns-sd._udp.<domain> browse PTRs directly from HNCP state,
+ * which it indexes as the node name and delegated zone TLVs come and
+ * go (so there is nothing to regenerate or restart when they
+ * change). Queries for names within delegated zones are forwarded to
+ * the zone's server, and anything else to the configured upstream.
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <unistd.h>
+#include <libubox/avl.h>
+#include <libubox/avl-cmp.h>
+
+#include "hncp_dns.h"
+#include "hncp_sd.h"
+#include "hncp_i.h"
+#include "dns_util.h"
+
+#define DNS_PORT 53
+
+/* Replies are kept within the classic UDP limit; anything more is
+ * truncated (and the client can retry over TCP elsewhere). */
+#define DNS_UDP_MAX_LEN 512
+
+/* TTL of the synthesized records. It is deliberately short, as
+ * nothing notifies the caches when the HNCP state changes. */
+#define HNCP_DNS_TTL 30
+
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_OPCODE 0x7800
+#define DNS_FLAG_AA 0x0400
+#define DNS_FLAG_TC 0x0200
+#define DNS_FLAG_RD 0x0100
+#define DNS_FLAG_RA 0x0080
+
+#define DNS_RCODE_NOERROR 0
+#define DNS_RCODE_FORMERR 1
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_RCODE_REFUSED 5
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_PTR 12
+#define DNS_TYPE_AAAA 28
+#define DNS_TYPE_ANY 255
+#define DNS_CLASS_IN 1
+
+/* Forwarded queries are tracked in a fixed table. Each one has its
+ * own socket, connected to the server, so the source port is picked
+ * (randomly) by the kernel and only the server's replies arrive on
+ * it; the outgoing id is random too. As each slot holds a socket,
+ * the table is kept fairly small. */
+#define FORWARD_SLOTS 64
+#define FORWARD_TIMEOUT (5 * HNETD_TIME_PER_SECOND)
+
+typedef struct __packed {
+  uint16_t id;
+  uint16_t flags;
+  uint16_t qdcount;
+  uint16_t ancount;
+  uint16_t nscount;
+  uint16_t arcount;
+} dns_header_s, *dns_header;
+
+typedef struct hncp_dns_host_struct {
+  struct avl_node in_hosts;
+
+  dncp_node node;
+  struct in6_addr address;
+
+  /* Lowercase, escaped router name (the key) */
+  char name[];
+} hncp_dns_host_s, *hncp_dns_host;
+
+typedef struct hncp_dns_zone_struct {
+  struct avl_node in_zones;
+
+  dncp_node node;
+  uint8_t flags;
+  struct sockaddr_in6 server;
+
+  /* Label list as published (used in PTR answers) */
+  uint8_t ll[DNS_MAX_LL_LEN];
+  int ll_len;
+
+  /* Lowercase, escaped FQDN (the key) */
+  char name[];
+} hncp_dns_zone_s, *hncp_dns_zone;
+
+typedef struct hncp_dns_forward_struct {
+  hncp_dns d;
+
+  /* Socket connected to the server (only open while in use) */
+  struct uloop_fd ufd;
+
+  /* 0 = free slot */
+  hnetd_time_t expires;
+
+  uint16_t id;
+  uint16_t orig_id;
+  struct sockaddr_in6 src;
+  struct sockaddr_in6 dst;
+} hncp_dns_forward_s, *hncp_dns_forward;
+
+struct hncp_dns_struct {
+  hncp hncp;
+  dncp dncp;
+  hncp_dns_params_s p;
+
+  dncp_subscriber_s subscriber;
+
+  /* hncp_dns_host, by name (duplicates allowed) */
+  struct avl_tree hosts;
+
+  /* hncp_dns_zone, by name (duplicates allowed) */
+  struct avl_tree zones;
+
+  bool has_upstream;
+  struct sockaddr_in6 upstream;
+
+  udp46 server;
+  hncp_dns_forward_s forwards[FORWARD_SLOTS];
+  struct uloop_timeout forward_timeout;
+};
+
+static void _lowercase(char *s)
+{
+  for (; *s; s++)
+    *s = tolower((unsigned char)*s);
+}
+
+static void _mapped_sockaddr(struct sockaddr_in6 *sa, const char *address,
+                             uint16_t port)
+{
+  struct in_addr a4;
+
+  memset(sa, 0, sizeof(*sa));
+  sa->sin6_family = AF_INET6;
+  sa->sin6_port = htons(port);
+  if (inet_pton(AF_INET, address, &a4) == 1)
+    {
+      sa->sin6_addr.s6_addr[10] = 0xff;
+      sa->sin6_addr.s6_addr[11] = 0xff;
+      memcpy(&sa->sin6_addr.s6_addr[12], &a4, 4);
+    }
+  else
+    inet_pton(AF_INET6, address, &sa->sin6_addr);
+}
+
+static void _host_update(hncp_dns d, dncp_node n,
+                         struct tlv_attr *a, bool add)
+{
+  hncp_t_node_name nn = tlv_data(a);
+  char name[DNS_MAX_ESCAPED_L_LEN];
+  hncp_dns_host h, h2;
+  int r;
+
+  if (tlv_len(a) < sizeof(*nn)
+      || tlv_len(a) - sizeof(*nn) < nn->name_length
+      || !nn->name_length || nn->name_length >= DNS_MAX_L_LEN)
+    return;
+  if ((r = l2escaped((uint8_t *)nn->name, nn->name_length,
+                     name, sizeof(name) - 1)) < 0)
+    return;
+  name[r] = 0;
+  _lowercase(name);
+  if (add)
+    {
+      if (!(h = calloc(1, sizeof(*h) + strlen(name) + 1)))
+        {
+          L_ERR("oom when indexing node name");
+          return;
+        }
+      h->node = n;
+      h->address = nn->address;
+      strcpy(h->name, name);
+      h->in_hosts.key = h->name;
+      avl_insert(&d->hosts, &h->in_hosts);
+      return;
+    }
+  h = avl_find_element(&d->hosts, name, h, in_hosts);
+  if (!h)
+    return;
+  /* Duplicates follow the first one in the list. */
+  avl_for_element_to_last(&d->hosts, h, h2, in_hosts)
+    {
+      if (strcmp(h2->name, name))
+        break;
+      if (h2->node == n
+          && !memcmp(&h2->address, &nn->address, sizeof(nn->address)))
+        {
+          avl_delete(&d->hosts, &h2->in_hosts);
+          free(h2);
+          return;
+        }
+    }
+}
+
+static void _zone_update(hncp_dns d, dncp_node n,
+                         struct tlv_attr *a, bool add)
+{
+  hncp_t_dns_delegated_zone dh = tlv_data(a);
+  char name[DNS_MAX_ESCAPED_LEN];
+  int ll_len;
+  hncp_dns_zone z, z2;
+
+  if (tlv_len(a) < sizeof(*dh) + 1)
+    return;
+  ll_len = tlv_len(a) - sizeof(*dh);
+  if (ll_len > DNS_MAX_LL_LEN
+      || ll2escaped(dh->ll, ll_len, name, sizeof(name)) < 0)
+    return;
+  _lowercase(name);
+  if (add)
+    {
+      if (!(z = calloc(1, sizeof(*z) + strlen(name) + 1)))
+        {
+          L_ERR("oom when indexing delegated zone");
+          return;
+        }
+      z->node = n;
+      z->flags = dh->flags;
+      memcpy(z->ll, dh->ll, ll_len);
+      z->ll_len = ll_len;
+      if (dncp_node_is_self(n))
+        {
+          /* Our own zones are served by the local hybrid proxy. */
+          _mapped_sockaddr(&z->server, HNCP_SD_OHP_ADDRESS,
+                           HNCP_SD_OHP_PORT);
+        }
+      else
+        {
+          z->server.sin6_family = AF_INET6;
+          z->server.sin6_port = htons(DNS_PORT);
+          memcpy(&z->server.sin6_addr, dh->address, sizeof(dh->address));
+        }
+      strcpy(z->name, name);
+      z->in_zones.key = z->name;
+      avl_insert(&d->zones, &z->in_zones);
+      return;
+    }
+  z = avl_find_element(&d->zones, name, z, in_zones);
+  if (!z)
+    return;
+  avl_for_element_to_last(&d->zones, z, z2, in_zones)
+    {
+      if (strcmp(z2->name, name))
+        break;
+      if (z2->node == n && z2->flags == dh->flags
+          && z2->ll_len == ll_len && !memcmp(z2->ll, dh->ll, ll_len))
+        {
+          avl_delete(&d->zones, &z2->in_zones);
+          free(z2);
+          return;
+        }
+    }
+}
+
+static void _tlv_cb(dncp_subscriber s,
+                    dncp_node n, struct tlv_attr *tlv, bool add)
+{
+  hncp_dns d = container_of(s, hncp_dns_s, subscriber);
+
+  switch (tlv_id(tlv))
+    {
+    case HNCP_T_NODE_NAME:
+      _host_update(d, n, tlv, add);
+      break;
+    case HNCP_T_DNS_DELEGATED_ZONE:
+      _zone_update(d, n, tlv, add);
+      break;
+    }
+}
+
+static const char *_domain(hncp_dns d)
+{
+  return d->hncp->domain[0] ? d->hncp->domain : HNCP_SD_DEFAULT_DOMAIN;
+}
+
+/* Append an answer to the question name (at offset 12) to the reply. */
+static bool _push_rr(uint8_t **p, uint8_t *end, uint16_t type,
+                     const void *rdata, int rdata_len)
+{
+  uint8_t *c = *p;
+
+  if (c + 12 + rdata_len > end)
+    return false;
+  *c++ = 0xc0;
+  *c++ = sizeof(dns_header_s);
+  *c++ = type >> 8;
+  *c++ = type & 0xff;
+  *c++ = 0;
+  *c++ = DNS_CLASS_IN;
+  *c++ = 0;
+  *c++ = 0;
+  *c++ = HNCP_DNS_TTL >> 8;
+  *c++ = HNCP_DNS_TTL & 0xff;
+  *c++ = rdata_len >> 8;
+  *c++ = rdata_len & 0xff;
+  memcpy(c, rdata, rdata_len);
+  *p = c + rdata_len;
+  return true;
+}
+
+static int _answer_host(hncp_dns d, const char *label, uint16_t qtype,
+                        uint8_t **p, uint8_t *end, int *count, bool *tc)
+{
+  hncp_dns_host h, h2;
+
+  h = avl_find_element(&d->hosts, label, h, in_hosts);
+  if (!h)
+    return DNS_RCODE_NXDOMAIN;
+  avl_for_element_to_last(&d->hosts, h, h2, in_hosts)
+    {
+      bool v4 = IN6_IS_ADDR_V4MAPPED(&h2->address);
+      bool ok;
+
+      if (strcmp(h2->name, label))
+        break;
+      if (v4 && (qtype == DNS_TYPE_A || qtype == DNS_TYPE_ANY))
+        ok = _push_rr(p, end, DNS_TYPE_A, &h2->address.s6_addr[12], 4);
+      else if (!v4 && (qtype == DNS_TYPE_AAAA || qtype == DNS_TYPE_ANY))
+        ok = _push_rr(p, end, DNS_TYPE_AAAA, &h2->address, 16);
+      else
+        continue;
+      if (!ok)
+        {
+          *tc = true;
+          break;
+        }
+      (*count)++;
+    }
+  return DNS_RCODE_NOERROR;
+}
+
+static void _answer_browse(hncp_dns d, uint8_t flag, uint16_t qtype,
+                           uint8_t **p, uint8_t *end, int *count, bool *tc)
+{
+  hncp_dns_zone z, last = NULL;
+
+  if (qtype != DNS_TYPE_PTR && qtype != DNS_TYPE_ANY)
+    return;
+  avl_for_each_element(&d->zones, z, in_zones)
+    {
+      if (!(z->flags & flag))
+        continue;
+      /* The same zone may be published by several nodes. */
+      if (last && !strcmp(last->name, z->name))
+        continue;
+      if (!_push_rr(p, end, DNS_TYPE_PTR, z->ll, z->ll_len))
+        {
+          *tc = true;
+          break;
+        }
+      last = z;
+      (*count)++;
+    }
+}
+
+int hncp_dns_answer(hncp_dns d, const uint8_t *buf, int len,
+                    uint8_t *reply, int reply_len,
+                    struct sockaddr_in6 *server)
+{
+  const dns_header h = (dns_header)buf;
+  dns_header rh = (dns_header)reply;
+  int offsets[DNS_MAX_LL_LEN / 2];
+  int labels = 0, i, ofs, count = 0, rcode = DNS_RCODE_NOERROR;
+  char suffix[DNS_MAX_ESCAPED_LEN], first[DNS_MAX_ESCAPED_L_LEN];
+  const char *domain = _domain(d);
+  uint16_t flags, qtype, qclass;
+  bool tc = false, authoritative = false, done = false;
+  uint8_t *p, *end;
+
+  if (len < (int)sizeof(*h))
+    return -1;
+  flags = ntohs(h->flags);
+  if (flags & DNS_FLAG_QR)
+    return -1;
+
+  /* Find the label boundaries of the (single) question name. */
+  ofs = sizeof(*h);
+  while (ofs < len && buf[ofs])
+    {
+      if (buf[ofs] >= DNS_MAX_L_LEN
+          || labels == ARRAY_SIZE(offsets)
+          || ofs + buf[ofs] + 1 - (int)sizeof(*h) >= DNS_MAX_LL_LEN)
+        break;
+      offsets[labels++] = ofs;
+      ofs += buf[ofs] + 1;
+    }
+  if (ofs + 5 > len || buf[ofs]
+      || ntohs(h->qdcount) != 1 || (flags & DNS_FLAG_OPCODE))
+    {
+      /* Not something we can answer; just echo the header back. */
+      if (reply_len < (int)sizeof(*h))
+        return -1;
+      *rh = *h;
+      rh->flags = htons(DNS_FLAG_QR | (flags & DNS_FLAG_OPCODE)
+                        | (flags & DNS_FLAG_RD) | DNS_RCODE_FORMERR);
+      rh->qdcount = rh->ancount = rh->nscount = rh->arcount = 0;
+      return sizeof(*h);
+    }
+  ofs++;
+  qtype = buf[ofs] << 8 | buf[ofs + 1];
+  qclass = buf[ofs + 2] << 8 | buf[ofs + 3];
+  ofs += 4;
+
+  /* The reply starts with the header and question of the query. */
+  if (reply_len > DNS_UDP_MAX_LEN)
+    reply_len = DNS_UDP_MAX_LEN;
+  if (reply_len < ofs)
+    return -1;
+  memcpy(reply, buf, ofs);
+  p = reply + ofs;
+  end = reply + reply_len;
+
+  first[0] = 0;
+  if (labels)
+    {
+      int r = l2escaped(&buf[offsets[0] + 1], buf[offsets[0]],
+                        first, sizeof(first) - 1);
+      if (r < 0)
+        return -1;
+      first[r] = 0;
+      _lowercase(first);
+    }
+
+  /* Longest match first: delegated zones within the home domain
+   * take precedence over the domain itself. */
+  for (i = 0 ; i < labels ; i++)
+    {
+      hncp_dns_zone z;
+
+      if (ll2escaped(&buf[offsets[i]], ofs - offsets[i],
+                     suffix, sizeof(suffix)) < 0)
+        return -1;
+      _lowercase(suffix);
+      if (!strcasecmp(suffix, domain))
+        {
+          authoritative = true;
+          done = true;
+          if (qclass != DNS_CLASS_IN)
+            rcode = DNS_RCODE_REFUSED;
+          else if (i == 0)
+            ; /* The domain itself exists, but has no data here. */
+          else if (i == 1)
+            rcode = _answer_host(d, first, qtype, &p, end, &count, &tc);
+          else if (i == 3
+                   && (!strcmp(first, "b") || !strcmp(first, "lb"))
+                   && buf[offsets[1]] == 7
+                   && !strncasecmp((char *)&buf[offsets[1] + 1],
+                                   "_dns-sd", 7)
+                   && buf[offsets[2]] == 4
+                   && !strncasecmp((char *)&buf[offsets[2] + 1], "_udp", 4))
+            _answer_browse(d, first[0] == 'b'
+                           ? HNCP_T_DNS_DELEGATED_ZONE_FLAG_BROWSE
+                           : HNCP_T_DNS_DELEGATED_ZONE_FLAG_LEGACY_BROWSE,
+                           qtype, &p, end, &count, &tc);
+          else
+            rcode = DNS_RCODE_NXDOMAIN;
+          break;
+        }
+      if ((z = avl_find_element(&d->zones, suffix, z, in_zones)))
+        {
+          *server = z->server;
+          return 0;
+        }
+    }
+  if (!done)
+    {
+      if (d->has_upstream)
+        {
+          *server = d->upstream;
+          return 0;
+        }
+      rcode = DNS_RCODE_REFUSED;
+    }
+  rh->flags = htons(DNS_FLAG_QR
+                    | (authoritative ? DNS_FLAG_AA : 0)
+                    | (tc ? DNS_FLAG_TC : 0)
+                    | (flags & DNS_FLAG_RD)
+                    | (d->has_upstream ? DNS_FLAG_RA : 0)
+                    | rcode);
+  rh->qdcount = htons(1);
+  rh->ancount = htons(count);
+  rh->nscount = rh->arcount = 0;
+  return p - reply;
+}
+
+static void _forward_done(hncp_dns_forward f)
+{
+  uloop_fd_delete(&f->ufd);
+  close(f->ufd.fd);
+  f->expires = 0;
+}
+
+static void _forward_timeout_cb(struct uloop_timeout *t)
+{
+  hncp_dns d = container_of(t, hncp_dns_s, forward_timeout);
+  hnetd_time_t now = hnetd_time(), next = 0;
+  hncp_dns_forward f;
+  int i;
+
+  for (i = 0 ; i < FORWARD_SLOTS ; i++)
+    {
+      f = &d->forwards[i];
+      if (!f->expires)
+        continue;
+      if (f->expires <= now)
+        {
+          L_DEBUG("hncp_dns: forwarded query %d timed out", f->id);
+          _forward_done(f);
+        }
+      else if (!next || f->expires < next)
+        next = f->expires;
+    }
+  if (next)
+    uloop_timeout_set(t, next - now);
+}
+
+static void _forward_readable_cb(struct uloop_fd *ufd,
+                                 unsigned int events __unused)
+{
+  hncp_dns_forward f = container_of(ufd, hncp_dns_forward_s, ufd);
+  uint8_t buf[65536];
+  dns_header h = (dns_header)buf;
+  ssize_t len;
+
+  while (f->expires && (len = recv(ufd->fd, buf, sizeof(buf), 0)) >= 0)
+    {
+      if (len < (ssize_t)sizeof(*h) || ntohs(h->id) != f->id
+          || !(ntohs(h->flags) & DNS_FLAG_QR))
+        {
+          L_DEBUG("hncp_dns: unexpected reply to query %d", f->id);
+          continue;
+        }
+      h->id = f->orig_id;
+      udp46_send(f->d->server, &f->dst, &f->src, buf, len);
+      _forward_done(f);
+    }
+}
+
+static void _forward(hncp_dns d,
+                     const struct sockaddr_in6 *src,
+                     const struct sockaddr_in6 *dst,
+                     uint8_t *buf, int len,
+                     const struct sockaddr_in6 *server)
+{
+  dns_header h = (dns_header)buf;
+  hncp_dns_forward f = NULL;
+  struct sockaddr_in sin;
+  const struct sockaddr *sa = (const struct sockaddr *)server;
+  socklen_t sa_len = sizeof(*server);
+  int i, fd;
+
+  if (!d->server)
+    return;
+  for (i = 0 ; i < FORWARD_SLOTS ; i++)
+    if (!d->forwards[i].expires)
+      {
+        f = &d->forwards[i];
+        break;
+      }
+  if (!f)
+    {
+      L_DEBUG("hncp_dns: all forwarding slots busy, dropping query");
+      return;
+    }
+  if (IN6_IS_ADDR_V4MAPPED(&server->sin6_addr))
+    {
+      memset(&sin, 0, sizeof(sin));
+      sin.sin_family = AF_INET;
+      sin.sin_port = server->sin6_port;
+      memcpy(&sin.sin_addr, &server->sin6_addr.s6_addr[12], 4);
+      sa = (const struct sockaddr *)&sin;
+      sa_len = sizeof(sin);
+    }
+  L_DEBUG("hncp_dns: forwarding query to " SA6_F, SA6_D(server));
+  if ((fd = socket(sa->sa_family, SOCK_DGRAM, 0)) < 0)
+    {
+      L_ERR("hncp_dns: unable to create socket: %s", strerror(errno));
+      return;
+    }
+  f->id = random() & 0xffff;
+  f->orig_id = h->id;
+  h->id = htons(f->id);
+  /* connect() also binds the socket to a random ephemeral port */
+  if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0
+      || connect(fd, sa, sa_len) < 0
+      || send(fd, buf, len, 0) < 0)
+    {
+      L_DEBUG("hncp_dns: unable to forward query: %s", strerror(errno));
+      close(fd);
+      return;
+    }
+  f->d = d;
+  f->ufd.fd = fd;
+  f->ufd.cb = _forward_readable_cb;
+  uloop_fd_add(&f->ufd, ULOOP_READ);
+  f->expires = hnetd_time() + FORWARD_TIMEOUT;
+  f->src = *src;
+  f->dst = *dst;
+  if (!d->forward_timeout.pending)
+    uloop_timeout_set(&d->forward_timeout, FORWARD_TIMEOUT);
+}
+
+/* Only queries from the home network (received on an interface
+ * HNCP runs on) and the router itself are served; the socket listens
+ * on external interfaces too, and we are not an open resolver. */
+static bool _query_is_internal(hncp_dns d,
+                               const struct sockaddr_in6 *src,
+                               const struct sockaddr_in6 *dst)
+{
+  char ifname[IFNAMSIZ];
+  dncp_ep ep;
+
+  if (IN6_IS_ADDR_LOOPBACK(&src->sin6_addr)
+      || (IN6_IS_ADDR_V4MAPPED(&src->sin6_addr)
+          && src->sin6_addr.s6_addr[12] == 127))
+    return true;
+  if (!dst->sin6_scope_id || !if_indextoname(dst->sin6_scope_id, ifname))
+    return false;
+  /* (dncp_find_ep_by_name would create the endpoint) */
+  dncp_for_each_enabled_ep(d->dncp, ep)
+    if (!strcmp(ep->ifname, ifname))
+      return true;
+  return false;
+}
+
+static void _server_readable_cb(udp46 s, void *context)
+{
+  hncp_dns d = context;
+  struct sockaddr_in6 src, dst, server;
+  uint8_t buf[DNS_UDP_MAX_LEN * 2], reply[DNS_UDP_MAX_LEN];
+  ssize_t len;
+  int r;
+
+  while ((len = udp46_recv(s, &src, &dst, buf, sizeof(buf))) >= 0)
+    {
+      if (!_query_is_internal(d, &src, &dst))
+        {
+          L_DEBUG("hncp_dns: ignoring query from %s",
+                  ADDR_REPR(&src.sin6_addr));
+          continue;
+        }
+      r = hncp_dns_answer(d, buf, len, reply, sizeof(reply), &server);
+      if (r > 0)
+        udp46_send(s, &dst, &src, reply, r);
+      else if (!r)
+        _forward(d, &src, &dst, buf, len, &server);
+    }
+}
+
+hncp_dns hncp_dns_create(hncp h, hncp_dns_params p)
+{
+  hncp_dns d = calloc(1, sizeof(*d));
+
+  if (!d)
+    return NULL;
+  d->hncp = h;
+  d->dncp = h->dncp;
+  d->p = *p;
+  avl_init(&d->hosts, avl_strcmp, true, NULL);
+  avl_init(&d->zones, avl_strcmp, true, NULL);
+  if (p->upstream)
+    {
+      _mapped_sockaddr(&d->upstream, p->upstream,
+                       p->upstream_port ? p->upstream_port : DNS_PORT);
+      if (IN6_IS_ADDR_UNSPECIFIED(&d->upstream.sin6_addr))
+        {
+          L_ERR("hncp_dns: invalid upstream %s", p->upstream);
+          goto fail;
+        }
+      d->has_upstream = true;
+    }
+  if (p->port)
+    {
+      if (!(d->server = udp46_create(p->port)))
+        {
+          L_ERR("hncp_dns: unable to create socket");
+          goto fail;
+        }
+      udp46_set_readable_cb(d->server, _server_readable_cb, d);
+    }
+  d->forward_timeout.cb = _forward_timeout_cb;
+  d->subscriber.tlv_change_cb = _tlv_cb;
+  dncp_subscribe(d->dncp, &d->subscriber);
+  return d;
+
+ fail:
+  free(d);
+  return NULL;
+}
+
+void hncp_dns_destroy(hncp_dns d)
+{
+  hncp_dns_host h, h2;
+  hncp_dns_zone z, z2;
+  int i;
+
+  dncp_unsubscribe(d->dncp, &d->subscriber);
+  uloop_timeout_cancel(&d->forward_timeout);
+  for (i = 0 ; i < FORWARD_SLOTS ; i++)
+    if (d->forwards[i].expires)
+      _forward_done(&d->forwards[i]);
+  if (d->server)
+    udp46_destroy(d->server);
+  avl_remove_all_elements(&d->hosts, h, in_hosts, h2)
+    free(h);
+  avl_remove_all_elements(&d->zones, z, in_zones, z2)
+    free(z);
+  free(d);
+}
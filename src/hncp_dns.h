@@ -0,0 +1,45 @@
+/*
+ * $Id: hncp_dns.h $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+#pragma once
+
+#include "hncp.h"
+
+typedef struct hncp_dns_struct hncp_dns_s, *hncp_dns;
+
+/* Parameters of the built-in DNS responder. The whole structure's
+ * memory is owned by the external party, and is assumed to be valid
+ * from hncp_dns_create to hncp_dns_destroy. */
+typedef struct hncp_dns_params_struct
+{
+  /* UDP port to answer queries on (0 = no socket; only
+   * hncp_dns_answer is usable then). Only queries received on HNCP
+   * interfaces or from the router itself are answered. */
+  uint16_t port;
+
+  /* Where to forward queries outside the home domain (optional,
+   * IPv6 or IPv4 address literal; without it they are refused). */
+  const char *upstream;
+
+  /* Port of the upstream server (0 = 53). */
+  uint16_t upstream_port;
+} hncp_dns_params_s, *hncp_dns_params;
+
+/* The responder answers <routername>.<domain> A/AAAA and
+ * (l)b._dns-sd._udp.<domain> PTR queries directly from HNCP state,
+ * and forwards queries for names within delegated zones to the
+ * zone's server (and everything else to the upstream, if any). */
+hncp_dns hncp_dns_create(hncp h, hncp_dns_params p);
+
+void hncp_dns_destroy(hncp_dns d);
+
+/* Produce a reply to the query in buf. Returns the length of the
+ * reply, 0 if the query should be forwarded to *server instead, or
+ * -1 if it should be dropped. */
+int hncp_dns_answer(hncp_dns d, const uint8_t *buf, int len,
+                    uint8_t *reply, int reply_len,
+                    struct sockaddr_in6 *server);
@@ -13,6 +13,13 @@
 #include "platform.h"
 
 #include <libubox/blobmsg_json.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+
+/* Upper bound for the size of one dump page. The reply is sent as a
+ * single IPC datagram (and the client reads at most 128KB). */
+#define HD_PAGE_MAX_LEN (64 * 1024)
 
 #define hd_a(test, err) do{if(!(test)) {err;}}while(0)
 
@@ -103,8 +110,7 @@ static int hd_node_externals_dp(struct tlv_attr *tlv, struct blob_buf *b)
 	struct prefix p;
 	struct tlv_attr *a;
 	unsigned int flen;
-	int ret = -1;
-	struct blob_buf dps = {NULL, NULL, 0, NULL};
+	void *k;
 
 	if (!(dh = hncp_tlv_dp(tlv)))
 		return -1;
@@ -119,7 +125,7 @@ static int hd_node_externals_dp(struct tlv_attr *tlv, struct blob_buf *b)
 	flen = ROUND_BYTES_TO_4BYTES(sizeof(*dh) +
 			ROUND_BITS_TO_BYTES(dh->prefix_length_bits));
 
-	hd_a(!blob_buf_init(&dps, BLOBMSG_TYPE_ARRAY), return -1);
+	hd_a(k = blobmsg_open_array(b, "domains"), return -1);
 	if (tlv_len(tlv) > flen) {
 		tlv_for_each_in_buf(a, tlv_data(tlv) + flen, tlv_len(tlv) - flen) {
 			hncp_t_prefix_policy d = tlv_data(a);
@@ -131,50 +137,53 @@ static int hd_node_externals_dp(struct tlv_attr *tlv, struct blob_buf *b)
 				p.plen = d->type;
 				memcpy(&p.prefix, d->id, plen);
 				memset(&p.prefix.s6_addr[plen], 0, sizeof(p.prefix) - plen);
-				hd_a(!blobmsg_add_string(&dps, NULL, PREFIX_REPR(&p)), return -1);
+				hd_a(!blobmsg_add_string(b, NULL, PREFIX_REPR(&p)), goto err);
 			} else if (d->type == 129 && tlv_len(a) >= 2 && d->id[tlv_len(a) - 2] == 0) {
-				hd_a(!blobmsg_add_string(&dps, NULL, (const char*)d->id), return -1);
+				hd_a(!blobmsg_add_string(b, NULL, (const char*)d->id), goto err);
 			}
 		}
 	}
-	hd_a(!blobmsg_add_named_blob(b, "domains", dps.head), goto err);
-	ret = 0;
+	blobmsg_close_array(b, k);
+	return 0;
 err:
-	blob_buf_free(&dps);
-	return ret;
+	blobmsg_close_array(b, k);
+	return -1;
+}
+
+static int hd_node_external_dps(struct tlv_attr *tlv, struct blob_buf *b)
+{
+	struct tlv_attr *a;
+
+	tlv_for_each_attr(a, tlv)
+		if (tlv_id(a) == HNCP_T_DELEGATED_PREFIX)
+			hd_do_in_table(b, NULL, hd_node_externals_dp(a, b), return -1);
+	return 0;
 }
 
 static int hd_node_external(struct tlv_attr *tlv, struct blob_buf *b)
 {
 	struct tlv_attr *a;
-	struct blob_buf dps = {NULL, NULL, 0, NULL};
-	int ret = -1;
 
-	hd_a(!blob_buf_init(&dps, BLOBMSG_TYPE_ARRAY), return -1);
+	/* Options first, so that the delegated prefixes can be written
+	 * straight into a nested array (instead of a temporary buffer). */
 	tlv_for_each_attr(a, tlv)
 	{
 		switch (tlv_id(a)) {
-			case HNCP_T_DELEGATED_PREFIX:
-				hd_do_in_table(&dps, NULL, hd_node_externals_dp(a, &dps), goto err);
-				break;
 			case HNCP_T_DHCPV6_OPTIONS:
-				hd_a(tlv_len(a) > 0, goto err);
-				hd_a(!hd_push_hex(b, "dhcpv6", tlv_data(a), tlv_len(a)), goto err);
+				hd_a(tlv_len(a) > 0, return -1);
+				hd_a(!hd_push_hex(b, "dhcpv6", tlv_data(a), tlv_len(a)), return -1);
 				break;
 			case HNCP_T_DHCP_OPTIONS:
-				hd_a(tlv_len(a) > 0, goto err);
-				hd_a(!hd_push_hex(b, "dhcpv4", tlv_data(a), tlv_len(a)), goto err);
+				hd_a(tlv_len(a) > 0, return -1);
+				hd_a(!hd_push_hex(b, "dhcpv4", tlv_data(a), tlv_len(a)), return -1);
 				break;
 			default:
 				break;
 		}
 	}
 
-	hd_a(!blobmsg_add_named_blob(b, "delegated", dps.head), goto err);
-	ret = 0;
-err:
-	blob_buf_free(&dps);
-	return ret;
+	hd_do_in_array(b, "delegated", hd_node_external_dps(tlv, b), return -1);
+	return 0;
 }
 
 static int hd_node_neighbor(struct tlv_attr *tlv, struct blob_buf *b)
@@ -240,114 +249,158 @@ inv:
 }
 
 
-static int hd_node(dncp o, dncp_node n, struct blob_buf *b)
+/* Node TLVs that are dumped as arrays of tables. */
+static const struct hd_array {
+	uint16_t type;
+	const char *name;
+	int (*cb)(struct tlv_attr *tlv, struct blob_buf *b);
+} hd_arrays[] = {
+	{DNCP_T_PEER, "neighbors", hd_node_neighbor},
+	{HNCP_T_ASSIGNED_PREFIX, "prefixes", hd_node_prefix},
+	{HNCP_T_EXTERNAL_CONNECTION, "uplinks", hd_node_external},
+	{HNCP_T_NODE_ADDRESS, "addresses", hd_node_address},
+	{HNCP_T_DNS_DELEGATED_ZONE, "zones", hd_node_zone},
+	{HNCP_T_PIM_BORDER_PROXY, "pim_proxies", hd_node_pim_bp},
+	{HNCP_T_SSID, "ssids", hd_node_ssid},
+};
+
+#define HD_ARRAYS (sizeof(hd_arrays) / sizeof(hd_arrays[0]))
+
+/* Dump request filters and pagination state. */
+struct hd_filter {
+	struct blob_attr *nodes; /* array of node-id (hex) strings */
+	struct blob_attr *types; /* array of TLV types */
+	dncp_node_id_s cursor; /* dump nodes after this one.. */
+	bool has_cursor;
+	uint32_t limit; /* ..at most this many (0 = no limit) */
+};
+
+static bool hd_filter_type(struct hd_filter *f, uint16_t type)
+{
+	struct blob_attr *a;
+	unsigned rem;
+
+	if (!f->types)
+		return true;
+	blobmsg_for_each_attr(a, f->types, rem)
+		if (blobmsg_type(a) == BLOBMSG_TYPE_INT32 && blobmsg_get_u32(a) == type)
+			return true;
+	return false;
+}
+
+static bool hd_filter_node(struct hd_filter *f, dncp_node n)
+{
+	struct blob_attr *a;
+	unsigned rem;
+
+	if (!f->nodes)
+		return true;
+	blobmsg_for_each_attr(a, f->nodes, rem)
+		if (blobmsg_type(a) == BLOBMSG_TYPE_STRING &&
+				!strcasecmp(blobmsg_get_string(a), hd_ni_to_hex(&n->node_id)))
+			return true;
+	return false;
+}
+
+static int hd_node(dncp o, dncp_node n, struct blob_buf *b, struct hd_filter *f)
 {
 	struct tlv_attr *tlv;
 	hncp_t_version v;
 	hncp_t_node_name na;
-	struct blob_buf prefixes = {NULL, NULL, 0, NULL},
-			neighbors = {NULL, NULL, 0, NULL},
-			externals = {NULL, NULL, 0, NULL},
-			addresses = {NULL, NULL, 0, NULL},
-			zones = {NULL, NULL, 0, NULL},
-			pim_bps = {NULL, NULL, 0, NULL},
-			hncp_wifi = {NULL, NULL, 0, NULL};
-	int ret = -1;
+	bool seen[HD_ARRAYS] = {false};
+	void *k = NULL;
+	int cur = -1;
+	size_t i;
 
 	hd_a(!blobmsg_add_u32(b, "update", n->update_number), return -1);
 	hd_a(!blobmsg_add_u64(b, "age", hd_now - n->origination_time), return -1);
 	if(n == o->own_node)
 			hd_a(!blobmsg_add_u8(b, "self", 1), return -1);
 
-	hd_a(!blob_buf_init(&prefixes, BLOBMSG_TYPE_ARRAY), goto px);
-	hd_a(!blob_buf_init(&neighbors, BLOBMSG_TYPE_ARRAY), goto nh);
-	hd_a(!blob_buf_init(&externals, BLOBMSG_TYPE_ARRAY), goto el);
-	hd_a(!blob_buf_init(&addresses, BLOBMSG_TYPE_ARRAY), goto ad);
-	hd_a(!blob_buf_init(&zones, BLOBMSG_TYPE_ARRAY), goto zo);
-	hd_a(!blob_buf_init(&pim_bps, BLOBMSG_TYPE_ARRAY), goto bp);
-	hd_a(!blob_buf_init(&hncp_wifi, BLOBMSG_TYPE_ARRAY), goto aw);
-
+	/* The node's TLVs are sorted by type, so those of one array are
+	 * consecutive and can be written directly into the output. */
 	dncp_node_for_each_tlv(n, tlv) {
+		if (!hd_filter_type(f, tlv_id(tlv)))
+			continue;
+		for (i = 0; i < HD_ARRAYS && hd_arrays[i].type != tlv_id(tlv); i++);
+		if (cur >= 0 && (size_t)cur != i) {
+			blobmsg_close_array(b, k);
+			cur = -1;
+		}
+		if (i < HD_ARRAYS) {
+			if (cur < 0) {
+				if (seen[i])
+					continue;
+				hd_a(k = blobmsg_open_array(b, hd_arrays[i].name), return -1);
+				seen[i] = true;
+				cur = i;
+			}
+			hd_do_in_table(b, NULL, hd_arrays[i].cb(tlv, b), goto err);
+			continue;
+		}
 		switch (tlv_id(tlv)) {
-			case HNCP_T_ASSIGNED_PREFIX:
-				hd_do_in_table(&prefixes, NULL, hd_node_prefix(tlv, &prefixes), goto err);
-				break;
-			case DNCP_T_PEER:
-				hd_do_in_table(&neighbors, NULL, hd_node_neighbor(tlv, &neighbors), goto err);
-				break;
-			case HNCP_T_EXTERNAL_CONNECTION:
-				hd_do_in_table(&externals, NULL, hd_node_external(tlv, &externals), goto err);
-				break;
-			case HNCP_T_NODE_ADDRESS:
-				hd_do_in_table(&addresses, NULL, hd_node_address(tlv, &addresses), goto err);
-				break;
 			case HNCP_T_VERSION:
 				v = (hncp_t_version)tlv_data(tlv);
 				if(tlv_len(tlv) > sizeof(hncp_t_version_s)) {
-					hd_a(!blobmsg_add_u32(b, "cap_m", v->caps_mp >> 4), goto err);
-					hd_a(!blobmsg_add_u32(b, "cap_p", v->caps_mp & 0x0f), goto err);
-					hd_a(!blobmsg_add_u32(b, "cap_h", v->caps_hl >> 4), goto err);
-					hd_a(!blobmsg_add_u32(b, "cap_l", v->caps_hl & 0x0f), goto err);
+					hd_a(!blobmsg_add_u32(b, "cap_m", v->caps_mp >> 4), return -1);
+					hd_a(!blobmsg_add_u32(b, "cap_p", v->caps_mp & 0x0f), return -1);
+					hd_a(!blobmsg_add_u32(b, "cap_h", v->caps_hl >> 4), return -1);
+					hd_a(!blobmsg_add_u32(b, "cap_l", v->caps_hl & 0x0f), return -1);
 				}
 
 				if(tlv_len(tlv) > sizeof(hncp_t_version_s))
-					hd_a(!hd_push_string(b, "user-agent", v->user_agent, tlv_len(tlv) - sizeof(hncp_t_version_s)), goto err);
-				break;
-			case HNCP_T_DNS_DELEGATED_ZONE:
-				hd_do_in_table(&zones, NULL, hd_node_zone(tlv, &zones), goto err);
+					hd_a(!hd_push_string(b, "user-agent", v->user_agent, tlv_len(tlv) - sizeof(hncp_t_version_s)), return -1);
 				break;
 			case HNCP_T_NODE_NAME:
 				na = tlv_data(tlv);
-				hd_a(!hd_push_string(b, "router-name", na->name, na->name_length), goto err);
+				hd_a(!hd_push_string(b, "router-name", na->name, na->name_length), return -1);
 				break;
 			case HNCP_T_DOMAIN_NAME:
-				hd_a(!hd_push_dn(b, "domain", tlv_data(tlv), tlv_len(tlv)), goto err);
+				hd_a(!hd_push_dn(b, "domain", tlv_data(tlv), tlv_len(tlv)), return -1);
 				break;
 			case HNCP_T_PIM_RPA_CANDIDATE:
-				hd_a(!blobmsg_add_string(b, "rpa_candidate", ADDR_REPR((struct in6_addr *)tlv_data(tlv))), goto err);
-				break;
-			case HNCP_T_PIM_BORDER_PROXY:
-				hd_do_in_table(&pim_bps, NULL, hd_node_pim_bp(tlv, &pim_bps), goto err);
-				break;
-			case HNCP_T_SSID:
-				hd_do_in_table(&hncp_wifi, NULL, hd_node_ssid(tlv, &hncp_wifi), goto err);
+				hd_a(!blobmsg_add_string(b, "rpa_candidate", ADDR_REPR((struct in6_addr *)tlv_data(tlv))), return -1);
 				break;
 			default:
 				break;
 		}
 	}
+	if (cur >= 0)
+		blobmsg_close_array(b, k);
 
-	hd_a(!blobmsg_add_named_blob(b, "neighbors", neighbors.head), goto err);
-	hd_a(!blobmsg_add_named_blob(b, "prefixes", prefixes.head), goto err);
-	hd_a(!blobmsg_add_named_blob(b, "uplinks", externals.head), goto err);
-	hd_a(!blobmsg_add_named_blob(b, "addresses", addresses.head), goto err);
-	hd_a(!blobmsg_add_named_blob(b, "zones", zones.head), goto err);
-	hd_a(!blobmsg_add_named_blob(b, "pim_proxies", pim_bps.head), goto err);
-	hd_a(!blobmsg_add_named_blob(b, "ssids", hncp_wifi.head), goto err);
-	ret = 0;
+	/* Arrays are present even when empty (unless filtered out). */
+	for (i = 0; i < HD_ARRAYS; i++)
+		if (!seen[i] && hd_filter_type(f, hd_arrays[i].type))
+			hd_do_in_array(b, hd_arrays[i].name, 0, return -1);
+	return 0;
 err:
-	blob_buf_free(&hncp_wifi);
-aw:
-	blob_buf_free(&pim_bps);
-bp:
-	blob_buf_free(&zones);
-zo:
-	blob_buf_free(&addresses);
-ad:
-	blob_buf_free(&externals);
-el:
-	blob_buf_free(&neighbors);
-nh:
-	blob_buf_free(&prefixes);
-px:
-	return ret;
+	blobmsg_close_array(b, k);
+	return -1;
 }
 
-static int hd_nodes(dncp o, struct blob_buf *b)
+static int hd_nodes(dncp o, struct blob_buf *b, struct hd_filter *f, dncp_node *next)
 {
-	dncp_node node;
-	dncp_for_each_node(o, node)
-		hd_do_in_table(b, hd_ni_to_hex(&node->node_id), hd_node(o, node,b), return -1);
+	dncp_node node, last = NULL;
+	uint32_t count = 0;
+
+	*next = NULL;
+	dncp_for_each_node(o, node) {
+		if (f->has_cursor && memcmp(&node->node_id, &f->cursor, HNCP_NI_LEN) <= 0)
+			continue;
+		if (!hd_filter_node(f, node))
+			continue;
+		/* Stop at the page limit, or when the reply would no longer fit
+		 * a single IPC datagram; the client passes 'next' (the last
+		 * node dumped) as the cursor of the following request. */
+		if (count && ((f->limit && count >= f->limit) ||
+				blob_len(b->head) > HD_PAGE_MAX_LEN)) {
+			*next = last;
+			break;
+		}
+		hd_do_in_table(b, hd_ni_to_hex(&node->node_id), hd_node(o, node, b, f), return -1);
+		last = node;
+		count++;
+	}
 	return 0;
 }
 
@@ -369,26 +422,130 @@ static int hd_info(dncp o, struct blob_buf *b)
 platform_rpc_cb hd_cb;
 platform_rpc_main hd_main;
 
+enum {
+	HD_NODES,
+	HD_TYPES,
+	HD_CURSOR,
+	HD_LIMIT,
+	HD_MAX
+};
+
+static struct blobmsg_policy hd_policy[HD_MAX] = {
+	[HD_NODES] = { .name = "nodes", .type = BLOBMSG_TYPE_ARRAY },
+	[HD_TYPES] = { .name = "types", .type = BLOBMSG_TYPE_ARRAY },
+	[HD_CURSOR] = { .name = "cursor", .type = BLOBMSG_TYPE_STRING },
+	[HD_LIMIT] = { .name = "limit", .type = BLOBMSG_TYPE_INT32 },
+};
+
 static struct hd_rpc_method {
 	struct platform_rpc_method m;
 	dncp dncp;
 } hncp_rpc_dump = {
-	{.name = "dump", .cb = hd_cb, .main = hd_main},
+	{.name = "dump", .cb = hd_cb, .main = hd_main,
+	 .policy = hd_policy, .policy_cnt = HD_MAX},
 	NULL,
 };
 
-int hd_main(struct platform_rpc_method *method, __unused int argc, __unused char* const argv[])
+/* Parses a decimal number in [0, max]. */
+static bool hd_parse_uint(const char *s, unsigned long max, uint32_t *v)
 {
-	return platform_rpc_cli(method->name, NULL);
+	unsigned long l;
+	char *end;
+
+	errno = 0;
+	l = strtoul(s, &end, 10);
+	if (!isdigit((unsigned char)*s) || *end || errno || l > max)
+		return false;
+	*v = l;
+	return true;
 }
 
-int hd_cb(struct platform_rpc_method *method, __unused const struct blob_attr *in, struct blob_buf *b)
+int hd_main(struct platform_rpc_method *method, int argc, char* const argv[])
+{
+	struct blob_buf b = {NULL, NULL, 0, NULL};
+	void *nodes = NULL, *types = NULL;
+	uint32_t v;
+	int c, ret;
+
+	blob_buf_init(&b, 0);
+	optind = 1;
+	while ((c = getopt(argc, argv, "n:c:l:")) != -1) {
+		switch (c) {
+			case 'n':
+				if (!nodes)
+					nodes = blobmsg_open_array(&b, "nodes");
+				blobmsg_add_string(&b, NULL, optarg);
+				break;
+			case 'c':
+				if (nodes) {
+					blobmsg_close_array(&b, nodes);
+					nodes = NULL;
+				}
+				blobmsg_add_string(&b, "cursor", optarg);
+				break;
+			case 'l':
+				if (nodes) {
+					blobmsg_close_array(&b, nodes);
+					nodes = NULL;
+				}
+				if (!hd_parse_uint(optarg, UINT32_MAX, &v)) {
+					fprintf(stderr, "Invalid limit: %s\n", optarg);
+					goto usage;
+				}
+				blobmsg_add_u32(&b, "limit", v);
+				break;
+			default:
+				goto usage;
+		}
+	}
+	if (nodes)
+		blobmsg_close_array(&b, nodes);
+	for (; optind < argc; optind++) {
+		if (!hd_parse_uint(argv[optind], UINT16_MAX, &v)) {
+			fprintf(stderr, "Invalid TLV type: %s\n", argv[optind]);
+			goto usage;
+		}
+		if (!types)
+			types = blobmsg_open_array(&b, "types");
+		blobmsg_add_u32(&b, NULL, v);
+	}
+	if (types)
+		blobmsg_close_array(&b, types);
+	ret = platform_rpc_cli(method->name, b.head);
+	blob_buf_free(&b);
+	return ret;
+usage:
+	fprintf(stderr, "Usage: %s [-n node-id]... [-c cursor] [-l limit] [tlv-type]...\n", argv[0]);
+	blob_buf_free(&b);
+	return 1;
+}
+
+int hd_cb(struct platform_rpc_method *method, const struct blob_attr *in, struct blob_buf *b)
 {
 	struct hd_rpc_method *m = container_of(method, struct hd_rpc_method, m);
+	struct blob_attr *tb[HD_MAX];
+	struct hd_filter f;
+	dncp_node next;
+
+	memset(&f, 0, sizeof(f));
+	blobmsg_parse(hd_policy, HD_MAX, tb, blob_data(in), blob_len(in));
+	f.nodes = tb[HD_NODES];
+	f.types = tb[HD_TYPES];
+	if (tb[HD_CURSOR]) {
+		hd_a(unhexlify(f.cursor.buf, HNCP_NI_LEN,
+			       blobmsg_get_string(tb[HD_CURSOR])) == HNCP_NI_LEN,
+		     return -EINVAL);
+		f.has_cursor = true;
+	}
+	if (tb[HD_LIMIT])
+		f.limit = blobmsg_get_u32(tb[HD_LIMIT]);
+
 	hd_now = hnetd_time();
 	hd_a(!hd_info(m->dncp, b), return -1);
 	hd_do_in_table(b, "links", hd_links(m->dncp, b), return -1);
-	hd_do_in_table(b, "nodes", hd_nodes(m->dncp, b), return -1);
+	hd_do_in_table(b, "nodes", hd_nodes(m->dncp, b, &f, &next), return -1);
+	if (next)
+		hd_a(!blobmsg_add_string(b, "next", hd_ni_to_hex(&next->node_id)), return -1);
 	return 1;
 }
 
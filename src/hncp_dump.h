@@ -25,8 +25,21 @@
  *     node-id : NODE
  *     ...
  *   }
+ *   next : node-id to pass as cursor to get the next page (string/hex,
+ *          present only if the dump was cut short)
  * }
  *
+ * The dump request may contain the following (optional) arguments:
+ * {
+ *   nodes : [ node-id ... ] (dump only these nodes)
+ *   types : [ tlv-type ... ] (dump only data from these TLVs)
+ *   cursor : node-id (dump only nodes after this one)
+ *   limit : maximum number of nodes in one reply (u32)
+ * }
+ * A reply also ends early if it would not fit a single IPC datagram.
+ *
+ * hnet-dump [-n node-id]... [-c cursor] [-l limit] [tlv-type]...
+ *
  * NODE : Represents some router's data TLVs
  * {
  *   version : version-number (u32)
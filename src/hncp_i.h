@@ -17,6 +17,7 @@
 #include "hncp_proto.h"
 #include "dncp_util.h"
 #include "udp46.h"
+#include "hncp_capture.h"
 
 /* TLV handling */
 #include "prefix_utils.h"
@@ -84,6 +85,13 @@ struct hncp_struct {
   /* Timeout for doing 'something' in dncp_io. */
   struct uloop_timeout timeout;
 
+  /* Addresses of the last received (non-DTLS) packet. They are
+   * per-instance so that several instances may live in one process. */
+  struct sockaddr_in6 recv_src, recv_dst;
+
+  /* If set, all I/O is also written to this capture (hncp_capture.h) */
+  hncp_capture capture;
+
 #ifdef DTLS
   /* DTLS 'socket' abstraction, which actually hides two UDP sockets
    * (client and server) and N OpenSSL contexts tied to each of
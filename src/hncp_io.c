@@ -79,9 +79,36 @@ _get_hwaddrs(dncp_ext ext __unused, unsigned char *buf, int buf_left)
   return ETHER_ADDR_LEN * 2;
 }
 
+#ifndef DISABLE_HNCP_CAPTURE
+static void _capture(hncp h, enum hncp_capture_type type,
+                     dncp_ep ep, int flags,
+                     struct sockaddr_in6 *src, struct sockaddr_in6 *dst,
+                     void *buf, size_t len)
+{
+  hncp_capture_event_s e = {
+    .type = type,
+    .time = hnetd_time(),
+    .ifname = ep ? ep->ifname : NULL,
+    .flags = flags,
+    .src = src,
+    .dst = dst,
+    .buf = buf,
+    .len = len
+  };
+
+  hncp_capture_add(h->capture, &e);
+}
+#else
+/* Built without hncp_capture.c; h->capture is never set. */
+#define _capture(h, type, ep, flags, src, dst, buf, len) do { } while (0)
+#endif /* !DISABLE_HNCP_CAPTURE */
+
 static void _timeout(struct uloop_timeout *t)
 {
   hncp h = container_of(t, hncp_s, timeout);
+
+  if (h->capture)
+    _capture(h, HNCP_CAPTURE_TIMEOUT, NULL, 0, NULL, NULL, NULL, 0);
   dncp_ext_timeout(h->dncp);
 }
 
@@ -111,7 +138,10 @@ hncp_io_set_ifname_enabled(hncp h, const char *ifname, bool enabled)
       return false;
     }
   /* Yay. It succeeded(?). */
-  dncp_ext_ep_ready(dncp_find_ep_by_name(h->dncp, ifname), enabled);
+  dncp_ep ep = dncp_find_ep_by_name(h->dncp, ifname);
+  if (h->capture)
+    _capture(h, HNCP_CAPTURE_EP_READY, ep, enabled, NULL, NULL, NULL, 0);
+  dncp_ext_ep_ready(ep, enabled);
   return true;
 }
 
@@ -155,12 +185,11 @@ _recv(dncp_ext ext,
 #endif /* DTLS */
       if (r < 0)
         {
-          static struct sockaddr_in6 src_store, dst_store;
-          r = udp46_recv(h->u46_server, &src_store, &dst_store, buf, len);
+          r = udp46_recv(h->u46_server, &h->recv_src, &h->recv_dst, buf, len);
           if (r < 0)
             break;
-          src = &src_store;
-          dst = &dst_store;
+          src = &h->recv_src;
+          dst = &h->recv_dst;
         }
       if (!dst)
         {
@@ -203,6 +232,8 @@ _recv(dncp_ext ext,
       *src_store = src;
       *dst_store = dst;
       *flags = f;
+      if (h->capture)
+        _capture(h, HNCP_CAPTURE_RECV, *ep, f, src, dst, buf, r);
       break;
     }
   return r;
@@ -218,6 +249,8 @@ _send(dncp_ext ext, dncp_ep ep,
   struct sockaddr_in6 rdst;
   ssize_t r;
 
+  if (h->capture)
+    _capture(h, HNCP_CAPTURE_SEND, ep, 0, src, dst, buf, len);
   if (!dst)
     sockaddr_in6_set(&rdst, &h->multicast_address, HNCP_PORT);
   else
@@ -267,14 +300,34 @@ static void _dtls_readable_cb(dtls d __unused, void *context)
 
 void hncp_set_dtls(hncp h, dtls d)
 {
+  dtls_limits_s limits;
+
   h->d = d;
   dtls_set_readable_cb(d, _dtls_readable_cb, h);
+  if (h->ext.conf.per_ep.maximum_unicast_size > 0)
+    {
+      dtls_get_limits(d, &limits);
+      limits.max_datagram_size = h->ext.conf.per_ep.maximum_unicast_size;
+      dtls_set_limits(d, &limits);
+    }
   h->ext.conf.per_ep.accept_node_data_updates_via_multicast = false;
   /* TBD: Should we also configure existing links not to do this? */
 }
 
 #endif /* DTLS */
 
+#ifndef DISABLE_HNCP_CAPTURE
+void hncp_set_capture(hncp h, hncp_capture c)
+{
+  dncp_node n = dncp_get_own_node(h->dncp);
+
+  h->capture = c;
+  if (c && n)
+    hncp_capture_set_node_id(c, dncp_node_get_id(n),
+                             h->ext.conf.node_id_length);
+}
+#endif /* !DISABLE_HNCP_CAPTURE */
+
 void _udp46_readable_cb(udp46 s __unused, void *context)
 {
   hncp h = context;
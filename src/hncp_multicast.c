@@ -397,6 +397,7 @@ hncp_multicast hncp_multicast_create(hncp h, hncp_multicast_params p)
 	m->addr_timeout.cb = _addr_timeout;
 	INIT_LIST_HEAD(&m->ifaces);
 	exeq_init(&m->exeq);
+	m->exeq.stats = dncp_get_stats(m->dncp);
 
 	m->subscriber.tlv_change_cb = _tlv_cb;
 	dncp_subscribe(m->dncp, &m->subscriber);
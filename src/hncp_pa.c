@@ -1096,8 +1096,13 @@ static void hpa_iface_set_pa_enabled(hncp_pa hpa, hpa_iface i, bool enabled)
 			}
 		}
 
-		pa_store_link_add(&i->hpa->store, &i->pasl);
-		pa_store_link_add(&i->hpa->store, &i->aasl);
+		//pa_store_link_remove ignores a link which could not be added
+		if(pa_store_link_add(&i->hpa->store, &i->pasl))
+			L_WARN("Prefixes of %s will not be stored (duplicated link name %s)",
+					i->ifname, i->pasl.name);
+		if(pa_store_link_add(&i->hpa->store, &i->aasl))
+			L_WARN("Addresses of %s will not be stored (duplicated link name %s)",
+					i->ifname, i->aasl.name);
 	} else {
 		pa_store_link_remove(&i->hpa->store, &i->pasl);
 		pa_store_link_remove(&i->hpa->store, &i->aasl);
@@ -1267,25 +1272,18 @@ static void hpa_iface_intaddr_cb(struct iface_user *u, const char *ifname,
 
 /******** DNCP Stuff *******/
 
-static hpa_advp hpa_get_hpa_advp(struct pa_core *core, dncp_node n,
+static hpa_advp hpa_get_hpa_advp(struct avl_tree *index, dncp_node n,
 		struct in6_addr *addr, uint8_t plen, uint32_t ep_id,
 		uint8_t flags)
 {
-	struct pa_advp *ap;
+	hpa_advp_s key = {.ep_id = {.ep_id = ep_id}, .ap_flags = flags};
 	hpa_advp hap;
-	hncp_ep_id_s id = {.ep_id = ep_id};
-
-	DNCP_NODE_TO_PA(n, &id.node_id);
-	pa_for_each_advp(core, ap, addr, plen) {
-		hap = container_of(ap, hpa_advp_s, advp);
-		//We must compare every field of the TLV in case it was modified
-		if(!hap->fake &&
-				!memcmp(&id, &hap->ep_id, sizeof(id)) &&
-				hap->ap_flags == flags) {
-			return hap;
-		}
-	}
-	return NULL;
+
+	//We must compare every field of the TLV in case it was modified
+	DNCP_NODE_TO_PA(n, &key.ep_id.node_id);
+	key.advp.prefix = *addr;
+	key.advp.plen = plen;
+	return avl_find_element(index, &key, hap, te);
 }
 
 static void hpa_update_ap_tlv(hncp_pa hpa, dncp_node n,
@@ -1302,12 +1300,13 @@ static void hpa_update_ap_tlv(hncp_pa hpa, dncp_node n,
 
 	hpa_advp hap;
 	if(!add) {
-		if((hap = hpa_get_hpa_advp(&hpa->pa, n, &p.prefix,
+		if((hap = hpa_get_hpa_advp(&hpa->ap_index, n, &p.prefix,
 				p.plen, ah->ep_id, ah->flags))) {
 			L_DEBUG("hpa_update_ap_tlv: deleting assigned prefix from %s",
 									HEX_REPR(tlv_data(tlv), tlv_len(tlv)));
 			pa_advp_del(&hpa->pa, &hap->advp);
 			list_del(&hap->le);
+			avl_delete(&hpa->ap_index, &hap->te);
 			free(hap);
 		} else {
 			L_INFO("hpa_update_ap_tlv: could not find assigned prefix from %s",
@@ -1332,6 +1331,8 @@ static void hpa_update_ap_tlv(hncp_pa hpa, dncp_node n,
 		hap->fake = 0;
 		hap->ep_id = id;
 		hap->ap_flags = ah->flags;
+		hap->te.key = hap;
+		avl_insert(&hpa->ap_index, &hap->te);
 	}
 }
 
@@ -1344,11 +1345,12 @@ static void hpa_update_ra_tlv(hncp_pa hpa, dncp_node n,
 
 	hpa_advp hap;
 	if(!add) {
-		if((hap = hpa_get_hpa_advp(&hpa->aa, n,
+		if((hap = hpa_get_hpa_advp(&hpa->ra_index, n,
 				&ra->address, 128, ra->ep_id, 0))) {
 			L_DEBUG("hpa_update_ra_tlv removing router address from %s",
 					HEX_REPR(tlv_data(tlv), tlv_len(tlv)));
 			pa_advp_del(&hpa->aa, &hap->advp);
+			avl_delete(&hpa->ra_index, &hap->te);
 			free(hap);
 		} else {
 			L_INFO("hpa_update_ra_tlv could not find router address from %s",
@@ -1369,6 +1371,9 @@ static void hpa_update_ra_tlv(hncp_pa hpa, dncp_node n,
 		DNCP_NODE_TO_PA(n, &hap->ep_id.node_id);
 		hap->ep_id.ep_id = ra->ep_id;
 		hap->ap_flags = 0;
+		hap->fake = 0;
+		hap->te.key = hap;
+		avl_insert(&hpa->ra_index, &hap->te);
 	}
 }
 
@@ -1379,6 +1384,7 @@ static void hpa_dp_delete_to(struct uloop_timeout *to)
 	hncp_pa hpa = dp->hpa;
 	hpa_dp_set_enabled(hpa, dp, 0);
 	list_del(&dp->dp.le);
+	avl_delete(&hpa->hncp_dp_index, &dp->hncp.te);
 	free(dp);
 	hpa_dp_update_enabled(hpa);
 
@@ -1390,15 +1396,11 @@ static void hpa_dp_delete_to(struct uloop_timeout *to)
 static hpa_dp hpa_dp_get_hncp(hncp_pa hpa, const struct prefix *p,
 		hncp_node_id id)
 {
+	hpa_dp_s key;
 	hpa_dp dp;
-	hpa_for_each_dp(hpa, dp) {
-		if(dp->pa.type == HPA_DP_T_HNCP &&
-				!prefix_cmp(&dp->dp.prefix, p) &&
-				!DNCP_ID_CMP(&dp->hncp.node_id, id)) {
-			return dp;
-		}
-	}
-	return NULL;
+	key.dp.prefix = *p;
+	key.hncp.node_id = *id;
+	return avl_find_element(&hpa->hncp_dp_index, &key, dp, hncp.te);
 }
 
 static void hpa_update_dp_tlv(hncp_pa hpa, dncp_node n,
@@ -1512,6 +1514,8 @@ static void hpa_update_dp_tlv(hncp_pa hpa, dncp_node n,
 			memcpy(&dp->hncp.dst, &dst, sizeof(dst));
 
 		list_add(&dp->dp.le, &hpa->dps);
+		dp->hncp.te.key = dp;
+		avl_insert(&hpa->hncp_dp_index, &dp->hncp.te);
 		hpa_dp_update(hpa, dp, preferred, valid, dhcpv6_data, dhcpv6_len);
 		hpa_dp_update_enabled(hpa); //recompute enabled
 
@@ -2084,6 +2088,30 @@ static int hpa_adj_avl_tree_comp(const void *k1, const void *k2,
 	return memcmp(k1, k2, sizeof(hncp_ep_id_s));
 }
 
+static int hpa_advp_avl_tree_comp(const void *k1, const void *k2,
+		__unused void *ptr)
+{
+	const hpa_advp_s *a1 = k1, *a2 = k2;
+	int i;
+	if((i = memcmp(&a1->ep_id, &a2->ep_id, sizeof(hncp_ep_id_s))))
+		return i;
+	if(a1->ap_flags != a2->ap_flags)
+		return (a1->ap_flags > a2->ap_flags)?1:-1;
+	if(a1->advp.plen != a2->advp.plen)
+		return (a1->advp.plen > a2->advp.plen)?1:-1;
+	return memcmp(&a1->advp.prefix, &a2->advp.prefix, sizeof(a1->advp.prefix));
+}
+
+static int hpa_dp_avl_tree_comp(const void *k1, const void *k2,
+		__unused void *ptr)
+{
+	const hpa_dp_s *dp1 = k1, *dp2 = k2;
+	int i;
+	if((i = DNCP_ID_CMP(&dp1->hncp.node_id, &dp2->hncp.node_id)))
+		return i;
+	return prefix_cmp(&dp1->dp.prefix, &dp2->dp.prefix);
+}
+
 int hncp_pa_storage_set(hncp_pa hpa, const char *path)
 {
 	pa_store_load(&hpa->store, path);
@@ -2094,6 +2122,15 @@ int hncp_pa_storage_set(hncp_pa hpa, const char *path)
 	return 0;
 }
 
+int hncp_pa_journal_set(hncp_pa hpa, const char *path)
+{
+	int i;
+	if((i = pa_store_set_journal(&hpa->store, path,
+					HPA_STORE_SAVE_DELAY, HPA_STORE_TOKEN_DELAY)))
+		return i;
+	return 0;
+}
+
 void hncp_pa_iface_user_register(hncp_pa hp, struct hncp_pa_iface_user *user)
 {
 	hp->if_cbs = user;
@@ -2114,6 +2151,9 @@ hncp_pa hncp_pa_create(hncp hncp, struct hncp_link *hncp_link)
 	INIT_LIST_HEAD(&hp->ifaces);
 	INIT_LIST_HEAD(&hp->leases);
 	avl_init(&hp->adjacencies, hpa_adj_avl_tree_comp, false, NULL);
+	avl_init(&hp->ap_index, hpa_advp_avl_tree_comp, true, NULL);
+	avl_init(&hp->ra_index, hpa_advp_avl_tree_comp, true, NULL);
+	avl_init(&hp->hncp_dp_index, hpa_dp_avl_tree_comp, false, NULL);
 
 	//Init ULA
 	hncp_pa_ula_conf_default(&hp->ula_conf); //Get ULA default conf
@@ -2126,6 +2166,7 @@ hncp_pa hncp_pa_create(hncp hncp, struct hncp_link *hncp_link)
 
 	pa_core_init(&hp->pa);
 	pa_core_init(&hp->aa);
+	hp->pa.stats = hp->aa.stats = dncp_get_stats(hncp->dncp);
 	pa_store_init(&hp->store, 100);
 	pa_store_bind(&hp->store, &hp->pa, &hp->store_pa_b);
 	pa_store_bind(&hp->store, &hp->aa, &hp->store_aa_b);
@@ -167,6 +167,12 @@ int hncp_pa_ula_conf_set(hncp_pa hncp_pa, const struct hncp_pa_ula_conf *);
 
 int hncp_pa_storage_set(hncp_pa hncp_pa, const char *path);
 
+/*
+ * Binary journal may be used instead of the storage file
+ */
+
+int hncp_pa_journal_set(hncp_pa hncp_pa, const char *path);
+
 
 /********************************
  * Downstream Prefix Delegation *
@@ -35,6 +35,7 @@ typedef struct hpa_adjacency_struct {
 typedef struct hpa_advp_struct {
 	struct pa_advp advp;
 	struct list_head le; //APs are linked in main struct
+	struct avl_node te; //APs and RAs are indexed in main struct (unless fake)
 	hncp_ep_id_s ep_id;
 	uint8_t ap_flags;
 	bool fake; //This is not a real advertised prefix, but rather a trick to fool PA.
@@ -191,6 +192,7 @@ typedef struct hpa_dp_struct {
 		struct {
 			hncp_node_id_s node_id;
 			struct uloop_timeout delete_to;
+			struct avl_node te; //Indexed in main struct by prefix and node id
 
 			//When there is an explicit destination option
 			bool dst_present;
@@ -246,6 +248,13 @@ struct hncp_pa_struct {
 	/* All APs are linked here for fast iteration */
 	struct list_head aps;
 
+	/* APs and RAs received from other nodes, indexed by TLV content */
+	struct avl_tree ap_index;
+	struct avl_tree ra_index;
+
+	/* DPs received from other nodes, indexed by prefix and node id */
+	struct avl_tree hncp_dp_index;
+
 	/* List of ifaces known to hncp_pa */
 	struct list_head ifaces;
 
@@ -302,7 +311,7 @@ do                              \
   } while(0)
 
 
-static hnetd_time_t
+static inline hnetd_time_t
 _remote_rel_to_local_abs(hnetd_time_t base, uint32_t netvalue)
 {
   if (netvalue == UINT32_MAX)
@@ -310,7 +319,7 @@ _remote_rel_to_local_abs(hnetd_time_t base, uint32_t netvalue)
   return base + be32_to_cpu(netvalue) * HNETD_TIME_PER_SECOND;
 }
 
-static uint32_t _local_abs_to_remote_rel(hnetd_time_t now, hnetd_time_t v)
+static inline uint32_t _local_abs_to_remote_rel(hnetd_time_t now, hnetd_time_t v)
 {
   if (v == HNETD_TIME_MAX)
     return cpu_to_be32(UINT32_MAX);
@@ -323,7 +332,7 @@ static uint32_t _local_abs_to_remote_rel(hnetd_time_t now, hnetd_time_t v)
   return cpu_to_be32(delta);
 }
 
-static int hpa_ifconf_comp(const void *k1, const void *k2, __unused void *ptr)
+static inline int hpa_ifconf_comp(const void *k1, const void *k2, __unused void *ptr)
 {
 	const hpa_conf_s *e1 = k1, *e2 = k2;
 	int i;
@@ -352,7 +361,7 @@ static int hpa_ifconf_comp(const void *k1, const void *k2, __unused void *ptr)
 }
 
 
-static void hpa_ap_iface_notify(__unused hncp_pa hpa,
+static inline void hpa_ap_iface_notify(__unused hncp_pa hpa,
 		struct pa_ldp *ldp, struct pa_ldp *addr_ldp)
 {
 	hpa_iface i = container_of(ldp->link, hpa_iface_s, pal);
@@ -365,7 +374,7 @@ static void hpa_ap_iface_notify(__unused hncp_pa hpa,
 				!addr_ldp->applied);
 }
 
-static void hpa_ap_pd_notify(__unused hncp_pa hpa, struct pa_ldp *ldp)
+static inline void hpa_ap_pd_notify(__unused hncp_pa hpa, struct pa_ldp *ldp)
 {
 	hnetd_time_t valid, pref;
 	hpa_lease l = container_of(ldp->link, hpa_lease_s, pal);
@@ -387,7 +396,7 @@ static void hpa_ap_pd_notify(__unused hncp_pa hpa, struct pa_ldp *ldp)
 				valid, pref, dp->dhcp_data, dp->dhcp_len, l->priv);
 }
 
-static hpa_iface hpa_get_adjacent_iface(hncp_pa hpa, hncp_ep_id id)
+static inline hpa_iface hpa_get_adjacent_iface(hncp_pa hpa, hncp_ep_id id)
 {
 	hpa_adjacency adj;
 	adj = avl_find_element(&hpa->adjacencies, id, adj, te);
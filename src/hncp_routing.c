@@ -17,6 +17,7 @@
 #include "dncp_i.h"
 #include "hncp_i.h"
 #include "iface.h"
+#include "hnetd_stats.h"
 
 struct hncp_routing_struct {
 	dncp_subscriber_s subscr;
@@ -113,6 +114,7 @@ static void hncp_routing_exec(struct uloop_process *p, __unused int ret)
 	if (bfs->routing_proc.pid) {
 		uloop_process_add(&bfs->routing_proc);
 		bfs->routing_pending = false;
+		hnetd_stats_inc(dncp_get_stats(bfs->dncp), HNETD_STATS_ROUTING_RUN);
 		return;
 	}
 
@@ -27,7 +27,10 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <errno.h>
 #include <libubox/md5.h>
+#include <libubox/avl-cmp.h>
 
 #include "hncp_sd.h"
 #include "hncp_i.h"
@@ -38,8 +41,8 @@
 
 /* Provided to ohybridproxy */
 #define LOCAL_OHP_AF "-4"
-#define LOCAL_OHP_ADDRESS "127.0.0.2"
-#define LOCAL_OHP_PORT 54
+#define LOCAL_OHP_ADDRESS HNCP_SD_OHP_ADDRESS
+#define LOCAL_OHP_PORT HNCP_SD_OHP_PORT
 
 #define ARGS_MAX_LEN 4096
 #define ARGS_MAX_COUNT 256
@@ -69,6 +72,64 @@
  * information may be invalid unacceptably long.*/
 #define MAXIMUM_UPDATE_DELAY 10000
 
+/* The dnsmasq configuration is split in three files: the main one
+ * (dnsmasq_bonus_file) which contains the rarely changing parts, a
+ * hosts file within a --hostsdir directory, which dnsmasq watches
+ * with inotify (no signal, and the rest of the cache is kept), and a
+ * servers file, which dnsmasq re-reads only on SIGHUP (which also
+ * clears its cache). Host records change the most often. */
+enum {
+  DNSMASQ_FILE_CONF,
+  DNSMASQ_FILE_HOSTS,
+  DNSMASQ_FILE_SERVERS,
+  NUM_DNSMASQ_FILE
+};
+
+#define DNSMASQ_HOSTSDIR_SUFFIX ".hosts.d"
+
+static const char *_dnsmasq_file_suffix[NUM_DNSMASQ_FILE] = {
+  "", DNSMASQ_HOSTSDIR_SUFFIX "/hosts", ".servers"
+};
+
+/* One line of the dnsmasq configuration, shared by all TLVs that
+ * produce it. */
+typedef struct {
+  struct avl_node in_lines;
+  int refcount;
+  int file;
+  char hash[16];
+  char line[];
+} hncp_sd_line_s, *hncp_sd_line;
+
+/* Locally published delegated zone (the TLV payload). */
+typedef struct {
+  struct avl_node in_ddzs;
+  int generation;
+  int len;
+  uint8_t data[];
+} hncp_sd_ddz_s, *hncp_sd_ddz;
+
+typedef struct {
+  ep_id_t ep_id;
+  bool has_prefix;
+  struct prefix prefix;
+} hncp_sd_ddz_key_s;
+
+/* Encoded zone names of an endpoint (+ assigned prefix). */
+typedef struct {
+  struct avl_node in_ddz_cache;
+  hncp_sd_ddz_key_s key;
+  int generation;
+
+  /* The forward name is re-encoded only if the FQDN changes. */
+  char fqdn[DNS_MAX_ESCAPED_LEN];
+  uint8_t forward_ll[DNS_MAX_LL_LEN];
+  int forward_len;
+
+  uint8_t reverse_ll[DNS_MAX_LL_LEN];
+  int reverse_len;
+} hncp_sd_ddz_cache_s, *hncp_sd_ddz_cache;
+
 struct hncp_sd_struct
 {
   hncp hncp;
@@ -91,6 +152,22 @@ struct hncp_sd_struct
   /* Parameters received when created (pointers within owned by someone else) */
   hncp_sd_params_s p;
 
+  /* dnsmasq configuration lines (hncp_sd_line), maintained from TLV
+   * changes, and XOR of the md5 hashes of lines per file. */
+  struct avl_tree dnsmasq_lines;
+  char dnsmasq_lines_state[NUM_DNSMASQ_FILE][16];
+
+  /* What was last written to each dnsmasq file. */
+  char dnsmasq_file_state[NUM_DNSMASQ_FILE][16];
+  bool dnsmasq_needs_restart;
+  bool dnsmasq_needs_reload;
+
+  /* Published DDZs (hncp_sd_ddz) and the encoding cache; entries
+   * not refreshed in the latest _publish_ddzs round are removed. */
+  struct avl_tree ddzs;
+  struct avl_tree ddz_cache;
+  int ddz_generation;
+
   /* State (md5) hashes used to keep track of what has been committed. */
   char dnsmasq_state[16];
   char ohp_state[16];
@@ -212,42 +289,128 @@ void hncp_sd_dump_link_fqdn(hncp_sd sd, dncp_ep ep,
            ifname, sd->router_name, sd->hncp->domain);
 }
 
+static int _ddz_cmp(const void *k1, const void *k2, void *ptr __unused)
+{
+  const hncp_sd_ddz d1 = (hncp_sd_ddz)k1, d2 = (hncp_sd_ddz)k2;
+
+  if (d1->len != d2->len)
+    return d1->len - d2->len;
+  return memcmp(d1->data, d2->data, d1->len);
+}
+
+static int _ddz_cache_cmp(const void *k1, const void *k2,
+                          void *ptr __unused)
+{
+  return memcmp(k1, k2, sizeof(hncp_sd_ddz_key_s));
+}
+
+/* Get the (up to date) encoded zone names of ep + prefix. */
+static hncp_sd_ddz_cache _ddz_cache_get(hncp_sd sd, dncp_ep ep,
+                                        struct prefix *assigned_prefix)
+{
+  hncp_sd_ddz_key_s key;
+  hncp_sd_ddz_cache c;
+  char tbuf[DNS_MAX_ESCAPED_LEN];
+
+  memset(&key, 0, sizeof(key));
+  key.ep_id = dncp_ep_get_id(ep);
+  if (assigned_prefix)
+    {
+      key.prefix = *assigned_prefix;
+      key.has_prefix = true;
+    }
+  c = avl_find_element(&sd->ddz_cache, &key, c, in_ddz_cache);
+  if (!c)
+    {
+      if (!(c = calloc(1, sizeof(*c))))
+        return NULL;
+      c->key = key;
+      c->forward_len = -1;
+      /* The reverse name depends only on the prefix. */
+      c->reverse_len = assigned_prefix
+        ? _push_reverse_ll(assigned_prefix, c->reverse_ll,
+                           sizeof(c->reverse_ll))
+        : -1;
+      c->in_ddz_cache.key = &c->key;
+      avl_insert(&sd->ddz_cache, &c->in_ddz_cache);
+    }
+  c->generation = sd->ddz_generation;
+  hncp_sd_dump_link_fqdn(sd, ep, ep->ifname, tbuf, sizeof(tbuf));
+  if (c->forward_len < 0 || strcmp(tbuf, c->fqdn))
+    {
+      strcpy(c->fqdn, tbuf);
+      c->forward_len = escaped2ll(tbuf, c->forward_ll,
+                                  sizeof(c->forward_ll));
+    }
+  return c;
+}
+
+/* Mark a DDZ as desired; it is published unless it already is. */
+static void _ddz_want(hncp_sd sd, struct in6_addr *a, int flags,
+                      uint8_t *ll, int ll_len)
+{
+  union {
+    hncp_sd_ddz_s d;
+    uint8_t buf[sizeof(hncp_sd_ddz_s) + sizeof(hncp_t_dns_delegated_zone_s)
+                + DNS_MAX_LL_LEN];
+  } k;
+  hncp_t_dns_delegated_zone dh = (void *)k.d.data;
+  hncp_sd_ddz d;
+
+  if (ll_len < 0 || ll_len > DNS_MAX_LL_LEN)
+    return;
+  memset(dh, 0, sizeof(*dh));
+  *((struct in6_addr *)dh->address) = *a;
+  dh->flags = flags;
+  memcpy(dh->ll, ll, ll_len);
+  k.d.len = sizeof(*dh) + ll_len;
+  d = avl_find_element(&sd->ddzs, &k.d, d, in_ddzs);
+  if (!d)
+    {
+      if (!(d = calloc(1, sizeof(*d) + k.d.len)))
+        return;
+      d->len = k.d.len;
+      memcpy(d->data, k.d.data, d->len);
+      d->in_ddzs.key = d;
+      if (!dncp_add_tlv(sd->dncp, HNCP_T_DNS_DELEGATED_ZONE,
+                        d->data, d->len, 0))
+        {
+          /* Not published -> not ours to withdraw; try again later. */
+          L_ERR("unable to publish delegated zone");
+          free(d);
+          sd->should_update |= UPDATE_FLAG_LOCAL_DDZ;
+          return;
+        }
+      avl_insert(&sd->ddzs, &d->in_ddzs);
+    }
+  d->generation = sd->ddz_generation;
+}
+
 static void _publish_ddz(hncp_sd sd, dncp_ep ep,
                          int flags_forward,
                          struct prefix *assigned_prefix)
 {
-  hncp_t_dns_delegated_zone dh;
-  unsigned char buf[sizeof(struct tlv_attr) +
-                    sizeof(*dh) +
-                    DNS_MAX_ESCAPED_LEN];
-  char tbuf[DNS_MAX_ESCAPED_LEN];
+  hncp_sd_ddz_cache c;
 
   /* Forward DDZ handling (note: duplication doesn't matter) */
-  dh = (void *)buf;
-  memset(dh, 0, sizeof(*dh));
   struct in6_addr *a = hncp_get_ipv6_address(sd->hncp, ep->ifname);
   if (!a)
     return;
-  *((struct in6_addr *)dh->address) = *a;
-  hncp_sd_dump_link_fqdn(sd, ep, ep->ifname, tbuf, sizeof(tbuf));
-  int r = escaped2ll(tbuf, dh->ll, DNS_MAX_ESCAPED_LEN);
-  if (r < 0)
+  if (!(c = _ddz_cache_get(sd, ep, assigned_prefix)))
     return;
-  int flen = sizeof(*dh) + r;
-  dh->flags = flags_forward;
-  dncp_add_tlv(sd->dncp, HNCP_T_DNS_DELEGATED_ZONE, dh, flen, 0);
+  _ddz_want(sd, a, flags_forward, c->forward_ll, c->forward_len);
 
   /* Reverse DDZ handling */
   /* (.ip6.arpa. or .in-addr.arpa.). */
   if (assigned_prefix)
-    {
-      r = _push_reverse_ll(assigned_prefix, dh->ll, DNS_MAX_ESCAPED_LEN);
-      if (r < 0)
-        return;
-      flen = sizeof(*dh) + r;
-      dh->flags = 0;
-      dncp_add_tlv(sd->dncp, HNCP_T_DNS_DELEGATED_ZONE, dh, flen, 0);
-    }
+    _ddz_want(sd, a, 0, c->reverse_ll, c->reverse_len);
+}
+
+static int _ep_id_cmp(const void *a, const void *b)
+{
+  ep_id_t i1 = *(const ep_id_t *)a, i2 = *(const ep_id_t *)b;
+
+  return i1 < i2 ? -1 : i1 > i2;
 }
 
 static void _publish_ddzs(hncp_sd sd)
@@ -255,15 +418,32 @@ static void _publish_ddzs(hncp_sd sd)
   dncp_tlv t;
   hncp_t_assigned_prefix_header ah;
   dncp_ep ep;
+  hncp_sd_ddz d, d2;
+  hncp_sd_ddz_cache c, c2;
+  ep_id_t *ap_eps = NULL;
+  int ap_eps_count = 0, ap_eps_size = 0;
 
   if (!(sd->should_update & UPDATE_FLAG_LOCAL_DDZ))
     return;
   sd->should_update &= ~UPDATE_FLAG_LOCAL_DDZ;
   L_DEBUG("_publish_ddzs");
-  (void)dncp_remove_tlvs_by_type(sd->dncp, HNCP_T_DNS_DELEGATED_ZONE);
+  sd->ddz_generation++;
   dncp_for_each_tlv(sd->dncp, t)
     if ((ah = hncp_tlv_ap(dncp_tlv_get_attr(t))))
       {
+        if (ap_eps_count == ap_eps_size)
+          {
+            int size = ap_eps_size ? ap_eps_size * 2 : 16;
+            ep_id_t *n = realloc(ap_eps, size * sizeof(*ap_eps));
+            if (n)
+              {
+                ap_eps = n;
+                ap_eps_size = size;
+              }
+          }
+        if (ap_eps_count < ap_eps_size)
+          ap_eps[ap_eps_count++] = ah->ep_id;
+
         ep = dncp_find_ep_by_id(sd->dncp, ah->ep_id);
 
         /* May be just race condition or whatever, silently ignore */
@@ -271,12 +451,15 @@ static void _publish_ddzs(hncp_sd sd)
           continue;
 
         struct prefix p;
+        memset(&p, 0, sizeof(p));
         p.plen = ah->prefix_length_bits;
         memcpy(&p.prefix, ah->prefix_data, ROUND_BITS_TO_BYTES(p.plen));
 
         _publish_ddz(sd, ep, HNCP_T_DNS_DELEGATED_ZONE_FLAG_BROWSE
                      | HNCP_T_DNS_DELEGATED_ZONE_FLAG_LEGACY_BROWSE, &p);
       }
+  if (ap_eps_count)
+    qsort(ap_eps, ap_eps_count, sizeof(*ap_eps), _ep_id_cmp);
 
   /*
    * Second stage: publish DDZs ALSO for any other interface, but if
@@ -289,117 +472,274 @@ static void _publish_ddzs(hncp_sd sd)
    */
   dncp_for_each_enabled_ep(sd->dncp, ep)
     {
-      bool found = false;
+      ep_id_t ep_id = dncp_ep_get_id(ep);
 
-      dncp_for_each_tlv(sd->dncp, t)
-        if ((ah = hncp_tlv_ap(dncp_tlv_get_attr(t))))
-          {
-            if (ah->ep_id == dncp_ep_get_id(ep))
-              {
-                found = true;
-                break;
-              }
-          }
-      if (found)
+      if (ap_eps_count
+          && bsearch(&ep_id, ap_eps, ap_eps_count, sizeof(*ap_eps),
+                     _ep_id_cmp))
         continue;
       /* Not found -> produce forward DDZ only. */
       _publish_ddz(sd, ep, 0, NULL);
     }
+  free(ap_eps);
+
+  /* Withdraw what is no longer desired (and forget stale encodings). */
+  avl_for_each_element_safe(&sd->ddzs, d, in_ddzs, d2)
+    if (d->generation != sd->ddz_generation)
+      {
+        dncp_remove_tlv_matching(sd->dncp, HNCP_T_DNS_DELEGATED_ZONE,
+                                 d->data, d->len);
+        avl_delete(&sd->ddzs, &d->in_ddzs);
+        free(d);
+      }
+  avl_for_each_element_safe(&sd->ddz_cache, c, in_ddz_cache, c2)
+    if (c->generation != sd->ddz_generation)
+      {
+        avl_delete(&sd->ddz_cache, &c->in_ddz_cache);
+        free(c);
+      }
 }
 
-bool hncp_sd_write_dnsmasq_conf(hncp_sd sd, const char *filename)
+static void _xor16(char *dst, const char *src)
 {
-  dncp_node n;
-  struct tlv_attr *a;
-  FILE *f = fopen(filename, "w");
+  int i;
+
+  for (i = 0 ; i < 16 ; i++)
+    dst[i] ^= src[i];
+}
+
+/* Add (delta=1) or remove (delta=-1) a reference to a line; returns
+ * true if the set of lines changed. */
+static bool _dnsmasq_line_ref(hncp_sd sd, int file, const char *line, int delta)
+{
+  hncp_sd_line l = avl_find_element(&sd->dnsmasq_lines, line, l, in_lines);
   md5_ctx_t ctx;
 
-  md5_begin(&ctx);
-  if (!f)
+  if (!l)
     {
-      L_ERR("unable to open %s for writing dnsmasq conf", filename);
-      return false;
+      if (delta < 0)
+        return false;
+      size_t len = strlen(line);
+      if (!(l = calloc(1, sizeof(*l) + len + 1)))
+        {
+          L_ERR("oom in _dnsmasq_line_ref");
+          return false;
+        }
+      memcpy(l->line, line, len + 1);
+      l->file = file;
+      md5_begin(&ctx);
+      md5_hash(l->line, len, &ctx);
+      md5_end(l->hash, &ctx);
+      l->in_lines.key = l->line;
+      avl_insert(&sd->dnsmasq_lines, &l->in_lines);
     }
-  /* Basic idea: Traverse through the hncp node+tlv graph _once_,
-   * producing appropriate configuration file.
-   *
-   * What do we need to take care of?
-   * - <routername>.<domain>
-   *
-   * (These are all in DNS Delegated Zone TLVs)
-   * - b._dns-sd._udp.<domain> => browseable domain
-   * - lb._dns-sd._udp.<domain> => (legacy) browseable domain
-   *
-   * <subdomain>'s ~NS (remote, real IP)
-   * <subdomain>'s ~NS (local, LOCAL_OHP_ADDRESS)
-   */
-  dncp_for_each_node(sd->dncp, n)
+  l->refcount += delta;
+  if (l->refcount > 0 && (delta < 0 || l->refcount > delta))
+    return false;
+  _xor16(sd->dnsmasq_lines_state[l->file], l->hash);
+  if (l->refcount <= 0)
     {
-      dncp_node_for_each_tlv_with_type(n, a, HNCP_T_NODE_NAME) {
+      avl_delete(&sd->dnsmasq_lines, &l->in_lines);
+      free(l);
+    }
+  return true;
+}
+
+/* Update the lines produced by a (node name or delegated zone) TLV. */
+static bool _dnsmasq_update_tlv(hncp_sd sd, dncp_node n,
+                                struct tlv_attr *a, int delta)
+{
+  char line[DNS_MAX_ESCAPED_LEN * 2 + 64];
+  bool changed = false;
+
+  switch (tlv_id(a))
+    {
+    case HNCP_T_NODE_NAME:
+      {
         hncp_t_node_name rname = tlv_data(a);
         int namelen = tlv_len(a) - sizeof(hncp_t_node_name_s);
         if (namelen > 0 && namelen >= rname->name_length
             && rname->name_length && rname->name_length <= DNS_MAX_L_LEN)
           {
-            md5_hash(rname, tlv_len(a), &ctx);
-            fprintf(f, "host-record=%.*s.%s,%s\n",
-                    rname->name_length, rname->name, sd->hncp->domain,
-                    ADDR_REPR(&rname->address));
+            snprintf(line, sizeof(line), "%s %.*s.%s",
+                     ADDR_REPR(&rname->address),
+                     rname->name_length, rname->name, sd->hncp->domain);
+            changed |= _dnsmasq_line_ref(sd, DNSMASQ_FILE_HOSTS, line, delta);
           }
       }
+      break;
+    case HNCP_T_DNS_DELEGATED_ZONE:
+      {
+        /* Decode the labels */
+        char buf[DNS_MAX_ESCAPED_LEN];
+        char buf2[256];
+        char *server;
+        int port;
+        hncp_t_dns_delegated_zone dh;
+
+        if (tlv_len(a) < (sizeof(*dh)+1))
+          break;
+
+        dh = tlv_data(a);
+        if (ll2escaped(dh->ll, tlv_len(a) - sizeof(*dh),
+                       buf, sizeof(buf)) < 0)
+          break;
+
+        if (dh->flags & HNCP_T_DNS_DELEGATED_ZONE_FLAG_BROWSE)
+          {
+            snprintf(line, sizeof(line), "ptr-record=b._dns-sd._udp.%s,%s",
+                     sd->hncp->domain, buf);
+            changed |= _dnsmasq_line_ref(sd, DNSMASQ_FILE_CONF, line, delta);
+          }
+        if (dh->flags & HNCP_T_DNS_DELEGATED_ZONE_FLAG_LEGACY_BROWSE)
+          {
+            snprintf(line, sizeof(line), "ptr-record=lb._dns-sd._udp.%s,%s",
+                     sd->hncp->domain, buf);
+            changed |= _dnsmasq_line_ref(sd, DNSMASQ_FILE_CONF, line, delta);
+          }
+        if (dncp_node_is_self(n))
+          {
+            server = LOCAL_OHP_ADDRESS;
+            port = LOCAL_OHP_PORT;
+          }
+        else
+          {
+            server = buf2;
+            port = DNS_PORT;
+            if (!inet_ntop(AF_INET6, dh->address,
+                           buf2, sizeof(buf2)))
+              {
+                L_ERR("inet_ntop failed in _dnsmasq_update_tlv");
+                break;
+              }
+          }
+        snprintf(line, sizeof(line), "server=/%s/%s#%d", buf, server, port);
+        changed |= _dnsmasq_line_ref(sd, DNSMASQ_FILE_SERVERS, line, delta);
+      }
+      break;
+    }
+  return changed;
+}
 
+/* Recreate all lines from scratch (needed when the domain changes). */
+static void _dnsmasq_rebuild(hncp_sd sd)
+{
+  hncp_sd_line l, l2;
+  dncp_node n;
+  struct tlv_attr *a;
+
+  avl_remove_all_elements(&sd->dnsmasq_lines, l, in_lines, l2)
+    free(l);
+  memset(sd->dnsmasq_lines_state, 0, sizeof(sd->dnsmasq_lines_state));
+  dncp_for_each_node(sd->dncp, n)
+    {
+      dncp_node_for_each_tlv_with_type(n, a, HNCP_T_NODE_NAME)
+        _dnsmasq_update_tlv(sd, n, a, 1);
       dncp_node_for_each_tlv_with_type(n, a, HNCP_T_DNS_DELEGATED_ZONE)
+        _dnsmasq_update_tlv(sd, n, a, 1);
+    }
+}
+
+static bool _dnsmasq_write_file(hncp_sd sd, const char *filename, int file)
+{
+  char path[strlen(filename) + 16], tmp[strlen(filename) + 16];
+  hncp_sd_line l;
+  FILE *f;
+
+  sprintf(path, "%s%s", filename, _dnsmasq_file_suffix[file]);
+  /* Not within the hosts directory, as dnsmasq would read it too. */
+  sprintf(tmp, "%s.tmp%d", filename, file);
+  if (file == DNSMASQ_FILE_HOSTS)
+    {
+      char dir[strlen(filename) + 16];
+
+      sprintf(dir, "%s%s", filename, DNSMASQ_HOSTSDIR_SUFFIX);
+      if (mkdir(dir, 0755) && errno != EEXIST)
         {
-          /* Decode the labels */
-          char buf[DNS_MAX_ESCAPED_LEN];
-          char buf2[256];
-          char *server;
-          int port;
-          hncp_t_dns_delegated_zone dh;
+          L_ERR("unable to create %s for dnsmasq hosts", dir);
+          return false;
+        }
+    }
+  if (!(f = fopen(tmp, "w")))
+    {
+      L_ERR("unable to open %s for writing dnsmasq conf", tmp);
+      return false;
+    }
+  avl_for_each_element(&sd->dnsmasq_lines, l, in_lines)
+    if (l->file == file)
+      fprintf(f, "%s\n", l->line);
+  if (file == DNSMASQ_FILE_CONF)
+    {
+      fprintf(f, "hostsdir=%s%s\n", filename, DNSMASQ_HOSTSDIR_SUFFIX);
+      fprintf(f, "servers-file=%s%s\n",
+              filename, _dnsmasq_file_suffix[DNSMASQ_FILE_SERVERS]);
 
-          if (tlv_len(a) < (sizeof(*dh)+1))
-            continue;
+      /* Default is 150. Given 0.5 second lifetime on service queries,
+       * that's not much. */
+      fprintf(f, "dns-forward-max=12345\n");
 
-          dh = tlv_data(a);
-          if (ll2escaped(dh->ll, tlv_len(a) - sizeof(*dh),
-                         buf, sizeof(buf)) < 0)
-            continue;
+      /* RFC1918 rebinds are ok for the home domain */
+      fprintf(f, "rebind-domain-ok=%s\n", sd->hncp->domain);
+    }
+  if (fclose(f) || rename(tmp, path))
+    {
+      L_ERR("unable to write %s", path);
+      unlink(tmp);
+      return false;
+    }
+  return true;
+}
 
-          md5_hash(a, tlv_raw_len(a), &ctx);
+/* Returns true if the files changed and were written; false if
+ * nothing changed, or if writing failed (then retried on next update). */
+bool hncp_sd_write_dnsmasq_conf(hncp_sd sd, const char *filename)
+{
+  char state[NUM_DNSMASQ_FILE][16];
+  bool written = true;
+  md5_ctx_t ctx;
+  int i;
 
-          if (dh->flags & HNCP_T_DNS_DELEGATED_ZONE_FLAG_BROWSE)
-            fprintf(f, "ptr-record=b._dns-sd._udp.%s,%s\n",
-                    sd->hncp->domain, buf);
-          if (dh->flags & HNCP_T_DNS_DELEGATED_ZONE_FLAG_LEGACY_BROWSE)
-            fprintf(f, "ptr-record=lb._dns-sd._udp.%s,%s\n",
-                    sd->hncp->domain, buf);
-          if (dncp_node_is_self(n))
-            {
-              server = LOCAL_OHP_ADDRESS;
-              port = LOCAL_OHP_PORT;
-            }
-          else
-            {
-              server = buf2;
-              port = DNS_PORT;
-              if (!inet_ntop(AF_INET6, dh->address,
-                             buf2, sizeof(buf2)))
-                {
-                  L_ERR("inet_ntop failed in hncp_sd_write_dnsmasq_conf");
-                  continue;
-                }
-            }
-          fprintf(f, "server=/%s/%s#%d\n", buf, server, port);
+  /* The lines themselves are kept up to date as TLVs change; here we
+   * just figure which files (if any) differ from what was written,
+   * and write those. The files also depend on the domain and where
+   * they are written. */
+  memcpy(state, sd->dnsmasq_lines_state, sizeof(state));
+  md5_begin(&ctx);
+  md5_hash(sd->hncp->domain, strlen(sd->hncp->domain), &ctx);
+  md5_hash((void *)filename, strlen(filename), &ctx);
+  char buf[16];
+  md5_end(buf, &ctx);
+  for (i = 0 ; i < NUM_DNSMASQ_FILE ; i++)
+    _xor16(state[i], buf);
+
+  md5_begin(&ctx);
+  md5_hash(state, sizeof(state), &ctx);
+  if (!_sh_changed(&ctx, &sd->dnsmasq_state))
+    return false;
+
+  /* If nothing seems to differ, the committed state was reset ->
+   * write everything. */
+  bool force = !memcmp(state, sd->dnsmasq_file_state, sizeof(state));
+  for (i = 0 ; i < NUM_DNSMASQ_FILE ; i++)
+    {
+      if (!force && !memcmp(state[i], sd->dnsmasq_file_state[i], 16))
+        continue;
+      if (!_dnsmasq_write_file(sd, filename, i))
+        {
+          /* Make sure we try again next time. */
+          memset(sd->dnsmasq_state, 0, sizeof(sd->dnsmasq_state));
+          memset(sd->dnsmasq_file_state[i], 0, 16);
+          sd->should_update |= UPDATE_FLAG_DNSMASQ;
+          written = false;
+          continue;
         }
+      memcpy(sd->dnsmasq_file_state[i], state[i], 16);
+      if (i == DNSMASQ_FILE_CONF)
+        sd->dnsmasq_needs_restart = true;
+      else if (i == DNSMASQ_FILE_SERVERS)
+        sd->dnsmasq_needs_reload = true;
     }
-  /* Default is 150. Given 0.5 second lifetime on service queries,
-   * that's not much. */
-  fprintf(f, "dns-forward-max=12345\n");
-
-  /* RFC1918 rebinds are ok for the home domain */
-  fprintf(f, "rebind-domain-ok=%s\n", sd->hncp->domain);
-  fclose(f);
-  return _sh_changed(&ctx, &sd->dnsmasq_state);
+  return written;
 }
 
 bool hncp_sd_restart_dnsmasq(hncp_sd sd)
@@ -407,6 +747,17 @@ bool hncp_sd_restart_dnsmasq(hncp_sd sd)
   char *args[] = { (char *)sd->p.dnsmasq_script, "restart", NULL};
 
   hncp_run(args);
+  sd->dnsmasq_needs_restart = false;
+  sd->dnsmasq_needs_reload = false;
+  return true;
+}
+
+bool hncp_sd_reload_dnsmasq(hncp_sd sd)
+{
+  char *args[] = { (char *)sd->p.dnsmasq_script, "reload", NULL};
+
+  hncp_run(args);
+  sd->dnsmasq_needs_reload = false;
   return true;
 }
 
@@ -777,6 +1128,7 @@ static void _refresh_domain(hncp_sd sd)
     {
       L_DEBUG("set sd domain to %s", new_domain);
       strcpy(sd->hncp->domain, new_domain);
+      _dnsmasq_rebuild(sd);
       _should_update(sd, UPDATE_FLAG_ALL & ~UPDATE_FLAG_DOMAIN);
     }
 }
@@ -821,13 +1173,16 @@ static void _tlv_cb(dncp_subscriber s,
         }
       /* Router name/address changes trigger dnsmasq update due to
        * synthesized <routername>.<domain> host records. */
-      _should_update(sd, UPDATE_FLAG_DNSMASQ);
+      if (_dnsmasq_update_tlv(sd, n, tlv, add ? 1 : -1))
+        _should_update(sd, UPDATE_FLAG_DNSMASQ);
       break;
 
     case HNCP_T_DNS_DELEGATED_ZONE:
       /* Dnsmasq forwarder file reflects what's in published DDZ's. If
        * they change, it (could) change too. */
-      _should_update(sd, UPDATE_FLAG_DNSMASQ | UPDATE_FLAG_DDZ);
+      if (_dnsmasq_update_tlv(sd, n, tlv, add ? 1 : -1))
+        _should_update(sd, UPDATE_FLAG_DNSMASQ);
+      _should_update(sd, UPDATE_FLAG_DDZ);
 
       /* Check also if it's name matches our router name directly ->
        * rename us if it does. */
@@ -846,10 +1201,10 @@ static void _tlv_cb(dncp_subscriber s,
       break;
 
     case HNCP_T_NODE_ADDRESS:
-      /* Router name/address changes trigger dnsmasq update due to
-       * synthesized <routername>.<domain> host records. */
-      /* Addresses of where to find PCP server may also have changed */
-      _should_update(sd, UPDATE_FLAG_DNSMASQ | UPDATE_FLAG_PCP);
+      /* Addresses of where to find PCP server may have changed. (The
+       * host records come from the node name TLVs, which carry
+       * their own address.) */
+      _should_update(sd, UPDATE_FLAG_PCP);
       break;
 
     case HNCP_T_EXTERNAL_CONNECTION:
@@ -877,7 +1232,13 @@ void hncp_sd_update(hncp_sd sd)
       if (sd->p.dnsmasq_script && sd->p.dnsmasq_bonus_file)
         {
           if (hncp_sd_write_dnsmasq_conf(sd, sd->p.dnsmasq_bonus_file))
-            hncp_sd_restart_dnsmasq(sd);
+            {
+              /* Host records alone are picked up via inotify. */
+              if (sd->dnsmasq_needs_restart)
+                hncp_sd_restart_dnsmasq(sd);
+              else if (sd->dnsmasq_needs_reload)
+                hncp_sd_reload_dnsmasq(sd);
+            }
         }
     }
   if (sd->should_update & UPDATE_FLAG_DDZ)
@@ -947,6 +1308,9 @@ hncp_sd hncp_sd_create(hncp h, hncp_sd_params p, struct hncp_link *l)
   sd->p = *p;
   if (!sd)
     return NULL;
+  avl_init(&sd->dnsmasq_lines, avl_strcmp, false, NULL);
+  avl_init(&sd->ddzs, _ddz_cmp, false, NULL);
+  avl_init(&sd->ddz_cache, _ddz_cache_cmp, false, NULL);
 
   sd->iface.cb_intaddr = _intaddr_cb;
   sd->link.cb_elected = _election_cb;
@@ -996,6 +1360,15 @@ void hncp_sd_destroy(hncp_sd sd)
   iface_unregister_user(&sd->iface);
   dncp_unsubscribe(sd->dncp, &sd->subscriber);
   uloop_timeout_cancel(&sd->timeout);
+  hncp_sd_line l, l2;
+  avl_remove_all_elements(&sd->dnsmasq_lines, l, in_lines, l2)
+    free(l);
+  hncp_sd_ddz d, d2;
+  avl_remove_all_elements(&sd->ddzs, d, in_ddzs, d2)
+    free(d);
+  hncp_sd_ddz_cache c, c2;
+  avl_remove_all_elements(&sd->ddz_cache, c, in_ddz_cache, c2)
+    free(c);
   free(sd);
 }
 
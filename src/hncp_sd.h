@@ -19,15 +19,24 @@
 
 typedef struct hncp_sd_struct hncp_sd_s, *hncp_sd;
 
+/* Where the ohybridproxy serving our own delegated zones listens */
+#define HNCP_SD_OHP_ADDRESS "127.0.0.2"
+#define HNCP_SD_OHP_PORT 54
+
 /* These are the parameters SD code uses. The whole structure's memory
  * is owned by the external party, and is assumed to be valid from
  * sd_create to sd_destroy. */
 typedef struct hncp_sd_params_struct
 {
-  /* Which script is used to prod at dnsmasq (required for SD) */
+  /* Which script is used to prod at dnsmasq (required for SD); it is
+   * called with 'restart' when the bonus file changes, and with
+   * 'reload' (which should SIGHUP dnsmasq) when only the server file
+   * does. Host file changes are noticed by dnsmasq itself. */
   const char *dnsmasq_script;
 
-  /* And where to store the dnsmasq.conf (required for SD) */
+  /* And where to store the dnsmasq.conf (required for SD); host
+   * records are stored in <file>.hosts.d/hosts (used as --hostsdir),
+   * and server records in <file>.servers. */
   const char *dnsmasq_bonus_file;
 
   /* Which script is used to prod at ohybridproxy (required for SD) */
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ */
+
+#include "hncp_stats.h"
+
+#include "dncp_i.h"
+#include "hnetd_stats.h"
+#include "hnetd_trace.h"
+#include "platform.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Upper bound for the size of a trace dump (it is sent as a single
+ * IPC datagram; the most recent events that fit are included). */
+#define HS_TRACE_MAX_LEN (64 * 1024)
+
+#define hs_a(test, err) do{if(!(test)) {err;}}while(0)
+
+#define hs_do_in_table(buf, name, action, err) do { \
+		void *__k; \
+		if(!(__k = blobmsg_open_table(buf, name)) || (action)) { \
+			if(__k) \
+				blobmsg_close_table(buf, __k);\
+			do{err;}while(0);\
+		}\
+		blobmsg_close_table(buf, __k);\
+} while(0)
+
+static int hs_counters(hnetd_stats s, struct blob_buf *b)
+{
+	int i;
+
+	for (i = 0; i < HNETD_STATS_NUM_COUNTERS; i++)
+		hs_a(!blobmsg_add_u64(b, hnetd_stats_counter_names[i],
+				      s->counters[i]), return -1);
+	return 0;
+}
+
+static int hs_histograms(hnetd_stats s, struct blob_buf *b)
+{
+	void *t, *a;
+	int i, j;
+
+	for (i = 0; i < HNETD_STATS_NUM_HISTOGRAMS; i++) {
+		hnetd_stats_histogram h = &s->histograms[i];
+
+		hs_a(t = blobmsg_open_table(b, hnetd_stats_histogram_names[i]), return -1);
+		blobmsg_add_u64(b, "count", h->count);
+		blobmsg_add_u64(b, "sum", h->sum_us);
+		hs_a(a = blobmsg_open_array(b, "buckets"), return -1);
+		for (j = 0; j < HNETD_STATS_BUCKETS; j++)
+			blobmsg_add_u64(b, NULL, h->buckets[j]);
+		blobmsg_close_array(b, a);
+		blobmsg_close_table(b, t);
+	}
+	return 0;
+}
+
+/* Per-endpoint counters */
+static uint64_t hs_ep_recv_packets(dncp_ep_i l)
+{
+	return l->num_recv_packets;
+}
+
+static uint64_t hs_ep_recv_bytes(dncp_ep_i l)
+{
+	return l->num_recv_bytes;
+}
+
+static uint64_t hs_ep_sent_packets(dncp_ep_i l)
+{
+	return l->num_sent_packets;
+}
+
+static uint64_t hs_ep_sent_bytes(dncp_ep_i l)
+{
+	return l->num_sent_bytes;
+}
+
+static const struct hs_ep_counter {
+	const char *name;
+	const char *prometheus_name;
+	uint64_t (*get)(dncp_ep_i l);
+} hs_ep_counters[] = {
+	{"recv-packets", "recv_packets", hs_ep_recv_packets},
+	{"recv-bytes", "recv_bytes", hs_ep_recv_bytes},
+	{"sent-packets", "sent_packets", hs_ep_sent_packets},
+	{"sent-bytes", "sent_bytes", hs_ep_sent_bytes},
+};
+
+static int hs_links(dncp o, struct blob_buf *b)
+{
+	dncp_ep ep;
+	void *t;
+	size_t i;
+
+	dncp_for_each_ep(o, ep) {
+		dncp_ep_i l = container_of(ep, dncp_ep_i_s, conf);
+
+		hs_a(t = blobmsg_open_table(b, ep->ifname), return -1);
+		for (i = 0; i < ARRAY_SIZE(hs_ep_counters); i++)
+			blobmsg_add_u64(b, hs_ep_counters[i].name, hs_ep_counters[i].get(l));
+		blobmsg_close_table(b, t);
+	}
+	return 0;
+}
+
+static void hs_prometheus_link(FILE *f, dncp o, const struct hs_ep_counter *c)
+{
+	dncp_ep ep;
+
+	fprintf(f, "# TYPE hnetd_dncp_link_%s_total counter\n", c->prometheus_name);
+	dncp_for_each_ep(o, ep) {
+		dncp_ep_i l = container_of(ep, dncp_ep_i_s, conf);
+
+		fprintf(f, "hnetd_dncp_link_%s_total{link=\"%s\"} %" PRIu64 "\n",
+			c->prometheus_name, ep->ifname, c->get(l));
+	}
+}
+
+static int hs_prometheus(dncp o, struct blob_buf *b)
+{
+	char *text = NULL;
+	size_t len = 0;
+	size_t i;
+	FILE *f;
+	int ret;
+
+	hs_a(f = open_memstream(&text, &len), return -1);
+	hnetd_stats_write_prometheus(dncp_get_stats(o), f);
+	for (i = 0; i < ARRAY_SIZE(hs_ep_counters); i++)
+		hs_prometheus_link(f, o, &hs_ep_counters[i]);
+	fclose(f);
+	ret = blobmsg_add_string(b, "text", text);
+	free(text);
+	return ret;
+}
+
+platform_rpc_cb hs_cb;
+platform_rpc_main hs_main;
+
+enum {
+	HS_FORMAT,
+	HS_MAX
+};
+
+static struct blobmsg_policy hs_policy[HS_MAX] = {
+	[HS_FORMAT] = { .name = "format", .type = BLOBMSG_TYPE_STRING },
+};
+
+static struct hs_rpc_method {
+	struct platform_rpc_method m;
+	dncp dncp;
+} hncp_rpc_stats = {
+	{.name = "stats", .cb = hs_cb, .main = hs_main,
+	 .policy = hs_policy, .policy_cnt = HS_MAX},
+	NULL,
+};
+
+int hs_main(struct platform_rpc_method *method, int argc, char* const argv[])
+{
+	struct blob_buf b = {NULL, NULL, 0, NULL};
+	int c, ret;
+
+	blob_buf_init(&b, 0);
+	optind = 1;
+	while ((c = getopt(argc, argv, "p")) != -1) {
+		switch (c) {
+			case 'p':
+				blobmsg_add_string(&b, "format", "prometheus");
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-p]\n", argv[0]);
+				blob_buf_free(&b);
+				return 1;
+		}
+	}
+	ret = platform_rpc_cli(method->name, b.head);
+	blob_buf_free(&b);
+	return ret;
+}
+
+int hs_cb(struct platform_rpc_method *method, const struct blob_attr *in, struct blob_buf *b)
+{
+	struct hs_rpc_method *m = container_of(method, struct hs_rpc_method, m);
+	struct blob_attr *tb[HS_MAX];
+
+	blobmsg_parse(hs_policy, HS_MAX, tb, blob_data(in), blob_len(in));
+	hs_a(m->dncp, return -ENOENT);
+	if (tb[HS_FORMAT]) {
+		hs_a(!strcmp(blobmsg_get_string(tb[HS_FORMAT]), "prometheus"),
+		     return -EINVAL);
+		hs_a(!hs_prometheus(m->dncp, b), return -1);
+		return 1;
+	}
+
+	hs_do_in_table(b, "counters", hs_counters(dncp_get_stats(m->dncp), b), return -1);
+	hs_do_in_table(b, "histograms", hs_histograms(dncp_get_stats(m->dncp), b), return -1);
+	hs_do_in_table(b, "links", hs_links(m->dncp, b), return -1);
+	return 1;
+}
+
+static bool hs_trace_event(hnetd_trace_event e, bool slow, void *context)
+{
+	struct blob_buf *b = context;
+	char name[64];
+	void *t, *a;
+
+	if (blob_len(b->head) > HS_TRACE_MAX_LEN)
+		return false;
+	snprintf(name, sizeof(name), "%s%s%p", e->name ? e->name : "",
+		 e->name ? " " : "", e->cb);
+	hs_a(t = blobmsg_open_table(b, NULL), return false);
+	blobmsg_add_string(b, "name", name);
+	blobmsg_add_string(b, "cat", hnetd_trace_kind_names[e->kind]);
+	blobmsg_add_string(b, "ph", "X");
+	blobmsg_add_u64(b, "ts", e->start_us);
+	blobmsg_add_u64(b, "dur", e->duration_us);
+	blobmsg_add_u32(b, "pid", getpid());
+	blobmsg_add_u32(b, "tid", 0);
+	if (slow) {
+		hs_a(a = blobmsg_open_table(b, "args"), return false);
+		blobmsg_add_u8(b, "slow", 1);
+		blobmsg_close_table(b, a);
+	}
+	blobmsg_close_table(b, t);
+	return true;
+}
+
+platform_rpc_cb hs_trace_cb;
+platform_rpc_main hs_trace_main;
+
+enum {
+	HS_TRACE_CLEAR,
+	HS_TRACE_MAX
+};
+
+static struct blobmsg_policy hs_trace_policy[HS_TRACE_MAX] = {
+	[HS_TRACE_CLEAR] = { .name = "clear", .type = BLOBMSG_TYPE_BOOL },
+};
+
+static struct platform_rpc_method hncp_rpc_trace = {
+	.name = "trace", .cb = hs_trace_cb, .main = hs_trace_main,
+	.policy = hs_trace_policy, .policy_cnt = HS_TRACE_MAX
+};
+
+int hs_trace_main(struct platform_rpc_method *method, int argc, char* const argv[])
+{
+	struct blob_buf b = {NULL, NULL, 0, NULL};
+	int c, ret;
+
+	blob_buf_init(&b, 0);
+	optind = 1;
+	while ((c = getopt(argc, argv, "c")) != -1) {
+		switch (c) {
+			case 'c':
+				blobmsg_add_u8(&b, "clear", 1);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-c]\n", argv[0]);
+				blob_buf_free(&b);
+				return 1;
+		}
+	}
+	ret = platform_rpc_cli(method->name, b.head);
+	blob_buf_free(&b);
+	return ret;
+}
+
+int hs_trace_cb(__unused struct platform_rpc_method *method, const struct blob_attr *in, struct blob_buf *b)
+{
+	struct blob_attr *tb[HS_TRACE_MAX];
+	void *a;
+
+	blobmsg_parse(hs_trace_policy, HS_TRACE_MAX, tb, blob_data(in), blob_len(in));
+	hs_a(hnetd_trace_enabled, return -ENOENT);
+	hs_a(a = blobmsg_open_array(b, "traceEvents"), return -1);
+	hnetd_trace_foreach(hs_trace_event, b);
+	blobmsg_close_array(b, a);
+	blobmsg_add_string(b, "displayTimeUnit", "ms");
+	if (tb[HS_TRACE_CLEAR] && blobmsg_get_bool(tb[HS_TRACE_CLEAR]))
+		hnetd_trace_clear();
+	return 1;
+}
+
+void hs_register_rpc(void)
+{
+	platform_rpc_register(&hncp_rpc_stats.m);
+	platform_rpc_register(&hncp_rpc_trace);
+}
+
+void hs_init(dncp dncp)
+{
+	hncp_rpc_stats.dncp = dncp;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ *
+ * Runtime statistics and event loop trace RPCs (hnet-stats, hnet-trace).
+ *
+ */
+
+#pragma once
+
+#include "dncp.h"
+
+/* The 'stats' RPC method returns the counters and latency histograms
+ * (hnetd_stats.h) of the hncp instance given to hs_init, and its
+ * per-endpoint DNCP traffic counters:
+ * {
+ *   counters : {
+ *     name : value (u64)
+ *     ...
+ *   }
+ *   histograms : {
+ *     name : {
+ *       count : Number of samples (u64)
+ *       sum : Sum of the samples in microseconds (u64)
+ *       buckets : Sample counts; bucket i counts samples below 2^i
+ *                 microseconds, the last one everything else (array/u64)
+ *     }
+ *     ...
+ *   }
+ *   links : {
+ *     link-name : {
+ *       recv-packets, recv-bytes, sent-packets, sent-bytes (u64)
+ *     }
+ *     ...
+ *   }
+ * }
+ *
+ * If the input has "format" set to "prometheus", the same data is
+ * instead returned as a single "text" string in the Prometheus text
+ * exposition format (hnet-stats -p).
+ */
+/* The 'trace' RPC method (hnet-trace) returns the callbacks recorded
+ * by the event loop tracer (hnetd_trace.h, hnetd --trace), most
+ * recent first, in the Chrome trace event format:
+ * {
+ *   traceEvents : [
+ *     {
+ *       name : Callback name and/or address (string)
+ *       cat : timeout, fd or process (string)
+ *       ph : "X" (complete event)
+ *       ts : Start time in microseconds (u64)
+ *       dur : Duration in microseconds (u64)
+ *       pid, tid : Process id, 0 (u32)
+ *       args : { slow : true } if the callback exceeded the threshold
+ *     }
+ *     ...
+ *   ]
+ *   displayTimeUnit : "ms"
+ * }
+ *
+ * If "clear" is set (hnet-trace -c), the ring buffer is emptied after
+ * the dump.
+ */
+void hs_init(dncp o);
+void hs_register_rpc(void);
@@ -167,6 +167,7 @@ hncp_wifi hncp_wifi_init(hncp hncp, char *scriptpath)
 	wifi->dncp = hncp->dncp;
 	wifi->subscriber.tlv_change_cb = wifi_tlv_cb;
 	exeq_init(&wifi->exeq);
+	wifi->exeq.stats = dncp_get_stats(wifi->dncp);
 	dncp_subscribe(wifi->dncp, &wifi->subscriber);
 	return wifi;
 }
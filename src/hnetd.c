@@ -22,6 +22,7 @@
 #include "hnetd_time.h"
 #include "hncp_pa.h"
 #include "hncp_sd.h"
+#include "hncp_dns.h"
 #include "hncp_multicast.h"
 #include "hncp_routing.h"
 #include "hncp_tunnel.h"
@@ -29,6 +30,9 @@
 #include "hncp_proto.h"
 #include "hncp_link.h"
 #include "hncp_dump.h"
+#include "hncp_stats.h"
+#include "hnetd_trace.h"
+#include "hncp_capture.h"
 #include "platform.h"
 #include "pd.h"
 #include "dncp_trust.h"
@@ -84,6 +88,7 @@ int usage() {
 	 "\t-n router_name\n"
 	 "\t-m domain_name\n"
 	 "\t-s pa_store file\n"
+	 "\t--pajournal <pa_store binary journal (overrides -s)>\n"
 	 "\t-p socket path\n"
 	 "\t--ip4prefix v.x.y.z/prefix\n"
 	 "\t--ip4mode [ifuplink,on,off]"
@@ -96,6 +101,12 @@ int usage() {
 	 "\t--trust <(DTLS) path to trust consensus store file>\n"
 	 "\t--verify-path <(DTLS) path to trusted cert file>\n"
 	 "\t--verify-dir <(DTLS) path to trusted cert directory>\n"
+	 "\t--sessioncache <(DTLS) path to session resumption cache file>\n"
+	 "\t--dnsport <port for the built-in home domain DNS responder>\n"
+	 "\t--dnsupstream <server the DNS responder forwards other queries to>\n"
+	 "\t--trace <threshold in ms> (trace event loop callbacks, log slow ones; 0 = off)\n"
+	 "\t--capture <file> (capture HNCP traffic for offline replay)\n"
+	 "\t--capturesize <size of the capture ring in kB>\n"
 	 "\t-M multicast_script (enables draft-pfister-homenet-multicast support)\n"
 	 "\t-w wifi_script,[ssid1:pass2,[ssid2:pass2,...]]\n"
 	 );
@@ -109,6 +120,7 @@ int main(__unused int argc, char *argv[])
 	hncp_iface_user_s hiu;
 	hncp_pa hncp_pa;
 	hncp_sd_params_s sd_params;
+	hncp_dns_params_s dns_params;
 	hncp_multicast_params_s multicast_params;
 #ifdef DTLS
 	dncp_trust dt = NULL;
@@ -117,6 +129,7 @@ int main(__unused int argc, char *argv[])
                                                0, 0, 0, 0, ""};
 
 	memset(&sd_params, 0, sizeof(sd_params));
+	memset(&dns_params, 0, sizeof(dns_params));
 	memset(&multicast_params, 0, sizeof(multicast_params));
 
 	openlog("hnetd", LOG_PERROR | LOG_PID, LOG_DAEMON);
@@ -129,6 +142,7 @@ int main(__unused int argc, char *argv[])
 
 	// Register multicalls
 	hd_register_rpc();
+	hs_register_rpc();
 #ifdef DTLS
 	dncp_trust_register_multicall();
 #endif
@@ -148,6 +162,7 @@ int main(__unused int argc, char *argv[])
 	const char *routing_script = NULL;
 	const char *tunnel_script = NULL;
 	const char *pa_store_file = NULL;
+	const char *pa_journal_file = NULL;
 	const char *pd_socket_path = "/var/run/hnetd_pd";
 	const char *pa_ip4prefix = NULL;
 	const char *pa_ip4mode = NULL;
@@ -158,11 +173,17 @@ int main(__unused int argc, char *argv[])
 #ifdef DTLS
 	const char *dtls_cert = NULL;
 	const char *dtls_key = NULL;
+	const char *dtls_sessions = NULL;
 #endif
 	const char *dtls_path = NULL;
 	const char *dtls_dir = NULL;
 	const char *pidfile = NULL;
 	const char *wifi = NULL;
+	int trace_threshold = 0;
+	char *endptr;
+	long val;
+	const char *capture_file = NULL;
+	size_t capture_size = HNCP_CAPTURE_DEFAULT_SIZE;
 	bool strict = false;
 
 	enum {
@@ -177,6 +198,13 @@ int main(__unused int argc, char *argv[])
 		GOL_TRUST, /* DTLS trust cache filename */
 		GOL_DIR, /* DTLS trusted cert dir */
 		GOL_PATH, /* DTLS trusted cert file path */
+		GOL_PAJOURNAL, /* pa_store binary journal */
+		GOL_SESSIONS, /* DTLS session cache filename */
+		GOL_DNSPORT, /* built-in DNS responder port */
+		GOL_DNSUPSTREAM, /* built-in DNS responder upstream server */
+		GOL_TRACE, /* event loop tracer slow callback threshold */
+		GOL_CAPTURE, /* HNCP capture file */
+		GOL_CAPTURESIZE, /* HNCP capture ring size */
 	};
 
 	struct option longopts[] = {
@@ -192,6 +220,13 @@ int main(__unused int argc, char *argv[])
 			{ "privatekey",    required_argument,      NULL,           GOL_KEY },
 			{ "verifydir",    required_argument,      NULL,           GOL_DIR },
 			{ "verifypath",    required_argument,      NULL,           GOL_PATH },
+			{ "pajournal",    required_argument,      NULL,           GOL_PAJOURNAL },
+			{ "sessioncache",    required_argument,      NULL,           GOL_SESSIONS },
+			{ "dnsport",    required_argument,      NULL,           GOL_DNSPORT },
+			{ "dnsupstream",    required_argument,      NULL,           GOL_DNSUPSTREAM },
+			{ "trace",    required_argument,      NULL,           GOL_TRACE },
+			{ "capture",    required_argument,      NULL,           GOL_CAPTURE },
+			{ "capturesize",    required_argument,      NULL,           GOL_CAPTURESIZE },
 			{ "help",	 no_argument,		 NULL,           '?' },
 			{ NULL,          0,                      NULL,           0 }
 	};
@@ -258,6 +293,9 @@ int main(__unused int argc, char *argv[])
 		case GOL_LOGLEVEL:
 			log_level = atoi(optarg);
 			break;
+		case GOL_PAJOURNAL:
+			pa_journal_file = optarg;
+			break;
 		case GOL_PASSWORD:
 			dtls_password = optarg;
 			break;
@@ -270,6 +308,41 @@ int main(__unused int argc, char *argv[])
 		case GOL_PATH:
 			dtls_path = optarg;
 			break;
+		case GOL_DNSPORT:
+			val = strtol(optarg, &endptr, 10);
+			if (!*optarg || *endptr || val < 0 || val > UINT16_MAX) {
+				L_ERR("Invalid --dnsport: %s", optarg);
+				return usage();
+			}
+			dns_params.port = val;
+			break;
+		case GOL_DNSUPSTREAM:
+			dns_params.upstream = optarg;
+			break;
+		case GOL_TRACE:
+			trace_threshold = strtol(optarg, &endptr, 10);
+			if (!*optarg || *endptr || trace_threshold < 0) {
+				L_ERR("Invalid --trace threshold: %s", optarg);
+				return usage();
+			}
+			break;
+		case GOL_CAPTURE:
+			capture_file = optarg;
+			break;
+		case GOL_CAPTURESIZE:
+			val = strtol(optarg, &endptr, 10);
+			if (!*optarg || *endptr || val <= 0 ||
+					val > HNCP_CAPTURE_MAX_SIZE / 1024) {
+				L_ERR("Invalid --capturesize: %s", optarg);
+				return usage();
+			}
+			capture_size = (size_t)val * 1024;
+			break;
+		case GOL_SESSIONS:
+#ifdef DTLS
+			dtls_sessions = optarg;
+#endif
+			break;
 		case GOL_KEY:
 #ifdef DTLS
 			dtls_key = optarg;
@@ -289,13 +362,27 @@ int main(__unused int argc, char *argv[])
 		}
 	}
 
+	if (trace_threshold > 0 &&
+	    !hnetd_trace_enable(HNETD_TRACE_SIZE, (uint64_t)trace_threshold * 1000))
+		L_ERR("Unable to enable event loop tracing");
+
 	h = hncp_create();
 	if (!h) {
 		L_ERR("Unable to initialize HNCP");
 		return 42;
 	}
 
+	if (capture_file) {
+		hncp_capture c = hncp_capture_open(capture_file, capture_size);
+		if (!c) {
+			L_ERR("Unable to open capture file %s", capture_file);
+			return 44;
+		}
+		hncp_set_capture(h, c);
+	}
+
 	hd_init(hncp_get_dncp(h));
+	hs_init(hncp_get_dncp(h));
 
 	if (sd_params.dnsmasq_script && sd_params.dnsmasq_bonus_file && sd_params.ohp_script)
 		link_config.cap_mdnsproxy = 4;
@@ -322,6 +409,12 @@ int main(__unused int argc, char *argv[])
 						return 13;
 				}
 		}
+		if (dtls_sessions) {
+				if (!dtls_set_session_cache(d, 0, dtls_sessions)) {
+						L_ERR("Unable to set up dtls session cache");
+						return 13;
+				}
+		}
 		hncp_set_dtls(h, d);
 		if (dtls_password) {
 				if (!(dtls_set_psk(d,
@@ -336,6 +429,7 @@ int main(__unused int argc, char *argv[])
 						return 13;
 				}
 				dtls_set_unknown_cert_cb(d, dncp_trust_dtls_unknown_cb, dt);
+				dncp_trust_set_dtls(dt, d);
 		}
 		dtls_start(d);
 #endif /* DTLS */
@@ -349,6 +443,11 @@ int main(__unused int argc, char *argv[])
 		return 71;
 	}
 
+	if (dns_params.port && !hncp_dns_create(h, &dns_params)) {
+		L_ERR("unable to initialize dns responder, exiting");
+		return 72;
+	}
+
 	if (multicast_params.multicast_script) {
 			hncp_multicast m = hncp_multicast_create(h, &multicast_params);
 			if (!m) {
@@ -398,7 +497,13 @@ int main(__unused int argc, char *argv[])
 
 	//PA configuration
 
-	if(pa_store_file && hncp_pa_storage_set(hncp_pa, pa_store_file)) {
+	if(pa_journal_file) {
+		if(hncp_pa_journal_set(hncp_pa, pa_journal_file)) {
+			L_ERR("Could not set prefix storage journal (%s): %s",
+					pa_journal_file, strerror(errno));
+			return 18;
+		}
+	} else if(pa_store_file && hncp_pa_storage_set(hncp_pa, pa_store_file)) {
 		L_ERR("Could not set prefix storage file (%s): %s",
 				pa_store_file, strerror(errno));
 		return 18;
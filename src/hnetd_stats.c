@@ -0,0 +1,109 @@
+/*
+ * $Id: hnetd_stats.c $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "hnetd_stats.h"
+
+const char *hnetd_stats_counter_names[HNETD_STATS_NUM_COUNTERS] = {
+  [HNETD_STATS_DNCP_RECV_PACKETS] = "dncp_recv_packets",
+  [HNETD_STATS_DNCP_RECV_BYTES] = "dncp_recv_bytes",
+  [HNETD_STATS_DNCP_SENT_PACKETS] = "dncp_sent_packets",
+  [HNETD_STATS_DNCP_SENT_BYTES] = "dncp_sent_bytes",
+  [HNETD_STATS_DNCP_TRICKLE_SENT] = "dncp_trickle_sent",
+  [HNETD_STATS_DNCP_TRICKLE_SKIPPED] = "dncp_trickle_skipped",
+  [HNETD_STATS_DNCP_NEIGHBOR_DROPPED] = "dncp_neighbor_dropped",
+  [HNETD_STATS_DNCP_NETWORK_HASH] = "dncp_network_hash_calculations",
+  [HNETD_STATS_DNCP_PRUNE] = "dncp_prunes",
+  [HNETD_STATS_DNCP_TLV_CALLBACKS] = "dncp_tlv_callbacks",
+  [HNETD_STATS_PA_ROUTINE] = "pa_routines",
+  [HNETD_STATS_ROUTING_RUN] = "routing_runs",
+  [HNETD_STATS_SCRIPT_SPAWN] = "script_spawns",
+};
+
+const char *hnetd_stats_histogram_names[HNETD_STATS_NUM_HISTOGRAMS] = {
+  [HNETD_STATS_H_DNCP_NETWORK_HASH] = "dncp_network_hash",
+  [HNETD_STATS_H_DNCP_PRUNE] = "dncp_prune",
+  [HNETD_STATS_H_DNCP_TLV_NOTIFY] = "dncp_tlv_notify",
+  [HNETD_STATS_H_PA_ROUTINE] = "pa_routine",
+};
+
+uint64_t hnetd_stats_time_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void hnetd_stats_record(hnetd_stats s, enum hnetd_stats_histogram h,
+                        uint64_t us)
+{
+  hnetd_stats_histogram hi = &s->histograms[h];
+  int i = 0;
+
+  while (i < HNETD_STATS_BUCKETS - 1 && us >= (UINT64_C(1) << i))
+    i++;
+  hi->buckets[i]++;
+  hi->count++;
+  hi->sum_us += us;
+}
+
+void hnetd_stats_reset(hnetd_stats s)
+{
+  memset(s, 0, sizeof(*s));
+}
+
+void hnetd_stats_merge(hnetd_stats dst, hnetd_stats src)
+{
+  int i, j;
+
+  for (i = 0 ; i < HNETD_STATS_NUM_COUNTERS ; i++)
+    dst->counters[i] += src->counters[i];
+  for (i = 0 ; i < HNETD_STATS_NUM_HISTOGRAMS ; i++)
+    {
+      dst->histograms[i].count += src->histograms[i].count;
+      dst->histograms[i].sum_us += src->histograms[i].sum_us;
+      for (j = 0 ; j < HNETD_STATS_BUCKETS ; j++)
+        dst->histograms[i].buckets[j] += src->histograms[i].buckets[j];
+    }
+}
+
+void hnetd_stats_write_prometheus(hnetd_stats s, FILE *f)
+{
+  int i, j;
+
+  for (i = 0 ; i < HNETD_STATS_NUM_COUNTERS ; i++)
+    {
+      fprintf(f, "# TYPE hnetd_%s_total counter\n",
+              hnetd_stats_counter_names[i]);
+      fprintf(f, "hnetd_%s_total %" PRIu64 "\n",
+              hnetd_stats_counter_names[i], s->counters[i]);
+    }
+  for (i = 0 ; i < HNETD_STATS_NUM_HISTOGRAMS ; i++)
+    {
+      hnetd_stats_histogram hi = &s->histograms[i];
+      const char *name = hnetd_stats_histogram_names[i];
+      uint64_t sum = 0;
+
+      fprintf(f, "# TYPE hnetd_%s_seconds histogram\n", name);
+      /* Bucket j holds (whole) microseconds below 2^j, and 'le' is
+       * inclusive; hence 2^j - 1. */
+      for (j = 0 ; j < HNETD_STATS_BUCKETS - 1 ; j++)
+        {
+          sum += hi->buckets[j];
+          fprintf(f, "hnetd_%s_seconds_bucket{le=\"%.6f\"} %" PRIu64 "\n",
+                  name, (double)((UINT64_C(1) << j) - 1) / 1e6, sum);
+        }
+      fprintf(f, "hnetd_%s_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n",
+              name, hi->count);
+      fprintf(f, "hnetd_%s_seconds_sum %.6f\n", name, hi->sum_us / 1e6);
+      fprintf(f, "hnetd_%s_seconds_count %" PRIu64 "\n", name, hi->count);
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * $Id: hnetd_stats.h $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Lightweight runtime metrics: plain counters, and latency histograms
+ * with power-of-two (microsecond) buckets. They are cheap enough to be
+ * updated unconditionally on hot paths. They are kept per instance:
+ * each dncp instance owns a set (see dncp_get_stats), which the other
+ * modules of the same hncp instance (PA, routing, exeq) refer to.
+ * They are not atomic, and must only be updated from the uloop
+ * thread. */
+
+enum hnetd_stats_counter {
+  HNETD_STATS_DNCP_RECV_PACKETS,
+  HNETD_STATS_DNCP_RECV_BYTES,
+  HNETD_STATS_DNCP_SENT_PACKETS,
+  HNETD_STATS_DNCP_SENT_BYTES,
+  HNETD_STATS_DNCP_TRICKLE_SENT,
+  HNETD_STATS_DNCP_TRICKLE_SKIPPED,
+  HNETD_STATS_DNCP_NEIGHBOR_DROPPED,
+  HNETD_STATS_DNCP_NETWORK_HASH,
+  HNETD_STATS_DNCP_PRUNE,
+  HNETD_STATS_DNCP_TLV_CALLBACKS,
+  HNETD_STATS_PA_ROUTINE,
+  HNETD_STATS_ROUTING_RUN,
+  HNETD_STATS_SCRIPT_SPAWN,
+  HNETD_STATS_NUM_COUNTERS
+};
+
+enum hnetd_stats_histogram {
+  HNETD_STATS_H_DNCP_NETWORK_HASH,
+  HNETD_STATS_H_DNCP_PRUNE,
+  HNETD_STATS_H_DNCP_TLV_NOTIFY,
+  HNETD_STATS_H_PA_ROUTINE,
+  HNETD_STATS_NUM_HISTOGRAMS
+};
+
+/* Bucket i counts durations below 2^i us; the last one the rest. */
+#define HNETD_STATS_BUCKETS 24
+
+typedef struct hnetd_stats_histogram_struct {
+  uint64_t count;
+  uint64_t sum_us;
+  uint64_t buckets[HNETD_STATS_BUCKETS];
+} hnetd_stats_histogram_s, *hnetd_stats_histogram;
+
+typedef struct hnetd_stats_struct {
+  uint64_t counters[HNETD_STATS_NUM_COUNTERS];
+  hnetd_stats_histogram_s histograms[HNETD_STATS_NUM_HISTOGRAMS];
+} hnetd_stats_s, *hnetd_stats;
+
+extern const char *hnetd_stats_counter_names[HNETD_STATS_NUM_COUNTERS];
+extern const char *hnetd_stats_histogram_names[HNETD_STATS_NUM_HISTOGRAMS];
+
+#define hnetd_stats_add(s, c, v) ((s)->counters[(c)] += (v))
+#define hnetd_stats_inc(s, c) hnetd_stats_add(s, c, 1)
+
+/* Monotonic wall clock in microseconds (real time, even in tests). */
+uint64_t hnetd_stats_time_us(void);
+
+void hnetd_stats_record(hnetd_stats s, enum hnetd_stats_histogram h,
+                        uint64_t us);
+
+/* Time a block of code: HNETD_STATS_TIMER(t); ...;
+ * HNETD_STATS_RECORD(s, HNETD_STATS_H_X, t); */
+#define HNETD_STATS_TIMER(t) uint64_t t = hnetd_stats_time_us()
+#define HNETD_STATS_RECORD(s, h, t)                             \
+  hnetd_stats_record(s, h, hnetd_stats_time_us() - (t))
+
+void hnetd_stats_reset(hnetd_stats s);
+
+/* Add the counters and histograms of src to dst (e.g. to sum several
+ * instances). */
+void hnetd_stats_merge(hnetd_stats dst, hnetd_stats src);
+
+/* Write the counters and histograms in the Prometheus text format. */
+void hnetd_stats_write_prometheus(hnetd_stats s, FILE *f);
@@ -11,6 +11,7 @@
 /* Wrapper functions for time and timeouts. */
 #include "hnetd_time.h"
 #include "hnetd.h"
+#include "hnetd_trace.h"
 
 hnetd_time_t hnetd_time(void)
 {
@@ -22,16 +23,21 @@ hnetd_time_t hnetd_time(void)
 
 int hnetd_time_timeout_add(struct uloop_timeout *timeout)
 {
+  if (hnetd_trace_enabled)
+    hnetd_trace_timeout_wrap(timeout);
   return uloop_timeout_add(timeout);
 }
 
 int hnetd_time_timeout_set(struct uloop_timeout *timeout, int msecs)
 {
+  if (hnetd_trace_enabled)
+    hnetd_trace_timeout_wrap(timeout);
   return uloop_timeout_set(timeout, msecs);
 }
 
 int hnetd_time_timeout_cancel(struct uloop_timeout *timeout)
 {
+  hnetd_trace_timeout_unwrap(timeout);
   return uloop_timeout_cancel(timeout);
 }
 
@@ -0,0 +1,154 @@
+/*
+ * $Id: hnetd_trace.c $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libubox/avl.h>
+
+#include "hnetd.h"
+#include "hnetd_trace.h"
+
+bool hnetd_trace_enabled;
+
+const char *hnetd_trace_kind_names[HNETD_TRACE_NUM_KINDS] = {
+  [HNETD_TRACE_TIMEOUT] = "timeout",
+  [HNETD_TRACE_FD] = "fd",
+  [HNETD_TRACE_PROCESS] = "process",
+};
+
+static struct {
+  hnetd_trace_event events;
+  int size;
+  int first;
+  int count;
+  uint64_t threshold_us;
+} trace;
+
+/* Original callbacks of wrapped timeouts, keyed by the timeout. */
+typedef struct {
+  struct avl_node in_timeouts;
+  uloop_timeout_handler cb;
+} hnetd_trace_timeout_s, *hnetd_trace_timeout;
+
+static int _ptr_cmp(const void *k1, const void *k2, void *ptr __unused)
+{
+  return (k1 > k2) - (k1 < k2);
+}
+
+static struct avl_tree timeouts;
+
+bool hnetd_trace_enable(int size, uint64_t threshold_us)
+{
+  if (hnetd_trace_enabled || size <= 0 || !threshold_us)
+    return false;
+  if (!(trace.events = calloc(size, sizeof(*trace.events))))
+    return false;
+  trace.size = size;
+  trace.threshold_us = threshold_us;
+  avl_init(&timeouts, _ptr_cmp, false, NULL);
+  hnetd_trace_enabled = true;
+  return true;
+}
+
+void hnetd_trace_record(hnetd_trace_kind kind, const char *name,
+                        const void *cb, uint64_t start_us)
+{
+  uint64_t duration_us = hnetd_stats_time_us() - start_us;
+  hnetd_trace_event e;
+
+  if (!trace.size)
+    return;
+  if (trace.count < trace.size)
+    e = &trace.events[(trace.first + trace.count++) % trace.size];
+  else
+    {
+      e = &trace.events[trace.first];
+      trace.first = (trace.first + 1) % trace.size;
+    }
+  e->start_us = start_us;
+  e->duration_us = duration_us;
+  e->kind = kind;
+  e->name = name;
+  e->cb = cb;
+  if (duration_us >= trace.threshold_us)
+    L_WARN("slow %s callback %s%p took %d ms",
+           hnetd_trace_kind_names[kind], name ? name : "", cb,
+           (int)(duration_us / 1000));
+}
+
+void hnetd_trace_foreach(bool (*cb)(hnetd_trace_event e, bool slow,
+                                    void *context),
+                         void *context)
+{
+  int i;
+
+  for (i = trace.count - 1 ; i >= 0 ; i--)
+    {
+      hnetd_trace_event e = &trace.events[(trace.first + i) % trace.size];
+
+      if (!cb(e, e->duration_us >= trace.threshold_us, context))
+        return;
+    }
+}
+
+void hnetd_trace_clear(void)
+{
+  trace.first = 0;
+  trace.count = 0;
+}
+
+void hnetd_trace_timeout_wrap(struct uloop_timeout *timeout)
+{
+  hnetd_trace_timeout t;
+
+  if (timeout->cb == hnetd_trace_timeout_cb || !timeout->cb)
+    return;
+  t = avl_find_element(&timeouts, timeout, t, in_timeouts);
+  if (!t)
+    {
+      if (!(t = calloc(1, sizeof(*t))))
+        return;
+      t->in_timeouts.key = timeout;
+      avl_insert(&timeouts, &t->in_timeouts);
+    }
+  t->cb = timeout->cb;
+  timeout->cb = hnetd_trace_timeout_cb;
+}
+
+static uloop_timeout_handler _timeout_unwrap(struct uloop_timeout *timeout)
+{
+  hnetd_trace_timeout t;
+  uloop_timeout_handler cb;
+
+  t = avl_find_element(&timeouts, timeout, t, in_timeouts);
+  if (!t)
+    return NULL;
+  cb = t->cb;
+  avl_delete(&timeouts, &t->in_timeouts);
+  free(t);
+  timeout->cb = cb;
+  return cb;
+}
+
+void hnetd_trace_timeout_unwrap(struct uloop_timeout *timeout)
+{
+  if (timeout->cb == hnetd_trace_timeout_cb)
+    _timeout_unwrap(timeout);
+}
+
+void hnetd_trace_timeout_cb(struct uloop_timeout *timeout)
+{
+  uloop_timeout_handler cb = _timeout_unwrap(timeout);
+
+  if (!cb)
+    {
+      L_ERR("hnetd_trace_timeout_cb: unknown timeout %p", timeout);
+      return;
+    }
+  HNETD_TRACE_CALL(HNETD_TRACE_TIMEOUT, NULL, cb, cb(timeout));
+}
@@ -0,0 +1,83 @@
+/*
+ * $Id: hnetd_trace.h $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libubox/uloop.h>
+
+#include "hnetd_stats.h"
+
+/* Optional event loop latency tracer. When enabled, the wall time of
+ * uloop callbacks (timeouts set via hnetd_time_timeout_*, udp46 fds
+ * and exeq processes) is recorded in a ring buffer, and callbacks
+ * exceeding the threshold are logged. When disabled, the cost is one
+ * (predictable) branch per callback. There is one trace per event
+ * loop, hence per process (as with uloop), covering the callbacks of
+ * all instances. It must only be used from the uloop thread. */
+
+typedef enum {
+  HNETD_TRACE_TIMEOUT,
+  HNETD_TRACE_FD,
+  HNETD_TRACE_PROCESS,
+  HNETD_TRACE_NUM_KINDS
+} hnetd_trace_kind;
+
+typedef struct hnetd_trace_event_struct {
+  uint64_t start_us;
+  uint64_t duration_us;
+  hnetd_trace_kind kind;
+
+  /* Either name (if known) or the callback address identifies the
+   * callback. */
+  const char *name;
+  const void *cb;
+} hnetd_trace_event_s, *hnetd_trace_event;
+
+/* Default ring buffer size (in events). */
+#define HNETD_TRACE_SIZE 1024
+
+extern bool hnetd_trace_enabled;
+
+extern const char *hnetd_trace_kind_names[HNETD_TRACE_NUM_KINDS];
+
+/* Start tracing to a ring buffer of size events; callbacks taking at
+ * least threshold_us (which must be non-zero, or every callback would
+ * be logged) are logged as slow. */
+bool hnetd_trace_enable(int size, uint64_t threshold_us);
+
+void hnetd_trace_record(hnetd_trace_kind kind, const char *name,
+                        const void *cb, uint64_t start_us);
+
+/* Iterate over recorded events, from the most recent to the oldest;
+ * stops if cb returns false. */
+void hnetd_trace_foreach(bool (*cb)(hnetd_trace_event e, bool slow,
+                                    void *context),
+                         void *context);
+
+void hnetd_trace_clear(void);
+
+#define HNETD_TRACE_CALL(kind, name, cb, call)          \
+do {                                                    \
+  if (hnetd_trace_enabled)                              \
+    {                                                   \
+      uint64_t __start = hnetd_stats_time_us();         \
+      call;                                             \
+      hnetd_trace_record(kind, name, cb, __start);      \
+    }                                                   \
+  else                                                  \
+    call;                                               \
+ } while(0)
+
+/* Timeout wrapping used by hnetd_time.c: the callback of a traced
+ * timeout is temporarily replaced with hnetd_trace_timeout_cb, which
+ * restores and calls the original one. */
+void hnetd_trace_timeout_wrap(struct uloop_timeout *timeout);
+void hnetd_trace_timeout_unwrap(struct uloop_timeout *timeout);
+void hnetd_trace_timeout_cb(struct uloop_timeout *timeout);
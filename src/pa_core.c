@@ -12,6 +12,7 @@
 #include <string.h>
 
 #include "prefix.h"
+#include "hnetd_stats.h"
 
 #ifndef container_of
 #define container_of(ptr, type, member) (           \
@@ -48,9 +49,14 @@ const char *pa_hex_dump(uint8_t *ptr, size_t len, char *s) {
 		} \
 	} while(0)
 
+/* Routines are queued and executed together, at most once per ldp, by a single timeout. */
 #define pa_routine_schedule(ldp) do { \
-	if(!(ldp)->routine_to.pending) \
-		uloop_timeout_set(&(ldp)->routine_to, PA_RUN_DELAY); }while(0)
+	if(!(ldp)->routine_pending) { \
+		(ldp)->routine_pending = 1; \
+		list_add_tail(&(ldp)->in_routines, &(ldp)->core->routines); \
+		if(!(ldp)->core->routine_to.pending) \
+			uloop_timeout_set(&(ldp)->core->routine_to, PA_RUN_DELAY); \
+	} }while(0)
 
 #define PA_ADOPT_DELAY_r(ldp) (pa_rand() % (ldp)->core->adopt_delay)
 #define PA_BACKOFF_DELAY_r(ldp) ((ldp)->core->adopt_delay + pa_rand() % ((ldp)->core->backoff_delay - (ldp)->core->adopt_delay))
@@ -224,7 +230,7 @@ static bool pa_ldp_global_valid(struct pa_ldp *ldp)
 /*
  * Prefix Assignment Routine.
  */
-static void pa_routine(struct pa_ldp *ldp, bool backoff)
+static void pa_routine_do(struct pa_ldp *ldp, bool backoff)
 {
 	PA_DEBUG("Executing PA %sRoutine for "PA_LDP_P, backoff?"backoff ":"", PA_LDP_PA(ldp));
 
@@ -287,32 +293,9 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 
 	struct pa_rule *rule, *r2;
 	struct list_head rules, *insert;
-	INIT_LIST_HEAD(&rules);
+	pa_rule_priority bound;
 	ldp->backoff = backoff?1:0;
 
-	/* First, sort the rules with their max priority. */
-	list_for_each_entry(rule, &ldp->core->rules, le) {
-		/* Apply rule filter */
-		if(rule->filter_accept && !rule->filter_accept(rule, ldp, rule->filter_private))
-			continue;
-
-		/* Get priority */
-		rule->_max_priority = rule->get_max_priority?
-				rule->get_max_priority(rule, ldp):rule->max_priority;
-
-		if(!rule->_max_priority)
-			continue;
-
-		/* Insert the rule in descending order. */
-		insert = &rules;
-		list_for_each_entry(r2, &rules, _le) {
-			if(r2->_max_priority < rule->_max_priority)
-				break;
-			insert = &r2->_le;
-		}
-		list_add(&rule->_le, insert);
-	}
-
 	/* Now get the best rule result. */
 	enum pa_rule_target target,
 				best_target = PA_RULE_NO_MATCH;
@@ -323,21 +306,50 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 	//Get existing rule priority
 	best_prio = (ldp->published || ldp->adopting)?ldp->rule_priority:0;
 
-	list_for_each_entry(rule, &rules, _le) {
-		if(rule->_max_priority <= best_prio)
-			break; //Stop here as it is a sorted list
+	/* Rules are sorted by decreasing priority bound.
+	 * Rules sharing the same bound are sorted with their max priority. */
+	rule = list_first_entry(&ldp->core->rules, struct pa_rule, le);
+	while(&rule->le != &ldp->core->rules && rule->_bound > best_prio) {
+		INIT_LIST_HEAD(&rules);
+		for(bound = rule->_bound; &rule->le != &ldp->core->rules && rule->_bound == bound;
+				rule = list_entry(rule->le.next, struct pa_rule, le)) {
+			/* Apply rule filter */
+			if(rule->filter_accept && !rule->filter_accept(rule, ldp, rule->filter_private))
+				continue;
 
-		/* For now, we assume rules behave correctly.
-		 * They only return a match when they have the best
-		 * priority, and everything they say is valid.
-		 */
-		if(!rule->match || !(target = rule->match(rule, ldp, best_prio, &arg)))
+			/* Get priority */
+			rule->_max_priority = rule->get_max_priority?
+					rule->get_max_priority(rule, ldp):rule->max_priority;
+
+			if(rule->_max_priority <= best_prio)
 				continue;
 
-		best_arg = arg;
-		best_target = target;
-		best_prio = arg.rule_priority;
-		best_rule = rule;
+			/* Insert the rule in descending order. */
+			insert = &rules;
+			list_for_each_entry(r2, &rules, _le) {
+				if(r2->_max_priority < rule->_max_priority)
+					break;
+				insert = &r2->_le;
+			}
+			list_add(&rule->_le, insert);
+		}
+
+		list_for_each_entry(r2, &rules, _le) {
+			if(r2->_max_priority <= best_prio)
+				break; //Stop here as it is a sorted list
+
+			/* For now, we assume rules behave correctly.
+			 * They only return a match when they have the best
+			 * priority, and everything they say is valid.
+			 */
+			if(!r2->match || !(target = r2->match(r2, ldp, best_prio, &arg)))
+					continue;
+
+			best_arg = arg;
+			best_target = target;
+			best_prio = arg.rule_priority;
+			best_rule = r2;
+		}
 	}
 
 	if(best_target == PA_RULE_NO_MATCH)
@@ -435,6 +447,17 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 	}
 }
 
+static void pa_routine(struct pa_ldp *ldp, bool backoff)
+{
+	hnetd_stats stats = ldp->core->stats;
+	HNETD_STATS_TIMER(t);
+	pa_routine_do(ldp, backoff);
+	if(stats) {
+		hnetd_stats_inc(stats, HNETD_STATS_PA_ROUTINE);
+		HNETD_STATS_RECORD(stats, HNETD_STATS_H_PA_ROUTINE, t);
+	}
+}
+
 static void pa_backoff_to(struct uloop_timeout *to)
 {
 	struct pa_ldp *ldp = container_of(to, struct pa_ldp, backoff_to);
@@ -449,8 +472,20 @@ static void pa_backoff_to(struct uloop_timeout *to)
 
 static void pa_routine_to(struct uloop_timeout *to)
 {
-	struct pa_ldp *ldp = container_of(to, struct pa_ldp, routine_to);
-	pa_routine(ldp, false);
+	struct pa_core *core = container_of(to, struct pa_core, routine_to);
+	struct pa_ldp *ldp;
+	struct list_head batch;
+
+	/* Routines scheduled while executing the batch are executed in the next one.
+	 * ldps are removed from the batch when destroyed. */
+	INIT_LIST_HEAD(&batch);
+	list_splice_init(&core->routines, &batch);
+	while(!list_empty(&batch)) {
+		ldp = list_first_entry(&batch, struct pa_ldp, in_routines);
+		list_del(&ldp->in_routines);
+		ldp->routine_pending = 0;
+		pa_routine(ldp, false);
+	}
 }
 
 /*
@@ -465,7 +500,6 @@ static int pa_ldp_create(struct pa_core *core, struct pa_link *link, struct pa_d
 	}
 
 	ldp->backoff_to.cb = pa_backoff_to;
-	ldp->routine_to.cb = pa_routine_to;
 	ldp->in_core.type = PAT_ASSIGNED;
 	ldp->core = core;
 	ldp->link = link;
@@ -486,7 +520,11 @@ static void pa_ldp_destroy(struct pa_ldp *ldp)
 	list_del(&ldp->in_link);
 	list_del(&ldp->in_dp);
 	uloop_timeout_cancel(&ldp->backoff_to);
-	uloop_timeout_cancel(&ldp->routine_to);
+	if(ldp->routine_pending) {
+		list_del(&ldp->in_routines);
+		if(list_empty(&ldp->core->routines))
+			uloop_timeout_cancel(&ldp->core->routine_to);
+	}
 	free(ldp);
 }
 
@@ -643,8 +681,20 @@ void pa_advp_del(struct pa_core *core, struct pa_advp *advp)
 
 void pa_rule_add(struct pa_core *core, struct pa_rule *rule)
 {
+	struct pa_rule *r2;
+	struct list_head *insert = &core->rules;
 	PA_DEBUG("Adding rule "PA_RULE_P, PA_RULE_PA(rule));
-	list_add_tail(&rule->le, &core->rules);
+
+	/* Insert the rule in descending bound order, after rules with the same bound. */
+	rule->_bound = rule->get_max_priority?
+			rule->get_max_priority(rule, NULL):rule->max_priority;
+	list_for_each_entry(r2, &core->rules, le) {
+		if(r2->_bound < rule->_bound)
+			break;
+		insert = &r2->le;
+	}
+	list_add(&rule->le, insert);
+
 	/* Schedule all routines */
 	struct pa_link *link;
 	struct pa_ldp *ldp;
@@ -709,11 +759,15 @@ void pa_core_init(struct pa_core *core)
 	INIT_LIST_HEAD(&core->links);
 	INIT_LIST_HEAD(&core->users);
 	INIT_LIST_HEAD(&core->rules);
+	INIT_LIST_HEAD(&core->routines);
+	memset(&core->routine_to, 0, sizeof(core->routine_to));
+	core->routine_to.cb = pa_routine_to;
 	btrie_init(&core->prefixes);
 	memset(core->node_id, 0, PA_NODE_ID_LEN *sizeof(PA_NODE_ID_TYPE));
 	core->flooding_delay = PA_DEFAULT_FLOODING_DELAY;
 	core->adopt_delay = PA_ADOPT_DELAY_DEFAULT;
 	core->backoff_delay = PA_BACKOFF_DELAY_DEFAULT;
+	core->stats = NULL;
 #ifdef PA_HIERARCHICAL
 	core->ha_parent = NULL;
 #endif
@@ -16,6 +16,7 @@
 #include <libubox/list.h>
 
 #include "hnetd_time.h"
+#include "hnetd_stats.h"
 
 #include "btrie.h"
 
@@ -175,6 +176,15 @@ struct pa_core {
 	/* List of all PA rules. */
 	struct list_head rules;
 
+	/* Link/Delegated Prefix pairs whose routine is scheduled. */
+	struct list_head routines;
+
+	/* Timer used to execute all scheduled routines at once. */
+	struct uloop_timeout routine_to;
+
+	/* Runtime metrics routines are accounted in, or NULL. */
+	hnetd_stats stats;
+
 #ifdef PA_HIERARCHICAL
 
 	/* When not-null, points to the parent pa_core structure. */
@@ -404,6 +414,9 @@ struct pa_ldp {
 	/* (in routine) The routine is executed following backoff timeout. */
 	uint8_t backoff   : 1;
 
+	/* The routine is scheduled in the core's routine queue. */
+	uint8_t routine_pending : 1;
+
 #ifdef PA_HIERARCHICAL
 	/* The prefix is ready to be applied, but it is waiting for higher-level
 	 * prefix to be applied too. */
@@ -430,8 +443,8 @@ struct pa_ldp {
 	 * The rule used to publish or adopt this prefix. */
 	struct pa_rule *rule;
 
-	/* Timer used to schedule the routine. */
-	struct uloop_timeout routine_to;
+	/* (if routine_pending) Element in the core's routine queue. */
+	struct list_head in_routines;
 
 	/* Timer used to backoff prefix generation, adoption or apply. */
 	struct uloop_timeout backoff_to;
@@ -617,15 +630,21 @@ struct pa_rule {
 	 * In such case, or when the returned max_priority is smaller than another
 	 * matching rule, 'match' will not be called.
 	 *
+	 * When the rule is added to pa_core, it is called once with a NULL pa_ldp,
+	 * and must return an upper bound of the values it may return later on.
+	 * Rules are kept sorted by this bound, and rules whose bound is smaller
+	 * than the priority of a matching rule are not considered at all.
+	 *
 	 * @param pa_rule The rule from which the function is called.
-	 * @param pa_ldp The considered Link/Delegated Prefix pair.
+	 * @param pa_ldp The considered Link/Delegated Prefix pair (or NULL).
 	 * @return The maximum priority 'match' would pick given the same
 	 *         parameters.
 	 *
 	 */
 	pa_rule_priority (*get_max_priority)(struct pa_rule *, struct pa_ldp *);
 
-	/* If get_max_priority is NULL, this value is used instead. */
+	/* If get_max_priority is NULL, this value is used instead.
+	 * It must not be modified while the rule is added. */
 	pa_rule_priority max_priority;
 
 	/**
@@ -645,6 +664,7 @@ struct pa_rule {
 			struct pa_rule_arg *pa_arg);
 
 	 /* PRIVATE - Used by pa_core. */
+	 pa_rule_priority _bound; //Upper bound of max priority, rules are sorted by it
 	 pa_rule_priority _max_priority;
 	 struct list_head _le;
 };
@@ -38,17 +38,16 @@ void pa_rule_prefix_nth(pa_prefix *dst, pa_prefix *container, pa_plen container_
 void pa_rule_prefix_count(struct pa_core *core,
 		pa_prefix *subprefix, pa_plen subplen,
 		uint16_t *count, pa_plen max_plen) {
-	pa_prefix p;
+	uint32_t c[PA_RAND_MAX_PLEN + 1];
 	pa_plen plen;
-	struct btrie *n;
 
-	for(plen = 0; plen <= max_plen; plen++)
-		count[plen] = 0;
+	if(max_plen > PA_RAND_MAX_PLEN)
+		max_plen = PA_RAND_MAX_PLEN;
 
-	btrie_for_each_available(&core->prefixes, n, (btrie_key_t *)&p, (btrie_plen_t *)&plen, (btrie_key_t *)subprefix, subplen) {
-		if(count[plen] != UINT16_MAX)
-			count[plen]++;
-	}
+	//Counters are maintained by the btrie, no need to iterate
+	btrie_available_count(&core->prefixes, (btrie_key_t *)subprefix, subplen, c, max_plen);
+	for(plen = 0; plen <= max_plen; plen++)
+		count[plen] = (c[plen] > UINT16_MAX)?UINT16_MAX:c[plen];
 }
 
 /* Computes the candidate subset. */
@@ -85,23 +84,25 @@ uint32_t pa_rule_candidate_subset( //Returns the number of found prefixes
 int pa_rule_candidate_pick(struct pa_core *core, pa_prefix *subprefix, pa_plen subplen,
 		uint32_t n, pa_prefix *p, pa_plen plen, pa_plen min_plen, pa_plen max_plen)
 {
-	struct btrie *node;
 	pa_plen i;
 	pa_prefix iter;
-	int pass = 0;
-	do{
-		btrie_for_each_available(&core->prefixes, node, (btrie_key_t *)&iter, (btrie_plen_t *)&i,
-				(btrie_key_t *)subprefix, subplen) {
-			if((pass && i == min_plen) || (!pass && i > min_plen && i <= max_plen)) {
-				if((plen - i >= 32) || (n < (((uint32_t)1) << (plen - i)))) {
-					//The nth prefix is in this available prefix
-					pa_rule_prefix_nth(p, &iter, i, n, plen);
-					return 0;
-				}
-				n -= 1 << (plen - i);
-			}
-		}
-	} while(!(pass++));
+	uint64_t nth = n;
+
+	if(max_plen > plen)
+		max_plen = plen;
+
+	//First pass: available prefixes of length in ]min_plen, max_plen]
+	//Second pass: available prefixes of length min_plen
+	if((min_plen < max_plen &&
+			!btrie_available_nth(&core->prefixes, (btrie_key_t *)&iter, (btrie_plen_t *)&i,
+					(btrie_key_t *)subprefix, subplen, min_plen + 1, max_plen, plen, &nth)) ||
+			(min_plen <= max_plen &&
+			!btrie_available_nth(&core->prefixes, (btrie_key_t *)&iter, (btrie_plen_t *)&i,
+					(btrie_key_t *)subprefix, subplen, min_plen, min_plen, plen, &nth))) {
+		//The nth prefix is in this available prefix
+		pa_rule_prefix_nth(p, &iter, i, (uint32_t)nth, plen);
+		return 0;
+	}
 	return -1;
 }
 
@@ -131,10 +132,90 @@ void pa_rule_prefix_prandom(const uint8_t *seed, size_t seedlen, uint32_t ctr,
 	bmemcpy(dst, container_prefix, 0, container_len);
 }
 
+/* Round function of the Feistel network (MurmurHash3 finalizer). */
+static uint32_t pa_rule_feistel_f(uint32_t k, uint32_t r)
+{
+	r ^= k;
+	r *= 0x85ebca6b;
+	r ^= r >> 13;
+	r *= 0xc2b2ae35;
+	r ^= r >> 16;
+	return r;
+}
+
+/* Keyed pseudo-random permutation of [0, size), with 0 < size <= 2^32.
+ * A balanced Feistel network permutes the smallest even number of bits
+ * covering size. Values falling outside are fed back until they fit. */
+uint32_t pa_rule_permute(const uint32_t key[4], uint32_t x, uint64_t size)
+{
+	uint8_t half = 1;
+	uint32_t l, r, t;
+	uint64_t v = x;
+	int i;
+
+	while((((uint64_t)1) << (2*half)) < size)
+		half++;
+
+	uint32_t mask = (((uint64_t)1) << half) - 1;
+	do {
+		l = v >> half;
+		r = v & mask;
+		for(i = 0; i < 4; i++) {
+			t = l ^ (pa_rule_feistel_f(key[i], r) & mask);
+			l = r;
+			r = t;
+		}
+		v = (((uint64_t)l) << half) | r;
+	} while(v >= size);
+	return (uint32_t)v;
+}
+
+void pa_rule_prandom_key(const uint8_t *seed, size_t seedlen, uint32_t key[4])
+{
+	uint8_t hash[16];
+	md5_ctx_t ctx;
+	int i;
+	md5_begin(&ctx);
+	md5_hash(seed, seedlen, &ctx);
+	md5_end(hash, &ctx);
+	for(i = 0; i < 4; i++) //Network byte order
+		key[i] = (((uint32_t)hash[4*i]) << 24) | (((uint32_t)hash[4*i+1]) << 16) |
+				(((uint32_t)hash[4*i+2]) << 8) | hash[4*i+3];
+}
+
+/* Returns the nth prefix of the pseudo-random sequence defined by the key.
+ * When there are more than 2^32 prefixes of length plen in the container,
+ * the leading bits are picked from the key and only 2^32 prefixes are
+ * considered. */
+void pa_rule_prefix_prandom_nth(const uint32_t key[4], uint32_t n,
+		const pa_prefix *container_prefix, pa_plen container_len,
+		pa_prefix *dst, pa_plen plen)
+{
+	pa_plen bits = plen - container_len;
+	uint32_t i, nkey[4];
+
+	memset(dst, 0, sizeof(*dst));
+	bmemcpy(dst, container_prefix, 0, container_len);
+	if(bits > 32) {
+		for(i = 0; i < 4; i++)
+			nkey[i] = htonl(key[i]);
+		bmemcpy_shift(dst, container_len, nkey, 0, bits - 32);
+		container_len = plen - 32;
+		bits = 32;
+	}
+
+	if(bits) {
+		i = htonl(pa_rule_permute(key, n, ((uint64_t)1) << bits));
+		bmemcpy_shift(dst, container_len, &i, 32 - bits, bits);
+	}
+}
+
 /***** Adopt rule ****/
 
 pa_rule_priority pa_rule_adopt_get_max_priority(struct pa_rule *rule, struct pa_ldp *ldp)
 {
+	if(!ldp) //Upper bound
+		return container_of(rule, struct pa_rule_adopt, rule)->rule_priority;
 	if(!ldp->assigned || ldp->best_assignment || ldp->published) //No override
 		return 0;
 	return container_of(rule, struct pa_rule_adopt, rule)->rule_priority;
@@ -166,7 +247,7 @@ void pa_rule_adopt_init(struct pa_rule_adopt *r, const char *name,
 pa_rule_priority pa_rule_random_get_max_priority(struct pa_rule *rule, struct pa_ldp *ldp)
 {
 	struct pa_rule_random *rule_r = container_of(rule, struct pa_rule_random, rule);
-	if(ldp->best_assignment || ldp->published) //No override
+	if(ldp && (ldp->best_assignment || ldp->published)) //No override
 			return 0;
 
 	return rule_r->rule_priority;
@@ -307,13 +388,19 @@ enum pa_rule_target pa_rule_random_match(struct pa_rule *rule, struct pa_ldp *ld
 			PA_DEBUG("Last (#%"PRIu32") candidate in available prefix of length %d is %s", overflow_n, min_plen, pa_prefix_repr(&overflow_prefix, desired_plen));
 		}
 
-		/* Make pseudo-random tentatives. */
+		/* Make pseudo-random tentatives.
+		 * The sequence only depends on the seed, so the key is computed once
+		 * and tentatives are obtained by permuting their index. */
 		struct btrie *n0, *n;
 		btrie_plen_t l0;
 		pa_prefix iter_p;
 		pa_plen iter_plen;
-		for(i=0; i<rule_r->pseudo_random_tentatives; i++) {
-			pa_rule_prefix_prandom(rule_r->pseudo_random_seed, rule_r->pseudo_random_seedlen, i, subprefix, subplen, &tentative, desired_plen);
+		uint32_t key[4];
+		uint64_t space = ((desired_plen - subplen) >= 32)?
+				(((uint64_t)1) << 32):(((uint64_t)1) << (desired_plen - subplen));
+		pa_rule_prandom_key(rule_r->pseudo_random_seed, rule_r->pseudo_random_seedlen, key);
+		for(i=0; i<rule_r->pseudo_random_tentatives && i < space; i++) {
+			pa_rule_prefix_prandom_nth(key, i, subprefix, subplen, &tentative, desired_plen);
 			PA_DEBUG("Trying pseudo-random %s", pa_prefix_repr(&tentative, desired_plen));
 			btrie_for_each_available_loop_stop(&ldp->core->prefixes, n, n0, l0, (btrie_key_t *)&iter_p, &iter_plen, \
 					(btrie_key_t *)&tentative, subplen, desired_plen)
@@ -485,7 +572,7 @@ enum pa_rule_target pa_rule_hamming_match(struct pa_rule *rule, struct pa_ldp *l
 pa_rule_priority pa_rule_hamming_get_max_priority(struct pa_rule *rule, struct pa_ldp *ldp)
 {
 	struct pa_rule_hamming *rule_h = container_of(rule, struct pa_rule_hamming, rule);
-	if(ldp->best_assignment || ldp->published) //No override
+	if(ldp && (ldp->best_assignment || ldp->published)) //No override
 			return 0;
 
 	return rule_h->rule_priority;
@@ -513,6 +600,8 @@ void pa_rule_hamming_init(struct pa_rule_hamming *r, const char *name,
 pa_rule_priority pa_rule_static_get_max_priority(struct pa_rule *rule, struct pa_ldp *ldp)
 {
 	struct pa_rule_static *srule = container_of(rule, struct pa_rule_static, rule);
+	if(!ldp) //Upper bound
+		return srule->rule_priority;
 	if(!srule->get_prefix || srule->get_prefix(srule, ldp, &srule->_prefix, &srule->_plen) ||
 			(ldp->dp->plen > srule->_plen) ||
 			!pa_prefix_contains(&ldp->dp->prefix, ldp->dp->plen, &srule->_prefix) ||
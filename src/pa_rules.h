@@ -85,7 +85,8 @@ struct pa_rule_random {
 	uint16_t random_set_size;
 
 	/* The algorithm first makes pseudo_random_tentatives pseudo-random
-	 * tentatives. */
+	 * tentatives. They follow a permutation of the prefixes contained in the
+	 * pool, which only depends on the seed, such that no prefix is tried twice. */
 	uint16_t pseudo_random_tentatives;
 
 	/* Seed and seed length used for the pseudo-random tentatives. */
@@ -109,6 +110,19 @@ void pa_rule_random_prandconf(struct pa_rule_random *r,
 		uint16_t pseudo_random_tentatives,
 		uint8_t *pseudo_random_seed, uint16_t pseudo_random_seedlen);
 
+/* Keyed pseudo-random permutation of [0, size), with 0 < size <= 2^32. */
+uint32_t pa_rule_permute(const uint32_t key[4], uint32_t x, uint64_t size);
+
+/* Computes the permutation key from a seed (MD5 of the seed, read in
+ * network byte order, so that all hosts get the same sequence). */
+void pa_rule_prandom_key(const uint8_t *seed, size_t seedlen, uint32_t key[4]);
+
+/* Returns the nth prefix of length plen, contained in container_prefix,
+ * of the pseudo-random sequence defined by the key. */
+void pa_rule_prefix_prandom_nth(const uint32_t key[4], uint32_t n,
+		const pa_prefix *container_prefix, pa_plen container_len,
+		pa_prefix *dst, pa_plen plen);
+
 /**
  * Pseudo-random prefix selection based on Hamming weights.
  * This approach genuinely sorts all possible prefixes and
@@ -9,31 +9,110 @@
 
 #include "pa_store.h"
 
+#include <libubox/avl-cmp.h>
+
 #include <errno.h>
 #include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <inttypes.h>
 
+static int pa_store_prefix_comp(const void *k1, const void *k2,
+		__attribute__ ((unused)) void *ptr)
+{
+	const struct pa_store_prefix *p1 = k1, *p2 = k2;
+	if(p1->plen != p2->plen)
+		return (p1->plen > p2->plen)?1:-1;
+	return bmemcmp(&p1->prefix, &p2->prefix, p1->plen);
+}
+
+static int pa_store_ptr_comp(const void *k1, const void *k2,
+		__attribute__ ((unused)) void *ptr)
+{
+	return (k1 > k2) - (k1 < k2);
+}
+
+static struct pa_store_prefix *pa_store_prefix_get(struct pa_store_link *link,
+		const pa_prefix *prefix, pa_plen plen)
+{
+	struct pa_store_prefix key, *p;
+	key.prefix = *prefix;
+	key.plen = plen;
+	return avl_find_element(&link->prefix_tree, &key, p, in_tree);
+}
+
+/* Moves all prefixes from one link to the head of another link. */
+static void pa_store_link_move_prefixes(struct pa_store_link *from, struct pa_store_link *to)
+{
+	struct pa_store_prefix *p;
+	list_for_each_entry(p, &from->prefixes, in_link) {
+		avl_delete(&from->prefix_tree, &p->in_tree);
+		avl_insert(&to->prefix_tree, &p->in_tree);
+		p->link = to;
+	}
+	list_splice(&from->prefixes, &to->prefixes);
+	to->n_prefixes += from->n_prefixes;
+	from->n_prefixes = 0;
+}
+
+/* Links without a name are not indexed by name, and a name may only be used
+ * by a single link. */
+static int pa_store_link_index(struct pa_store *store, struct pa_store_link *l)
+{
+	avl_init(&l->prefix_tree, pa_store_prefix_comp, true, NULL);
+	l->name_node.key = l->name;
+	if(strlen(l->name) && avl_insert(&store->link_names, &l->name_node)) {
+		INIT_LIST_HEAD(&l->le);
+		return -1;
+	}
+	if(l->link) {
+		l->ptr_node.key = l->link;
+		avl_insert(&store->link_ptrs, &l->ptr_node);
+	}
+	list_add(&l->le, &store->links);
+	return 0;
+}
+
+static void pa_store_link_unindex(struct pa_store *store, struct pa_store_link *l)
+{
+	if(strlen(l->name))
+		avl_delete(&store->link_names, &l->name_node);
+	if(l->link)
+		avl_delete(&store->link_ptrs, &l->ptr_node);
+	list_del_init(&l->le);
+}
+
+static struct pa_store_link *pa_store_link_get(struct pa_store *store, struct pa_link *link)
+{
+	struct pa_store_link *l;
+	return avl_find_element(&store->link_ptrs, link, l, ptr_node);
+}
+
 static struct pa_store_link *pa_store_link_goc(struct pa_store *store, const char *name, int create)
 {
 	struct pa_store_link *l;
-	list_for_each_entry(l, &store->links, le) {
-		if(!strcmp(l->name, name)) {
-			return l;
-		}
-	}
+	if((l = avl_find_element(&store->link_names, name, l, name_node)))
+		return l;
+
 	if(!create || !(l = malloc(sizeof(*l))))
 		return NULL;
 
 	strcpy(l->name, name);
 	INIT_LIST_HEAD(&l->prefixes);
 	l->n_prefixes = 0;
+	l->journal_id = 0;
 	l->link = NULL;
 	l->max_prefixes = 0;
-	list_add(&l->le, &store->links);
+	if(pa_store_link_index(store, l)) {
+		free(l);
+		return NULL;
+	}
 	return l;
 }
 
@@ -153,7 +232,7 @@ int pa_store_save(struct pa_store *store)
 	}
 
 	list_for_each_entry_reverse(p, &store->prefixes, in_store) {
-		link = list_entry(p->in_link.next, struct pa_store_link, prefixes);
+		link = p->link;
 		if(!strlen(link->name))
 			continue;
 
@@ -163,7 +242,6 @@ int pa_store_save(struct pa_store *store)
 					pa_prefix_tostring(px, &p->prefix, p->plen)) < 0)
 				err = -2;
 		}
-		list_move(&p->in_link, &link->prefixes);
 	}
 	if(err)
 		PA_WARNING("Error occurred while writing cache into %s: %s", store->filepath, strerror(errno));
@@ -172,12 +250,220 @@ int pa_store_save(struct pa_store *store)
 	return err;
 }
 
+/* Returns a new record, with a zeroed payload of the given length, at the end
+ * of the journal buffer. */
+static struct pa_store_jrecord *pa_store_journal_push(struct pa_store *store,
+		uint8_t op, uint8_t len)
+{
+	struct pa_store_jrecord *r;
+	size_t rlen = sizeof(*r) + len;
+	if(store->journal_buf_len + rlen > store->journal_buf_size) {
+		size_t size = store->journal_buf_size?(2 * store->journal_buf_size):(16 * PA_STORE_JRECORD_MAXLEN);
+		uint8_t *buf;
+		if(!(buf = realloc(store->journal_buf, size))) {
+			PA_WARNING("Cannot allocate journal records");
+			return NULL;
+		}
+		store->journal_buf = buf;
+		store->journal_buf_size = size;
+	}
+	r = (struct pa_store_jrecord *)(store->journal_buf + store->journal_buf_len);
+	store->journal_buf_len += rlen;
+	store->journal_buf_records++;
+	memset(r, 0, rlen);
+	r->op = op;
+	r->len = len;
+	return r;
+}
+
+static void pa_store_journal_put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static uint16_t pa_store_journal_get16(const uint8_t *p)
+{
+	return (((uint16_t)p[0]) << 8) | p[1];
+}
+
+static void pa_store_journal_put32(uint8_t *p, uint32_t v)
+{
+	pa_store_journal_put16(p, v >> 16);
+	pa_store_journal_put16(p + 2, v);
+}
+
+static uint32_t pa_store_journal_get32(const uint8_t *p)
+{
+	return (((uint32_t)pa_store_journal_get16(p)) << 16) | pa_store_journal_get16(p + 2);
+}
+
+static int pa_store_journal_value(struct pa_store *store, uint8_t op, uint32_t value)
+{
+	struct pa_store_jrecord *r;
+	if(!(r = pa_store_journal_push(store, op, sizeof(uint32_t))))
+		return -1;
+	pa_store_journal_put32(r->data, value);
+	return 0;
+}
+
+/* Makes sure the link name was written in the journal. */
+static int pa_store_journal_link(struct pa_store *store, struct pa_store_link *link)
+{
+	struct pa_store_jrecord *r;
+	size_t namelen = strlen(link->name);
+	if(link->journal_id)
+		return 0;
+
+	if(store->journal_link_id == UINT16_MAX ||
+			!(r = pa_store_journal_push(store, PA_STORE_JOP_LINK, sizeof(uint16_t) + namelen)))
+		return -1;
+
+	link->journal_id = ++store->journal_link_id;
+	pa_store_journal_put16(r->data, link->journal_id);
+	memcpy(r->data + sizeof(uint16_t), link->name, namelen);
+	return 0;
+}
+
+/* Pushes a prefix (or prefix removal) record. */
+static int pa_store_journal_push_prefix(struct pa_store *store, struct pa_store_link *link,
+		uint8_t op, const pa_prefix *prefix, pa_plen plen)
+{
+	struct pa_store_jrecord *r;
+	uint8_t bytes = (plen + 7) / 8;
+	if(pa_store_journal_link(store, link) ||
+			!(r = pa_store_journal_push(store, op, sizeof(uint16_t) + 1 + bytes)))
+		return -1;
+	pa_store_journal_put16(r->data, link->journal_id);
+	r->data[2] = plen;
+	bmemcpy(r->data + 3, prefix, 0, plen);
+	return 0;
+}
+
+/* Records a cache change when the journal is in use. */
+static void pa_store_journal_prefix(struct pa_store *store, struct pa_store_link *link,
+		uint8_t op, const pa_prefix *prefix, pa_plen plen)
+{
+	if(store->journal_fd == -1 || store->journal_replay || !strlen(link->name))
+		return;
+
+	if(pa_store_journal_push_prefix(store, link, op, prefix, plen)) {
+		//The journal is out of sync and must be entirely rewritten
+		close(store->journal_fd);
+		store->journal_fd = -1;
+	}
+}
+
+static void pa_store_journal_reset_buf(struct pa_store *store)
+{
+	store->journal_buf_len = 0;
+	store->journal_buf_records = 0;
+}
+
+/* Makes a rename into the directory containing path durable. */
+static int pa_store_sync_dir(const char *path)
+{
+	char dir[PATH_MAX];
+	int fd, ret;
+	snprintf(dir, sizeof(dir), "%s", path);
+	if((fd = open(dirname(dir), O_RDONLY | O_DIRECTORY, 0)) == -1)
+		return -1;
+	ret = fsync(fd);
+	close(fd);
+	return ret;
+}
+
+/* Writes the cache content into a new journal, which replaces the old one.
+ * Prefixes are written from the least to the most recently used, so that
+ * reading the journal restores the same order. */
+static int pa_store_journal_compact(struct pa_store *store)
+{
+	char tmp[PATH_MAX];
+	struct pa_store_prefix *p;
+	struct pa_store_link *link;
+	int fd;
+
+	if(store->journal_fd != -1) {
+		close(store->journal_fd);
+		store->journal_fd = -1;
+	}
+
+	pa_store_journal_reset_buf(store);
+	store->journal_link_id = 0;
+	list_for_each_entry(link, &store->links, le)
+		link->journal_id = 0;
+
+	if(pa_store_journal_value(store, PA_STORE_JOP_HEADER, PA_STORE_JOURNAL_MAGIC) ||
+			pa_store_journal_value(store, PA_STORE_JOP_WTOKEN, store->token_count))
+		return -1;
+
+	list_for_each_entry_reverse(p, &store->prefixes, in_store) {
+		if(!strlen(p->link->name))
+			continue;
+
+		if(pa_store_journal_push_prefix(store, p->link, PA_STORE_JOP_PREFIX, &p->prefix, p->plen))
+			return -1;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", store->journal_path);
+	if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0664)) == -1)
+		goto err;
+
+	if(write(fd, store->journal_buf, store->journal_buf_len) != (ssize_t) store->journal_buf_len ||
+			fsync(fd)) {
+		close(fd);
+		goto err;
+	}
+	close(fd);
+
+	if(rename(tmp, store->journal_path) || pa_store_sync_dir(store->journal_path) ||
+			(store->journal_fd = open(store->journal_path, O_WRONLY | O_APPEND, 0)) == -1)
+		goto err;
+
+	store->journal_records = store->journal_buf_records;
+	pa_store_journal_reset_buf(store);
+	return 0;
+
+err:
+	PA_WARNING("Error occurred while writing journal %s: %s", store->journal_path, strerror(errno));
+	pa_store_journal_reset_buf(store);
+	return -1;
+}
+
+/* Appends pending records to the journal, or compacts it when it grew too
+ * large. Records are synced to stable storage at once. */
+static int pa_store_journal_flush(struct pa_store *store)
+{
+	if(store->journal_fd == -1 || store->journal_link_id == UINT16_MAX ||
+			store->journal_records + store->journal_buf_records >
+					2 * store->n_prefixes + PA_STORE_JOURNAL_SLACK)
+		return pa_store_journal_compact(store);
+
+	pa_store_journal_value(store, PA_STORE_JOP_WTOKEN, store->token_count);
+
+	if(write(store->journal_fd, store->journal_buf, store->journal_buf_len) != (ssize_t) store->journal_buf_len ||
+			fsync(store->journal_fd)) {
+		PA_WARNING("Error occurred while writing journal %s: %s", store->journal_path, strerror(errno));
+		close(store->journal_fd);
+		store->journal_fd = -1;
+		pa_store_journal_reset_buf(store);
+		return -1;
+	}
+
+	store->journal_records += store->journal_buf_records;
+	pa_store_journal_reset_buf(store);
+	return 0;
+}
+
 static void pa_save_to(struct uloop_timeout *to)
 {
 	struct pa_store *store = container_of(to, struct pa_store, save_timer);
 	store->pending_changes = 0;
 	store->token_count--;
-	pa_store_save(store);
+	if(store->journal_path)
+		pa_store_journal_flush(store);
+	else
+		pa_store_save(store);
 }
 
 void pa_token_to(struct uloop_timeout *to)
@@ -195,26 +481,28 @@ void pa_token_to(struct uloop_timeout *to)
 void pa_store_updated(struct pa_store *store)
 {
 	store->pending_changes = 1;
-	if(store->filepath && store->token_count && !store->save_timer.pending) {
+	if((store->filepath || store->journal_path) && store->token_count && !store->save_timer.pending) {
 		uloop_timeout_set(&store->save_timer, store->save_delay);
 	}
 }
 
 /* Only an empty private link can be destroyed */
-static void pa_store_private_link_destroy(struct pa_store_link *l)
+static void pa_store_private_link_destroy(struct pa_store *store, struct pa_store_link *l)
 {
-	list_del(&l->le);
+	pa_store_link_unindex(store, l);
 	free(l);
 }
 
 static void pa_store_uncache(struct pa_store *store, struct pa_store_link *l, struct pa_store_prefix *p)
 {
+	pa_store_journal_prefix(store, l, PA_STORE_JOP_DEL, &p->prefix, p->plen);
 	list_del(&p->in_link);
+	avl_delete(&l->prefix_tree, &p->in_tree);
 	l->n_prefixes--;
 	list_del(&p->in_store);
 	store->n_prefixes--;
 	if(!l->n_prefixes && !l->link)
-		pa_store_private_link_destroy(l);
+		pa_store_private_link_destroy(store, l);
 
 	free(p);
 	pa_store_updated(store);
@@ -226,32 +514,37 @@ static void pa_store_uncache(struct pa_store *store, struct pa_store_link *l, st
 static void pa_store_uncache_last_from_store(struct pa_store *store)
 {
 	struct pa_store_prefix *p = list_entry((store)->prefixes.prev, struct pa_store_prefix, in_store);
-	struct pa_store_link *l =  list_entry(p->in_link.next, struct pa_store_link, prefixes);
-	pa_store_uncache(store, l, p);
+	pa_store_uncache(store, p->link, p);
 }
 
 int pa_store_cache(struct pa_store *store, struct pa_store_link *link, pa_prefix *prefix, pa_plen plen)
 {
 	PA_DEBUG("Caching %s %s", link->name, pa_prefix_repr(prefix, plen));
 	struct pa_store_prefix *p;
-	list_for_each_entry(p, &link->prefixes, in_link) {
-		if(pa_prefix_equals(prefix, plen, &p->prefix, p->plen)) {
-			//Put existing prefix at head
-			list_move(&p->in_store, &store->prefixes);
-			if(p->in_link.prev != &link->prefixes) {
-				//We do not update if it is just moving the first prefix
-				//of the link.
-				list_move(&p->in_link, &link->prefixes);
-				pa_store_updated(store);
-			}
-			return 0;
+	if((p = pa_store_prefix_get(link, prefix, plen))) {
+		if(p->in_store.prev == &store->prefixes && p->in_link.prev == &link->prefixes)
+			return 0; //Already the most recently used
+
+		pa_store_journal_prefix(store, link, PA_STORE_JOP_PREFIX, prefix, plen);
+		//Put existing prefix at head
+		list_move(&p->in_store, &store->prefixes);
+		if(p->in_link.prev != &link->prefixes) {
+			//We do not update if it is just moving the first prefix
+			//of the link.
+			list_move(&p->in_link, &link->prefixes);
+			pa_store_updated(store);
 		}
+		return 0;
 	}
+	pa_store_journal_prefix(store, link, PA_STORE_JOP_PREFIX, prefix, plen);
 	if(!(p = malloc(sizeof(*p))))
 		return -1;
 	//Add the new prefix
 	pa_prefix_cpy(prefix, plen, &p->prefix, p->plen);
+	p->link = link;
 	list_add(&p->in_link, &link->prefixes);
+	p->in_tree.key = p;
+	avl_insert(&link->prefix_tree, &p->in_tree);
 	link->n_prefixes++;
 	list_add(&p->in_store, &store->prefixes);
 	store->n_prefixes++;
@@ -276,53 +569,63 @@ static void pa_store_applied_cb(struct pa_user *user, struct pa_ldp *ldp)
 		return;
 
 	struct pa_store_link *link;
-	list_for_each_entry(link, &store->links, le) {
-		if(link->link == ldp->link) {
-			pa_store_cache(store, link, &ldp->prefix, ldp->plen);
-			return;
-		}
-	}
+	if((link = pa_store_link_get(store, ldp->link)))
+		pa_store_cache(store, link, &ldp->prefix, ldp->plen);
 }
 
-void pa_store_link_add(struct pa_store *store, struct pa_store_link *link)
+int pa_store_link_add(struct pa_store *store, struct pa_store_link *link)
 {
 	struct pa_store_link *l;
 	INIT_LIST_HEAD(&link->prefixes);
 	link->n_prefixes = 0;
-	if((l = pa_store_link_goc(store, link->name, 0))) {
-		list_splice(&l->prefixes, &link->prefixes);
-		link->n_prefixes = l->n_prefixes;
-		if(!l->link)
-			pa_store_private_link_destroy(l);
+	link->journal_id = 0;
+	//A private link with the same name is replaced
+	if((l = pa_store_link_goc(store, link->name, 0)) && !l->link)
+		pa_store_link_unindex(store, l);
+
+	if(pa_store_link_index(store, link)) {
+		PA_WARNING("Link name %s is already used", link->name);
+		return -1;
+	}
+
+	if(l) {
+		pa_store_link_move_prefixes(l, link);
+		link->journal_id = l->journal_id;
+		free(l);
 
 		if(link->max_prefixes)
 			while(link->n_prefixes > link->max_prefixes)
 				pa_store_uncache_last_from_link(store, link);
 	}
-	list_add(&link->le, &store->links);
-	return;
+	return 0;
 }
 
 void pa_store_link_remove(struct pa_store *store, struct pa_store_link *link)
 {
 	struct pa_store_link *l;
-	list_del(&link->le);
+	if(list_empty(&link->le)) //Not added
+		return;
+
+	pa_store_link_unindex(store, link);
 	if(!link->n_prefixes)
 		return;
 
 	if(((strlen(link->name) && (l = pa_store_link_goc(store, link->name, 1))))) {
-		list_splice(&link->prefixes, &l->prefixes); //Save prefixes in a private list
-		l->n_prefixes = link->n_prefixes;
+		pa_store_link_move_prefixes(link, l); //Save prefixes in a private list
+		if(!l->journal_id)
+			l->journal_id = link->journal_id;
 
 		if(l->max_prefixes)
 			while(l->n_prefixes > l->max_prefixes)
 				pa_store_uncache_last_from_link(store, l);
 	} else {
-		struct pa_store_prefix *p;
-		list_for_each_entry(p, &link->prefixes, in_link) {
+		struct pa_store_prefix *p, *p2;
+		list_for_each_entry_safe(p, p2, &link->prefixes, in_link) {
 			list_del(&p->in_store);
+			store->n_prefixes--;
 			free(p);
 		}
+		link->n_prefixes = 0;
 		pa_store_updated(store);
 	}
 	return;
@@ -343,6 +646,14 @@ void pa_store_term(struct pa_store *store)
 
 	uloop_timeout_cancel(&store->save_timer);
 	uloop_timeout_cancel(&store->token_timer);
+
+	if(store->journal_fd != -1)
+		close(store->journal_fd);
+	store->journal_fd = -1;
+	free(store->journal_buf);
+	store->journal_buf = NULL;
+	pa_store_journal_reset_buf(store);
+	store->journal_buf_size = 0;
 }
 
 int pa_store_set_file(struct pa_store *store, const char *filepath,
@@ -387,6 +698,180 @@ int pa_store_set_file(struct pa_store *store, const char *filepath,
 	store->save_delay = save_delay;
 	store->token_delay = token_delay;
 	store->filepath = filepath;
+	store->journal_path = NULL;
+	if(store->journal_fd != -1) {
+		close(store->journal_fd);
+		store->journal_fd = -1;
+	}
+	store->pending_changes = 0;
+	uloop_timeout_set(&store->token_timer, store->token_delay);
+	return 0;
+}
+
+/* A record which cannot be read ends the journal. */
+#define PAS_JE(test, errmsg, ...) \
+		if(test) { \
+			PA_WARNING("Invalid journal %s - "errmsg" at record %d", filepath, ##__VA_ARGS__, (int)i); \
+			goto tail; \
+		}
+
+/* Reads the journal into the cache, and gets the last token count.
+ * Reading stops at the first truncated or invalid record, as when the system
+ * went down while appending. When repair is set, the file is truncated there,
+ * so that new records are not appended after garbage. */
+static int pa_store_journal_read(struct pa_store *store, const char *filepath,
+		uint32_t *token_count, int repair)
+{
+	const struct pa_store_jrecord *r;
+	char (*names)[PA_STORE_NAMELEN] = NULL, (*n)[PA_STORE_NAMELEN];
+	size_t n_names = 0, pos, i;
+	struct pa_store_link *l;
+	struct pa_store_prefix *p;
+	uint16_t link_id;
+	struct stat st;
+	pa_prefix px;
+	pa_plen plen;
+	uint8_t *map;
+	int fd, err = 0;
+
+	if((fd = open(filepath, O_RDONLY, 0)) == -1) {
+		PA_WARNING("Cannot open file %s (read mode) - %s", filepath, strerror(errno));
+		return -1;
+	}
+
+	if(fstat(fd, &st)) {
+		PA_WARNING("Cannot stat file %s - %s", filepath, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if(!st.st_size) { //New journal
+		close(fd);
+		return 0;
+	}
+
+	if((size_t)st.st_size < sizeof(*r) + sizeof(uint32_t) ||
+			(map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		PA_WARNING("Cannot map file %s - %s", filepath, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	r = (const struct pa_store_jrecord *)map;
+	if(r->op != PA_STORE_JOP_HEADER || r->len != sizeof(uint32_t) ||
+			pa_store_journal_get32(r->data) != PA_STORE_JOURNAL_MAGIC) {
+		PA_WARNING("Invalid journal header in %s", filepath);
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	store->journal_replay = 1;
+	for(i = 1, pos = sizeof(*r) + r->len; pos < (size_t)st.st_size;
+			i++, pos += sizeof(*r) + r->len) {
+		r = (const struct pa_store_jrecord *)(map + pos);
+		PAS_JE(pos + sizeof(*r) > (size_t)st.st_size ||
+				pos + sizeof(*r) + r->len > (size_t)st.st_size, "Truncated record");
+		switch (r->op) {
+		case PA_STORE_JOP_LINK:
+			PAS_JE(r->len < sizeof(uint16_t) || !(link_id = pa_store_journal_get16(r->data)), "Invalid link id");
+			PAS_JE(r->len - sizeof(uint16_t) >= PA_STORE_NAMELEN, "Link name is too long");
+			if(link_id >= n_names) {
+				if(!(n = realloc(names, (link_id + 1) * sizeof(*names)))) {
+					PA_WARNING("Cannot allocate journal link names");
+					err = -1;
+					goto out;
+				}
+				memset(n + n_names, 0, (link_id + 1 - n_names) * sizeof(*names));
+				names = n;
+				n_names = link_id + 1;
+			}
+			memcpy(names[link_id], r->data + sizeof(uint16_t), r->len - sizeof(uint16_t));
+			names[link_id][r->len - sizeof(uint16_t)] = '\0';
+			break;
+		case PA_STORE_JOP_PREFIX:
+		case PA_STORE_JOP_DEL:
+			PAS_JE(r->len < sizeof(uint16_t) + 1, "Invalid prefix record");
+			link_id = pa_store_journal_get16(r->data);
+			plen = r->data[2];
+			PAS_JE(link_id >= n_names || !names[link_id][0], "Unknown link id %d", (int)link_id);
+			PAS_JE(plen > 128 || r->len != sizeof(uint16_t) + 1 + (plen + 7) / 8, "Invalid prefix length");
+			memset(&px, 0, sizeof(px));
+			bmemcpy(&px, r->data + 3, 0, plen);
+			if(r->op == PA_STORE_JOP_PREFIX) {
+				if(!(l = pa_store_link_goc(store, names[link_id], 1))) {
+					PA_WARNING("Cannot allocate journal link %s", names[link_id]);
+					err = -1;
+					goto out;
+				}
+				pa_store_cache(store, l, &px, plen);
+			} else if((l = pa_store_link_goc(store, names[link_id], 0)) &&
+					(p = pa_store_prefix_get(l, &px, plen))) {
+				pa_store_uncache(store, l, p);
+			}
+			break;
+		case PA_STORE_JOP_WTOKEN:
+			PAS_JE(r->len != sizeof(uint32_t), "Invalid token record");
+			if(token_count)
+				*token_count = pa_store_journal_get32(r->data);
+			break;
+		default:
+			PAS_JE(1, "Unknown type %d", (int)r->op);
+		}
+	}
+
+tail:
+	if(pos < (size_t)st.st_size) {
+		PA_WARNING("Ignoring the last %d bytes of %s", (int)((size_t)st.st_size - pos), filepath);
+		if(repair && truncate(filepath, pos))
+			PA_WARNING("Cannot truncate %s - %s", filepath, strerror(errno));
+	}
+
+out:
+	store->journal_replay = 0;
+	free(names);
+	munmap(map, st.st_size);
+	return err;
+}
+
+int pa_store_journal_load(struct pa_store *store, const char *filepath)
+{
+	return pa_store_journal_read(store, filepath, NULL, 0);
+}
+
+int pa_store_set_journal(struct pa_store *store, const char *filepath,
+		uint32_t save_delay, uint32_t token_delay)
+{
+	int fd;
+	uint32_t token_count = PA_STORE_WTOKENS_DEFAULT;
+	uloop_timeout_cancel(&store->save_timer);
+	uloop_timeout_cancel(&store->token_timer);
+	if(store->journal_fd != -1) {
+		close(store->journal_fd);
+		store->journal_fd = -1;
+	}
+
+	if((fd = open(filepath, O_WRONLY | O_CREAT, 0664)) == -1) {
+		PA_WARNING("Could not open file (Or incorrect authorizations) %s: %s", filepath, strerror(errno));
+		store->journal_path = NULL;
+		return -1;
+	}
+	close(fd);
+
+	/* The journal is read once, to load the cache and get the token counter. */
+	if(pa_store_journal_read(store, filepath, &token_count, 1)) {
+		store->journal_path = NULL;
+		return -1;
+	}
+
+	/* The journal is rewritten from the cache on first save. */
+	store->token_count = token_count;
+	store->save_delay = save_delay;
+	store->token_delay = token_delay;
+	store->filepath = NULL;
+	store->journal_path = filepath;
+	store->journal_records = 0;
+	pa_store_journal_reset_buf(store);
 	store->pending_changes = 0;
 	uloop_timeout_set(&store->token_timer, store->token_delay);
 	return 0;
@@ -397,6 +882,8 @@ void pa_store_init(struct pa_store *store, uint32_t max_prefixes)
 	store->max_prefixes = max_prefixes;
 	INIT_LIST_HEAD(&store->links);
 	INIT_LIST_HEAD(&store->prefixes);
+	avl_init(&store->link_names, avl_strcmp, false, NULL);
+	avl_init(&store->link_ptrs, pa_store_ptr_comp, true, NULL);
 	store->filepath = NULL;
 	store->n_prefixes = 0;
 	store->pending_changes = 0;
@@ -405,6 +892,15 @@ void pa_store_init(struct pa_store *store, uint32_t max_prefixes)
 	store->token_timer.pending = 0;
 	store->token_timer.cb = pa_token_to;
 	store->token_count = 0;
+	store->journal_path = NULL;
+	store->journal_fd = -1;
+	store->journal_buf = NULL;
+	store->journal_buf_len = 0;
+	store->journal_buf_size = 0;
+	store->journal_buf_records = 0;
+	store->journal_records = 0;
+	store->journal_link_id = 0;
+	store->journal_replay = 0;
 }
 
 void pa_store_bind(struct pa_store *store, struct pa_core *core,
@@ -424,20 +920,16 @@ void pa_store_unbind(struct pa_store_bound *bound)
 
 pa_rule_priority pa_store_get_max_priority(struct pa_rule *rule, struct pa_ldp *ldp)
 {
+	struct pa_store_rule *rule_s = container_of(rule, struct pa_store_rule, rule);
+	if(!ldp) //Upper bound
+		return rule_s->rule_priority;
+
 	if(ldp->best_assignment || ldp->published) //No override
 		return 0;
 
-	struct pa_store_rule *rule_s = container_of(rule, struct pa_store_rule, rule);
-	struct pa_store *store = rule_s->store;
 	struct pa_store_link *l;
-	list_for_each_entry(l, &store->links, le) {
-		if(l->link == ldp->link) {
-			if(l->n_prefixes)
-				return rule_s->rule_priority;
-			else
-				return 0;
-		}
-	}
+	if((l = pa_store_link_get(rule_s->store, ldp->link)) && l->n_prefixes)
+		return rule_s->rule_priority;
 	return 0;
 }
 
@@ -457,11 +949,7 @@ enum pa_rule_target pa_store_match(struct pa_rule *rule, struct pa_ldp *ldp,
 		rule_s->get_plen_range(rule, ldp, &min, &max);
 
 	/* We checked that there is a candidate during get_max_priority call */
-	struct pa_store_link *l;
-	list_for_each_entry(l, &store->links, le) {
-		if(l->link == ldp->link) //Will happen
-			break;
-	}
+	struct pa_store_link *l = pa_store_link_get(store, ldp->link);
 
 	//Find a matching prefix
 	struct pa_store_prefix *prefix;
@@ -61,6 +61,39 @@
 /* Maximum number of write tokens */
 #define PA_STORE_WTOKENS_MAX     100
 
+/* Binary journal format.
+ *
+ * The journal is a sequence of variable-length records, made of a type, a
+ * payload length and the payload. Integers are stored in network byte order.
+ * It starts with a header record, and is only appended to, until it is
+ * compacted by rewriting the current cache content into a new file.
+ * Link names are written once in a link record, and are then referred to by
+ * their id. */
+#define PA_STORE_JOURNAL_MAGIC 0x70616a31
+
+/* Journal record types. */
+enum pa_store_jop {
+	PA_STORE_JOP_HEADER = 1, /* u32 PA_STORE_JOURNAL_MAGIC */
+	PA_STORE_JOP_LINK,       /* u16 link_id, link name (without '\0') */
+	PA_STORE_JOP_PREFIX,     /* u16 link_id, u8 plen, prefix bytes cached for link_id */
+	PA_STORE_JOP_DEL,        /* u16 link_id, u8 plen, prefix bytes removed from link_id */
+	PA_STORE_JOP_WTOKEN,     /* u32 write token count */
+};
+
+struct pa_store_jrecord {
+	uint8_t op;
+	uint8_t len; /* Payload length */
+	uint8_t data[];
+};
+
+/* Maximum record length (link records are the largest). */
+#define PA_STORE_JRECORD_MAXLEN \
+	(sizeof(struct pa_store_jrecord) + sizeof(uint16_t) + PA_STORE_NAMELEN)
+
+/* The journal is compacted when it holds more than twice the number of
+ * cached prefixes plus this number of records. */
+#define PA_STORE_JOURNAL_SLACK 64
+
 /**
  * PA storage main structure.
  */
@@ -72,6 +105,12 @@ struct pa_store {
 	/* Tree containing pa_store Links */
 	struct list_head links;
 
+	/* Links indexed by name. */
+	struct avl_tree link_names;
+
+	/* Links indexed by associated pa_link (when not NULL). */
+	struct avl_tree link_ptrs;
+
 	/* All cached prefixes */
 	struct list_head prefixes;
 
@@ -105,6 +144,27 @@ struct pa_store {
 
 	/* Counts time to add tokens. */
 	struct uloop_timeout token_timer;
+
+	/* Path of the binary journal, used instead of filepath when set. */
+	const char *journal_path;
+
+	/* Journal opened in append mode, or -1 when it must be compacted. */
+	int journal_fd;
+
+	/* Records waiting to be appended to the journal. */
+	uint8_t *journal_buf;
+	size_t journal_buf_len;     /* In bytes */
+	size_t journal_buf_size;    /* In bytes */
+	uint32_t journal_buf_records;
+
+	/* Number of records in the journal file. */
+	uint32_t journal_records;
+
+	/* Last link id used in the journal. */
+	uint16_t journal_link_id;
+
+	/* Set while the journal is being read. */
+	uint8_t journal_replay;
 };
 
 /**
@@ -152,12 +212,18 @@ struct pa_store_link {
 	/* PRIVATE to pa_store */
 	struct list_head le;      /* Linked in pa_store. */
 	struct list_head prefixes;/* List of pa_store entries. */
+	struct avl_tree prefix_tree; /* pa_store entries indexed by prefix. */
+	struct avl_node name_node; /* Indexed by name in pa_store. */
+	struct avl_node ptr_node; /* Indexed by pa_link in pa_store. */
 	uint32_t n_prefixes;      /* Number of entries currently stored for this Link. */
+	uint16_t journal_id;      /* Id of the link name in the journal, or 0. */
 };
 
 struct pa_store_prefix {
 	struct list_head in_store;
 	struct list_head in_link;
+	struct pa_store_link *link;
+	struct avl_node in_tree;
 	pa_prefix prefix;
 	pa_plen plen;
 };
@@ -190,6 +256,7 @@ int pa_store_set_file(struct pa_store *, const char *filepath,
  * Loads the file into the cache.
  *
  * The content is considered more recent than the cached information.
+ * Reading stops at the first truncated or invalid record.
  *
  * @param store The PA store structure.
  * @param filepath Path to the file being read.
@@ -197,6 +264,38 @@ int pa_store_set_file(struct pa_store *, const char *filepath,
  */
 int pa_store_load(struct pa_store *store, const char *filepath);
 
+/**
+ * Sets the binary journal to be used for stable storage.
+ *
+ * When set, changes are appended to the journal instead of rewriting the
+ * whole text file. Appends are written and synced in batches, with the same
+ * delays and write tokens as the text file. The text file functions
+ * (pa_store_load and pa_store_save) can still be used for import and export.
+ *
+ * The journal content is loaded into the cache (there is no need to call
+ * pa_store_journal_load first). Reading stops at the first truncated or
+ * invalid record, and the journal is truncated there.
+ *
+ * @param store The PA store structure.
+ * @param filepath Path to the journal.
+ * @param save_delay Time before a modification is saved.
+ * @param token_delay Time before an additional token is added.
+ * @return 0 on success and -1 otherwise (errno is set).
+ */
+int pa_store_set_journal(struct pa_store *, const char *filepath,
+		uint32_t save_delay, uint32_t token_delay);
+
+/**
+ * Loads a binary journal into the cache.
+ *
+ * The content is considered more recent than the cached information.
+ *
+ * @param store The PA store structure.
+ * @param filepath Path to the journal being read.
+ * @return 0 on success, -1 otherwise.
+ */
+int pa_store_journal_load(struct pa_store *store, const char *filepath);
+
 /**
  * Manually triggers cache saving into the file.
  *
@@ -228,8 +327,10 @@ void pa_store_term(struct pa_store *store);
  *
  * When a link is added, cached entries with same link name are associated to
  * the link. When it is removed, cached entries are kept.
+ * Adding a link fails (and returns -1) when another added link uses the same
+ * (non-empty) name.
  */
-void pa_store_link_add(struct pa_store *, struct pa_store_link *);
+int pa_store_link_add(struct pa_store *, struct pa_store_link *);
 void pa_store_link_remove(struct pa_store *, struct pa_store_link *);
 
 /**
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ * Backend independent parts of the platform RPC client.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libubox/blobmsg.h>
+#include <libubox/blobmsg_json.h>
+
+#include "platform.h"
+
+bool platform_rpc_print(struct blob_attr *out)
+{
+	struct blob_attr *a;
+	unsigned rem, cnt = 0;
+	const char *text = NULL;
+
+	blobmsg_for_each_attr(a, out, rem) {
+		if (blobmsg_type(a) == BLOBMSG_TYPE_STRING && !strcmp(blobmsg_name(a), "text"))
+			text = blobmsg_get_string(a);
+		cnt++;
+	}
+	if (text && cnt == 1) {
+		fputs(text, stdout);
+		return true;
+	}
+
+	char *json = blobmsg_format_json_indent(out, true, true);
+	if (!json)
+		return false;
+	puts(json);
+	free(json);
+	return true;
+}
@@ -121,11 +121,8 @@ int platform_rpc_cli(const char *method, struct blob_attr *in)
 		if (rcvlen >= 0) {
 			resp.hdr.id_len = 0;
 			blob_set_raw_len(&resp.hdr, rcvlen + sizeof(resp.hdr));
-			char *json = blobmsg_format_json_indent(&resp.hdr, true, true);
-			if (json) {
-				puts(json);
+			if (platform_rpc_print(&resp.hdr))
 				ret = 0;
-			}
 		}
 
 		if (ret > 0)
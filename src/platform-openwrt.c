@@ -180,13 +180,8 @@ int platform_rpc_cli(const char *method, struct blob_attr *in)
 		return 3;
 	}
 
-	if (out) {
-		char *json = blobmsg_format_json_indent(out, true, true);
-		if (json) {
-			puts(json);
-			return 0;
-		}
-	}
+	if (out && platform_rpc_print(out))
+		return 0;
 
 	return 4;
 }
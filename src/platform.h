@@ -59,9 +59,13 @@ struct platform_rpc_method {
 };
 int platform_rpc_register(struct platform_rpc_method *method);
 
-// Call RPC function from your own program
+// Call RPC function from your own program and print the reply (as JSON,
+// or verbatim if it consists only of a "text" string)
 int platform_rpc_cli(const char *name, struct blob_attr *in);
 
+// Print an RPC reply: a lone "text" string verbatim, anything else as JSON
+bool platform_rpc_print(struct blob_attr *out);
+
 // Multicall RPC dispatcher
 int platform_rpc_multicall(int argc, char *const argv[]);
 
@@ -12,6 +12,7 @@
  */
 
 #include "udp46_i.h"
+#include "hnetd_trace.h"
 #include <errno.h>
 #include <unistd.h>
 #include <assert.h>
@@ -344,14 +345,16 @@ static void ufd_cb_4(struct uloop_fd *u, unsigned int events __unused)
 {
   udp46 s = container_of(u, udp46_s, ufds[0]);
   if (s->cb)
-    s->cb(s, s->cb_context);
+    HNETD_TRACE_CALL(HNETD_TRACE_FD, "udp46", s->cb,
+                     s->cb(s, s->cb_context));
 }
 
 static void ufd_cb_6(struct uloop_fd *u, unsigned int events __unused)
 {
   udp46 s = container_of(u, udp46_s, ufds[1]);
   if (s->cb)
-    s->cb(s, s->cb_context);
+    HNETD_TRACE_CALL(HNETD_TRACE_FD, "udp46", s->cb,
+                     s->cb(s, s->cb_context));
 }
 
 void udp46_set_readable_cb(udp46 s, udp46_readable_cb cb,
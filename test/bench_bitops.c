@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ */
+
+/*
+ * bitops performance benchmark.
+ *
+ * The word-parallel hamming kernels are run over random IPv6 prefixes,
+ * as well as their bit per bit reference implementations. The time of
+ * each is printed to stdout as a single JSON object (as with bench_btrie):
+ *
+ * bench_bitops [-n prefixes] [-r seed]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bitops_ref.h"
+
+static int64_t bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char **argv)
+{
+	struct in6_addr *a, *b, d;
+	uint8_t *plen;
+	int64_t start, fast, ref;
+	size_t sum_fast = 0, sum_ref = 0;
+	int size = 100000, seed = 0;
+	int i, c;
+
+	while((c = getopt(argc, argv, "n:r:")) > 0) {
+		switch (c) {
+		case 'n':
+			size = atoi(optarg);
+			break;
+		case 'r':
+			seed = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n prefixes] [-r seed]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	a = malloc(size * sizeof(*a));
+	b = malloc(size * sizeof(*b));
+	plen = malloc(size);
+	if(size < 1 || !a || !b || !plen)
+		return 1;
+
+	srand(seed);
+	for(i = 0; i < size; i++) {
+		bitops_random_addr(&a[i]);
+		bitops_random_addr(&b[i]);
+		plen[i] = (i % 4)?(rand() % 129):128;
+	}
+
+	start = bench_now();
+	for(i = 0; i < size; i++) {
+		sum_fast += hamming_distance_64((uint64_t *)&a[i], (uint64_t *)&b[i], plen[i] / 2);
+		sum_fast += hamming_minimize(a[i].s6_addr, b[i].s6_addr, d.s6_addr, plen[i] / 2, plen[i] - plen[i] / 2);
+	}
+	fast = bench_now();
+	for(i = 0; i < size; i++) {
+		sum_ref += hamming_distance_ref(a[i].s6_addr, b[i].s6_addr, plen[i] / 2);
+		sum_ref += hamming_minimize_ref(a[i].s6_addr, b[i].s6_addr, d.s6_addr, plen[i] / 2, plen[i] - plen[i] / 2);
+	}
+	ref = bench_now();
+
+	printf("{\"prefixes\":%d,\"seed\":%d,\"sum\":%zu,\"word_us\":%"PRId64",\"bit_us\":%"PRId64"}\n",
+			size, seed, sum_fast, fast - start, ref - fast);
+
+	free(a);
+	free(b);
+	free(plen);
+	return (sum_fast == sum_ref)?0:1;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ */
+
+/*
+ * btrie performance benchmark.
+ *
+ * Random IPv6 prefixes (mostly /48 to /64, and some /128) inside
+ * 2001:db8::/32 are inserted, looked up, used for available key space
+ * computations and removed. The time of each phase is printed to stdout
+ * as a single JSON object, so that it can be collected per commit and
+ * compared (as with bench_dncp):
+ *
+ * bench_btrie [-n prefixes] [-q queries] [-r seed]
+ */
+
+#include "btrie.h"
+
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+struct bench_prefix {
+	struct in6_addr prefix;
+	uint8_t plen;
+};
+
+static int64_t bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void bench_random_prefix(struct bench_prefix *p, int i)
+{
+	int j;
+	memset(p, 0, sizeof(*p));
+	p->prefix.s6_addr[0] = 0x20;
+	p->prefix.s6_addr[1] = 0x01;
+	p->prefix.s6_addr[2] = 0x0d;
+	p->prefix.s6_addr[3] = 0xb8;
+	for(j = 4; j < 16; j++)
+		p->prefix.s6_addr[j] = rand();
+	p->plen = (i % 4)?(48 + rand() % 17):128;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_prefix *prefixes, q;
+	struct btrie_element *elements, *e;
+	struct btrie t;
+	int64_t start, add, lookup, space, del;
+	uint64_t s = 0;
+	int size = 100000, queries = 10000, seed = 0;
+	int i, c, found = 0;
+	struct rusage ru;
+
+	while((c = getopt(argc, argv, "n:q:r:")) > 0) {
+		switch (c) {
+		case 'n':
+			size = atoi(optarg);
+			break;
+		case 'q':
+			queries = atoi(optarg);
+			break;
+		case 'r':
+			seed = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n prefixes] [-q queries] [-r seed]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	prefixes = malloc(size * sizeof(*prefixes));
+	elements = malloc(size * sizeof(*elements));
+	if(size < 1 || !prefixes || !elements)
+		return 1;
+
+	srand(seed);
+	for(i = 0; i < size; i++)
+		bench_random_prefix(&prefixes[i], i);
+
+	btrie_init(&t);
+	start = bench_now();
+	for(i = 0; i < size; i++)
+		btrie_add(&t, &elements[i], (btrie_key_t *)&prefixes[i].prefix, prefixes[i].plen);
+	add = bench_now();
+	for(i = 0; i < size; i++) {
+		btrie_for_each_up(e, &t, (btrie_key_t *)&prefixes[i].prefix, 128)
+			found++;
+	}
+	lookup = bench_now();
+	for(i = 0; i < queries; i++) { //Free space in random /40s
+		bench_random_prefix(&q, i);
+		s += btrie_available_space(&t, (btrie_key_t *)&q.prefix, 40, 64) >> 32;
+	}
+	space = bench_now();
+	getrusage(RUSAGE_SELF, &ru);
+	for(i = 0; i < size; i++)
+		btrie_remove(&elements[i]);
+	del = bench_now();
+
+	printf("{\"prefixes\":%d,\"queries\":%d,\"seed\":%d,\"found\":%d,\"space\":%"PRIu64","
+			"\"add_us\":%"PRId64",\"lookup_us\":%"PRId64",\"space_us\":%"PRId64",\"remove_us\":%"PRId64","
+			"\"maxrss_kb\":%ld}\n",
+			size, queries, seed, found, s,
+			add - start, lookup - add, space - lookup, del - space, ru.ru_maxrss);
+
+	free(prefixes);
+	free(elements);
+	return btrie_empty(&t)?0:1;
+}
@@ -0,0 +1,404 @@
+/*
+ * $Id: bench_dncp.c $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+/*
+ * DNCP (HNCP profile) performance benchmark built on net_sim.
+ *
+ * A topology of the given shape and size is generated, simulated
+ * (with fake time) until it converges, then optionally churned by
+ * flapping random links, and finally left running in steady state
+ * for a while. The result is printed to stdout as a single JSON
+ * object, so that it can be collected per commit and compared:
+ *
+ * bench_dncp [-t line|grid|star|random] [-n nodes] [-r seed]
+ *            [-c churn events] [-i churn interval ms]
+ *            [-d steady state seconds] [-v]
+ */
+
+#ifdef L_LEVEL
+#undef L_LEVEL
+#endif /* L_LEVEL */
+#define L_LEVEL 5
+#define DISABLE_HNCP_PA
+#define DISABLE_HNCP_SD
+#define DISABLE_HNCP_MULTICAST
+#include "hncp.h"
+#include "net_sim.h"
+#include "sput.h"
+
+#include <math.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+/* Upper bound for any single simulation phase (in simulated time). */
+#define BENCH_PHASE_MAX (3600 * HNETD_TIME_PER_SECOND)
+
+typedef struct {
+  dncp_ep ep1, ep2;
+} bench_link_s, *bench_link;
+
+static struct {
+  const char *topology;
+  int num_nodes;
+  int seed;
+  int churn;
+  int churn_interval;
+  int steady;
+
+  dncp *nodes;
+  int *num_eps;
+  bench_link links;
+  int num_links, max_links;
+
+  bool converged;
+  hnetd_time_t convergence_time;
+  hnetd_time_t reconvergence_max, reconvergence_sum;
+  int reconverged;
+} b = {
+  .topology = "line",
+  .num_nodes = 10,
+  .seed = 1,
+  .churn_interval = 60000,
+  .steady = 60,
+};
+
+static dncp_ep _new_ep(int i, const char *name)
+{
+  char buf[16];
+
+  if (!name)
+    {
+      sprintf(buf, "l%d", b.num_eps[i]++);
+      name = buf;
+    }
+  return net_sim_dncp_find_ep_by_name(b.nodes[i], name);
+}
+
+static void _connect(int i, const char *n1, int j, const char *n2)
+{
+  dncp_ep ep1 = _new_ep(i, n1);
+  dncp_ep ep2 = _new_ep(j, n2);
+
+  if (b.num_links == b.max_links)
+    {
+      b.max_links = b.max_links ? b.max_links * 2 : 64;
+      b.links = realloc(b.links, b.max_links * sizeof(*b.links));
+      sput_fail_unless(b.links, "realloc links");
+    }
+  b.links[b.num_links].ep1 = ep1;
+  b.links[b.num_links].ep2 = ep2;
+  b.num_links++;
+  net_sim_set_connected(ep1, ep2, true);
+  net_sim_set_connected(ep2, ep1, true);
+}
+
+static void _topology_line(void)
+{
+  int i;
+
+  for (i = 0 ; i < b.num_nodes - 1 ; i++)
+    _connect(i, "down", i + 1, "up");
+}
+
+static void _topology_grid(void)
+{
+  int side = ceil(sqrt(b.num_nodes));
+  int i;
+
+  for (i = 0 ; i < b.num_nodes ; i++)
+    {
+      if ((i % side) != side - 1 && i + 1 < b.num_nodes)
+        _connect(i, "e", i + 1, "w");
+      if (i + side < b.num_nodes)
+        _connect(i, "s", i + side, "n");
+    }
+}
+
+static void _topology_star(void)
+{
+  int i;
+
+  for (i = 1 ; i < b.num_nodes ; i++)
+    _connect(0, NULL, i, "up");
+}
+
+static int _find(int *parent, int i)
+{
+  while (parent[i] != i)
+    i = parent[i] = parent[parent[i]];
+  return i;
+}
+
+/* Random geometric graph in an unit square, with radius picked for an
+ * average degree of ~4. Disconnected components are joined to the
+ * closest node of the component of node 0. */
+static void _topology_random(void)
+{
+  int n = b.num_nodes;
+  double *x = calloc(n, sizeof(double)), *y = calloc(n, sizeof(double));
+  int *parent = calloc(n, sizeof(int));
+  double r2 = 4.0 / (M_PI * n);
+  int i, j;
+
+  sput_fail_unless(x && y && parent, "calloc");
+  for (i = 0 ; i < n ; i++)
+    {
+      x[i] = (double)random() / RAND_MAX;
+      y[i] = (double)random() / RAND_MAX;
+      parent[i] = i;
+    }
+  for (i = 0 ; i < n ; i++)
+    for (j = i + 1 ; j < n ; j++)
+      {
+        double dx = x[i] - x[j], dy = y[i] - y[j];
+
+        if (dx * dx + dy * dy < r2)
+          {
+            _connect(i, NULL, j, NULL);
+            parent[_find(parent, i)] = _find(parent, j);
+          }
+      }
+  for (i = 1 ; i < n ; i++)
+    {
+      double best = INFINITY;
+      int bj = -1;
+
+      if (_find(parent, i) == _find(parent, 0))
+        continue;
+      for (j = 0 ; j < n ; j++)
+        {
+          double dx = x[i] - x[j], dy = y[i] - y[j];
+
+          if (_find(parent, j) == _find(parent, 0)
+              && dx * dx + dy * dy < best)
+            {
+              best = dx * dx + dy * dy;
+              bj = j;
+            }
+        }
+      _connect(i, NULL, bj, NULL);
+      parent[_find(parent, i)] = _find(parent, bj);
+    }
+  free(x);
+  free(y);
+  free(parent);
+}
+
+static struct {
+  const char *name;
+  void (*create)(void);
+} topologies[] = {
+  { "line", _topology_line },
+  { "grid", _topology_grid },
+  { "star", _topology_star },
+  { "random", _topology_random },
+};
+
+/* Same network hash everywhere, and everyone knows about everyone
+ * (net_sim_is_converged also insists on origination times being in
+ * sync, which is not the point here). */
+static bool _converged(net_sim s)
+{
+  net_node n, fn = NULL;
+
+  list_for_each_entry(n, &s->nodes, lh)
+    {
+      if (n->d->network_hash_dirty
+          || (int)n->d->nodes.avl.count != s->node_count)
+        return false;
+      if (!fn)
+        fn = n;
+      else if (memcmp(&fn->d->network_hash, &n->d->network_hash,
+                      HNCP_HASH_LEN))
+        return false;
+    }
+  return true;
+}
+
+/* Run the simulation until (simulated) time t, or until converged if
+ * wait_converged is set. Returns whether the network is converged. */
+static bool _run(net_sim s, hnetd_time_t t, bool wait_converged)
+{
+  while (hnetd_time() < t && fu_loop(1) == 0)
+    {
+      while (fu_poll());
+      if (wait_converged && _converged(s))
+        return true;
+    }
+  if (hnetd_time() < t)
+    set_hnetd_time(t);
+  return _converged(s);
+}
+
+static void _log(int priority, const char *format, ...)
+{
+  va_list a;
+
+  fprintf(stderr, "[%d]", priority);
+  va_start(a, format);
+  vfprintf(stderr, format, a);
+  va_end(a);
+  fprintf(stderr, "\n");
+}
+
+static uint64_t _cpu_us(struct rusage *ru)
+{
+  return (uint64_t)(ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000
+    + ru->ru_utime.tv_usec + ru->ru_stime.tv_usec;
+}
+
+void bench_dncp(void)
+{
+  net_sim_s s;
+  hnetd_stats_s stats;
+  net_node n;
+  struct rusage ru;
+  hnetd_time_t t;
+  unsigned int i;
+  int j;
+
+  net_sim_init(&s);
+  s.disable_pa = true;
+  s.disable_sd = true;
+  s.disable_multicast = true;
+
+  b.nodes = calloc(b.num_nodes, sizeof(*b.nodes));
+  b.num_eps = calloc(b.num_nodes, sizeof(*b.num_eps));
+  sput_fail_unless(b.nodes && b.num_eps, "calloc nodes");
+  for (j = 0 ; j < b.num_nodes ; j++)
+    {
+      char buf[16];
+
+      sprintf(buf, "node%d", j);
+      b.nodes[j] = net_sim_find_dncp(&s, buf);
+    }
+  for (i = 0 ; i < sizeof(topologies) / sizeof(topologies[0]) ; i++)
+    if (!strcmp(topologies[i].name, b.topology))
+      {
+        topologies[i].create();
+        break;
+      }
+  sput_fail_unless(i < sizeof(topologies) / sizeof(topologies[0]),
+                   "known topology");
+
+  /* Initial convergence */
+  b.converged = _run(&s, s.start + BENCH_PHASE_MAX, true);
+  b.convergence_time = hnetd_time() - s.start;
+
+  /* Churn: flap a random link, and wait for the network to
+   * reconverge after it comes back. */
+  for (j = 0 ; j < b.churn && b.converged && b.num_links ; j++)
+    {
+      bench_link l = &b.links[random() % b.num_links];
+
+      net_sim_set_connected(l->ep1, l->ep2, false);
+      net_sim_set_connected(l->ep2, l->ep1, false);
+      _run(&s, hnetd_time() + b.churn_interval, false);
+      net_sim_set_connected(l->ep1, l->ep2, true);
+      net_sim_set_connected(l->ep2, l->ep1, true);
+      t = hnetd_time();
+      b.converged = _run(&s, t + BENCH_PHASE_MAX, true);
+      t = hnetd_time() - t;
+      b.reconverged++;
+      b.reconvergence_sum += t;
+      if (t > b.reconvergence_max)
+        b.reconvergence_max = t;
+    }
+
+  /* Steady state */
+  if (b.converged)
+    b.converged = _run(&s, hnetd_time() + b.steady * HNETD_TIME_PER_SECOND,
+                       false);
+
+  t = hnetd_time() - s.start;
+  getrusage(RUSAGE_SELF, &ru);
+  hnetd_stats_reset(&stats);
+  list_for_each_entry(n, &s.nodes, lh)
+    hnetd_stats_merge(&stats, dncp_get_stats(n->d));
+  printf("{\"topology\":\"%s\",\"nodes\":%d,\"links\":%d,\"seed\":%d,"
+         "\"churn\":%d,\"converged\":%s,\"convergence_ms\":%lld,"
+         "\"reconvergence_avg_ms\":%lld,\"reconvergence_max_ms\":%lld,"
+         "\"simulated_ms\":%lld,\"cpu_ms\":%.1f,"
+         "\"cpu_ms_per_simulated_s\":%.3f,"
+         "\"messages_per_node\":%.1f,\"bytes_per_node\":%.1f,"
+         "\"unicasts\":%d,\"multicasts\":%d,\"peak_rss_kb\":%ld}\n",
+         b.topology, b.num_nodes, b.num_links, b.seed,
+         b.reconverged, b.converged ? "true" : "false",
+         (long long)b.convergence_time,
+         (long long)(b.reconverged ? b.reconvergence_sum / b.reconverged : 0),
+         (long long)b.reconvergence_max,
+         (long long)t, _cpu_us(&ru) / 1000.0,
+         t ? _cpu_us(&ru) / (double)t : 0.0,
+         (double)stats.counters[HNETD_STATS_DNCP_SENT_PACKETS]
+         / b.num_nodes,
+         (double)stats.counters[HNETD_STATS_DNCP_SENT_BYTES]
+         / b.num_nodes,
+         s.sent_unicast, s.sent_multicast, ru.ru_maxrss);
+
+  /* Churn may leave messages in flight; net_sim_uninit frees them. */
+  net_sim_uninit(&s);
+  free(b.nodes);
+  free(b.num_eps);
+  free(b.links);
+}
+
+int main(int argc, char **argv)
+{
+  int c;
+
+  /* Keep stdout for the result only */
+  hnetd_log = _log;
+  log_level = LOG_WARNING;
+  while ((c = getopt(argc, argv, "t:n:r:c:i:d:v")) > 0)
+    {
+      switch (c)
+        {
+        case 't':
+          b.topology = optarg;
+          break;
+        case 'n':
+          b.num_nodes = atoi(optarg);
+          break;
+        case 'r':
+          b.seed = atoi(optarg);
+          break;
+        case 'c':
+          b.churn = atoi(optarg);
+          break;
+        case 'i':
+          b.churn_interval = atoi(optarg);
+          break;
+        case 'd':
+          b.steady = atoi(optarg);
+          break;
+        case 'v':
+          log_level = LOG_DEBUG;
+          break;
+        default:
+          fprintf(stderr, "Usage: %s [-t line|grid|star|random] [-n nodes]"
+                  " [-r seed] [-c churn] [-i churn interval ms]"
+                  " [-d steady state seconds] [-v]\n", argv[0]);
+          return 1;
+        }
+    }
+  if (b.num_nodes < 1)
+    return 1;
+  srandom(b.seed);
+
+  openlog("bench_dncp", LOG_CONS | LOG_PERROR, LOG_DAEMON);
+  sput_start_testing();
+  /* Per-check output of sput is far too verbose for this. */
+  if (log_level < LOG_DEBUG)
+    sput_set_output_stream(fopen("/dev/null", "w"));
+  else
+    sput_set_output_stream(stderr);
+  sput_enter_suite("bench_dncp");
+  sput_run_test(bench_dncp);
+  sput_leave_suite();
+  sput_finish_testing();
+  return b.converged ? sput_get_return_value() : 2;
+}
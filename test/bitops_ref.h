@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ */
+
+/*
+ * Bit per bit reference implementations of the bitops kernels,
+ * shared by test_bitops and bench_bitops.
+ */
+
+#ifndef BITOPS_REF_H_
+#define BITOPS_REF_H_
+
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitops.h"
+
+/* Bit per bit reference implementations */
+static size_t hamming_distance_ref(const uint8_t *m1, const uint8_t *m2, size_t nbits)
+{
+	size_t i, dst = 0;
+	for(i = 0; i < nbits; i++)
+		dst += ((m1[i/8] ^ m2[i/8]) & (0x80 >> (i%8)))?1:0;
+	return dst;
+}
+
+static size_t hamming_minimize_ref(const uint8_t *max, const uint8_t *target,
+		uint8_t *dst, size_t start_len, size_t nbits)
+{
+	size_t ret = 0;
+	size_t end = start_len + nbits;
+	size_t n = start_len;
+	while(n != end && !(max[n/8] & (0x80 >> (n%8)))) {
+		if(target[n/8] & (0x80 >> (n%8)))
+			ret ++;
+		n++;
+	}
+	bmemcpy(dst, max, start_len, n - start_len);
+
+	nbits = end - n;
+	if(nbits) {
+		bmemcpy(dst, target, n, nbits);
+		if(bmemcmp_s(max, target, n, nbits) < 0) {
+			dst[n/8] = dst[n/8] & ~(0x80 >> (n%8));
+			ret++;
+		}
+	}
+	return ret;
+}
+
+static void bitops_random_addr(struct in6_addr *a)
+{
+	size_t i;
+	for(i = 0; i < sizeof(*a); i++)
+		a->s6_addr[i] = rand();
+	//Sparse leading bits, as in overflow prefixes
+	if(rand() % 2)
+		memset(a, 0, rand() % 16);
+}
+
+#endif /* BITOPS_REF_H_ */
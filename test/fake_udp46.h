@@ -0,0 +1,228 @@
+/*
+ * $Id: fake_udp46.h $
+ *
+ * Author: Markus Stenberg <markus stenberg@iki.fi>
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+/*
+ * In-memory replacement of udp46, for tests that run on fake_uloop
+ * (which has no file descriptors to poll).
+ *
+ * All sockets are on the same (loopback) host, and datagrams are
+ * routed solely by the destination port. Delivery happens from a zero
+ * timeout, so it is in-order and lossless, and time does not move
+ * while datagrams are in flight. The readable callback is called for
+ * as long as it keeps consuming datagrams (like level-triggered
+ * uloop_fd would, before the next timeout is run).
+ *
+ * fu_udp46_sent / fu_udp46_sent_bytes / fu_udp46_max_sent count what
+ * has been sent so far (by everyone).
+ */
+
+#ifndef FAKE_UDP46_H
+#define FAKE_UDP46_H
+
+#include "udp46.h"
+#include "fake_uloop.h"
+
+#include <libubox/list.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+
+/* Ports handed out for udp46_create(0) */
+#define FU_UDP46_EPHEMERAL_PORT 50000
+
+typedef struct fu_datagram_s {
+  struct list_head in_datagrams;
+  struct sockaddr_in6 src;
+  struct sockaddr_in6 dst;
+  size_t len;
+  unsigned char buf[0];
+} fu_datagram_s, *fu_datagram;
+
+struct udp46_struct {
+  struct list_head in_sockets;
+  uint16_t port;
+
+  udp46_readable_cb cb;
+  void *cb_context;
+
+  struct list_head datagrams;
+  int received;
+  struct uloop_timeout uto;
+};
+
+static LIST_HEAD(_fu_udp46s);
+static uint16_t _fu_udp46_next_port = FU_UDP46_EPHEMERAL_PORT;
+
+int fu_udp46_sent, fu_udp46_sent_bytes, fu_udp46_max_sent;
+
+static udp46 _fu_udp46_find(uint16_t port)
+{
+  udp46 s;
+
+  list_for_each_entry(s, &_fu_udp46s, in_sockets)
+    if (s->port == port)
+      return s;
+  return NULL;
+}
+
+static void _fu_udp46_addr(struct sockaddr_in6 *sa, uint16_t port)
+{
+  memset(sa, 0, sizeof(*sa));
+  sa->sin6_family = AF_INET6;
+#ifdef __APPLE__
+  sa->sin6_len = sizeof(*sa);
+#endif /* __APPLE__ */
+  sa->sin6_addr = in6addr_loopback;
+  sa->sin6_port = htons(port);
+}
+
+static void _fu_udp46_schedule(udp46 s)
+{
+  if (s->cb && !list_empty(&s->datagrams) && !s->uto.pending)
+    uloop_timeout_set(&s->uto, 0);
+}
+
+static void _fu_udp46_uto_cb(struct uloop_timeout *t)
+{
+  udp46 s = container_of(t, struct udp46_struct, uto);
+  int received;
+
+  while (s->cb && !list_empty(&s->datagrams))
+    {
+      received = s->received;
+      s->cb(s, s->cb_context);
+      if (s->received == received)
+        break;
+    }
+}
+
+udp46 udp46_create(uint16_t port)
+{
+  udp46 s;
+
+  if (!port)
+    while (_fu_udp46_find(port = _fu_udp46_next_port++));
+  if (_fu_udp46_find(port))
+    {
+      L_ERR("fake udp46 port %d already in use", (int)port);
+      return NULL;
+    }
+  if (!(s = calloc(1, sizeof(*s))))
+    return NULL;
+  s->port = port;
+  INIT_LIST_HEAD(&s->datagrams);
+  s->uto.cb = _fu_udp46_uto_cb;
+  list_add(&s->in_sockets, &_fu_udp46s);
+  return s;
+}
+
+void udp46_get_fds(udp46 s __unused, int *fd_v4, int *fd_v6)
+{
+  *fd_v4 = -1;
+  *fd_v6 = -1;
+}
+
+void udp46_set_readable_cb(udp46 s, udp46_readable_cb cb, void *cb_context)
+{
+  s->cb = cb;
+  s->cb_context = cb_context;
+  _fu_udp46_schedule(s);
+}
+
+ssize_t udp46_recv(udp46 s,
+                   struct sockaddr_in6 *src,
+                   struct sockaddr_in6 *dst,
+                   void *buf, size_t buf_size)
+{
+  fu_datagram dg;
+  size_t len;
+
+  if (list_empty(&s->datagrams))
+    return -1;
+  dg = list_first_entry(&s->datagrams, fu_datagram_s, in_datagrams);
+  /* Like recvmsg, truncate to the buffer. */
+  len = dg->len < buf_size ? dg->len : buf_size;
+  memcpy(buf, dg->buf, len);
+  if (src)
+    *src = dg->src;
+  if (dst)
+    *dst = dg->dst;
+  list_del(&dg->in_datagrams);
+  free(dg);
+  s->received++;
+  return len;
+}
+
+int udp46_send_iovec(udp46 s,
+                     const struct sockaddr_in6 *src __unused,
+                     const struct sockaddr_in6 *dst,
+                     struct iovec *iov, int iov_len)
+{
+  udp46 ds = _fu_udp46_find(ntohs(dst->sin6_port));
+  fu_datagram dg;
+  size_t len = 0;
+  int i;
+
+  for (i = 0 ; i < iov_len ; i++)
+    len += iov[i].iov_len;
+  fu_udp46_sent++;
+  fu_udp46_sent_bytes += len;
+  if ((int)len > fu_udp46_max_sent)
+    fu_udp46_max_sent = len;
+  if (!ds)
+    {
+      L_DEBUG("fake udp46: nobody at port %d", (int)ntohs(dst->sin6_port));
+      return len;
+    }
+  if (!(dg = malloc(sizeof(*dg) + len)))
+    return -1;
+  _fu_udp46_addr(&dg->src, s->port);
+  _fu_udp46_addr(&dg->dst, ds->port);
+  dg->len = 0;
+  for (i = 0 ; i < iov_len ; i++)
+    {
+      memcpy(dg->buf + dg->len, iov[i].iov_base, iov[i].iov_len);
+      dg->len += iov[i].iov_len;
+    }
+  list_add_tail(&dg->in_datagrams, &ds->datagrams);
+  _fu_udp46_schedule(ds);
+  return len;
+}
+
+int udp46_send(udp46 s,
+               const struct sockaddr_in6 *src,
+               const struct sockaddr_in6 *dst,
+               void *buf, size_t buf_size)
+{
+  struct iovec iov = { .iov_base = buf, .iov_len = buf_size };
+
+  return udp46_send_iovec(s, src, dst, &iov, 1);
+}
+
+void udp46_destroy(udp46 s)
+{
+  fu_datagram dg, dg2;
+
+  list_for_each_entry_safe(dg, dg2, &s->datagrams, in_datagrams)
+    {
+      list_del(&dg->in_datagrams);
+      free(dg);
+    }
+  uloop_timeout_cancel(&s->uto);
+  list_del(&s->in_sockets);
+  free(s);
+}
+
+static inline void fu_udp46_reset_counters(void)
+{
+  fu_udp46_sent = 0;
+  fu_udp46_sent_bytes = 0;
+  fu_udp46_max_sent = 0;
+}
+
+#endif /* FAKE_UDP46_H */
@@ -18,7 +18,7 @@
 
    The code's based on bits and pieces from test_pa and net_sim,
    merged to keep it in one place and reusable elsewhere too. The main
-   idea is that there's only ONE place where time and list of pending
+   idea is that there's only ONE place where time and (heap of) pending
    timeouts is kept, and that's here (just like in test_pa).
 
    As shared functionality, we provide replacement for hnetd_time(),
@@ -36,6 +36,7 @@
 #include "hnetd.h"
 
 #include <libubox/uloop.h>
+#include <libubox/avl.h>
 
 #include "sput.h"
 
@@ -48,7 +49,35 @@
 
 
 static hnetd_time_t _fu_time;
-LIST_HEAD(timeouts);
+
+/* Pending timeouts are kept in a binary heap ordered by (expiry time,
+ * sequence number); the sequence number keeps timeouts expiring at
+ * the same time in the order they were set. Each pending timeout has
+ * an entry in a side tree (keyed by the timeout) that tracks where in
+ * the heap it is, so that it can be moved or removed. */
+typedef struct {
+  struct avl_node in_timeouts;
+  int index;
+} fu_timeout_s, *fu_timeout;
+
+typedef struct {
+  fu_timeout ft;
+  struct uloop_timeout *t;
+  hnetd_time_t time;
+  uint64_t seq;
+} fu_heap_entry_s, *fu_heap_entry;
+
+static fu_heap_entry _fu_heap;
+static int _fu_heap_count, _fu_heap_size;
+static uint64_t _fu_seq;
+
+static int _fu_timeout_cmp(const void *k1, const void *k2,
+                           void *ptr __unused)
+{
+  return (k1 > k2) - (k1 < k2);
+}
+
+static AVL_TREE(_fu_timeouts, _fu_timeout_cmp, false, NULL);
 
 hnetd_time_t hnetd_time()
 {
@@ -57,9 +86,14 @@ hnetd_time_t hnetd_time()
 
 static inline void fu_init()
 {
+  fu_timeout ft, ft2;
+
   /*      12345678901 (> MAXINT, but not much over) */
   _fu_time = 10000000000;
-  INIT_LIST_HEAD(&timeouts);
+  /* Timeouts left pending by a previous user are simply forgotten. */
+  avl_remove_all_elements(&_fu_timeouts, ft, in_timeouts, ft2)
+    free(ft);
+  _fu_heap_count = 0;
 }
 
 static inline void fu_set_hnetd_time(hnetd_time_t v)
@@ -80,6 +114,64 @@ static hnetd_time_t _to_time(struct timeval *tv)
   return (int64_t)tv->tv_sec * HNETD_TIME_PER_SECOND + tv->tv_usec;
 }
 
+static inline bool _fu_heap_less(int i, int j)
+{
+  return _fu_heap[i].time < _fu_heap[j].time
+    || (_fu_heap[i].time == _fu_heap[j].time
+        && _fu_heap[i].seq < _fu_heap[j].seq);
+}
+
+static inline void _fu_heap_swap(int i, int j)
+{
+  fu_heap_entry_s e = _fu_heap[i];
+
+  _fu_heap[i] = _fu_heap[j];
+  _fu_heap[j] = e;
+  _fu_heap[i].ft->index = i;
+  _fu_heap[j].ft->index = j;
+}
+
+static void _fu_heap_fix(int i)
+{
+  while (i > 0 && _fu_heap_less(i, (i - 1) / 2))
+    {
+      _fu_heap_swap(i, (i - 1) / 2);
+      i = (i - 1) / 2;
+    }
+  while (1)
+    {
+      int c = 2 * i + 1;
+
+      if (c >= _fu_heap_count)
+        break;
+      if (c + 1 < _fu_heap_count && _fu_heap_less(c + 1, c))
+        c++;
+      if (!_fu_heap_less(c, i))
+        break;
+      _fu_heap_swap(i, c);
+      i = c;
+    }
+}
+
+/* Remove the timeout from the heap, if it is there. */
+static void _fu_heap_remove(struct uloop_timeout *t)
+{
+  fu_timeout ft = avl_find_element(&_fu_timeouts, t, ft, in_timeouts);
+  int i;
+
+  if (!ft)
+    return;
+  i = ft->index;
+  avl_delete(&_fu_timeouts, &ft->in_timeouts);
+  free(ft);
+  if (i != --_fu_heap_count)
+    {
+      _fu_heap[i] = _fu_heap[_fu_heap_count];
+      _fu_heap[i].ft->index = i;
+      _fu_heap_fix(i);
+    }
+}
+
 int hnetd_time_timeout_remaining(struct uloop_timeout *to)
 {
   if (!to->pending)
@@ -91,34 +183,49 @@ int hnetd_time_timeout_set(struct uloop_timeout *timeout, int ms)
 {
   sput_fail_if(ms < 0, "Timeout delay is positive");
   hnetd_time_t v = hnetd_time() + ms;
+  fu_timeout ft = NULL;
+  int i;
 
-  if(timeout->pending)
-    list_del(&timeout->list);
+  if (timeout->pending)
+    ft = avl_find_element(&_fu_timeouts, timeout, ft, in_timeouts);
   else
     timeout->pending = true;
 
   _to_tv(v, &timeout->time);
 
-  struct uloop_timeout *tp;
-  list_for_each_entry(tp, &timeouts, list)
+  /* Already in the heap -> just move it */
+  if (ft)
+    {
+      i = ft->index;
+      _fu_heap[i].time = v;
+      _fu_heap[i].seq = _fu_seq++;
+      _fu_heap_fix(i);
+      return 0;
+    }
+
+  if (_fu_heap_count == _fu_heap_size)
     {
-      if (_to_time(&tp->time) > v)
-        {
-          list_add_tail(&timeout->list, &tp->list);
-          return 0;
-        }
+      _fu_heap_size = _fu_heap_size ? _fu_heap_size * 2 : 64;
+      _fu_heap = realloc(_fu_heap, _fu_heap_size * sizeof(*_fu_heap));
+      sput_fail_unless(_fu_heap, "realloc timeout heap");
     }
-  list_add_tail(&timeout->list, &timeouts);
+  ft = calloc(1, sizeof(*ft));
+  sput_fail_unless(ft, "calloc fu_timeout");
+  ft->in_timeouts.key = timeout;
+  avl_insert(&_fu_timeouts, &ft->in_timeouts);
+  i = _fu_heap_count++;
+  ft->index = i;
+  _fu_heap[i].ft = ft;
+  _fu_heap[i].t = timeout;
+  _fu_heap[i].time = v;
+  _fu_heap[i].seq = _fu_seq++;
+  _fu_heap_fix(i);
   return 0;
 }
 
 static inline int fu_timeouts()
 {
-  int c = 0;
-  struct uloop_timeout *tp;
-  list_for_each_entry(tp, &timeouts, list)
-    c++;
-  return c;
+  return _fu_heap_count;
 }
 
 int hnetd_time_timeout_cancel(struct uloop_timeout *timeout)
@@ -128,7 +235,7 @@ int hnetd_time_timeout_cancel(struct uloop_timeout *timeout)
 #endif /* FU_PARANOID_TIMEOUT_CANCEL */
   if (timeout->pending)
     {
-      list_del(&timeout->list);
+      _fu_heap_remove(timeout);
       timeout->pending = 0;
     }
   return 0;
@@ -136,9 +243,9 @@ int hnetd_time_timeout_cancel(struct uloop_timeout *timeout)
 
 static inline struct uloop_timeout *fu_next()
 {
-  if (list_empty(&timeouts))
+  if (!_fu_heap_count)
     return NULL;
-  return list_first_entry(&timeouts, struct uloop_timeout, list);
+  return _fu_heap[0].t;
 }
 
 static inline hnetd_time_t fu_next_time()
@@ -149,7 +256,7 @@ static inline hnetd_time_t fu_next_time()
 
 static inline void fu_run_one(struct uloop_timeout *t)
 {
-  list_del(&t->list);
+  _fu_heap_remove(t);
   t->pending = false;
   if(t->cb)
     t->cb(t);
@@ -163,7 +270,7 @@ static inline int fu_loop(int rounds)
   _fu_loop_ended = false;
   while (!_fu_loop_ended && rounds != 0 && (to = fu_next()))
     {
-      hnetd_time_t when = _to_time(&to->time);
+      hnetd_time_t when = _fu_heap[0].time;
       if (when >= hnetd_time())
         set_hnetd_time(when);
       fu_run_one(to);
@@ -178,7 +285,7 @@ static inline int fu_poll(void)
   hnetd_time_t now = hnetd_time();
   struct uloop_timeout *to;
 
-  while ((to = fu_next()) && _to_time(&to->time) <= now)
+  while ((to = fu_next()) && _fu_heap[0].time <= now)
     {
       fu_run_one(to);
       ran++;
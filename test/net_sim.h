@@ -79,25 +79,42 @@
 #endif /* MESSAGE_LOSS_CHANCE > 0 */
 #endif /* !MESSAGE_LOSS_CHANCE */
 
+/* Payload of a sent message; shared (refcounted) by all of its
+ * receivers. */
+typedef struct {
+  int refcount;
+  size_t len;
+  unsigned char buf[];
+} net_payload_s, *net_payload;
+
 typedef struct {
   struct list_head lh;
 
   dncp_ep ep;
   struct sockaddr_in6 src, dst;
-  void *buf;
-  size_t len;
+  net_payload payload;
 
   /* When is it delivered? */
   struct uloop_timeout deliver_to;
 } net_msg_s, *net_msg;
 
 typedef struct {
+  /* net_sim->neighs entry */
   struct list_head lh;
 
+  /* net_ep->neighs entry */
+  struct list_head lh_ep;
+
   dncp_ep src;
   dncp_ep dst;
 } net_neigh_s, *net_neigh;
 
+/* Per-endpoint list of neighbors (=receivers of what it sends). */
+typedef struct {
+  struct avl_node in_eps;
+  struct list_head neighs;
+} net_ep_s, *net_ep;
+
 typedef struct {
   struct list_head lh;
   struct net_sim_t *s;
@@ -125,6 +142,11 @@ typedef struct {
   dncp_subscriber_s debug_subscriber;
 
   struct list_head iface_users;
+
+  /* Network hash with which our view of every other node was last
+   * found to be in sync (valid if view_ok). */
+  dncp_hash_s view_ok_hash;
+  bool view_ok;
 } net_node_s, *net_node;
 
 typedef struct net_sim_t {
@@ -133,6 +155,9 @@ typedef struct net_sim_t {
   struct list_head neighs;
   struct list_head messages;
 
+  /* net_ep's, keyed by the dncp_ep */
+  struct avl_tree eps;
+
   bool disable_link_auto_address;
   bool disable_sd;
   bool disable_pa;
@@ -160,7 +185,10 @@ typedef struct net_sim_t {
 
 } net_sim_s, *net_sim;
 
-static struct list_head net_sim_interfaces = LIST_HEAD_INIT(net_sim_interfaces);
+static int _net_ep_cmp(const void *k1, const void *k2, void *ptr)
+{
+  return (k1 > k2) - (k1 < k2);
+}
 
 void net_sim_init(net_sim s)
 {
@@ -168,6 +196,7 @@ void net_sim_init(net_sim s)
   INIT_LIST_HEAD(&s->nodes);
   INIT_LIST_HEAD(&s->neighs);
   INIT_LIST_HEAD(&s->messages);
+  avl_init(&s->eps, _net_ep_cmp, false, NULL);
   uloop_init();
   s->start = hnetd_time();
   s->next_free_ep_id = 100;
@@ -186,23 +215,60 @@ int net_sim_dncp_tlv_type_count(dncp o, int type)
   return c;
 }
 
+static bool _net_sim_node_view_ok(net_sim s, net_node n, net_node n2)
+{
+  int acceptable_offset = MAXIMUM_PROPAGATION_DELAY * (s->node_count - 1);
+  dncp_node hn;
+
+  /* Make sure that the information about other node _is_ valid */
+  hn = dncp_find_node_by_node_id(n->d, &n2->d->own_node->node_id, false);
+  if (!hn)
+    {
+      L_DEBUG("unable to find other node hash - %s -> %s",
+              n->name, n2->name);
+      return false;
+    }
+  if (memcmp(&n2->d->own_node->node_data_hash,
+             &hn->node_data_hash, HNCP_HASH_LEN))
+    {
+      L_DEBUG("node data hash mismatch w/ network hash in sync %s @%s",
+              n2->name, n->name);
+      return false;
+    }
+  if (!s->accept_time_errors
+      && llabs(n2->d->own_node->origination_time
+               - hn->origination_time) > acceptable_offset)
+    {
+      L_DEBUG("origination time mismatch at "
+              "%s: %lld !=~ %lld for %s [update number %d]",
+              n->name,
+              (long long) hn->origination_time,
+              (long long) n2->d->own_node->origination_time,
+              n2->name,
+              hn->update_number);
+      s->not_converged_count++;
+      return false;
+    }
+  return true;
+}
+
+/* The network hashes are compared first, as that is cheap and
+ * usually enough to tell that we are not there yet. Once they all
+ * match, every node's view of every other node is checked too, but
+ * that is tracked incrementally: a node whose network hash has not
+ * changed since its view was last found in sync is not rechecked (the
+ * others' own node state is covered by their identical network
+ * hashes). So the quadratic check happens once per change in the
+ * network, not on every call. */
 bool net_sim_is_converged(net_sim s)
 {
   net_node n, n2, fn = NULL;
-  bool first = true;
-  dncp_node hn;
-  int acceptable_offset = MAXIMUM_PROPAGATION_DELAY * (s->node_count - 1);
 #if L_LEVEL >= 7
   /* Dump # of nodes in each node */
-  char *buf = alloca(4 * s->node_count), *c = buf;
+  char *buf = alloca(12 * s->node_count + 1), *c = buf;
+  *c = 0;
   list_for_each_entry(n, &s->nodes, lh)
-    {
-      int count = 0;
-
-      dncp_for_each_node(n->d, hn)
-        count++;
-      c += sprintf(c, "%d ", count);
-    }
+    c += sprintf(c, "%d ", n->d->nodes.avl.count);
   L_DEBUG("net_sim_is_converged: %s", buf);
 #endif /* L_LEVEL >= 7 */
 
@@ -210,10 +276,9 @@ bool net_sim_is_converged(net_sim s)
     {
       if (n->d->network_hash_dirty)
         return false;
-      if (first)
+      if (!fn)
         {
           fn = n;
-          first = false;
           continue;
         }
       if (memcmp(&fn->d->network_hash, &n->d->network_hash, HNCP_HASH_LEN))
@@ -228,38 +293,15 @@ bool net_sim_is_converged(net_sim s)
     }
   list_for_each_entry(n, &s->nodes, lh)
     {
+      if (n->view_ok
+          && !memcmp(&n->view_ok_hash, &n->d->network_hash, HNCP_HASH_LEN))
+        continue;
+      n->view_ok = false;
       list_for_each_entry(n2, &s->nodes, lh)
-        {
-          /* Make sure that the information about other node _is_ valid */
-          hn = dncp_find_node_by_node_id(n->d, &n2->d->own_node->node_id, false);
-          if (!hn)
-            {
-              L_DEBUG("unable to find other node hash - %s -> %s",
-                      n->name, n2->name);
-              return false;
-            }
-          if (memcmp(&n2->d->own_node->node_data_hash,
-                     &hn->node_data_hash, HNCP_HASH_LEN))
-            {
-              L_DEBUG("node data hash mismatch w/ network hash in sync %s @%s",
-                      n2->name, n->name);
-              return false;
-            }
-          if (!s->accept_time_errors
-              && llabs(n2->d->own_node->origination_time
-                       - hn->origination_time) > acceptable_offset)
-            {
-              L_DEBUG("origination time mismatch at "
-                      "%s: %lld !=~ %lld for %s [update number %d]",
-                      n->name,
-                      (long long) hn->origination_time,
-                      (long long) n2->d->own_node->origination_time,
-                      n2->name,
-                      hn->update_number);
-              s->not_converged_count++;
-              return false;
-            }
-        }
+        if (!_net_sim_node_view_ok(s, n, n2))
+          return false;
+      n->view_ok_hash = n->d->network_hash;
+      n->view_ok = true;
     }
 
   s->converged_count++;
@@ -465,11 +507,21 @@ void net_sim_set_connected(dncp_ep ep1, dncp_ep ep2, bool enabled)
   hncp_ep h2 = dncp_ep_get_ext_data(ep2);
 
 
+  net_ep e = avl_find_element(&s->eps, ep1, e, in_eps);
+
+  if (!e)
+    {
+      e = calloc(1, sizeof(*e));
+      sput_fail_unless(e, "calloc net_ep");
+      e->in_eps.key = ep1;
+      INIT_LIST_HEAD(&e->neighs);
+      avl_insert(&s->eps, &e->in_eps);
+    }
   if (enabled)
     {
       /* Make sure it's not there already */
-      list_for_each_entry(n, &s->neighs, lh)
-        if (n->src == ep1 && n->dst == ep2)
+      list_for_each_entry(n, &e->neighs, lh_ep)
+        if (n->dst == ep2)
           return;
 
       /* Add node */
@@ -479,15 +531,17 @@ void net_sim_set_connected(dncp_ep ep1, dncp_ep ep2, bool enabled)
       n->src = ep1;
       n->dst = ep2;
       list_add(&n->lh, &s->neighs);
+      list_add(&n->lh_ep, &e->neighs);
     }
   else
     {
       /* Remove node */
-      list_for_each_entry(n, &s->neighs, lh)
+      list_for_each_entry(n, &e->neighs, lh_ep)
         {
-          if (n->src == ep1 && n->dst == ep2)
+          if (n->dst == ep2)
             {
               list_del(&n->lh);
+              list_del(&n->lh_ep);
               free(n);
               break;
             }
@@ -504,11 +558,25 @@ void net_sim_set_connected(dncp_ep ep1, dncp_ep ep2, bool enabled)
     }
 }
 
+static void _net_payload_put(net_payload p)
+{
+  if (!--p->refcount)
+    free(p);
+}
+
+static void _net_msg_free(net_msg m)
+{
+  list_del(&m->lh);
+  _net_payload_put(m->payload);
+  free(m);
+}
+
 void net_sim_remove_node(net_sim s, net_node node)
 {
   struct list_head *p, *pn;
   dncp o = node->d;
   net_neigh n, nn;
+  net_ep e, en;
 
   /* Remove from neighbors */
   list_for_each_entry_safe(n, nn, &s->neighs, lh)
@@ -516,9 +584,16 @@ void net_sim_remove_node(net_sim s, net_node node)
       if (dncp_ep_get_dncp(n->src) == o || dncp_ep_get_dncp(n->dst) == o)
         {
           list_del(&n->lh);
+          list_del(&n->lh_ep);
           free(n);
         }
     }
+  avl_for_each_element_safe(&s->eps, e, in_eps, en)
+    if (dncp_ep_get_dncp((dncp_ep)e->in_eps.key) == o)
+      {
+        avl_delete(&s->eps, &e->in_eps);
+        free(e);
+      }
 
   /* Remove from messages */
   list_for_each_safe(p, pn, &s->messages)
@@ -527,9 +602,7 @@ void net_sim_remove_node(net_sim s, net_node node)
       if (dncp_ep_get_dncp(m->ep) == o)
         {
           uloop_timeout_cancel(&m->deliver_to);
-          list_del(&m->lh);
-          free(m->buf);
-          free(m);
+          _net_msg_free(m);
         }
     }
 
@@ -589,6 +662,7 @@ void net_sim_uninit(net_sim s)
            (float)(hnetd_time() - s->start) / HNETD_TIME_PER_SECOND,
            s->sent_unicast, s->sent_multicast);
   sput_fail_unless(list_empty(&s->neighs), "no neighs");
+  sput_fail_unless(avl_is_empty(&s->eps), "no eps");
   sput_fail_unless(list_empty(&s->messages), "no messages");
 }
 
@@ -669,7 +743,7 @@ _recv(dncp_ext ext,
 
   list_for_each_entry(m, &node->messages, lh)
     {
-      int s = m->len > len ? len : m->len;
+      int s = m->payload->len > len ? len : m->payload->len;
       *ep = dncp_find_ep_by_name(o, m->ep->ifname);
       static struct sockaddr_in6 ret_src, ret_dst;
       ret_src = m->src;
@@ -687,11 +761,9 @@ _recv(dncp_ext ext,
       if (IN6_IS_ADDR_LINKLOCAL(&ret_src.sin6_addr))
         f |= DNCP_RECV_FLAG_SRC_LINKLOCAL;
       *flags = f;
-      memcpy(buf, m->buf, s);
+      memcpy(buf, m->payload->buf, s);
       L_DEBUG("%s/%s: _io_recv %d bytes", node->name, m->ep->ifname, s);
-      list_del(&m->lh);
-      free(m->buf);
-      free(m);
+      _net_msg_free(m);
       return s;
     }
   return - 1;
@@ -750,7 +822,7 @@ static void _message_deliver_cb(struct uloop_timeout *t)
 }
 
 static void
-_send_one(net_sim s, void *buf, size_t len, dncp_ep sl, dncp_ep dl,
+_send_one(net_sim s, net_payload p, dncp_ep sl, dncp_ep dl,
           const struct sockaddr_in6 *dst)
 {
   if (MESSAGE_WAS_LOST)
@@ -760,10 +832,8 @@ _send_one(net_sim s, void *buf, size_t len, dncp_ep sl, dncp_ep dl,
 
   sput_fail_unless(m, "calloc neigh");
   m->ep = dl;
-  m->buf = malloc(len);
-  sput_fail_unless(m->buf, "malloc buf");
-  memcpy(m->buf, buf, len);
-  m->len = len;
+  m->payload = p;
+  p->refcount++;
   memset(&m->src, 0, sizeof(m->src));
   m->src.sin6_family = AF_INET6;
   m->src.sin6_addr = shl->ipv6_address;
@@ -781,7 +851,7 @@ _send_one(net_sim s, void *buf, size_t len, dncp_ep sl, dncp_ep dl,
   bool is_multicast = memcmp(&dst->sin6_addr, &h1->multicast_address,
                              sizeof(h1->multicast_address)) == 0;
   L_DEBUG("_send_one: %s/%s -> %s/%s (%d bytes %s)",
-          node1->name, sl->ifname, node2->name, dl->ifname, (int)len,
+          node1->name, sl->ifname, node2->name, dl->ifname, (int)p->len,
           is_multicast ? "multicast" : "unicast");
 #endif /* L_LEVEL >= 7 */
 }
@@ -836,23 +906,31 @@ _send(dncp_ext ext, dncp_ep ep,
       s->last_unicast_sent = hnetd_time();
     }
   int sent = 0;
-  list_for_each_entry(n, &s->neighs, lh)
-    {
-      hncp_ep dhl = dncp_ep_get_ext_data(n->dst);
-      if (n->src == ep
-          && (is_multicast
-              || (memcmp(&dhl->ipv6_address, &dst->sin6_addr,
-                         sizeof(dst->sin6_addr)) == 0)))
-        {
-          _send_one(s, buf, len, n->src, n->dst, dst);
-          sent++;
-        }
-    }
+  net_payload p = malloc(sizeof(*p) + len);
+  net_ep e = avl_find_element(&s->eps, ep, e, in_eps);
+
+  sput_fail_unless(p, "malloc payload");
+  p->refcount = 1;
+  p->len = len;
+  memcpy(p->buf, buf, len);
+  if (e)
+    list_for_each_entry(n, &e->neighs, lh_ep)
+      {
+        hncp_ep dhl = dncp_ep_get_ext_data(n->dst);
+        if (is_multicast
+            || (memcmp(&dhl->ipv6_address, &dst->sin6_addr,
+                       sizeof(dst->sin6_addr)) == 0))
+          {
+            _send_one(s, p, n->src, n->dst, dst);
+            sent++;
+          }
+      }
   /* Loop at self too, just for fun. */
   if (is_multicast)
-    _send_one(s, buf, len, ep, ep, dst);
+    _send_one(s, p, ep, ep, dst);
   else
     sput_fail_unless(sent <= 1, "unicast must hit only one target");
+  _net_payload_put(p);
 }
 
 static hnetd_time_t
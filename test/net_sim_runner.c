@@ -0,0 +1,374 @@
+/*
+ * $Id: net_sim_runner.c $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+/*
+ * Run a seeded net_sim program (test_hncp_net, bench_dncp, ..) for a
+ * range of seeds, using a pool of worker processes.
+ *
+ * net_sim and fake_uloop keep their state in globals, so the
+ * simulations cannot share an address space; each seed is run as
+ * `prog -r <seed> [args]` in its own child process instead. A run
+ * passes if it exits with zero status. By default, the first failure
+ * stops the whole run (the other runs in flight are killed), and the
+ * lowest failing seed is reported along with the command line to
+ * reproduce it; -k keeps going instead.
+ *
+ * Per-seed cpu and wall time are collected, and if the program prints
+ * "convergence_ms":N (as bench_dncp does), convergence time too; the
+ * summary contains their percentiles.
+ *
+ * net_sim_runner [-j jobs] [-s first seed] [-n seeds] [-t timeout s]
+ *                [-k] [-v] prog [args]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* Only the head of the output is searched for the result. */
+#define RUNNER_OUTPUT_MAX 4096
+
+typedef struct {
+  pid_t pid;
+  int seed;
+  int fd;
+  uint64_t start_us;
+} runner_job_s, *runner_job;
+
+static struct {
+  int jobs;
+  int first_seed;
+  int num_seeds;
+  int timeout;
+  bool keep_going;
+  bool verbose;
+  char **argv;
+  int argc;
+
+  runner_job_s *running;
+  int num_running;
+
+  /* Per-seed measurements of completed (not killed) runs */
+  uint64_t *cpu_us, *wall_us, *convergence_ms;
+  int num_done, num_convergence;
+
+  int num_passed, num_failed, num_timeouts;
+  int first_failed_seed;
+  bool stopping;
+} r = {
+  .first_seed = 1,
+  .num_seeds = 1000,
+};
+
+static uint64_t _time_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void _print_cmd(FILE *f, int seed)
+{
+  int i;
+
+  fprintf(f, "%s -r %d", r.argv[0], seed);
+  for (i = 1 ; i < r.argc ; i++)
+    fprintf(f, " %s", r.argv[i]);
+}
+
+static bool _start(runner_job j, int seed)
+{
+  char buf[16];
+  char **args;
+  FILE *out = tmpfile();
+  int i;
+
+  if (!out)
+    {
+      perror("tmpfile");
+      return false;
+    }
+  args = calloc(r.argc + 3, sizeof(char *));
+  if (!args)
+    {
+      fclose(out);
+      return false;
+    }
+  sprintf(buf, "%d", seed);
+  args[0] = r.argv[0];
+  args[1] = "-r";
+  args[2] = buf;
+  for (i = 1 ; i < r.argc ; i++)
+    args[i + 2] = r.argv[i];
+
+  j->start_us = _time_us();
+  j->pid = fork();
+  if (j->pid < 0)
+    {
+      perror("fork");
+      free(args);
+      fclose(out);
+      return false;
+    }
+  if (!j->pid)
+    {
+      int null = open("/dev/null", O_RDWR);
+
+      dup2(fileno(out), STDOUT_FILENO);
+      if (null >= 0)
+        {
+          dup2(null, STDIN_FILENO);
+          dup2(null, STDERR_FILENO);
+        }
+      /* Default SIGALRM disposition kills the run, even after exec. */
+      if (r.timeout)
+        alarm(r.timeout);
+      execvp(args[0], args);
+      _exit(127);
+    }
+  free(args);
+  j->seed = seed;
+  j->fd = dup(fileno(out));
+  fclose(out);
+  r.num_running++;
+  return true;
+}
+
+static void _read_result(runner_job j)
+{
+  char buf[RUNNER_OUTPUT_MAX + 1];
+  ssize_t len;
+  char *c;
+
+  if (lseek(j->fd, 0, SEEK_SET) < 0)
+    return;
+  len = read(j->fd, buf, RUNNER_OUTPUT_MAX);
+  if (len <= 0)
+    return;
+  buf[len] = 0;
+  if ((c = strstr(buf, "\"convergence_ms\":")))
+    r.convergence_ms[r.num_convergence++] =
+      strtoull(c + strlen("\"convergence_ms\":"), NULL, 10);
+}
+
+static void _done(runner_job j, int status, struct rusage *ru)
+{
+  uint64_t cpu_us = (uint64_t)(ru->ru_utime.tv_sec + ru->ru_stime.tv_sec)
+    * 1000000 + ru->ru_utime.tv_usec + ru->ru_stime.tv_usec;
+  uint64_t wall_us = _time_us() - j->start_us;
+  bool timeout = WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM;
+  bool ok = WIFEXITED(status) && !WEXITSTATUS(status);
+
+  /* Runs we killed ourselves do not count either way. */
+  if (WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM && r.stopping)
+    goto done;
+
+  r.cpu_us[r.num_done] = cpu_us;
+  r.wall_us[r.num_done] = wall_us;
+  r.num_done++;
+  if (ok)
+    {
+      r.num_passed++;
+      _read_result(j);
+    }
+  else
+    {
+      r.num_failed++;
+      if (timeout)
+        r.num_timeouts++;
+      if (!r.first_failed_seed || j->seed < r.first_failed_seed)
+        r.first_failed_seed = j->seed;
+      fprintf(stderr, "seed %d %s", j->seed, timeout ? "timed out" : "failed");
+      if (WIFEXITED(status))
+        fprintf(stderr, " (exit %d)", WEXITSTATUS(status));
+      else if (!timeout)
+        fprintf(stderr, " (signal %d)", WTERMSIG(status));
+      fprintf(stderr, ": ");
+      _print_cmd(stderr, j->seed);
+      fprintf(stderr, "\n");
+      if (!r.keep_going)
+        r.stopping = true;
+    }
+  if (r.verbose)
+    printf("seed %d %s cpu %.1f ms wall %.1f ms\n", j->seed,
+           ok ? "ok" : "FAILED", cpu_us / 1000.0, wall_us / 1000.0);
+ done:
+  close(j->fd);
+  j->pid = 0;
+  r.num_running--;
+}
+
+static runner_job _find_job(pid_t pid)
+{
+  int i;
+
+  for (i = 0 ; i < r.jobs ; i++)
+    if (r.running[i].pid == pid)
+      return &r.running[i];
+  return NULL;
+}
+
+static void _stop_all(void)
+{
+  int i;
+
+  for (i = 0 ; i < r.jobs ; i++)
+    if (r.running[i].pid)
+      kill(r.running[i].pid, SIGTERM);
+}
+
+static int _cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile (in 1/1000s) of a sorted array. */
+static uint64_t _percentile(uint64_t *v, int n, int permille)
+{
+  int i = ((uint64_t)n * permille + 999) / 1000;
+
+  return v[i > 0 ? i - 1 : 0];
+}
+
+static void _print_percentiles(const char *name, uint64_t *v, int n,
+                               double scale)
+{
+  if (!n)
+    return;
+  qsort(v, n, sizeof(*v), _cmp_u64);
+  printf("%s: p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n", name,
+         _percentile(v, n, 500) / scale, _percentile(v, n, 900) / scale,
+         _percentile(v, n, 990) / scale, _percentile(v, n, 999) / scale,
+         v[n - 1] / scale);
+}
+
+static void _usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-j jobs] [-s first seed] [-n seeds]"
+          " [-t timeout s] [-k] [-v] prog [args]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t start_us;
+  int next_seed, c, i;
+
+  r.jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  /* '+': stop at the first non-option, the rest is for prog */
+  while ((c = getopt(argc, argv, "+j:s:n:t:kv")) > 0)
+    {
+      switch (c)
+        {
+        case 'j':
+          r.jobs = atoi(optarg);
+          break;
+        case 's':
+          r.first_seed = atoi(optarg);
+          break;
+        case 'n':
+          r.num_seeds = atoi(optarg);
+          break;
+        case 't':
+          r.timeout = atoi(optarg);
+          break;
+        case 'k':
+          r.keep_going = true;
+          break;
+        case 'v':
+          r.verbose = true;
+          break;
+        default:
+          _usage(argv[0]);
+          return 1;
+        }
+    }
+  if (optind >= argc || r.num_seeds < 1)
+    {
+      _usage(argv[0]);
+      return 1;
+    }
+  if (r.jobs < 1)
+    r.jobs = 1;
+  r.argv = argv + optind;
+  r.argc = argc - optind;
+  r.running = calloc(r.jobs, sizeof(*r.running));
+  r.cpu_us = calloc(r.num_seeds, sizeof(uint64_t));
+  r.wall_us = calloc(r.num_seeds, sizeof(uint64_t));
+  r.convergence_ms = calloc(r.num_seeds, sizeof(uint64_t));
+  if (!r.running || !r.cpu_us || !r.wall_us || !r.convergence_ms)
+    {
+      perror("calloc");
+      return 1;
+    }
+
+  start_us = _time_us();
+  next_seed = r.first_seed;
+  while (true)
+    {
+      struct rusage ru;
+      runner_job j;
+      int status;
+      pid_t pid;
+
+      while (!r.stopping && r.num_running < r.jobs
+             && next_seed < r.first_seed + r.num_seeds)
+        {
+          for (i = 0 ; r.running[i].pid ; i++);
+          if (!_start(&r.running[i], next_seed))
+            {
+              r.stopping = true;
+              break;
+            }
+          next_seed++;
+        }
+      if (!r.num_running)
+        break;
+      pid = wait4(-1, &status, 0, &ru);
+      if (pid < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          perror("wait4");
+          return 1;
+        }
+      if (!(j = _find_job(pid)))
+        continue;
+      _done(j, status, &ru);
+      if (r.stopping)
+        _stop_all();
+    }
+
+  printf("%s: %d seeds completed (%d-%d started), %d passed, %d failed"
+         " (%d timed out) in %.1f s with %d jobs\n",
+         r.argv[0], r.num_done, r.first_seed, next_seed - 1,
+         r.num_passed, r.num_failed, r.num_timeouts,
+         (_time_us() - start_us) / 1e6, r.jobs);
+  _print_percentiles("cpu_ms", r.cpu_us, r.num_done, 1000.0);
+  _print_percentiles("wall_ms", r.wall_us, r.num_done, 1000.0);
+  _print_percentiles("convergence_ms", r.convergence_ms, r.num_convergence,
+                     1.0);
+  if (r.num_failed)
+    {
+      printf("first failing seed %d: ", r.first_failed_seed);
+      _print_cmd(stdout, r.first_failed_seed);
+      printf("\n");
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,393 @@
+/*
+ * $Id: replay_dncp.c $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+/*
+ * Replay a capture made with hnetd --capture (see hncp_capture.h)
+ * against a fresh DNCP (HNCP profile) instance.
+ *
+ * The received packets are fed to the new instance through a fake
+ * dncp_ext, in the original order and with the original (relative)
+ * timestamps, but in fake time, i.e. as fast as possible. The new
+ * instance assumes the node identifier of the capturing node, and
+ * runs its own timeouts; captured timeouts and sent packets are only
+ * reported, as they depend on the local state of the original node
+ * (e.g. TLVs published by PA), which is not part of the capture.
+ *
+ * The result is printed as a single JSON object (like bench_dncp), so
+ * this doubles as a throughput benchmark on real traffic:
+ *
+ * replay_dncp [-l loops] [-r seed] [-p] [-v] capture-file
+ *
+ * Every loop starts from the same random seed, so the replays are
+ * identical. -p prints the captured events instead of replaying them.
+ */
+
+#ifdef L_LEVEL
+#undef L_LEVEL
+#endif /* L_LEVEL */
+#define L_LEVEL 5
+#include "hncp_i.h"
+#include "hnetd_stats.h"
+#include "sput.h"
+
+/* The fakes are stubs, rather not put __unused all over the place. */
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+/* hncp_link wants interfaces, and the time is fake */
+#include "fake_iface.h"
+#include "fake_uloop.h"
+#include "fake_log.h"
+
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+static struct {
+  hncp_capture c;
+  const char *filename;
+  int loops;
+  int seed;
+
+  /* Offset of captured time to fake time */
+  hnetd_time_t time_offset;
+
+  /* Endpoints that have to be enabled at start, as their first
+   * event is not an explicit enable (it may have been overwritten) */
+  const char *implicit_eps[HNCP_CAPTURE_MAX_EPS];
+  int num_implicit_eps;
+
+  /* Received packet being handed over to dncp */
+  hncp_capture_event pending;
+  hncp h;
+
+  int events[HNCP_CAPTURE_EP_READY + 1];
+  uint64_t recv_bytes;
+  hnetd_time_t first_time, last_time;
+  int nodes;
+
+  /* Sum of the stats of the replayed instances */
+  hnetd_stats_s stats;
+} r = {
+  .loops = 1,
+  .seed = 1
+};
+
+static struct uloop_timeout _timeout;
+
+static void _timeout_cb(struct uloop_timeout *t __unused)
+{
+  dncp_ext_timeout(r.h->dncp);
+}
+
+static void _schedule_timeout(dncp_ext ext __unused, int msecs)
+{
+  uloop_timeout_set(&_timeout, msecs);
+}
+
+static ssize_t
+_recv(dncp_ext ext __unused,
+      dncp_ep *ep,
+      struct sockaddr_in6 **src,
+      struct sockaddr_in6 **dst,
+      int *flags,
+      void *buf, size_t len)
+{
+  hncp_capture_event e = r.pending;
+
+  if (!e || e->len > len)
+    return -1;
+  r.pending = NULL;
+  *ep = dncp_find_ep_by_name(r.h->dncp, e->ifname);
+  *src = e->src;
+  *dst = e->dst;
+  *flags = e->flags;
+  memcpy(buf, e->buf, e->len);
+  return e->len;
+}
+
+static void _send(dncp_ext ext __unused, dncp_ep ep __unused,
+                  struct sockaddr_in6 *src __unused,
+                  struct sockaddr_in6 *dst __unused,
+                  void *buf __unused, size_t len __unused)
+{
+  /* Counted in hnetd_stats by dncp_proto */
+}
+
+static hnetd_time_t _get_time(dncp_ext ext __unused)
+{
+  return hnetd_time();
+}
+
+static int
+_get_hwaddrs(dncp_ext ext __unused, unsigned char *buf, int buf_left)
+{
+  const char *name = "replay";
+  int len = strlen(name);
+
+  if (buf_left < len)
+    return 0;
+  memcpy(buf, name, len);
+  return len;
+}
+
+bool hncp_io_init(hncp h)
+{
+  h->ext.cb.recv = _recv;
+  h->ext.cb.send = _send;
+  h->ext.cb.get_hwaddrs = _get_hwaddrs;
+  h->ext.cb.get_time = _get_time;
+  h->ext.cb.schedule_timeout = _schedule_timeout;
+  _timeout.cb = _timeout_cb;
+  return true;
+}
+
+void hncp_io_uninit(hncp h __unused)
+{
+  uloop_timeout_cancel(&_timeout);
+}
+
+bool hncp_io_set_ifname_enabled(hncp h __unused,
+                                const char *ifname __unused,
+                                bool enabled __unused)
+{
+  return true;
+}
+
+/* Run the timeouts of the new instance up to (captured) time t. */
+static void _advance(hnetd_time_t t)
+{
+  t += r.time_offset;
+  while (fu_next() && _fu_heap[0].time <= t)
+    fu_loop(1);
+  if (hnetd_time() < t)
+    set_hnetd_time(t);
+}
+
+static void _scan(void)
+{
+  const char *eps[HNCP_CAPTURE_MAX_EPS];
+  int num_eps = 0, i;
+  hncp_capture_event_s e;
+
+  hncp_capture_rewind(r.c);
+  while (hncp_capture_next(r.c, &e))
+    {
+      if (!r.events[0]++)
+        r.first_time = e.time;
+      r.last_time = e.time;
+      if (e.type > 0 && e.type <= HNCP_CAPTURE_EP_READY)
+        r.events[e.type]++;
+      if (e.type == HNCP_CAPTURE_RECV)
+        r.recv_bytes += e.len;
+      if (!e.ifname)
+        continue;
+      for (i = 0 ; i < num_eps ; i++)
+        if (!strcmp(eps[i], e.ifname))
+          break;
+      if (i < num_eps || num_eps == HNCP_CAPTURE_MAX_EPS)
+        continue;
+      eps[num_eps++] = e.ifname;
+      if (e.type != HNCP_CAPTURE_EP_READY)
+        r.implicit_eps[r.num_implicit_eps++] = e.ifname;
+    }
+}
+
+static void _print(void)
+{
+  hncp_capture_event_s e;
+  static const char *types[] = {
+    [HNCP_CAPTURE_RECV] = "recv",
+    [HNCP_CAPTURE_SEND] = "send",
+    [HNCP_CAPTURE_TIMEOUT] = "timeout",
+    [HNCP_CAPTURE_EP_READY] = "ep_ready",
+  };
+
+  hncp_capture_rewind(r.c);
+  while (hncp_capture_next(r.c, &e))
+    {
+      printf("%lld %s", (long long)(e.time - r.first_time),
+             e.type > 0 && e.type <= HNCP_CAPTURE_EP_READY
+             ? types[e.type] : "?");
+      if (e.ifname)
+        printf(" %s", e.ifname);
+      if (e.type == HNCP_CAPTURE_EP_READY)
+        printf(" %s", e.flags ? "up" : "down");
+      if (e.src)
+        printf(" " SA6_F, SA6_D(e.src));
+      if (e.type == HNCP_CAPTURE_RECV || e.type == HNCP_CAPTURE_SEND)
+        {
+          if (e.dst)
+            printf(" -> " SA6_F, SA6_D(e.dst));
+          else
+            printf(" -> multicast");
+          printf(" flags %d len %d", e.flags, (int)e.len);
+        }
+      printf("\n");
+    }
+}
+
+static void _replay(void)
+{
+  hncp_capture_event_s e;
+  const void *ni;
+  dncp_node n;
+  dncp d;
+  int i;
+
+  uloop_init();
+  srandom(r.seed);
+  r.time_offset = hnetd_time() - r.first_time;
+  r.h = hncp_create();
+  sput_fail_unless(r.h, "hncp_create");
+  if (!r.h)
+    return;
+  d = r.h->dncp;
+  if (hncp_capture_get_node_id(r.c, &ni) == r.h->ext.conf.node_id_length)
+    dncp_set_own_node_id(d, (void *)ni);
+  for (i = 0 ; i < r.num_implicit_eps ; i++)
+    dncp_ext_ep_ready(dncp_find_ep_by_name(d, r.implicit_eps[i]), true);
+
+  hncp_capture_rewind(r.c);
+  while (hncp_capture_next(r.c, &e))
+    {
+      _advance(e.time);
+      if (!e.ifname)
+        continue;
+      switch (e.type)
+        {
+        case HNCP_CAPTURE_RECV:
+          r.pending = &e;
+          dncp_ext_readable(d);
+          r.pending = NULL;
+          break;
+        case HNCP_CAPTURE_EP_READY:
+          dncp_ext_ep_ready(dncp_find_ep_by_name(d, e.ifname), e.flags);
+          break;
+        default:
+          /* Sends and timeouts of the original node: not replayed */
+          break;
+        }
+    }
+  /* Let the last packets be processed */
+  _advance(r.last_time + 1);
+  r.nodes = 0;
+  for (n = dncp_get_first_node(d) ; n ; n = dncp_node_get_next(n))
+    r.nodes++;
+  hnetd_stats_merge(&r.stats, dncp_get_stats(d));
+  hncp_destroy(r.h);
+  r.h = NULL;
+}
+
+static uint64_t _cpu_us(void)
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+    + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+void replay_dncp(void)
+{
+  uint64_t start_us, us;
+  int i;
+
+  hnetd_stats_reset(&r.stats);
+  start_us = _cpu_us();
+  for (i = 0 ; i < r.loops ; i++)
+    _replay();
+  us = _cpu_us() - start_us;
+
+  printf("{\"capture\":\"%s\",\"events\":%d,\"recv_packets\":%d,"
+         "\"recv_bytes\":%llu,\"captured_sends\":%d,"
+         "\"captured_timeouts\":%d,\"span_ms\":%lld,\"loops\":%d,"
+         "\"nodes\":%d,\"cpu_ms\":%.1f,\"recv_packets_per_s\":%.0f,"
+         "\"sent_packets\":%.1f,\"network_hash_calculations\":%.1f,"
+         "\"tlv_callbacks\":%.1f}\n",
+         r.filename, r.events[0], r.events[HNCP_CAPTURE_RECV],
+         (unsigned long long)r.recv_bytes, r.events[HNCP_CAPTURE_SEND],
+         r.events[HNCP_CAPTURE_TIMEOUT],
+         (long long)(r.last_time - r.first_time), r.loops, r.nodes,
+         us / 1000.0,
+         us ? (double)r.events[HNCP_CAPTURE_RECV] * r.loops * 1e6 / us : 0.0,
+         (double)r.stats.counters[HNETD_STATS_DNCP_SENT_PACKETS] / r.loops,
+         (double)r.stats.counters[HNETD_STATS_DNCP_NETWORK_HASH] / r.loops,
+         (double)r.stats.counters[HNETD_STATS_DNCP_TLV_CALLBACKS]
+         / r.loops);
+}
+
+static void _log(int priority, const char *format, ...)
+{
+  va_list a;
+
+  fprintf(stderr, "[%d]", priority);
+  va_start(a, format);
+  vfprintf(stderr, format, a);
+  va_end(a);
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+  bool print = false;
+  int c;
+
+  /* Keep stdout for the result only */
+  hnetd_log = _log;
+  log_level = LOG_WARNING;
+  while ((c = getopt(argc, argv, "l:r:pv")) > 0)
+    {
+      switch (c)
+        {
+        case 'l':
+          r.loops = atoi(optarg);
+          break;
+        case 'r':
+          r.seed = atoi(optarg);
+          break;
+        case 'p':
+          print = true;
+          break;
+        case 'v':
+          log_level = LOG_DEBUG;
+          break;
+        default:
+          goto usage;
+        }
+    }
+  if (optind != argc - 1 || r.loops < 1)
+    goto usage;
+  r.filename = argv[optind];
+  if (!(r.c = hncp_capture_load(r.filename)))
+    return 1;
+  _scan();
+  if (print)
+    {
+      _print();
+      hncp_capture_close(r.c);
+      return 0;
+    }
+
+  openlog("replay_dncp", LOG_CONS | LOG_PERROR, LOG_DAEMON);
+  sput_start_testing();
+  /* Per-check output of sput is far too verbose for this. */
+  if (log_level < LOG_DEBUG)
+    sput_set_output_stream(fopen("/dev/null", "w"));
+  else
+    sput_set_output_stream(stderr);
+  sput_enter_suite("replay_dncp");
+  sput_run_test(replay_dncp);
+  sput_leave_suite();
+  sput_finish_testing();
+  hncp_capture_close(r.c);
+  return sput_get_return_value();
+
+ usage:
+  fprintf(stderr, "Usage: %s [-l loops] [-r seed] [-p] [-v]"
+          " capture-file\n", argv[0]);
+  return 1;
+}
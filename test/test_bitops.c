@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 #include "bitops.h"
+#include "bitops_ref.h"
 #include <libubox/utils.h>
 
 void hamming(void)
@@ -114,6 +115,34 @@ void bmemcmp_s_test()
 	}
 }
 
+#define BITOPS_RANDOM_SIZE 10000
+
+/* Compares the word-parallel kernels with bit per bit references
+ * over random IPv6 prefixes. Timings are in bench_bitops. */
+void hamming_random(void)
+{
+	struct in6_addr a, b, d1, d2;
+	size_t s;
+	int i, plen, errors = 0;
+
+	srand(0);
+	for(i = 0; i < BITOPS_RANDOM_SIZE; i++) {
+		bitops_random_addr(&a);
+		bitops_random_addr(&b);
+		plen = (i % 4)?(rand() % 129):128;
+		s = rand() % (plen + 1);
+		memset(&d1, 0, sizeof(d1));
+		memset(&d2, 0, sizeof(d2));
+		if(hamming_distance_64((uint64_t *)&a, (uint64_t *)&b, plen) !=
+				hamming_distance_ref(a.s6_addr, b.s6_addr, plen) ||
+				hamming_minimize(a.s6_addr, b.s6_addr, d1.s6_addr, s, plen - s) !=
+				hamming_minimize_ref(a.s6_addr, b.s6_addr, d2.s6_addr, s, plen - s) ||
+				memcmp(&d1, &d2, sizeof(d1)))
+			errors++;
+	}
+	sput_fail_unless(!errors, "Same results as reference");
+}
+
 int main(__unused int argc, __unused char **argv)
 {
   openlog("test_bitops", LOG_CONS | LOG_PERROR, LOG_DAEMON);
@@ -121,6 +150,7 @@ int main(__unused int argc, __unused char **argv)
   sput_enter_suite("bitops"); /* optional */
   //sput_run_test(bmemcmp_s_test);
   sput_run_test(hamming);
+  sput_run_test(hamming_random);
   sput_leave_suite(); /* optional */
   sput_finish_testing();
   return sput_get_return_value();
@@ -20,17 +20,43 @@
 
 static int malloc_fails = 0;
 static int malloc_called = 0;
+static int malloc_live = 0;
 void *test_malloc(size_t size)
 {
+	void *p;
 	malloc_called = 1;
 
 	if(malloc_fails)
 		return NULL;
 
-	return malloc(size);
+	if((p = malloc(size)))
+		malloc_live++;
+	return p;
+}
+
+void *test_calloc(size_t nmemb, size_t size)
+{
+	void *p;
+	malloc_called = 1;
+
+	if(malloc_fails)
+		return NULL;
+
+	if((p = calloc(nmemb, size)))
+		malloc_live++;
+	return p;
+}
+
+void test_free(void *p)
+{
+	if(p)
+		malloc_live--;
+	free(p);
 }
 
 #define malloc test_malloc
+#define calloc test_calloc
+#define free test_free
 #include "btrie.c"
 #include "prefix_utils.h"
 
@@ -121,6 +147,49 @@ static uint64_t test_count_space(struct btrie *root, const pkey_t *contain_key,
 	return ctr;
 }
 
+/* Compares counters with available keys iteration */
+static int test_check_available_count(struct btrie *root, const pkey_t *contain_key, plen_t contain_len, pkey_t *iter_key)
+{
+	struct btrie *n;
+	plen_t iter_len;
+	uint32_t counts[BTRIE_AVAIL_LEN], expected[BTRIE_AVAIL_LEN];
+	memset(expected, 0, sizeof(expected));
+	btrie_for_each_available(root, n, iter_key, &iter_len, contain_key, contain_len) {
+		if(iter_len < BTRIE_AVAIL_LEN)
+			expected[iter_len]++;
+	}
+	btrie_available_count(root, contain_key, contain_len, counts, BTRIE_AVAIL_LEN - 1);
+	return memcmp(counts, expected, sizeof(counts));
+}
+
+/* Compares the nth available key lookup with available keys iteration */
+static int test_check_available_nth(struct btrie *root, const pkey_t *contain_key, plen_t contain_len,
+		plen_t min_len, plen_t max_len, plen_t target_len, uint64_t n)
+{
+	struct btrie *node;
+	pkey_t key[256 / BTRIE_KEY], key2[256 / BTRIE_KEY];
+	plen_t len, len2;
+	uint64_t w, n2 = n;
+	int found = 0;
+	btrie_for_each_available(root, node, key, &len, contain_key, contain_len) {
+		if(len < min_len || len > max_len)
+			continue;
+		w = (target_len - len >= 63)?BTRIE_AVAILABLE_ALL:(((uint64_t)1) << (target_len - len));
+		if(n < w) {
+			found = 1;
+			break;
+		}
+		n -= w;
+	}
+
+	if(btrie_available_nth(root, key2, &len2, contain_key, contain_len, min_len, max_len, target_len, &n2))
+		return found || n != n2;
+
+	return !found || n != n2 || len != len2 ||
+			(len && ((ntohk(key[index(len - 1)]) ^ ntohk(key2[index(len - 1)])) & mask(remain(len - 1)))) ||
+			(len > BTRIE_KEY && memcmp(key, key2, index(len - 1) * sizeof(pkey_t)));
+}
+
 void test_print_key(const pkey_t *k, uint8_t bitlen)
 {
 	if(!bitlen) {
@@ -138,6 +207,17 @@ void test_print_key(const pkey_t *k, uint8_t bitlen)
 
 void btrie_check(struct btrie *n)
 {
+	if(n->plen < BTRIE_AVAIL_LEN) {
+		uint32_t counts[BTRIE_AVAIL_LEN], total = 0;
+		unsigned int l;
+		memset(counts, 0, sizeof(counts));
+		btrie_avail_compute(n, counts, n->plen);
+		for(l = n->plen; l < BTRIE_AVAIL_LEN; l++)
+			total += counts[l - n->plen];
+		sput_fail_unless(total == n->avail, "Valid available counter");
+		sput_fail_if(n->counts && memcmp(counts, n->counts, (BTRIE_AVAIL_LEN - n->plen) * sizeof(uint32_t)),
+				"Valid kept available counts");
+	}
 	sput_fail_unless(!n->parent || !list_empty(&n->elements.l) || (n->child[0] && n->child[1]) ||
 			(!(n->plen & remain_mask) && (n->child[0] || n->child[1])), "Node exists for a reason");
 	if(n->child[0]) {
@@ -339,6 +419,15 @@ void test_btrie_stress_push(struct btrie *root, void *str, void *check, uint8_t
 			sput_fail_if(1, "Invalid space count 2");
 		}
 
+		if(test_check_available_count(root, str, 0, key) || test_check_available_count(root, str, bitlen, key))
+			sput_fail_if(1, "Invalid available count");
+
+		if(test_check_available_nth(root, str, 0, 0, 64, 64, rand()) ||
+				test_check_available_nth(root, str, 0, 20, 40, 48, rand()) ||
+				test_check_available_nth(root, str, 0, 0, 128, 128, ((uint64_t)rand()) << 40) ||
+				test_check_available_nth(root, str, bitlen, bitlen, 128, 128, rand() % 3))
+			sput_fail_if(1, "Invalid nth available key");
+
 		//Malloc fails
 		malloc_fails = 1;
 		malloc_called = 0;
@@ -738,6 +827,53 @@ static void test_btrie_available()
 	}
 }
 
+#define BTRIE_NTH_ELEMENTS 300
+#define BTRIE_NTH_ITER 2000
+
+static void test_btrie_available_nth()
+{
+	struct btrie t;
+	struct btrie_element e[BTRIE_NTH_ELEMENTS];
+	pkey_t key[4], iter_key[8];
+	plen_t len, min_len, max_len;
+	uint64_t n;
+	int i, j, found = 0;
+
+	btrie_init(&t);
+	for(i = 0; i < BTRIE_NTH_ELEMENTS; i++) {
+		for(j = 0; j < 4; j++)
+			key[j] = rand() & rand() & rand(); //Dense on the left
+		btrie_add(&t, &e[i], key, 8 + rand() % 120);
+	}
+	btrie_check(&t);
+
+	for(i = 0; i < BTRIE_NTH_ITER; i++) {
+		if(i == BTRIE_NTH_ITER / 2) {
+			for(j = 0; j < BTRIE_NTH_ELEMENTS; j += 2)
+				btrie_remove(&e[j]);
+			btrie_check(&t);
+		}
+
+		for(j = 0; j < 4; j++)
+			key[j] = rand() & rand() & rand();
+		len = rand() % 40;
+		sput_fail_if(test_check_available_count(&t, key, len, iter_key), "Valid available count");
+
+		min_len = len + rand() % 60;
+		max_len = min_len + rand() % 60;
+		if(max_len >= BTRIE_AVAIL_LEN)
+			max_len = BTRIE_AVAIL_LEN - 1;
+		n = (i % 2)?((uint64_t)rand()):((((uint64_t)rand()) << (rand() % 60)) & (BTRIE_AVAILABLE_ALL - 1));
+		sput_fail_if(test_check_available_nth(&t, key, len, min_len, max_len, max_len + rand() % 8, n),
+				"Valid nth available key");
+
+		n = 0;
+		if(!btrie_available_nth(&t, iter_key, &len, key, len, min_len, max_len, max_len, &n))
+			found++;
+	}
+	sput_fail_unless(found > BTRIE_NTH_ITER / 4, "Available keys were found");
+}
+
 #ifdef BTRIE_KEY_NETWORK_BYTE_ORDER
 void test_btrie_available_list(struct btrie *root)
 {
@@ -763,8 +899,43 @@ void test_btrie_available_prefix()
 	btrie_add(&t, &e2, (btrie_key_t *)&p2.prefix, p.plen);
 	test_btrie_available_list(&t);
 }
+
 #endif
 
+#define BTRIE_RELEASE_ELEMENTS 1000
+
+/* Nodes and kept counts are released when emptied. */
+static void test_btrie_release()
+{
+	struct btrie t;
+	struct btrie_element *e = malloc(BTRIE_RELEASE_ELEMENTS * sizeof(struct btrie_element));
+	uint32_t counts[129];
+	pkey_t key[4];
+	int i, j, start = malloc_live;
+
+	sput_fail_unless(e, "Elements allocation");
+	if(!e)
+		return;
+
+	btrie_init(&t);
+	for(i = 0; i < BTRIE_RELEASE_ELEMENTS; i++) {
+		for(j = 0; j < 4; j++)
+			key[j] = rand();
+		sput_fail_if(btrie_add(&t, &e[i], key, 1 + rand() % 128), "Element added");
+	}
+	btrie_available_count(&t, NULL, 0, counts, 128);
+	sput_fail_unless(malloc_live - start > 1, "Nodes are allocated");
+
+	for(i = 0; i < BTRIE_RELEASE_ELEMENTS; i += 2)
+		btrie_remove(&e[i]);
+	btrie_check(&t);
+	for(i = 1; i < BTRIE_RELEASE_ELEMENTS; i += 2)
+		btrie_remove(&e[i]);
+	sput_fail_unless(!t.child[0] && !t.child[1], "Trie is empty");
+	sput_fail_unless(malloc_live == start, "All nodes were released");
+	free(e);
+}
+
 int main( __unused int argc,  __unused char **argv)
 {
   sput_start_testing();
@@ -775,9 +946,11 @@ int main( __unused int argc,  __unused char **argv)
   sput_run_test(test_btrie_prefix);
 #endif
   sput_run_test(test_btrie_available);
+  sput_run_test(test_btrie_available_nth);
 #ifdef BTRIE_KEY_NETWORK_BYTE_ORDER
   sput_run_test(test_btrie_available_prefix);
 #endif
+  sput_run_test(test_btrie_release);
   sput_leave_suite(); /* optional */
   sput_finish_testing();
   return sput_get_return_value();
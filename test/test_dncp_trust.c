@@ -12,7 +12,7 @@
  */
 
 #include "net_sim.h"
-#include "dncp_trust.h"
+#include "dncp_trust.c"
 
 #include <unistd.h>
 
@@ -130,6 +130,223 @@ void dncp_trust_io()
   net_sim_uninit(&s);
 }
 
+static int _trust_count(dncp_trust t)
+{
+  dncp_sha256 h;
+  int i = 0;
+
+  dncp_trust_for_each_hash(t, h)
+    i++;
+  return i;
+}
+
+static void _remote(dncp_trust t, dncp_node n, dncp_sha256 h,
+                    uint8_t verdict, const char *cname, bool add)
+{
+  unsigned char buf[sizeof(dncp_t_trust_verdict_s)
+                    + DNCP_T_TRUST_VERDICT_CNAME_LEN];
+  dncp_t_trust_verdict tv = (dncp_t_trust_verdict)buf;
+
+  memset(buf, 0, sizeof(buf));
+  tv->verdict = verdict;
+  tv->sha256_hash = *h;
+  strcpy(tv->cname, cname);
+  _trust_remote_update(t, n, tv, add);
+}
+
+static bool _remote_is(dncp_trust t, dncp_sha256 h,
+                       int verdict, dncp_node n, const char *cname)
+{
+  char buf[DNCP_T_TRUST_VERDICT_CNAME_LEN];
+  dncp_node rn;
+
+  return _trust_get_remote_verdict(t, h, &rn, buf) == verdict
+    && rn == n && strcmp(buf, cname) == 0;
+}
+
+void dncp_trust_remote_index()
+{
+  net_sim_s s;
+  dncp_sha256_s h, h2;
+  char cname[DNCP_T_TRUST_VERDICT_CNAME_LEN];
+  dncp_node n1, n2, n;
+
+  memset(&h, 42, sizeof(h));
+  memset(&h2, 7, sizeof(h2));
+  net_sim_init(&s);
+  dncp d = net_sim_find_dncp(&s, "x");
+  n1 = dncp_get_own_node(net_sim_find_dncp(&s, "y"));
+  n2 = dncp_get_own_node(net_sim_find_dncp(&s, "z"));
+  if (dncp_node_cmp(n1, n2) > 0)
+    {
+      n = n1;
+      n1 = n2;
+      n2 = n;
+    }
+  dncp_trust t = dncp_trust_create(d, NULL);
+
+  _remote(t, n2, &h, DNCP_VERDICT_CONFIGURED_POSITIVE, "b", true);
+  _remote(t, n1, &h, DNCP_VERDICT_CONFIGURED_POSITIVE, "a", true);
+  _remote(t, n1, &h2, DNCP_VERDICT_CONFIGURED_NEGATIVE, "other", true);
+  sput_fail_unless(t->remote.count == 3, "indexed");
+  sput_fail_unless(_remote_is(t, &h, DNCP_VERDICT_CONFIGURED_POSITIVE,
+                              n1, "a"), "tie won by the lowest node");
+
+  _remote(t, n2, &h, DNCP_VERDICT_CONFIGURED_NEGATIVE, "c", true);
+  sput_fail_unless(_remote_is(t, &h, DNCP_VERDICT_CONFIGURED_NEGATIVE,
+                              n2, "c"), "best verdict wins");
+  sput_fail_unless(dncp_trust_get_verdict(t, &h, cname)
+                   == DNCP_VERDICT_CONFIGURED_NEGATIVE
+                   && strcmp(cname, "c") == 0, "remote verdict");
+
+  _remote(t, n2, &h, DNCP_VERDICT_CONFIGURED_NEGATIVE, "c", false);
+  sput_fail_unless(_remote_is(t, &h, DNCP_VERDICT_CONFIGURED_POSITIVE,
+                              n1, "a"), "removed");
+  _remote(t, n2, &h, DNCP_VERDICT_CONFIGURED_NEGATIVE, "c", false);
+  _remote(t, n1, &h, DNCP_VERDICT_CONFIGURED_NEGATIVE, "a", false);
+  sput_fail_unless(t->remote.count == 3, "unknown removal ignored");
+
+  _remote(t, n1, &h, DNCP_VERDICT_CONFIGURED_POSITIVE, "a", false);
+  sput_fail_unless(_remote_is(t, &h, DNCP_VERDICT_CONFIGURED_POSITIVE,
+                              n2, "b"), "other node left");
+  _remote(t, n2, &h, DNCP_VERDICT_CONFIGURED_POSITIVE, "b", false);
+  sput_fail_unless(_remote_is(t, &h, DNCP_VERDICT_NONE, NULL, ""),
+                   "no remote verdict");
+  sput_fail_unless(_remote_is(t, &h2, DNCP_VERDICT_CONFIGURED_NEGATIVE,
+                              n1, "other"), "other hash intact");
+  sput_fail_unless(t->remote.count == 1, "unindexed");
+
+  dncp_trust_destroy(t);
+  net_sim_uninit(&s);
+}
+
+/* Check the incrementally maintained hash against a full pass. */
+static void _hash_check(dncp_trust t, const char *msg)
+{
+  unsigned char buf[16], expected[16];
+  dncp_trust_node tn;
+  md5_ctx_t ctx;
+  int i;
+
+  memset(expected, 0, sizeof(expected));
+  vlist_for_each_element(&t->tree, tn, in_tree)
+    {
+      if (tn->stored.tlv.verdict == DNCP_VERDICT_NEUTRAL)
+        continue;
+      md5_begin(&ctx);
+      md5_hash(&tn->stored, sizeof(tn->stored), &ctx);
+      md5_end(buf, &ctx);
+      for (i = 0 ; i < (int)sizeof(buf) ; i++)
+        expected[i] ^= buf[i];
+    }
+  sput_fail_unless(memcmp(expected, t->content_hash, sizeof(expected)) == 0,
+                   msg);
+}
+
+void dncp_trust_hash()
+{
+  dncp_sha256_s ha[3];
+  net_sim_s s;
+
+  memset(&ha[0], 1, sizeof(ha[0]));
+  memset(&ha[1], 2, sizeof(ha[1]));
+  memset(&ha[2], 3, sizeof(ha[2]));
+  net_sim_init(&s);
+  dncp_trust t1 = dncp_trust_create(net_sim_find_dncp(&s, "x"), NULL);
+  dncp_trust t2 = dncp_trust_create(net_sim_find_dncp(&s, "y"), NULL);
+
+  dncp_trust_set(t1, &ha[0], DNCP_VERDICT_CONFIGURED_POSITIVE, "a");
+  dncp_trust_set(t1, &ha[1], DNCP_VERDICT_CONFIGURED_NEGATIVE, "b");
+  dncp_trust_request_verdict(t1, &ha[2], "c");
+  _hash_check(t1, "hash after set");
+
+  /* Same records in different order, no neutral one */
+  dncp_trust_set(t2, &ha[1], DNCP_VERDICT_CONFIGURED_NEGATIVE, "b");
+  dncp_trust_set(t2, &ha[0], DNCP_VERDICT_CONFIGURED_POSITIVE, "a");
+  _hash_check(t2, "hash after set 2");
+  sput_fail_unless(!memcmp(t1->content_hash, t2->content_hash,
+                           sizeof(t1->content_hash)), "order independent");
+
+  dncp_trust_set(t1, &ha[0], DNCP_VERDICT_CONFIGURED_NEGATIVE, "a");
+  _hash_check(t1, "hash after change");
+  sput_fail_unless(memcmp(t1->content_hash, t2->content_hash,
+                          sizeof(t1->content_hash)), "hash changed");
+  dncp_trust_set(t1, &ha[0], DNCP_VERDICT_CONFIGURED_POSITIVE, "a");
+  sput_fail_unless(!memcmp(t1->content_hash, t2->content_hash,
+                           sizeof(t1->content_hash)), "hash changed back");
+
+  dncp_trust_destroy(t1);
+  dncp_trust_destroy(t2);
+  net_sim_uninit(&s);
+}
+
+void dncp_trust_load()
+{
+  dncp_trust_stored_s st[3];
+  char cname[DNCP_T_TRUST_VERDICT_CNAME_LEN];
+  char version = SAVE_VERSION;
+  struct stat sb;
+  dncp_sha256_s h;
+  net_sim_s s;
+  dncp_trust t;
+  long size;
+  FILE *f;
+  int i;
+
+  memset(st, 0, sizeof(st));
+  for (i = 0 ; i < 3 ; i++)
+    {
+      memset(&h, i + 1, sizeof(h));
+      st[i].tlv.sha256_hash = h;
+      st[i].tlv.verdict = i == 2 ? DNCP_VERDICT_CACHED_NEGATIVE
+        : DNCP_VERDICT_CONFIGURED_POSITIVE;
+      sprintf(st[i].cname, "c%d", i);
+    }
+  f = fopen(TESTFILENAME, "wb");
+  fwrite(&version, 1, 1, f);
+  fwrite(st, sizeof(st), 1, f);
+  /* Partial trailing record is ignored */
+  fwrite(&st[0], 10, 1, f);
+  fclose(f);
+  size = 1 + sizeof(st) + 10;
+
+  net_sim_init(&s);
+  dncp d = net_sim_find_dncp(&s, "x");
+  t = dncp_trust_create(d, TESTFILENAME);
+  sput_fail_unless(_trust_count(t) == 3, "loaded records");
+  for (i = 0 ; i < 3 ; i++)
+    {
+      h = st[i].tlv.sha256_hash;
+      sput_fail_unless(dncp_trust_get_verdict(t, &h, cname)
+                       == st[i].tlv.verdict, "loaded verdict");
+      sput_fail_unless(strcmp(cname, st[i].cname) == 0, "loaded cname");
+    }
+  _hash_check(t, "hash after load");
+  dncp_trust_destroy(t);
+  sput_fail_unless(stat(TESTFILENAME, &sb) == 0 && sb.st_size == size,
+                   "unchanged file not rewritten");
+
+  /* Other versions are ignored */
+  f = fopen(TESTFILENAME, "wb");
+  version++;
+  fwrite(&version, 1, 1, f);
+  fwrite(st, sizeof(st), 1, f);
+  fclose(f);
+  t = dncp_trust_create(d, TESTFILENAME);
+  sput_fail_unless(_trust_count(t) == 0, "other version");
+  dncp_trust_destroy(t);
+
+  /* And so are empty files */
+  f = fopen(TESTFILENAME, "wb");
+  fclose(f);
+  t = dncp_trust_create(d, TESTFILENAME);
+  sput_fail_unless(_trust_count(t) == 0, "empty file");
+  dncp_trust_destroy(t);
+
+  unlink(TESTFILENAME);
+  net_sim_uninit(&s);
+}
+
 #define maybe_run_test(fun) sput_maybe_run_test(fun, do {} while(0))
 
 int main(int argc, char **argv)
@@ -145,6 +362,9 @@ int main(int argc, char **argv)
 
   maybe_run_test(dncp_trust_base);
   maybe_run_test(dncp_trust_io);
+  maybe_run_test(dncp_trust_remote_index);
+  maybe_run_test(dncp_trust_hash);
+  maybe_run_test(dncp_trust_load);
 
   sput_leave_suite(); /* optional */
   sput_finish_testing();
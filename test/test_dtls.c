@@ -12,19 +12,21 @@
  */
 
 /*
- * TBD: Write some tests that ensure the handling of limits is sane.
+ * The instances talk over fake_udp46 (in-memory datagrams on the same
+ * host) and time only moves with fake_uloop, so limits that depend on
+ * time can be checked exactly.
  *
  * TBD: Write test which makes sure that e.g. 3rd connection attempt
  * can still change the verdict for a cert.
  */
 
 #include "dtls.c"
-#include "udp46.c"
 #include "sput.h"
 #include "smock.h"
+#include "fake_udp46.h"
 
 #include <net/if.h>
-#include <libubox/uloop.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 #include <ctype.h>
 
@@ -134,12 +136,28 @@ bool _unknown_cb(dtls d, dtls_cert cert, void *context)
   return true;
 }
 
+/* The test certificates (and DTLS 1.0 signatures) are below the
+ * default security level of newer OpenSSL versions. */
+static dtls _dtls_create(uint16_t port)
+{
+  dtls d = dtls_create(port);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  if (d)
+    {
+      SSL_CTX_set_security_level(d->ssl_server_ctx, 0);
+      SSL_CTX_set_security_level(d->ssl_client_ctx, 0);
+    }
+#endif /* OPENSSL_VERSION_NUMBER >= 0x10100000L */
+  return d;
+}
+
 static void _test_basic_i(int i)
 {
   int pbase = 49000 + i * 2;
-  d1 = dtls_create(pbase);
+  d1 = _dtls_create(pbase);
   dtls_set_readable_cb(d1, _readable_cb, NULL);
-  d2 = dtls_create(pbase+1);
+  d2 = _dtls_create(pbase+1);
   dtls_set_readable_cb(d2, _readable_cb, NULL);
   int rv;
   char *msg = "foo";
@@ -242,9 +260,9 @@ static void _test_unknown_i(int i)
   fclose(f);
 
   int pbase = 49100 + i * 2;
-  d1 = dtls_create(pbase);
+  d1 = _dtls_create(pbase);
   dtls_set_unknown_cert_cb(d1, _unknown_cb, NULL);
-  d2 = dtls_create(pbase+1);
+  d2 = _dtls_create(pbase+1);
   dtls_set_unknown_cert_cb(d2, _unknown_cb, NULL);
   int rv;
   char *msg = "foo";
@@ -303,6 +321,506 @@ static void _test_unknown_i(int i)
   sput_fail_unless(!pending_unknown, "no unknown left");
 }
 
+static struct sockaddr_in6 _addr(int port)
+{
+  struct sockaddr_in6 sa;
+
+  _fu_udp46_addr(&sa, port);
+  return sa;
+}
+
+/* Move to the start of the next second, so that per-second limits
+ * start from scratch. */
+static void _next_second(void)
+{
+  set_hnetd_time((hnetd_time() / HNETD_TIME_PER_SECOND + 1)
+                 * HNETD_TIME_PER_SECOND);
+}
+
+static int _handshakes_queued(dtls d)
+{
+  dtls_connection dc;
+  int c = 0;
+
+  list_for_each_entry(dc, &d->handshakes, in_handshakes)
+    c++;
+  return c;
+}
+
+/* Run pending timeouts until t is the next one (or none are left). */
+static void _run_until(struct uloop_timeout *t)
+{
+  struct uloop_timeout *to;
+
+  while ((to = fu_next()) && to != t)
+    fu_run_one(to);
+}
+
+bool client_trusted, server_trusted;
+int received;
+
+bool _trust_cb(dtls d, dtls_cert cert, void *context)
+{
+  return *((bool *)context);
+}
+
+void _session_readable_cb(dtls d, void *context)
+{
+  struct sockaddr_in6 *src, *dst;
+  char buf[16];
+
+  while (dtls_recv(d, &src, &dst, buf, sizeof(buf)) > 0)
+    received++;
+  uloop_end();
+}
+
+void _session_end_cb(struct uloop_timeout *t)
+{
+  uloop_end();
+}
+
+/* Run until something is received, or ms milliseconds have passed. */
+static void _session_run(int ms)
+{
+  struct uloop_timeout t = { .cb = _session_end_cb };
+
+  uloop_timeout_set(&t, ms);
+  uloop_run();
+  uloop_timeout_cancel(&t);
+}
+
+static dtls _session_client(int port, const char *filename)
+{
+  dtls d = _dtls_create(port);
+
+  sput_fail_unless(d, "dtls_create");
+  dtls_set_local_cert(d, "test/cert1.pem", "test/key1.pem");
+  dtls_set_unknown_cert_cb(d, _trust_cb, &client_trusted);
+  sput_fail_unless(dtls_set_session_cache(d, 0, filename),
+                   "dtls_set_session_cache");
+  dtls_start(d);
+  return d;
+}
+
+static dtls _session_server(int port, const char *filename)
+{
+  dtls d = _dtls_create(port);
+
+  sput_fail_unless(d, "dtls_create");
+  dtls_set_local_cert(d, "test/cert2.pem", "test/key2.pem");
+  dtls_set_unknown_cert_cb(d, _trust_cb, &server_trusted);
+  sput_fail_unless(dtls_set_session_cache(d, 0, filename),
+                   "dtls_set_session_cache");
+  dtls_set_readable_cb(d, _session_readable_cb, NULL);
+  return d;
+}
+
+static dtls_connection _session_send(dtls d, struct sockaddr_in6 *dst)
+{
+  char *msg = "foo";
+
+  received = 0;
+  sput_fail_unless(dtls_send(d, NULL, dst, msg, strlen(msg)) == 3,
+                   "sendto failed?");
+  _session_run(SINGLE_TEST_ERROR_TIMEOUT / 2);
+  return _connection_find(d, -1, dst);
+}
+
+static void dtls_session_resume()
+{
+  unsigned char cert_hash[SHA256_DIGEST_LENGTH];
+  struct sockaddr_in6 dst = {.sin6_family = AF_INET6 };
+  int pbase = 49200;
+  char filename[64];
+  dtls_connection dc;
+  dtls_session ds;
+  struct stat st;
+  dtls d3;
+
+#ifdef __APPLE__
+  dst.sin6_len = sizeof(dst);
+#endif /* __APPLE__ */
+  (void)inet_pton(AF_INET6, "::1", &dst.sin6_addr);
+  dst.sin6_port = htons(pbase);
+  sprintf(filename, "/tmp/test_dtls_sessions.%d", (int)getpid());
+  unlink(filename);
+  client_trusted = server_trusted = true;
+
+  d2 = _session_server(pbase, NULL);
+  dtls_start(d2);
+
+  /* Full handshake; the session is saved when the client goes away. */
+  d1 = _session_client(pbase + 1, filename);
+  dc = _session_send(d1, &dst);
+  sput_fail_unless(received == 1, "received");
+  sput_fail_unless(dc && !SSL_session_reused(dc->ssl), "full handshake");
+  sput_fail_unless(d1->num_sessions == 1, "session stored");
+  if (d1->num_sessions)
+    {
+      ds = list_first_entry(&d1->session_lru, dtls_session_s, in_lru);
+      memcpy(cert_hash, ds->cert_hash, sizeof(cert_hash));
+    }
+  /* The next client may well get the same port; close cleanly. */
+  if (dc)
+    _connection_shutdown(dc);
+  struct uloop_timeout t = { .cb = _no_connections_timeout };
+  uloop_timeout_set(&t, 5);
+  uloop_run();
+  uloop_timeout_cancel(&t);
+  dtls_destroy(d1);
+  sput_fail_unless(stat(filename, &st) == 0 && (st.st_mode & 0777) == 0600,
+                   "private session file");
+
+  /* Loaded session is resumed */
+  d1 = _session_client(pbase + 2, filename);
+  sput_fail_unless(d1->num_sessions == 1, "session loaded");
+  if (d1->num_sessions)
+    {
+      ds = list_first_entry(&d1->session_lru, dtls_session_s, in_lru);
+      sput_fail_unless(!memcmp(cert_hash, ds->cert_hash, sizeof(cert_hash)),
+                       "cert hash loaded");
+    }
+  dc = _session_send(d1, &dst);
+  sput_fail_unless(received == 1, "received (resumed)");
+  sput_fail_unless(dc && SSL_session_reused(dc->ssl), "resumed");
+
+  /* Server no longer trusts the client: resumption is rejected. */
+  server_trusted = false;
+  d3 = _session_client(pbase + 3, filename);
+  dc = _session_send(d3, &dst);
+  sput_fail_unless(received == 0, "received (untrusted at server)");
+  dtls_destroy(d3);
+
+  /* Client no longer trusts the server: the session is not offered,
+   * and the cached ones are dropped once the peer is revoked. */
+  client_trusted = false;
+  d3 = _session_client(pbase + 3, filename);
+  sput_fail_unless(d3->num_sessions == 1, "session loaded (untrusted)");
+  dc = _session_send(d3, &dst);
+  sput_fail_unless(received == 0, "received (untrusted at client)");
+  sput_fail_unless(d3->num_sessions == 0, "session not offered");
+  dtls_destroy(d3);
+
+  /* Only the sessions of the revoked peer are dropped. */
+  struct sockaddr_in6 other = _addr(pbase + 10);
+  unsigned char other_hash[SHA256_DIGEST_LENGTH];
+  memset(other_hash, 42, sizeof(other_hash));
+  sput_fail_unless(_session_add(d1, &other, other_hash, SSL_SESSION_new()),
+                   "_session_add");
+  sput_fail_unless(d1->num_sessions == 2, "2 sessions");
+  dtls_trust_revoked(d1, cert_hash);
+  sput_fail_unless(d1->num_sessions == 1, "session dropped");
+  sput_fail_unless(_session_find(d1, &other), "other session kept");
+
+  dtls_destroy(d1);
+  dtls_destroy(d2);
+  unlink(filename);
+
+  /* A certificate valid according to the verify locations is accepted
+   * on resumption too, without asking the callback. */
+  client_trusted = true;
+  server_trusted = false;
+  d2 = _session_server(pbase, NULL);
+  dtls_set_verify_locations(d2, "test/cert1.pem", NULL);
+  dtls_start(d2);
+  d1 = _session_client(pbase + 4, filename);
+  dc = _session_send(d1, &dst);
+  sput_fail_unless(received == 1, "received (verified)");
+  dtls_destroy(d1);
+  d1 = _session_client(pbase + 5, filename);
+  dc = _session_send(d1, &dst);
+  sput_fail_unless(received == 1, "received (verified, resumed)");
+  sput_fail_unless(dc && SSL_session_reused(dc->ssl), "resumed (verified)");
+
+  dtls_destroy(d1);
+  dtls_destroy(d2);
+  unlink(filename);
+}
+
+static void dtls_session_server_restart()
+{
+  struct sockaddr_in6 dst = _addr(49250);
+  char filename[64], server_filename[64];
+  dtls_connection dc;
+  struct stat st;
+
+  sprintf(filename, "/tmp/test_dtls_sessions.%d", (int)getpid());
+  sprintf(server_filename, "/tmp/test_dtls_server.%d", (int)getpid());
+  unlink(filename);
+  unlink(server_filename);
+  client_trusted = server_trusted = true;
+
+  d2 = _session_server(49250, server_filename);
+  dtls_start(d2);
+  d1 = _session_client(49251, filename);
+  dc = _session_send(d1, &dst);
+  sput_fail_unless(received == 1, "received");
+  sput_fail_unless(dc && !SSL_session_reused(dc->ssl), "full handshake");
+  dtls_destroy(d1);
+  dtls_destroy(d2);
+  sput_fail_unless(stat(server_filename, &st) == 0
+                   && (st.st_mode & 0777) == 0600, "private server file");
+
+  /* Both ends restarted: the server still takes its own tickets. */
+  d2 = _session_server(49250, server_filename);
+  dtls_start(d2);
+  d1 = _session_client(49252, filename);
+  dc = _session_send(d1, &dst);
+  sput_fail_unless(received == 1, "received (restarted)");
+  sput_fail_unless(dc && SSL_session_reused(dc->ssl), "resumed (restarted)");
+  dtls_destroy(d1);
+  dtls_destroy(d2);
+
+  /* A server with new keys falls back to a full handshake. */
+  unlink(server_filename);
+  d2 = _session_server(49250, server_filename);
+  dtls_start(d2);
+  d1 = _session_client(49253, filename);
+  dc = _session_send(d1, &dst);
+  sput_fail_unless(received == 1, "received (new keys)");
+  sput_fail_unless(dc && !SSL_session_reused(dc->ssl), "not resumed");
+  dtls_destroy(d1);
+  dtls_destroy(d2);
+
+  unlink(filename);
+  unlink(server_filename);
+}
+
+static void dtls_handshake_rate_limit()
+{
+  dtls_limits_s limits = {
+    .input_pps = 4,
+    .handshake_steps_per_poll = 2,
+    .handshake_steps_per_second = 3,
+  };
+  int pbase = 49300;
+  struct sockaddr_in6 dst = _addr(pbase);
+  udp46 peers[5];
+  char *msg = "not a handshake";
+  int i;
+
+  d1 = _dtls_create(pbase);
+  sput_fail_unless(d1, "dtls_create");
+  dtls_set_psk(d1, "foo", 3);
+  dtls_set_limits(d1, &limits);
+  dtls_start(d1);
+
+  _next_second();
+  for (i = 0 ; i < 5 ; i++)
+    {
+      peers[i] = udp46_create(pbase + 1 + i);
+      udp46_send(peers[i], NULL, &dst, msg, strlen(msg));
+    }
+
+  /* Input beyond input_pps is dropped; the rest is only queued. */
+  _run_until(&d1->hs_uto);
+  sput_fail_unless(d1->num_non_data_connections == 4, "4 connections");
+  sput_fail_unless(_handshakes_queued(d1) == 4, "4 handshakes queued");
+  sput_fail_unless(uloop_timeout_remaining(&d1->hs_uto) == 0,
+                   "handshakes scheduled");
+
+  /* Each poll runs at most handshake_steps_per_poll steps.. */
+  fu_run_one(&d1->hs_uto);
+  sput_fail_unless(_handshakes_queued(d1) == 2, "2 steps per poll");
+  sput_fail_unless(uloop_timeout_remaining(&d1->hs_uto) == 0,
+                   "next poll scheduled");
+
+  /* ..and handshake_steps_per_second in total within a second. */
+  fu_run_one(&d1->hs_uto);
+  sput_fail_unless(_handshakes_queued(d1) == 1, "3 steps per second");
+  sput_fail_unless(uloop_timeout_remaining(&d1->hs_uto) == 1000,
+                   "next poll deferred to the next second");
+
+  _next_second();
+  fu_poll();
+  sput_fail_unless(_handshakes_queued(d1) == 0, "all steps run");
+  sput_fail_unless(!d1->hs_uto.pending, "nothing scheduled");
+  sput_fail_unless(d1->num_non_data_connections == 4, "connections kept");
+
+  /* The input limit is per second too. */
+  udp46_send(peers[4], NULL, &dst, msg, strlen(msg));
+  fu_poll();
+  sput_fail_unless(d1->num_non_data_connections == 5, "5th connection");
+
+  for (i = 0 ; i < 5 ; i++)
+    udp46_destroy(peers[i]);
+  dtls_destroy(d1);
+}
+
+static void dtls_connection_index()
+{
+  dtls_limits_s limits = {
+    .num_non_data_connections = 3,
+    .connection_idle_limit_seconds = 10,
+  };
+  struct sockaddr_in6 a[4];
+  dtls_connection dc[4], cdc;
+  hnetd_time_t t0;
+  int i;
+
+  d1 = _dtls_create(49400);
+  sput_fail_unless(d1, "dtls_create");
+  dtls_set_psk(d1, "foo", 3);
+  dtls_set_limits(d1, &limits);
+  for (i = 0 ; i < 4 ; i++)
+    a[i] = _addr(49401 + i);
+
+  /* Connections are indexed by (address, client/server). */
+  _next_second();
+  t0 = hnetd_time();
+  dc[0] = _connection_create(d1, false, &a[0]);
+  cdc = _connection_create(d1, true, &a[0]);
+  sput_fail_unless(dc[0] && cdc, "_connection_create");
+  sput_fail_unless(!_connection_create(d1, false, &a[0]), "no duplicate");
+  sput_fail_unless(_connection_find(d1, false, &a[0]) == dc[0], "server");
+  sput_fail_unless(_connection_find(d1, true, &a[0]) == cdc, "client");
+  sput_fail_unless(!_connection_find(d1, false, &a[1]), "no server");
+  _connection_shutdown(cdc);
+  sput_fail_unless(!_connection_find(d1, true, &a[0]), "client unindexed");
+  sput_fail_unless(_connection_find(d1, -1, &a[0]) == dc[0], "either");
+
+  /* The least recently used one is dropped at the limit.. */
+  for (i = 1 ; i < 3 ; i++)
+    {
+      set_hnetd_time(t0 + i * HNETD_TIME_PER_SECOND);
+      dc[i] = _connection_create(d1, false, &a[i]);
+    }
+  sput_fail_unless(d1->num_non_data_connections == 3, "3 connections");
+  (void)_connection_find(d1, false, &a[0]);
+  set_hnetd_time(t0 + 3 * HNETD_TIME_PER_SECOND);
+  dc[3] = _connection_create(d1, false, &a[3]);
+  sput_fail_unless(dc[3], "4th connection");
+  sput_fail_unless(d1->num_non_data_connections == 3, "still 3 connections");
+  sput_fail_unless(dc[1]->state == STATE_SHUTDOWN, "LRU one shut down");
+  sput_fail_unless(!_connection_find(d1, false, &a[1]), "LRU one unindexed");
+  sput_fail_unless(dc[0]->state == STATE_ACCEPT, "used one kept");
+
+  /* ..and the idle ones when they have been idle long enough: dc[2]
+   * and (the used) dc[0] at t0+12, and dc[3] at t0+13. */
+  set_hnetd_time(t0 + 11 * HNETD_TIME_PER_SECOND);
+  fu_poll();
+  sput_fail_unless(d1->num_non_data_connections == 3, "none idle yet");
+  sput_fail_unless(uloop_timeout_remaining(&d1->idle_uto)
+                   == HNETD_TIME_PER_SECOND, "idle check rescheduled");
+  set_hnetd_time(t0 + 12 * HNETD_TIME_PER_SECOND);
+  fu_poll();
+  sput_fail_unless(d1->num_non_data_connections == 1, "2 idle");
+  sput_fail_unless(dc[0]->state == STATE_SHUTDOWN
+                   && dc[2]->state == STATE_SHUTDOWN, "idle ones shut down");
+  sput_fail_unless(dc[3]->state == STATE_ACCEPT, "4th kept");
+  sput_fail_unless(uloop_timeout_remaining(&d1->idle_uto)
+                   == HNETD_TIME_PER_SECOND, "idle check moved");
+
+  set_hnetd_time(t0 + 13 * HNETD_TIME_PER_SECOND);
+  fu_poll();
+  sput_fail_unless(d1->num_non_data_connections == 0, "all idle");
+  sput_fail_unless(!d1->idle_uto.pending, "no idle check");
+  sput_fail_unless(!d1->connection_index.count, "index empty");
+
+  dtls_destroy(d1);
+}
+
+static void dtls_coalesce()
+{
+  dtls_limits_s limits = { .max_datagram_size = 512 };
+  struct sockaddr_in6 a1 = _addr(49451), a2 = _addr(49452);
+  unsigned char buf[2000], out[100];
+  dtls_connection dc, dc2;
+
+  memset(buf, 42, sizeof(buf));
+  d1 = _dtls_create(49450);
+  sput_fail_unless(d1, "dtls_create");
+  dtls_set_psk(d1, "foo", 3);
+  dc = _connection_create(d1, true, &a1);
+  dc2 = _connection_create(d1, false, &a2);
+  sput_fail_unless(dc && dc2, "_connection_create");
+
+  /* Records written are sent as one datagram once flushed.. */
+  fu_udp46_reset_counters();
+  BIO_write(dc->bio, buf, 100);
+  BIO_write(dc->bio, buf, 100);
+  sput_fail_unless(fu_udp46_sent == 0, "nothing sent before flush");
+  sput_fail_unless(BIO_wpending(dc->bio) == 200, "200 bytes pending");
+  (void)BIO_flush(dc->bio);
+  sput_fail_unless(fu_udp46_sent == 1 && fu_udp46_sent_bytes == 200,
+                   "one datagram");
+
+  /* ..or before it would exceed DTLS_COALESCE_SIZE.. */
+  BIO_write(dc->bio, buf, 1000);
+  BIO_write(dc->bio, buf, 500);
+  sput_fail_unless(fu_udp46_sent == 2 && fu_udp46_max_sent == 1000,
+                   "coalesced datagram is at most DTLS_COALESCE_SIZE");
+  sput_fail_unless(BIO_wpending(dc->bio) == 500, "500 bytes pending");
+
+  /* ..or when another connection writes. */
+  BIO_write(dc2->bio, buf, 10);
+  sput_fail_unless(fu_udp46_sent == 3 && fu_udp46_sent_bytes == 1700,
+                   "other connection's write flushes");
+  sput_fail_unless(!BIO_wpending(dc->bio) && BIO_wpending(dc2->bio) == 10,
+                   "other connection pending");
+  (void)BIO_flush(dc2->bio);
+  sput_fail_unless(fu_udp46_sent == 4, "flushed");
+
+  /* A record larger than the datagram buffer is sent on its own. */
+  dtls_set_limits(d1, &limits);
+  BIO_write(dc->bio, buf, 600);
+  sput_fail_unless(fu_udp46_sent == 5 && fu_udp46_max_sent == 1000,
+                   "oversized record sent");
+  sput_fail_unless(!BIO_wpending(dc->bio), "oversized record not kept");
+
+  /* A datagram that does not fit the read is dropped, and the read is
+   * retried later (rather than failing the connection). */
+  (void)_connection_push_datagram(dc, buf, 200);
+  (void)_connection_push_datagram(dc, buf, 50);
+  sput_fail_unless(BIO_read(dc->bio, out, sizeof(out)) == 50,
+                   "oversized datagram skipped");
+  (void)_connection_push_datagram(dc, buf, 200);
+  sput_fail_unless(BIO_read(dc->bio, out, sizeof(out)) < 0,
+                   "oversized datagram dropped");
+  sput_fail_unless(BIO_should_retry(dc->bio) && BIO_should_read(dc->bio),
+                   "retry read");
+  sput_fail_unless(list_empty(&dc->pending_datagrams), "nothing pending");
+
+  dtls_destroy(d1);
+}
+
+static void dtls_oversize()
+{
+  struct sockaddr_in6 dst = _addr(49461), src;
+  static unsigned char big[20000];
+  dtls_connection dc;
+  char *msg = "foo";
+
+  d1 = _dtls_create(49460);
+  d2 = _dtls_create(49461);
+  dtls_set_psk(d1, "foo", 3);
+  dtls_set_psk(d2, "foo", 3);
+  dtls_set_readable_cb(d2, _session_readable_cb, NULL);
+  dtls_start(d1);
+  dtls_start(d2);
+
+  received = 0;
+  dtls_send(d1, NULL, &dst, msg, strlen(msg));
+  _session_run(SINGLE_TEST_ERROR_TIMEOUT);
+  sput_fail_unless(received == 1, "received");
+
+  /* Larger than the SSL reads, but not than the receive buffer. */
+  memset(big, 23, sizeof(big));
+  udp46_send(d1->u46_client, NULL, &dst, big, sizeof(big));
+  fu_poll();
+  src = _addr(d1->u46_client->port);
+  dc = _connection_lookup(d2, false, &src);
+  sput_fail_unless(dc && dc->state == STATE_DATA, "connection survives");
+
+  received = 0;
+  dtls_send(d1, NULL, &dst, msg, strlen(msg));
+  _session_run(SINGLE_TEST_ERROR_TIMEOUT);
+  sput_fail_unless(received == 1, "received after oversized datagram");
+
+  dtls_destroy(d1);
+  dtls_destroy(d2);
+}
+
 static void dtls_basic_sc_cert()
 {
   _test_basic_i(0);
@@ -352,6 +870,12 @@ int main(int argc, char **argv)
   sput_maybe_run_test(dtls_basic_cc_psk, do {} while(0));
   sput_maybe_run_test(dtls_unknown_1, do {} while(0));
   sput_maybe_run_test(dtls_unknown_2, do {} while(0));
+  sput_maybe_run_test(dtls_session_resume, do {} while(0));
+  sput_maybe_run_test(dtls_session_server_restart, do {} while(0));
+  sput_maybe_run_test(dtls_handshake_rate_limit, do {} while(0));
+  sput_maybe_run_test(dtls_connection_index, do {} while(0));
+  sput_maybe_run_test(dtls_coalesce, do {} while(0));
+  sput_maybe_run_test(dtls_oversize, do {} while(0));
   sput_leave_suite(); /* optional */
   sput_finish_testing();
   return sput_get_return_value();
@@ -0,0 +1,216 @@
+/*
+ * $Id: test_hncp_capture.c $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+#ifdef L_LEVEL
+#undef L_LEVEL
+#endif /* L_LEVEL */
+#define L_LEVEL 7
+#define DISABLE_HNCP_PA
+#define DISABLE_HNCP_SD
+#define DISABLE_HNCP_MULTICAST
+#include "hncp.h"
+#include "net_sim.h"
+#include "sput.h"
+
+#include "hncp_capture.h"
+
+/*
+ * Exercise the capture ring (wrapping, reading it back from the file)
+ * and capture the I/O of one node in a small simulated network.
+ */
+
+static char filename[64];
+
+static void _sockaddr(struct sockaddr_in6 *sa, const char *address, int port)
+{
+  memset(sa, 0, sizeof(*sa));
+  sa->sin6_family = AF_INET6;
+  sa->sin6_port = htons(port);
+  inet_pton(AF_INET6, address, &sa->sin6_addr);
+}
+
+static void hncp_capture_ring(void)
+{
+  unsigned char buf[200];
+  struct sockaddr_in6 src, dst;
+  hncp_capture_event_s e;
+  hncp_capture c, c2;
+  int i, j, first = -1, count = 0;
+
+  _sockaddr(&src, "2001:db8::1", 1234);
+  _sockaddr(&dst, "2001:db8::2", HNCP_PORT);
+  c = hncp_capture_open(filename, 4096);
+  sput_fail_unless(c, "hncp_capture_open");
+  if (!c)
+    return;
+  for (i = 0 ; i < 1000 ; i++)
+    {
+      memset(buf, i, sizeof(buf));
+      e = (hncp_capture_event_s) {
+        .type = HNCP_CAPTURE_RECV,
+        .time = i,
+        .ifname = (i % 2) ? "eth0" : "eth1",
+        .flags = DNCP_RECV_FLAG_SRC_LINKLOCAL,
+        .src = &src,
+        .dst = (i % 3) ? &dst : NULL,
+        .buf = buf,
+        .len = i % sizeof(buf)
+      };
+      hncp_capture_add(c, &e);
+    }
+  /* Way too large ones are dropped */
+  e.len = 4096;
+  hncp_capture_add(c, &e);
+
+  c2 = hncp_capture_load(filename);
+  sput_fail_unless(c2, "hncp_capture_load");
+  while (c2 && hncp_capture_next(c2, &e))
+    {
+      if (first < 0)
+        first = e.time;
+      j = first + count++;
+      sput_fail_unless(e.time == j, "consecutive");
+      sput_fail_unless(e.type == HNCP_CAPTURE_RECV, "type");
+      sput_fail_unless(e.flags == DNCP_RECV_FLAG_SRC_LINKLOCAL, "flags");
+      sput_fail_unless(!strcmp(e.ifname, (j % 2) ? "eth0" : "eth1"),
+                       "ifname");
+      sput_fail_unless(e.src && !memcmp(&e.src->sin6_addr, &src.sin6_addr,
+                                        sizeof(src.sin6_addr))
+                       && e.src->sin6_port == src.sin6_port, "src");
+      sput_fail_unless((j % 3) ? e.dst != NULL : e.dst == NULL, "dst");
+      sput_fail_unless(e.len == j % sizeof(buf), "len");
+      memset(buf, j, sizeof(buf));
+      sput_fail_unless(!memcmp(e.buf, buf, e.len), "payload");
+    }
+  sput_fail_unless(first > 0, "wrapped");
+  sput_fail_unless(first + count == 1000, "newest last");
+  hncp_capture_close(c2);
+  hncp_capture_close(c);
+}
+
+static hncp_capture capture;
+static ssize_t (*_orig_recv)(dncp_ext e, dncp_ep *ep,
+                             struct sockaddr_in6 **src,
+                             struct sockaddr_in6 **dst,
+                             int *flags, void *buf, size_t buf_len);
+static void (*_orig_send)(dncp_ext e, dncp_ep ep,
+                          struct sockaddr_in6 *src,
+                          struct sockaddr_in6 *dst,
+                          void *buf, size_t buf_len);
+
+/* Same as what hncp_io does with real sockets */
+static ssize_t _capture_recv(dncp_ext ext, dncp_ep *ep,
+                             struct sockaddr_in6 **src,
+                             struct sockaddr_in6 **dst,
+                             int *flags, void *buf, size_t len)
+{
+  ssize_t r = _orig_recv(ext, ep, src, dst, flags, buf, len);
+
+  if (r >= 0)
+    {
+      hncp_capture_event_s e = {
+        .type = HNCP_CAPTURE_RECV, .time = hnetd_time(),
+        .ifname = (*ep)->ifname, .flags = *flags,
+        .src = *src, .dst = *dst, .buf = buf, .len = r
+      };
+      hncp_capture_add(capture, &e);
+    }
+  return r;
+}
+
+static void _capture_send(dncp_ext ext, dncp_ep ep,
+                          struct sockaddr_in6 *src,
+                          struct sockaddr_in6 *dst,
+                          void *buf, size_t len)
+{
+  hncp_capture_event_s e = {
+    .type = HNCP_CAPTURE_SEND, .time = hnetd_time(),
+    .ifname = ep->ifname, .src = src, .dst = dst, .buf = buf, .len = len
+  };
+
+  hncp_capture_add(capture, &e);
+  _orig_send(ext, ep, src, dst, buf, len);
+}
+
+static void hncp_capture_net_sim(void)
+{
+  int recvs = 0, sends = 0, len;
+  hncp_capture_event_s e;
+  net_sim_s s;
+  dncp n1, n2, n3;
+  net_node node2;
+  const void *ni;
+
+  net_sim_init(&s);
+  n1 = net_sim_find_dncp(&s, "n1");
+  n2 = net_sim_find_dncp(&s, "n2");
+  n3 = net_sim_find_dncp(&s, "n3");
+  node2 = net_sim_node_from_dncp(n2);
+  capture = hncp_capture_open(filename, HNCP_CAPTURE_DEFAULT_SIZE);
+  sput_fail_unless(capture, "hncp_capture_open");
+  if (!capture)
+    return;
+  hncp_capture_set_node_id(capture, dncp_node_get_id(dncp_get_own_node(n2)),
+                           HNCP_NI_LEN);
+  _orig_recv = node2->h.ext.cb.recv;
+  _orig_send = node2->h.ext.cb.send;
+  node2->h.ext.cb.recv = _capture_recv;
+  node2->h.ext.cb.send = _capture_send;
+
+  net_sim_set_connected(net_sim_dncp_find_ep_by_name(n1, "eth0"),
+                        net_sim_dncp_find_ep_by_name(n2, "eth0"), true);
+  net_sim_set_connected(net_sim_dncp_find_ep_by_name(n2, "eth0"),
+                        net_sim_dncp_find_ep_by_name(n1, "eth0"), true);
+  net_sim_set_connected(net_sim_dncp_find_ep_by_name(n2, "eth1"),
+                        net_sim_dncp_find_ep_by_name(n3, "eth0"), true);
+  net_sim_set_connected(net_sim_dncp_find_ep_by_name(n3, "eth0"),
+                        net_sim_dncp_find_ep_by_name(n2, "eth1"), true);
+  SIM_WHILE(&s, 1000, !net_sim_is_converged(&s));
+  hncp_capture_close(capture);
+  capture = NULL;
+
+  capture = hncp_capture_load(filename);
+  sput_fail_unless(capture, "hncp_capture_load");
+  if (!capture)
+    goto out;
+  len = hncp_capture_get_node_id(capture, &ni);
+  sput_fail_unless(len == HNCP_NI_LEN
+                   && !memcmp(ni, dncp_node_get_id(dncp_get_own_node(n2)),
+                              len), "node id");
+  while (hncp_capture_next(capture, &e))
+    {
+      sput_fail_unless(!strcmp(e.ifname, "eth0")
+                       || !strcmp(e.ifname, "eth1"), "ifname");
+      if (e.type == HNCP_CAPTURE_RECV)
+        recvs++;
+      else if (e.type == HNCP_CAPTURE_SEND)
+        sends++;
+    }
+  sput_fail_unless(recvs > 0 && sends > 0, "got traffic");
+  L_DEBUG("captured %d received and %d sent packets", recvs, sends);
+  hncp_capture_close(capture);
+ out:
+  node2->h.ext.cb.recv = _orig_recv;
+  node2->h.ext.cb.send = _orig_send;
+  net_sim_uninit(&s);
+}
+
+int main(__unused int argc, __unused char **argv)
+{
+  setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
+  openlog(argv[0], LOG_CONS | LOG_PERROR, LOG_DAEMON);
+  snprintf(filename, sizeof(filename), "/tmp/test_hncp_capture.%d",
+           (int)getpid());
+  sput_start_testing();
+  sput_enter_suite(argv[0]); /* optional */
+  sput_run_test(hncp_capture_ring);
+  sput_run_test(hncp_capture_net_sim);
+  sput_leave_suite(); /* optional */
+  sput_finish_testing();
+  unlink(filename);
+  return sput_get_return_value();
+}
@@ -0,0 +1,362 @@
+/*
+ * $Id: test_hncp_dns.c $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+#ifdef L_LEVEL
+#undef L_LEVEL
+#endif /* L_LEVEL */
+#define L_LEVEL 7
+#define DISABLE_HNCP_PA
+#define DISABLE_HNCP_SD
+#define DISABLE_HNCP_MULTICAST
+#include "hncp.h"
+#include "net_sim.h"
+#include "sput.h"
+
+#include "hncp_dns.c"
+
+#include <poll.h>
+
+/*
+ * Exercise the built-in DNS responder by feeding it queries directly
+ * (no sockets), while node name and delegated zone TLVs come and go.
+ */
+
+static void _add_name(dncp d, const char *name, const char *address)
+{
+  struct {
+    hncp_t_node_name_s h;
+    char name[DNS_MAX_L_LEN];
+  } s;
+  struct sockaddr_in6 sa;
+
+  _mapped_sockaddr(&sa, address, 0);
+  memset(&s, 0, sizeof(s));
+  s.h.address = sa.sin6_addr;
+  s.h.name_length = strlen(name);
+  memcpy(s.name, name, s.h.name_length);
+  dncp_add_tlv(d, HNCP_T_NODE_NAME, &s, sizeof(s.h) + s.h.name_length, 0);
+}
+
+static void _add_ddz(dncp d, const char *zone, const char *address,
+                     uint8_t flags)
+{
+  struct {
+    hncp_t_dns_delegated_zone_s h;
+    uint8_t ll[DNS_MAX_LL_LEN];
+  } s;
+  struct sockaddr_in6 sa;
+  int len;
+
+  _mapped_sockaddr(&sa, address, 0);
+  memset(&s, 0, sizeof(s));
+  memcpy(s.h.address, &sa.sin6_addr, sizeof(s.h.address));
+  s.h.flags = flags;
+  len = escaped2ll(zone, s.ll, sizeof(s.ll));
+  sput_fail_unless(len > 0, "escaped2ll");
+  dncp_add_tlv(d, HNCP_T_DNS_DELEGATED_ZONE, &s, sizeof(s.h) + len, 0);
+}
+
+static int _build_query(uint8_t *buf, int buf_len, uint16_t id,
+                        const char *name, uint16_t qtype)
+{
+  dns_header h = (dns_header)buf;
+  int len;
+
+  memset(buf, 0, buf_len);
+  h->id = htons(id);
+  h->flags = htons(DNS_FLAG_RD);
+  h->qdcount = htons(1);
+  len = escaped2ll(name, buf + sizeof(*h), buf_len - sizeof(*h) - 4);
+  sput_fail_unless(len > 0, "escaped2ll");
+  len += sizeof(*h);
+  buf[len++] = qtype >> 8;
+  buf[len++] = qtype & 0xff;
+  buf[len++] = 0;
+  buf[len++] = DNS_CLASS_IN;
+  return len;
+}
+
+static int _query(hncp_dns d, const char *name, uint16_t qtype,
+                  int *rcode, int *ancount, struct sockaddr_in6 *server)
+{
+  uint8_t buf[DNS_UDP_MAX_LEN], reply[DNS_UDP_MAX_LEN];
+  dns_header h;
+  int len, r;
+
+  len = _build_query(buf, sizeof(buf), 0x1234, name, qtype);
+  r = hncp_dns_answer(d, buf, len, reply, sizeof(reply), server);
+  if (r > 0)
+    {
+      h = (dns_header)reply;
+      sput_fail_unless(h->id == htons(0x1234), "id kept");
+      sput_fail_unless(ntohs(h->flags) & DNS_FLAG_QR, "reply");
+      *rcode = ntohs(h->flags) & 0xf;
+      *ancount = ntohs(h->ancount);
+    }
+  return r;
+}
+
+void test_hncp_dns(void)
+{
+  net_sim_s s;
+  dncp n1, n2;
+  net_node node1;
+  hncp_dns d;
+  struct sockaddr_in6 server, expected;
+  int r, rcode, ancount;
+  static hncp_dns_params_s p = {
+    .upstream = "2001:db8::53"
+  };
+
+  net_sim_init(&s);
+  n1 = net_sim_find_dncp(&s, "n1");
+  n2 = net_sim_find_dncp(&s, "n2");
+  node1 = net_sim_node_from_dncp(n1);
+  net_sim_set_connected(net_sim_dncp_find_ep_by_name(n1, "eth0"),
+                        net_sim_dncp_find_ep_by_name(n2, "eth0"), true);
+  net_sim_set_connected(net_sim_dncp_find_ep_by_name(n2, "eth0"),
+                        net_sim_dncp_find_ep_by_name(n1, "eth0"), true);
+
+  d = hncp_dns_create(&node1->h, &p);
+  sput_fail_unless(d, "hncp_dns_create");
+
+  _add_name(n1, "r", "2001:db8::1");
+  _add_name(n1, "r", "192.0.2.1");
+  _add_name(n2, "R1", "2001:db8::2");
+  _add_ddz(n1, "label.r.home.", "2001:db8::1",
+           HNCP_T_DNS_DELEGATED_ZONE_FLAG_BROWSE
+           | HNCP_T_DNS_DELEGATED_ZONE_FLAG_LEGACY_BROWSE);
+  _add_ddz(n2, "eth0.r1.home.", "2001:db8::2",
+           HNCP_T_DNS_DELEGATED_ZONE_FLAG_BROWSE);
+  SIM_WHILE(&s, 1000, !net_sim_is_converged(&s));
+
+  /* Host records */
+  r = _query(d, "r.home.", DNS_TYPE_AAAA, &rcode, &ancount, &server);
+  sput_fail_unless(r > 0 && rcode == DNS_RCODE_NOERROR && ancount == 1,
+                   "r AAAA");
+  r = _query(d, "R.Home.", DNS_TYPE_A, &rcode, &ancount, &server);
+  sput_fail_unless(r > 0 && rcode == DNS_RCODE_NOERROR && ancount == 1,
+                   "r A (case insensitive)");
+  r = _query(d, "r.home.", DNS_TYPE_ANY, &rcode, &ancount, &server);
+  sput_fail_unless(r > 0 && ancount == 2, "r ANY");
+  r = _query(d, "r1.home.", DNS_TYPE_AAAA, &rcode, &ancount, &server);
+  sput_fail_unless(r > 0 && rcode == DNS_RCODE_NOERROR && ancount == 1,
+                   "r1 AAAA");
+  r = _query(d, "r1.home.", DNS_TYPE_A, &rcode, &ancount, &server);
+  sput_fail_unless(r > 0 && rcode == DNS_RCODE_NOERROR && ancount == 0,
+                   "r1 A (no data)");
+  r = _query(d, "nope.home.", DNS_TYPE_AAAA, &rcode, &ancount, &server);
+  sput_fail_unless(r > 0 && rcode == DNS_RCODE_NXDOMAIN, "nope");
+
+  /* Browse PTRs */
+  r = _query(d, "b._dns-sd._udp.home.", DNS_TYPE_PTR,
+             &rcode, &ancount, &server);
+  sput_fail_unless(r > 0 && rcode == DNS_RCODE_NOERROR && ancount == 2,
+                   "b PTR");
+  r = _query(d, "lb._dns-sd._udp.home.", DNS_TYPE_PTR,
+             &rcode, &ancount, &server);
+  sput_fail_unless(r > 0 && rcode == DNS_RCODE_NOERROR && ancount == 1,
+                   "lb PTR");
+
+  /* Delegated zones are forwarded to their servers */
+  r = _query(d, "printer.eth0.r1.home.", DNS_TYPE_AAAA,
+             &rcode, &ancount, &server);
+  _mapped_sockaddr(&expected, "2001:db8::2", DNS_PORT);
+  sput_fail_unless(r == 0 && !memcmp(&server, &expected, sizeof(server)),
+                   "remote ddz forward");
+  r = _query(d, "printer.label.r.home.", DNS_TYPE_AAAA,
+             &rcode, &ancount, &server);
+  _mapped_sockaddr(&expected, HNCP_SD_OHP_ADDRESS, HNCP_SD_OHP_PORT);
+  sput_fail_unless(r == 0 && !memcmp(&server, &expected, sizeof(server)),
+                   "local ddz forward");
+
+  /* And the rest to the upstream */
+  r = _query(d, "example.com.", DNS_TYPE_AAAA, &rcode, &ancount, &server);
+  _mapped_sockaddr(&expected, "2001:db8::53", DNS_PORT);
+  sput_fail_unless(r == 0 && !memcmp(&server, &expected, sizeof(server)),
+                   "upstream forward");
+
+  /* Changes are reflected immediately */
+  dncp_remove_tlvs_by_type(n2, HNCP_T_NODE_NAME);
+  dncp_remove_tlvs_by_type(n2, HNCP_T_DNS_DELEGATED_ZONE);
+  SIM_WHILE(&s, 1000, net_sim_is_busy(&s) || !net_sim_is_converged(&s));
+  r = _query(d, "r1.home.", DNS_TYPE_AAAA, &rcode, &ancount, &server);
+  sput_fail_unless(r > 0 && rcode == DNS_RCODE_NXDOMAIN, "r1 gone");
+  r = _query(d, "b._dns-sd._udp.home.", DNS_TYPE_PTR,
+             &rcode, &ancount, &server);
+  sput_fail_unless(r > 0 && ancount == 1, "b PTR after removal");
+
+  hncp_dns_destroy(d);
+  net_sim_uninit(&s);
+}
+
+/* A socket bound to [::1]:<ephemeral>, and its port */
+static int _socket(uint16_t *port)
+{
+  struct sockaddr_in6 sa;
+  socklen_t sa_len = sizeof(sa);
+  int fd = socket(AF_INET6, SOCK_DGRAM, 0);
+
+  _mapped_sockaddr(&sa, "::1", 0);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0
+      || getsockname(fd, (struct sockaddr *)&sa, &sa_len) < 0)
+    {
+      sput_fail_unless(0, "socket");
+      if (fd >= 0)
+        close(fd);
+      return -1;
+    }
+  *port = ntohs(sa.sin6_port);
+  return fd;
+}
+
+static int _recv_reply(int fd, uint8_t *buf, int len,
+                       struct sockaddr_in6 *from)
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  socklen_t from_len = sizeof(*from);
+
+  if (poll(&pfd, 1, 1000) <= 0)
+    return -1;
+  return recvfrom(fd, buf, len, 0, (struct sockaddr *)from, &from_len);
+}
+
+static int _forwards_in_use(hncp_dns d)
+{
+  int i, count = 0;
+
+  for (i = 0 ; i < FORWARD_SLOTS ; i++)
+    if (d->forwards[i].expires)
+      count++;
+  return count;
+}
+
+/* Feed replies that have arrived to the forwarding slots. */
+static void _forwards_poll(hncp_dns d)
+{
+  int i;
+
+  for (i = 0 ; i < FORWARD_SLOTS ; i++)
+    if (d->forwards[i].expires)
+      d->forwards[i].ufd.cb(&d->forwards[i].ufd, ULOOP_READ);
+}
+
+void test_hncp_dns_forward(void)
+{
+  uint8_t buf[DNS_UDP_MAX_LEN];
+  dns_header h = (dns_header)buf;
+  struct sockaddr_in6 sa, sa_dns, fwd1, fwd2, from;
+  uint16_t port, upstream_port, client_port;
+  int fd, upstream, client, len, len1, len2;
+  uint16_t id1;
+  net_sim_s s;
+  dncp n1;
+  hncp_dns d;
+  hncp_dns_params_s p = { .upstream = "::1" };
+
+  net_sim_init(&s);
+  n1 = net_sim_find_dncp(&s, "n1");
+
+  /* Pick a free port for the responder */
+  if ((fd = _socket(&port)) < 0)
+    return;
+  close(fd);
+  p.port = port;
+  upstream = _socket(&upstream_port);
+  client = _socket(&client_port);
+  p.upstream_port = upstream_port;
+  d = hncp_dns_create(&net_sim_node_from_dncp(n1)->h, &p);
+  sput_fail_unless(d, "hncp_dns_create");
+  if (!d || upstream < 0 || client < 0)
+    goto out;
+
+  /* Only the router itself and HNCP interfaces are served */
+  _mapped_sockaddr(&sa, "2001:db8::99", 1234);
+  _mapped_sockaddr(&sa_dns, "2001:db8::1", port);
+  sput_fail_unless(!_query_is_internal(d, &sa, &sa_dns), "external");
+  sa_dns.sin6_scope_id = if_nametoindex("lo");
+  sput_fail_unless(!_query_is_internal(d, &sa, &sa_dns),
+                   "external (not a HNCP interface)");
+  sput_fail_unless(!dncp_find_ep_by_name(n1, "lo")
+                   || !dncp_ep_is_enabled(dncp_find_ep_by_name(n1, "lo")),
+                   "lo not enabled");
+  net_sim_dncp_find_ep_by_name(n1, "lo");
+  sput_fail_unless(_query_is_internal(d, &sa, &sa_dns), "HNCP interface");
+  sa_dns.sin6_scope_id = 0;
+  _mapped_sockaddr(&sa, "::1", 1234);
+  sput_fail_unless(_query_is_internal(d, &sa, &sa_dns), "loopback");
+  _mapped_sockaddr(&sa, "127.0.0.1", 1234);
+  sput_fail_unless(_query_is_internal(d, &sa, &sa_dns), "loopback (IPv4)");
+
+  /* Two outstanding queries to the upstream */
+  _mapped_sockaddr(&sa_dns, "::1", port);
+  len = _build_query(buf, sizeof(buf), 0x1234, "example.com.",
+                     DNS_TYPE_AAAA);
+  sendto(client, buf, len, 0, (struct sockaddr *)&sa_dns, sizeof(sa_dns));
+  _server_readable_cb(d->server, d);
+  len1 = _recv_reply(upstream, buf, sizeof(buf), &fwd1);
+  sput_fail_unless(len1 == len, "forwarded 1");
+  id1 = ntohs(h->id);
+  len = _build_query(buf, sizeof(buf), 0x1235, "example.com.",
+                     DNS_TYPE_A);
+  sendto(client, buf, len, 0, (struct sockaddr *)&sa_dns, sizeof(sa_dns));
+  _server_readable_cb(d->server, d);
+  len2 = _recv_reply(upstream, buf, sizeof(buf), &fwd2);
+  sput_fail_unless(len2 == len, "forwarded 2");
+  sput_fail_unless(_forwards_in_use(d) == 2, "2 forwards");
+  sput_fail_unless(fwd1.sin6_port != htons(port)
+                   && fwd2.sin6_port != htons(port)
+                   && fwd1.sin6_port != fwd2.sin6_port,
+                   "separate source ports");
+
+  /* A reply with the wrong id is ignored.. */
+  len = _build_query(buf, sizeof(buf), id1 ^ 1, "example.com.",
+                     DNS_TYPE_AAAA);
+  h->flags = htons(DNS_FLAG_QR | DNS_FLAG_RD | DNS_FLAG_RA);
+  sendto(upstream, buf, len, 0, (struct sockaddr *)&fwd1, sizeof(fwd1));
+  _forwards_poll(d);
+  sput_fail_unless(_forwards_in_use(d) == 2, "wrong id ignored");
+  /* ..as is one to the wrong port.. */
+  h->id = htons(id1);
+  sendto(upstream, buf, len, 0, (struct sockaddr *)&fwd2, sizeof(fwd2));
+  _forwards_poll(d);
+  sput_fail_unless(_forwards_in_use(d) == 2, "wrong port ignored");
+  /* ..and the right one is passed on to the client. */
+  sendto(upstream, buf, len, 0, (struct sockaddr *)&fwd1, sizeof(fwd1));
+  _forwards_poll(d);
+  sput_fail_unless(_forwards_in_use(d) == 1, "reply consumed");
+  memset(buf, 0, sizeof(buf));
+  sput_fail_unless(_recv_reply(client, buf, sizeof(buf), &from) == len,
+                   "reply received");
+  sput_fail_unless(h->id == htons(0x1234), "original id");
+  sput_fail_unless(from.sin6_port == htons(port), "reply from responder");
+
+  /* The other one times out. */
+  SIM_WHILE(&s, 1000, _forwards_in_use(d));
+
+ out:
+  if (d)
+    hncp_dns_destroy(d);
+  if (upstream >= 0)
+    close(upstream);
+  if (client >= 0)
+    close(client);
+  net_sim_uninit(&s);
+}
+
+int main(__unused int argc, __unused char **argv)
+{
+  setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
+  openlog(argv[0], LOG_CONS | LOG_PERROR, LOG_DAEMON);
+  sput_start_testing();
+  sput_enter_suite(argv[0]); /* optional */
+  sput_run_test(test_hncp_dns);
+  sput_run_test(test_hncp_dns_forward);
+  sput_leave_suite(); /* optional */
+  sput_finish_testing();
+  return sput_get_return_value();
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2015 Cisco Systems, Inc.
+ */
+
+/*
+ * Exercises the dump RPC (hd_cb) against a simulated network:
+ * filtering by node and TLV type, and paging through the nodes with a
+ * limit and cursor, or when a page would not fit a single reply. The
+ * hnet-dump argument parsing (hd_main) is tested as well.
+ */
+
+#define DISABLE_HNCP_PA
+#define DISABLE_HNCP_SD
+#define DISABLE_HNCP_MULTICAST
+#include <stdarg.h>
+
+#include "net_sim.h"
+#include "sput.h"
+
+#include "hncp_dump.c"
+
+int platform_rpc_register(__unused struct platform_rpc_method *m)
+{
+	return 0;
+}
+
+int platform_rpc_cli(__unused const char *method, __unused struct blob_attr *in)
+{
+	return 0;
+}
+
+enum {
+	R_NODES,
+	R_NEXT,
+	R_MAX
+};
+
+static const struct blobmsg_policy reply_policy[R_MAX] = {
+	[R_NODES] = { .name = "nodes", .type = BLOBMSG_TYPE_TABLE },
+	[R_NEXT] = { .name = "next", .type = BLOBMSG_TYPE_STRING },
+};
+
+static struct blob_buf req, reply;
+static struct blob_attr *tb[R_MAX];
+
+/* Zone names are long, so that the nodes do not take many of them to
+ * fill a page. */
+static void _add_zones(dncp o, int node, int zones)
+{
+	struct __packed {
+		hncp_t_dns_delegated_zone_s h;
+		uint8_t ll[DNS_MAX_LL_LEN];
+	} z;
+	char name[DNS_MAX_ESCAPED_LEN];
+	int i, len;
+
+	for (i = 0; i < zones; i++) {
+		memset(&z.h, 0, sizeof(z.h));
+		z.h.address[15] = node;
+		sprintf(name, "zone-%d-with-a-rather-long-name-to-fill-the-page.n%d.home.", i, node);
+		len = escaped2ll(name, z.ll, sizeof(z.ll));
+		sput_fail_unless(len > 0, "escaped2ll");
+		dncp_add_tlv(o, HNCP_T_DNS_DELEGATED_ZONE, &z, sizeof(z.h) + len, 0);
+	}
+}
+
+/* n0 with the other nodes connected to its eth0; the dump is n0's. */
+static void _setup(net_sim s, int nodes, int zones)
+{
+	dncp o, o0 = NULL;
+	char name[16];
+	int i;
+
+	net_sim_init(s);
+	for (i = 0; i < nodes; i++) {
+		sprintf(name, "n%d", i);
+		o = net_sim_find_dncp(s, name);
+		_add_zones(o, i, zones);
+		if (!i) {
+			o0 = o;
+			continue;
+		}
+		net_sim_set_connected(net_sim_dncp_find_ep_by_name(o0, "eth0"),
+				      net_sim_dncp_find_ep_by_name(o, "eth0"), true);
+		net_sim_set_connected(net_sim_dncp_find_ep_by_name(o, "eth0"),
+				      net_sim_dncp_find_ep_by_name(o0, "eth0"), true);
+	}
+	SIM_WHILE(s, 10000, !net_sim_is_converged(s));
+	sput_fail_unless(net_sim_is_converged(s), "converged");
+	hd_init(o0);
+	blob_buf_init(&req, 0);
+}
+
+/* Dumps with the current request; returns the number of nodes. */
+static int _dump(void)
+{
+	struct blob_attr *a;
+	unsigned rem;
+	int c = 0;
+
+	blob_buf_init(&reply, 0);
+	sput_fail_unless(hd_cb(&hncp_rpc_dump.m, req.head, &reply) > 0, "hd_cb");
+	blobmsg_parse(reply_policy, R_MAX, tb, blob_data(reply.head), blob_len(reply.head));
+	sput_fail_unless(tb[R_NODES], "nodes");
+	if (tb[R_NODES])
+		blobmsg_for_each_attr(a, tb[R_NODES], rem)
+			c++;
+	return c;
+}
+
+static void _teardown(net_sim s)
+{
+	hd_init(NULL);
+	blob_buf_free(&req);
+	blob_buf_free(&reply);
+	net_sim_uninit(s);
+}
+
+void hncp_dump_filter(void)
+{
+	net_sim_s s;
+	dncp o = NULL;
+	char id[HNCP_NI_LEN * 2 + 1];
+	struct blob_attr *node, *a, *z;
+	unsigned rem, rem2;
+	void *k;
+	int zones = 0;
+
+	_setup(&s, 3, 2);
+	o = net_sim_find_dncp(&s, "n1");
+	strcpy(id, hd_ni_to_hex(&o->own_node->node_id));
+
+	/* Unfiltered, everyone is there. */
+	sput_fail_unless(_dump() == 3, "3 nodes");
+	sput_fail_unless(!tb[R_NEXT], "no next");
+
+	k = blobmsg_open_array(&req, "nodes");
+	blobmsg_add_string(&req, NULL, id);
+	blobmsg_close_array(&req, k);
+	k = blobmsg_open_array(&req, "types");
+	blobmsg_add_u32(&req, NULL, HNCP_T_DNS_DELEGATED_ZONE);
+	blobmsg_close_array(&req, k);
+	sput_fail_unless(_dump() == 1, "1 node");
+	sput_fail_unless(!tb[R_NEXT], "no next (filtered)");
+	node = blobmsg_data(tb[R_NODES]);
+	sput_fail_unless(!strcmp(blobmsg_name(node), id), "right node");
+
+	/* Only the zones, not e.g. the (empty) other arrays or version. */
+	blobmsg_for_each_attr(a, node, rem) {
+		if (!strcmp(blobmsg_name(a), "zones"))
+			blobmsg_for_each_attr(z, a, rem2)
+				zones++;
+		else
+			sput_fail_unless(!strcmp(blobmsg_name(a), "update") ||
+					 !strcmp(blobmsg_name(a), "age"),
+					 blobmsg_name(a));
+	}
+	sput_fail_unless(zones == 2, "2 zones");
+
+	_teardown(&s);
+}
+
+void hncp_dump_pages(void)
+{
+	net_sim_s s;
+	char cursor[HNCP_NI_LEN * 2 + 1] = "";
+	char id[HNCP_NI_LEN * 2 + 1];
+	struct blob_attr *a;
+	unsigned rem;
+	int pages = 0, nodes = 0, c;
+
+	_setup(&s, 5, 1);
+	do {
+		blob_buf_init(&req, 0);
+		blobmsg_add_u32(&req, "limit", 2);
+		if (*cursor)
+			blobmsg_add_string(&req, "cursor", cursor);
+		c = _dump();
+		sput_fail_unless(c == (pages < 2 ? 2 : 1), "page size");
+		/* In node id order, after the cursor */
+		blobmsg_for_each_attr(a, tb[R_NODES], rem) {
+			strcpy(id, blobmsg_name(a));
+			sput_fail_unless(strcmp(id, cursor) > 0, "after cursor");
+			strcpy(cursor, id);
+		}
+		nodes += c;
+		pages++;
+		sput_fail_unless(!tb[R_NEXT] == (pages == 3), "next until the end");
+		if (tb[R_NEXT])
+			sput_fail_unless(!strcmp(blobmsg_get_string(tb[R_NEXT]), id),
+					 "next is the last node dumped");
+	} while (tb[R_NEXT] && pages < 5);
+	sput_fail_unless(pages == 3, "3 pages");
+	sput_fail_unless(nodes == 5, "5 nodes");
+
+	/* Bad cursors are rejected. */
+	blob_buf_init(&req, 0);
+	blobmsg_add_string(&req, "cursor", "nothex");
+	blob_buf_init(&reply, 0);
+	sput_fail_unless(hd_cb(&hncp_rpc_dump.m, req.head, &reply) == -EINVAL,
+			 "bad cursor");
+
+	_teardown(&s);
+}
+
+void hncp_dump_cap(void)
+{
+	net_sim_s s;
+	int pages = 0, nodes = 0, c;
+
+	/* Each node is a few KB in the dump; all of them well over 64KB. */
+	_setup(&s, 30, 20);
+	do {
+		c = _dump();
+		sput_fail_unless(c > 0, "something dumped");
+		nodes += c;
+		pages++;
+		if (tb[R_NEXT]) {
+			sput_fail_unless(blob_len(reply.head) > HD_PAGE_MAX_LEN,
+					 "page is full");
+			sput_fail_unless(blob_len(reply.head) < HD_PAGE_MAX_LEN + 8192,
+					 "by at most one node");
+			blob_buf_init(&req, 0);
+			blobmsg_add_string(&req, "cursor", blobmsg_get_string(tb[R_NEXT]));
+		}
+	} while (tb[R_NEXT] && pages < 30);
+	sput_fail_unless(pages > 1, "multiple pages");
+	sput_fail_unless(nodes == 30, "30 nodes");
+
+	_teardown(&s);
+}
+
+static int _main(int argc, ...)
+{
+	char *argv[8] = { "hnet-dump" };
+	va_list ap;
+	int i;
+
+	va_start(ap, argc);
+	for (i = 1; i < argc; i++)
+		argv[i] = va_arg(ap, char *);
+	va_end(ap);
+	return hd_main(&hncp_rpc_dump.m, argc, argv);
+}
+
+void hncp_dump_cli(void)
+{
+	sput_fail_unless(_main(1) == 0, "no arguments");
+	sput_fail_unless(_main(4, "-l", "10", "35", "42") == 0, "limit and types");
+	sput_fail_unless(_main(3, "-l", "0x10") == 1, "bad limit");
+	sput_fail_unless(_main(3, "-l", "-3") == 1, "negative limit");
+	sput_fail_unless(_main(3, "-l", "4294967296") == 1, "limit out of range");
+	sput_fail_unless(_main(2, "65535") == 0, "largest type");
+	sput_fail_unless(_main(2, "65536") == 1, "type out of range");
+	sput_fail_unless(_main(3, "35", "") == 1, "empty type");
+}
+
+int main(__unused int argc, __unused char **argv)
+{
+	setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
+	openlog("test_hncp_dump", LOG_CONS | LOG_PERROR, LOG_DAEMON);
+	sput_start_testing();
+	sput_enter_suite("hncp_dump"); /* optional */
+	sput_run_test(hncp_dump_filter);
+	sput_run_test(hncp_dump_pages);
+	sput_run_test(hncp_dump_cap);
+	sput_run_test(hncp_dump_cli);
+	sput_leave_suite(); /* optional */
+	sput_finish_testing();
+	return sput_get_return_value();
+}
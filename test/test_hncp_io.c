@@ -48,6 +48,16 @@ void dncp_ext_timeout(dncp o)
   smock_pull("dncp_run");
 }
 
+dncp_node dncp_get_own_node(dncp o)
+{
+  return NULL;
+}
+
+void *dncp_node_get_id(dncp_node n)
+{
+  return NULL;
+}
+
 int pending_packets = 0;
 
 void dncp_ext_readable(dncp o)
@@ -74,6 +84,9 @@ void dncp_ext_readable(dncp o)
       sput_fail_unless(memcmp(&dst->sin6_addr,
                               &edst->sin6_addr, sizeof(dst->sin6_addr))==0,
                        "dst mismatch");
+      hncp h = container_of(o->ext, hncp_s, ext);
+      sput_fail_unless(src == &h->recv_src && dst == &h->recv_dst,
+                       "per-instance address storage");
       if (!--pending_packets)
         uloop_end();
     }
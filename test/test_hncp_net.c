@@ -20,6 +20,7 @@
 /* Test utilities */
 #include "net_sim.h"
 #include "sput.h"
+#include "hncp_pa_i.h"
 
 /**************************************************************** Test cases */
 
@@ -150,6 +151,83 @@ void hncp_two(void)
   net_sim_uninit(&s);
 }
 
+static int _hpa_index_node_count(struct avl_tree *index, dncp_node n)
+{
+  hncp_node_id_s id;
+  hpa_advp hap;
+  int c = 0;
+
+  memset(&id, 0, sizeof(id));
+  memcpy(&id, dncp_node_get_id(n), HNCP_NI_LEN);
+  avl_for_each_element(index, hap, te)
+    if (!memcmp(&hap->ep_id.node_id, &id, sizeof(id)))
+      c++;
+  return c;
+}
+
+void hncp_pa_index(void)
+{
+  net_sim_s s;
+  dncp n1, n2;
+  dncp_ep l1, l2;
+  dncp_node n;
+  hncp_pa pa2;
+  struct tlv_attr *a;
+  int aps = 0, ras = 0;
+
+  net_sim_init(&s);
+  n1 = net_sim_find_dncp(&s, "n1");
+  n2 = net_sim_find_dncp(&s, "n2");
+  pa2 = net_sim_node_from_dncp(n2)->pa;
+  l1 = net_sim_dncp_find_ep_by_name(n1, "eth0");
+  l2 = net_sim_dncp_find_ep_by_name(n2, "eth1");
+  net_sim_set_connected(l1, l2, true);
+  net_sim_set_connected(l2, l1, true);
+  SIM_WHILE(&s, 1000, !net_sim_is_converged(&s));
+
+  net_sim_node_iface_cb(net_sim_node_from_dncp(n1), cb_prefix, "eth1", &p1,
+                        NULL, hnetd_time() + 123, hnetd_time() + 1, NULL, 0);
+  net_sim_node_iface_cb(net_sim_node_from_dncp(n1), cb_prefix, "eth1", &p2,
+                        NULL, hnetd_time() + 123, hnetd_time() + 1, NULL, 0);
+  SIM_WHILE(&s, 10000,
+            !net_sim_is_converged(&s) ||
+            net_sim_dncp_tlv_type_count(n2, HNCP_T_ASSIGNED_PREFIX) != 2);
+
+  /* The remote TLVs seen by n2 are all indexed, and nothing else */
+  n = dncp_find_node_by_node_id(n2, dncp_node_get_id(n1->own_node), false);
+  sput_fail_unless(n, "n1 known by n2");
+  if (n)
+    {
+      dncp_node_for_each_tlv_with_type(n, a, HNCP_T_ASSIGNED_PREFIX)
+        aps++;
+      dncp_node_for_each_tlv_with_type(n, a, HNCP_T_NODE_ADDRESS)
+        ras++;
+    }
+  sput_fail_unless(aps > 0 && ras > 0, "n1 publishes APs and RAs");
+  sput_fail_unless(pa2->ap_index.count == (unsigned int)aps, "ap_index");
+  sput_fail_unless(pa2->ra_index.count == (unsigned int)ras, "ra_index");
+  if (n)
+    {
+      sput_fail_unless(_hpa_index_node_count(&pa2->ap_index, n) == aps,
+                       "ap_index node");
+      sput_fail_unless(_hpa_index_node_count(&pa2->ra_index, n) == ras,
+                       "ra_index node");
+    }
+  sput_fail_unless(pa2->hncp_dp_index.count == 2, "hncp_dp_index");
+
+  /* Once n1 is gone, the removals must have found everything */
+  net_sim_set_connected(l1, l2, false);
+  net_sim_set_connected(l2, l1, false);
+  SIM_WHILE(&s, 10000, n2->nodes.avl.count != 1);
+  if (pa2->hncp_dp_index.count)
+    SIM_WHILE(&s, 10000, pa2->hncp_dp_index.count);
+  sput_fail_unless(!pa2->ap_index.count, "ap_index empty");
+  sput_fail_unless(!pa2->ra_index.count, "ra_index empty");
+  sput_fail_unless(list_empty(&pa2->aps), "aps empty");
+
+  net_sim_uninit(&s);
+}
+
 /* 11 nodes represented, wired according to how they are wired in the
  * test topology. */
 char *nodenames[] = {"cpe", "b1", "b2", "b3", "b4", "b5", "b6",
@@ -837,6 +915,7 @@ int main(__unused int argc, __unused char **argv)
   maybe_run_test(hncp_version);
   maybe_run_test(hncp_expiration);
   maybe_run_test(hncp_two);
+  maybe_run_test(hncp_pa_index);
   maybe_run_test(hncp_bird14);
   maybe_run_test(hncp_bird14_u);
   maybe_run_test(hncp_bird14_us);
@@ -42,9 +42,10 @@ void _file_contains(const char *filename, const char *string, bool has)
   sput_fail_unless(f, "fopen in file_contains");
   if (f)
     {
-      c = fread(buf, 1, sizeof(buf), f);
-      sput_fail_unless(c > 0, "fread in file_contains");
-      if (c > 0)
+      c = fread(buf, 1, sizeof(buf) - 1, f);
+      /* An empty file is fine, if we are looking for absence. */
+      sput_fail_unless(c > 0 || !has, "fread in file_contains");
+      if (c >= 0)
         {
           buf[c] = 0;
           sput_fail_unless(!has == !strstr(buf, string), string);
@@ -142,7 +143,9 @@ void test_hncp_sd(void)
   sput_fail_unless(rv, "write 1 works");
   smock_is_empty();
   file_contains("/tmp/n1.conf", "r.home");
-  file_contains("/tmp/n1.conf", "r1.home");
+  file_contains("/tmp/n1.conf", "hostsdir=/tmp/n1.conf.hosts.d");
+  file_contains("/tmp/n1.conf", "servers-file=/tmp/n1.conf.servers");
+  file_contains("/tmp/n1.conf.servers", "r1.home");
 
   rv = hncp_sd_write_dnsmasq_conf(node1->sd, "/tmp/n1.conf");
   sput_fail_unless(!rv, "write 1 'fails'");
@@ -153,7 +156,12 @@ void test_hncp_sd(void)
   sput_fail_unless(rv, "write 2 works");
   smock_is_empty();
   file_contains("/tmp/n2.conf", "label.r.home");
-  file_contains("/tmp/n2.conf", "r1.home");
+  file_contains("/tmp/n2.conf.hosts.d/hosts", "r1.home");
+
+  memset(&node2->sd->dnsmasq_state, 0, HNCP_HASH_LEN);
+  rv = hncp_sd_write_dnsmasq_conf(node2->sd, "/nonexistent/n2.conf");
+  sput_fail_unless(!rv, "write to missing directory fails");
+  smock_is_empty();
 
   check_exec = true;
   smock_push("execv_cmd", "s-dnsmasq");
@@ -162,6 +170,12 @@ void test_hncp_sd(void)
   sput_fail_unless(rv, "restart dnsmasq works");
   smock_is_empty();
 
+  smock_push("execv_cmd", "s-dnsmasq");
+  smock_push("execv_arg", "reload");
+  rv = hncp_sd_reload_dnsmasq(node1->sd);
+  sput_fail_unless(rv, "reload dnsmasq works");
+  smock_is_empty();
+
   mock_iface = true;
   /* Play with ohybridproxy */
   smock_push("execv_cmd", "s-ohp");
@@ -261,10 +275,149 @@ void test_hncp_sd(void)
   sput_fail_unless(rv, "write 12 works");
   smock_is_empty();
   file_contains("/tmp/n12.conf", "r.domain");
-  file_contains("/tmp/n12.conf", "r1.domain");
-  file_contains("/tmp/n12.conf", "xorbo.domain");
+  file_contains("/tmp/n12.conf.hosts.d/hosts", "r1.domain");
+  file_contains("/tmp/n12.conf.hosts.d/hosts", "xorbo.domain");
   file_does_not_contain("/tmp/n12.conf", "home");
+  file_does_not_contain("/tmp/n12.conf.hosts.d/hosts", "home");
+  file_does_not_contain("/tmp/n12.conf.servers", "home");
+
+  net_sim_uninit(&s);
+}
+
+static int ddz_added, ddz_removed;
+
+static void _ddz_local_tlv_change_cb(dncp_subscriber s __unused,
+                                     struct tlv_attr *tlv, bool add)
+{
+  if (tlv_id(tlv) != HNCP_T_DNS_DELEGATED_ZONE)
+    return;
+  if (add)
+    ddz_added++;
+  else
+    ddz_removed++;
+}
+
+static int _ddz_count(dncp o)
+{
+  dncp_tlv t;
+  int c = 0;
+
+  dncp_for_each_tlv(o, t)
+    if (tlv_id(dncp_tlv_get_attr(t)) == HNCP_T_DNS_DELEGATED_ZONE)
+      c++;
+  return c;
+}
+
+void test_hncp_sd_ddz(void)
+{
+  dncp_subscriber_s subscriber = {
+    .local_tlv_change_cb = _ddz_local_tlv_change_cb
+  };
+  net_sim_s s;
+  dncp n1;
+  dncp_ep l1;
+  hncp_sd sd;
+  struct prefix p;
+  int count;
 
+  net_sim_init(&s);
+  n1 = net_sim_find_dncp(&s, "n1");
+  sd = net_sim_node_from_dncp(n1)->sd;
+  l1 = net_sim_dncp_find_ep_by_name(n1, "eth0");
+  net_sim_dncp_find_ep_by_name(n1, "eth1");
+  sput_fail_unless(prefix_pton("2001:dead:beef::/64", &p.prefix, &p.plen),
+                   "prefix_pton");
+  tlv_ap_update(n1, p, l1, false, 0, true);
+  SIM_WHILE(&s, 100, !net_sim_is_converged(&s));
+
+  /* Browsable forward + reverse zone for eth0, forward one for eth1 */
+  count = _ddz_count(n1);
+  sput_fail_unless(count == 3, "3 ddzs published");
+  sput_fail_unless(count == (int)sd->ddzs.count, "ddzs match tlvs");
+
+  dncp_subscribe(n1, &subscriber);
+  ddz_added = ddz_removed = 0;
+
+  /* An unchanged set does not touch the TLVs. */
+  sd->should_update |= UPDATE_FLAG_LOCAL_DDZ;
+  _publish_ddzs(sd);
+  sput_fail_unless(!ddz_added && !ddz_removed, "unchanged set is a no-op");
+  sput_fail_unless(_ddz_count(n1) == count, "ddzs still there");
+
+  /* Without the assigned prefix, eth0's zones are withdrawn and only a
+   * non-browsable forward zone is published in their place. */
+  dncp_remove_tlvs_by_type(n1, HNCP_T_ASSIGNED_PREFIX);
+  ddz_added = ddz_removed = 0;
+  sd->should_update |= UPDATE_FLAG_LOCAL_DDZ;
+  _publish_ddzs(sd);
+  sput_fail_unless(ddz_added == 1, "1 ddz added");
+  sput_fail_unless(ddz_removed == 2, "2 ddzs removed");
+  sput_fail_unless(_ddz_count(n1) == 2, "2 ddzs published");
+  sput_fail_unless(sd->ddzs.count == 2, "ddzs match tlvs (2)");
+
+  dncp_unsubscribe(n1, &subscriber);
+  net_sim_uninit(&s);
+}
+
+static void _dnsmasq_update(hncp_sd sd, const char *cmd)
+{
+  if (cmd)
+    {
+      smock_push("execv_cmd", "s-dnsmasq");
+      smock_push("execv_arg", (void *)cmd);
+    }
+  sd->should_update = UPDATE_FLAG_DNSMASQ;
+  hncp_sd_update(sd);
+  smock_is_empty();
+}
+
+void test_hncp_sd_dnsmasq_update(void)
+{
+  const char *host = "2001:db8::1 extra.home";
+  const char *server = "server=/extra.home/2001:db8::2#53";
+  const char *ptr = "ptr-record=b._dns-sd._udp.home,extra.home";
+  net_sim_s s;
+  hncp_sd sd;
+
+  check_exec = true;
+  net_sim_init(&s);
+  sd = net_sim_node_from_dncp(net_sim_find_dncp(&s, "n1"))->sd;
+  SIM_WHILE(&s, 100, !net_sim_is_converged(&s));
+  sd->p.dnsmasq_bonus_file = "/tmp/n4.conf";
+
+  /* The first write is always a restart.. */
+  _dnsmasq_update(sd, "restart");
+  /* ..and nothing happens if nothing changed. */
+  _dnsmasq_update(sd, NULL);
+
+  /* Host records are picked up by dnsmasq itself. */
+  _dnsmasq_line_ref(sd, DNSMASQ_FILE_HOSTS, host, 1);
+  _dnsmasq_update(sd, NULL);
+  file_contains("/tmp/n4.conf.hosts.d/hosts", "extra.home");
+  _dnsmasq_line_ref(sd, DNSMASQ_FILE_HOSTS, host, -1);
+  _dnsmasq_update(sd, NULL);
+  file_does_not_contain("/tmp/n4.conf.hosts.d/hosts", "extra.home");
+
+  /* Servers require a reload.. */
+  _dnsmasq_line_ref(sd, DNSMASQ_FILE_SERVERS, server, 1);
+  _dnsmasq_update(sd, "reload");
+  file_contains("/tmp/n4.conf.servers", "extra.home");
+
+  /* ..and the main file a restart, even if servers changed too. */
+  _dnsmasq_line_ref(sd, DNSMASQ_FILE_SERVERS, server, -1);
+  _dnsmasq_line_ref(sd, DNSMASQ_FILE_CONF, ptr, 1);
+  _dnsmasq_update(sd, "restart");
+  file_contains("/tmp/n4.conf", "extra.home");
+  file_does_not_contain("/tmp/n4.conf.servers", "extra.home");
+
+  /* A failed write is retried on the next update. */
+  _dnsmasq_line_ref(sd, DNSMASQ_FILE_SERVERS, server, 1);
+  sd->p.dnsmasq_bonus_file = "/nonexistent/n4.conf";
+  _dnsmasq_update(sd, NULL);
+  sd->p.dnsmasq_bonus_file = "/tmp/n4.conf";
+  _dnsmasq_update(sd, "restart");
+
+  check_exec = false;
   net_sim_uninit(&s);
 }
 
@@ -275,6 +428,8 @@ int main(__unused int argc, __unused char **argv)
   sput_start_testing();
   sput_enter_suite(argv[0]); /* optional */
   sput_run_test(test_hncp_sd);
+  sput_run_test(test_hncp_sd_ddz);
+  sput_run_test(test_hncp_sd_dnsmasq_update);
   sput_leave_suite(); /* optional */
   sput_finish_testing();
   return sput_get_return_value();
@@ -0,0 +1,175 @@
+/*
+ * $Id: test_hnetd_stats.c $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+#include "hnetd.h"
+#include "hnetd_stats.h"
+#include "sput.h"
+#include "fake_log.h"
+
+#include <inttypes.h>
+
+/* Check the bucketing of the histograms, and that the Prometheus
+ * text output agrees with it (notably, that 'le' is inclusive). */
+
+static uint64_t samples[] = { 0, 1, 2, 3, 4, 7, 8, 1000, 1023, 1024,
+                              UINT64_C(1) << 22, (UINT64_C(1) << 23) - 1,
+                              UINT64_C(1) << 23, UINT64_C(1) << 40 };
+
+static hnetd_stats_s stats;
+
+void hnetd_stats_registry(void)
+{
+  hnetd_stats_histogram hi = &stats.histograms[HNETD_STATS_H_PA_ROUTINE];
+  uint64_t sum = 0;
+  unsigned int i;
+  int j;
+
+  hnetd_stats_reset(&stats);
+  hnetd_stats_inc(&stats, HNETD_STATS_DNCP_RECV_PACKETS);
+  hnetd_stats_add(&stats, HNETD_STATS_DNCP_RECV_BYTES, 123);
+  hnetd_stats_inc(&stats, HNETD_STATS_DNCP_RECV_PACKETS);
+  sput_fail_unless(stats.counters[HNETD_STATS_DNCP_RECV_PACKETS] == 2,
+                   "packets");
+  sput_fail_unless(stats.counters[HNETD_STATS_DNCP_RECV_BYTES] == 123,
+                   "bytes");
+
+  for (i = 0 ; i < ARRAY_SIZE(samples) ; i++)
+    {
+      hnetd_stats_record(&stats, HNETD_STATS_H_PA_ROUTINE, samples[i]);
+      sum += samples[i];
+    }
+  sput_fail_unless(hi->count == ARRAY_SIZE(samples), "count");
+  sput_fail_unless(hi->sum_us == sum, "sum");
+  for (j = 0 ; j < HNETD_STATS_BUCKETS ; j++)
+    {
+      uint64_t expected = 0;
+
+      /* Bucket j: [2^(j-1), 2^j), the first from 0, the last open */
+      for (i = 0 ; i < ARRAY_SIZE(samples) ; i++)
+        if ((j == 0 || samples[i] >= (UINT64_C(1) << (j - 1)))
+            && (j == HNETD_STATS_BUCKETS - 1
+                || samples[i] < (UINT64_C(1) << j)))
+          expected++;
+      sput_fail_unless(hi->buckets[j] == expected, "bucket");
+    }
+  sput_fail_unless(hi->buckets[0] == 1, "0 in the first bucket");
+  sput_fail_unless(hi->buckets[HNETD_STATS_BUCKETS - 1] == 4,
+                   "the rest in the last bucket");
+  sput_fail_unless(!stats.histograms[HNETD_STATS_H_DNCP_PRUNE].count,
+                   "other histograms untouched");
+
+  hnetd_stats_reset(&stats);
+  sput_fail_unless(!stats.counters[HNETD_STATS_DNCP_RECV_PACKETS]
+                   && !hi->count && !hi->sum_us && !hi->buckets[0],
+                   "reset");
+}
+
+void hnetd_stats_prometheus(void)
+{
+  const char *inf = "hnetd_dncp_network_hash_seconds_bucket{le=\"+Inf\"} ";
+  char *text = NULL, *line, *save = NULL;
+  size_t len = 0;
+  unsigned int i;
+  int buckets = 0, types = 0;
+  bool got_counter = false, got_inf = false, got_sum = false,
+    got_count = false;
+  FILE *f;
+
+  hnetd_stats_reset(&stats);
+  hnetd_stats_add(&stats, HNETD_STATS_SCRIPT_SPAWN, 42);
+  for (i = 0 ; i < ARRAY_SIZE(samples) ; i++)
+    hnetd_stats_record(&stats, HNETD_STATS_H_DNCP_NETWORK_HASH, samples[i]);
+
+  f = open_memstream(&text, &len);
+  sput_fail_unless(f, "open_memstream");
+  if (!f)
+    return;
+  hnetd_stats_write_prometheus(&stats, f);
+  fclose(f);
+
+  for (line = strtok_r(text, "\n", &save) ; line ;
+       line = strtok_r(NULL, "\n", &save))
+    {
+      double le;
+      uint64_t v, expected = 0;
+      int n;
+
+      if (!strncmp(line, "# TYPE ", 7))
+        {
+          types++;
+          continue;
+        }
+      if (!strcmp(line, "hnetd_script_spawns_total 42"))
+        got_counter = true;
+      if (!strncmp(line, inf, strlen(inf)))
+        got_inf = sscanf(line + strlen(inf), "%" SCNu64, &v) == 1
+          && v == ARRAY_SIZE(samples);
+      else if (sscanf(line,
+                      "hnetd_dncp_network_hash_seconds_bucket{le=\"%lf\"} %"
+                      SCNu64 "%n", &le, &v, &n) == 2 && !line[n])
+        {
+          /* Cumulative: every sample <= le */
+          for (i = 0 ; i < ARRAY_SIZE(samples) ; i++)
+            if (samples[i] / 1e6 <= le + 1e-9)
+              expected++;
+          sput_fail_unless(v == expected, "bucket matches le");
+          buckets++;
+        }
+      if (sscanf(line, "hnetd_dncp_network_hash_seconds_count %" SCNu64,
+                 &v) == 1)
+        got_count = v == ARRAY_SIZE(samples);
+      if (!strncmp(line, "hnetd_dncp_network_hash_seconds_sum ", 36))
+        got_sum = true;
+    }
+  sput_fail_unless(types == HNETD_STATS_NUM_COUNTERS
+                   + HNETD_STATS_NUM_HISTOGRAMS, "TYPE lines");
+  sput_fail_unless(got_counter, "counter");
+  sput_fail_unless(buckets == HNETD_STATS_BUCKETS - 1, "finite buckets");
+  sput_fail_unless(got_inf, "+Inf bucket");
+  sput_fail_unless(got_sum && got_count, "sum and count");
+  free(text);
+  hnetd_stats_reset(&stats);
+}
+
+/* Each instance has its own stats, which can be summed. */
+void hnetd_stats_instances(void)
+{
+  hnetd_stats_s s1, s2, sum;
+
+  hnetd_stats_reset(&s1);
+  hnetd_stats_reset(&s2);
+  hnetd_stats_reset(&sum);
+  hnetd_stats_inc(&s1, HNETD_STATS_DNCP_PRUNE);
+  hnetd_stats_add(&s2, HNETD_STATS_DNCP_PRUNE, 2);
+  hnetd_stats_record(&s1, HNETD_STATS_H_DNCP_PRUNE, 3);
+  sput_fail_unless(s1.counters[HNETD_STATS_DNCP_PRUNE] == 1
+                   && s2.counters[HNETD_STATS_DNCP_PRUNE] == 2, "separate");
+  sput_fail_unless(!s2.histograms[HNETD_STATS_H_DNCP_PRUNE].count,
+                   "other instance untouched");
+
+  hnetd_stats_merge(&sum, &s1);
+  hnetd_stats_merge(&sum, &s2);
+  sput_fail_unless(sum.counters[HNETD_STATS_DNCP_PRUNE] == 3, "summed");
+  sput_fail_unless(sum.histograms[HNETD_STATS_H_DNCP_PRUNE].count == 1
+                   && sum.histograms[HNETD_STATS_H_DNCP_PRUNE].sum_us == 3
+                   && sum.histograms[HNETD_STATS_H_DNCP_PRUNE].buckets[2] == 1,
+                   "histogram summed");
+}
+
+int main(__unused int argc, __unused char **argv)
+{
+  setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
+  openlog("test_hnetd_stats", LOG_CONS | LOG_PERROR, LOG_DAEMON);
+  sput_start_testing();
+  sput_enter_suite("hnetd_stats"); /* optional */
+  sput_run_test(hnetd_stats_registry);
+  sput_run_test(hnetd_stats_prometheus);
+  sput_run_test(hnetd_stats_instances);
+  sput_leave_suite(); /* optional */
+  sput_finish_testing();
+  return sput_get_return_value();
+}
@@ -0,0 +1,128 @@
+/*
+ * $Id: test_hnetd_trace.c $
+ *
+ * Copyright (c) 2015 cisco Systems, Inc.
+ *
+ */
+
+#include "hnetd.h"
+#include "sput.h"
+#include "fake_log.h"
+
+#include "hnetd_trace.c"
+
+/* Run real uloop timeouts through the tracer: the wrapping of the
+ * callback across set/re-add/cancel/fire, and the ring buffer once it
+ * has wrapped around. */
+
+#define TRACE_SIZE 4
+
+static int fired;
+static int rearm;
+
+static void _timeout_cb(struct uloop_timeout *t)
+{
+  fired++;
+  /* The original callback is in place while it runs */
+  sput_fail_unless(t->cb == _timeout_cb, "unwrapped in callback");
+  if (rearm-- > 0)
+    uloop_timeout_set(t, 0);
+  else
+    uloop_end();
+}
+
+static struct {
+  int count;
+  uint64_t last_start_us;
+  bool ordered, all_ours, slow;
+} seen;
+
+static bool _event_cb(hnetd_trace_event e, bool slow, void *context __unused)
+{
+  if (seen.count++ && e->start_us > seen.last_start_us)
+    seen.ordered = false;
+  seen.last_start_us = e->start_us;
+  if (e->kind != HNETD_TRACE_TIMEOUT || e->cb != _timeout_cb)
+    seen.all_ours = false;
+  seen.slow |= slow;
+  return true;
+}
+
+static int _foreach(void)
+{
+  memset(&seen, 0, sizeof(seen));
+  seen.ordered = seen.all_ours = true;
+  hnetd_trace_foreach(_event_cb, NULL);
+  return seen.count;
+}
+
+void hnetd_trace_timeouts(void)
+{
+  struct uloop_timeout t = { .cb = _timeout_cb };
+
+  uloop_init();
+  sput_fail_unless(!hnetd_trace_enable(TRACE_SIZE, 0), "0 threshold");
+  sput_fail_unless(!hnetd_trace_enable(0, 1000000), "0 size");
+  sput_fail_unless(hnetd_trace_enable(TRACE_SIZE, 1000000), "enable");
+  sput_fail_unless(!hnetd_trace_enable(TRACE_SIZE, 1000000), "only once");
+
+  /* Wrapped while pending, restored when it fires */
+  uloop_timeout_set(&t, 0);
+  sput_fail_unless(t.cb == hnetd_trace_timeout_cb, "wrapped");
+  sput_fail_unless(timeouts.count == 1, "1 wrapped timeout");
+  uloop_run();
+  sput_fail_unless(fired == 1, "fired");
+  sput_fail_unless(t.cb == _timeout_cb, "unwrapped after firing");
+  sput_fail_unless(timeouts.count == 0, "no wrapped timeouts");
+  sput_fail_unless(_foreach() == 1 && seen.all_ours && !seen.slow,
+                   "1 event");
+
+  /* Re-adding a pending timeout keeps the original callback */
+  uloop_timeout_set(&t, 1000);
+  uloop_timeout_set(&t, 0);
+  sput_fail_unless(t.cb == hnetd_trace_timeout_cb
+                   && timeouts.count == 1, "re-added");
+  uloop_run();
+  sput_fail_unless(fired == 2 && t.cb == _timeout_cb
+                   && timeouts.count == 0, "fired once");
+
+  /* Cancelling restores it, and it never fires */
+  uloop_timeout_set(&t, 0);
+  uloop_timeout_cancel(&t);
+  sput_fail_unless(!t.pending && t.cb == _timeout_cb
+                   && timeouts.count == 0, "cancelled");
+  sput_fail_unless(_foreach() == 2, "2 events");
+
+  /* Re-added from within the callback, until the ring wraps around */
+  rearm = 2 * TRACE_SIZE;
+  uloop_timeout_set(&t, 0);
+  uloop_run();
+  sput_fail_unless(fired == 3 + 2 * TRACE_SIZE, "fired repeatedly");
+  sput_fail_unless(t.cb == _timeout_cb && timeouts.count == 0,
+                   "unwrapped at end");
+  sput_fail_unless(trace.count == TRACE_SIZE && trace.first != 0,
+                   "ring wrapped");
+  sput_fail_unless(_foreach() == TRACE_SIZE, "ring size events");
+  sput_fail_unless(seen.ordered, "most recent first");
+  sput_fail_unless(seen.all_ours, "timeout events");
+
+  /* Slow ones are flagged */
+  hnetd_trace_record(HNETD_TRACE_FD, "slow", NULL,
+                     hnetd_stats_time_us() - 2000000);
+  sput_fail_unless(_foreach() == TRACE_SIZE && seen.slow, "slow");
+
+  hnetd_trace_clear();
+  sput_fail_unless(_foreach() == 0, "cleared");
+}
+
+int main(__unused int argc, __unused char **argv)
+{
+  setbuf(stdout, NULL); /* so that it's in sync with stderr when redirected */
+  openlog("test_hnetd_trace", LOG_CONS | LOG_PERROR, LOG_DAEMON);
+  sput_start_testing();
+  sput_enter_suite("hnetd_trace"); /* optional */
+  sput_run_test(hnetd_trace_timeouts);
+  sput_leave_suite(); /* optional */
+  sput_finish_testing();
+  return sput_get_return_value();
+}
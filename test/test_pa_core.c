@@ -135,6 +135,7 @@ struct test_rule {
 	pa_rule_priority priority; //Returned by get_prio
 	enum pa_rule_target target;
 	struct pa_rule_arg arg;    //arg returned by match
+	struct pa_link *del_link;  //Deleted by the next match
 };
 
 static int test_rule_filter_accept(struct pa_rule *rule,
@@ -150,6 +151,8 @@ static int test_rule_filter_accept(struct pa_rule *rule,
 static pa_rule_priority test_rule_prio(struct pa_rule *rule, struct pa_ldp *ldp)
 {
 	struct test_rule *t = container_of(rule, struct test_rule, rule);
+	if(!ldp) //Test rules priority may change while added
+		return (pa_rule_priority) -1;
 	t->ldp = *ldp;
 	t->prio_ctr++;
 	TEST_DEBUG("Called get_max_prio %d", t->priority);
@@ -161,8 +164,13 @@ static enum pa_rule_target test_rule_match(struct pa_rule *rule, struct pa_ldp *
 		struct pa_rule_arg *pa_arg)
 {
 	struct test_rule *t = container_of(rule, struct test_rule, rule);
+	struct pa_link *del_link;
 	t->ldp = *ldp;
 	t->best_match_priority = best_match_priority;
+	if((del_link = t->del_link)) { //Removes a link while its routines are in the batch
+		t->del_link = NULL;
+		pa_link_del(del_link);
+	}
 	*pa_arg = t->arg;
 	t->match_ctr++;
 	TEST_DEBUG("Called match %d", pa_arg->rule_priority);
@@ -300,6 +308,9 @@ void pa_core_override() {
 	s1.override_rule_priority = 2;
 
 	pa_rule_static_init(&s2, "static rule 1", static_rule_get_prefix2, 5, 2);
+	s2.override_priority = 0; //s2 never overrides
+	s2.override_rule_priority = 0;
+	s2.safety = 0;
 	pa_prefix_cpy(&advp1_01.prefix, 75, &sr_prefix2, sr_plen2); //Colliding prefix
 	pa_filter_ldp_init(&f2, &l2, NULL);
 	pa_rule_set_filter(&s2.rule, &f2.filter);
@@ -310,6 +321,8 @@ void pa_core_override() {
 
 	pa_rule_add(&core, &s1.rule);
 	pa_rule_add(&core, &s2.rule);
+	sput_fail_unless(ldp->routine_pending && ldp2->routine_pending, "Both routines pending");
+	sput_fail_unless(core.routine_to.pending, "Single routine timer");
 
 	fu_loop(5); //s2 wins
 	check_ldp_flags(ldp2, 1, 1, 1, 0);
@@ -479,6 +492,46 @@ void pa_core_hierarchical() {
 	pa_link_del(&low_link);
 }
 
+void pa_core_rule_bound() {
+	fu_init();
+	struct pa_core core;
+	struct pa_ldp *ldp;
+	struct test_rule low = {.rule = CUSTOM_RULE_INIT, .filter_accept = 1},
+			high = {.rule = CUSTOM_RULE_INIT, .filter_accept = 1};
+
+	low.rule.get_max_priority = NULL;
+	low.rule.max_priority = 1;
+	low.target = PA_RULE_NO_MATCH;
+
+	high.rule.get_max_priority = NULL;
+	high.rule.max_priority = 3;
+	high.target = PA_RULE_PUBLISH;
+	high.arg.plen = 63;
+	high.arg.prefix = advp1_01.prefix;
+	high.arg.rule_priority = 3;
+	high.arg.priority = 2;
+
+	pa_core_init(&core);
+	pa_rule_add(&core, &low.rule);
+	pa_rule_add(&core, &high.rule);
+	sput_fail_unless(core.rules.next == &high.rule.le, "Rules sorted by bound");
+
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+
+	fu_loop(1);
+	check_ldp_flags(ldp, true, true, false, false);
+	check_ldp_publish(ldp, &high.rule, 3, 2);
+	cr_check_ctr(&high, 1, 0, 1);
+	cr_check_ctr(&low, 0, 0, 0); //Bound is smaller than high's priority
+
+	pa_rule_del(&core, &high.rule);
+	pa_rule_del(&core, &low.rule);
+	pa_dp_del(&d1);
+	pa_link_del(&l1);
+}
+
 void pa_core_rule() {
 	struct pa_core core;
 	struct pa_ldp *ldp, *ldp2;
@@ -501,13 +554,13 @@ void pa_core_rule() {
 	sput_fail_if(fu_next(), "No scheduled timer.");
 
 	pa_rule_add(&core, &rule1.rule);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY, "Correct delay");
+	sput_fail_unless(ldp->routine_pending, "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&core.routine_to) == PA_RUN_DELAY, "Correct delay");
 
 	set_time(hnetd_time() + 1);
 	pa_rule_add(&core, &rule2.rule);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY - 1, "Correct delay");
+	sput_fail_unless(ldp->routine_pending, "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&core.routine_to) == PA_RUN_DELAY - 1, "Correct delay");
 
 	rule1.filter_accept = 0;
 	rule2.filter_accept = 0;
@@ -816,14 +869,14 @@ void pa_core_norule() {
 
 	//Test scheduling
 	sput_fail_unless(ldp, "ldp present");
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY, "Correct delay");
-	sput_fail_unless(fu_next() == &ldp->routine_to, "Correct timeout");
+	sput_fail_unless(ldp->routine_pending, "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&core.routine_to) == PA_RUN_DELAY, "Correct delay");
+	sput_fail_unless(fu_next() == &core.routine_to, "Correct timeout");
 
 	set_time(hnetd_time() + 1);
 	pa_core_set_node_id(&core, &id1); //Reschedule
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY - 1, "Correct delay");
+	sput_fail_unless(ldp->routine_pending, "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&core.routine_to) == PA_RUN_DELAY - 1, "Correct delay");
 
 	//Adding user
 	pa_user_register(&core, &tuser.user);
@@ -845,7 +898,7 @@ void pa_core_norule() {
 	advp2_01.priority = 2;
 	pa_advp_add(&core, &advp2_01);
 	pa_advp_update(&core, &advp2_01);
-	sput_fail_if(ldp->routine_to.pending, "Not routine pending");
+	sput_fail_if(ldp->routine_pending, "Not routine pending");
 	sput_fail_if(fu_next(), "No pending timeout");
 
 	//advp added
@@ -863,8 +916,8 @@ void pa_core_norule() {
 	advp1_01.link = NULL;
 	advp1_01.priority = 2;
 	pa_advp_add(&core, &advp1_01);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY, "Correct delay");
+	sput_fail_unless(ldp->routine_pending, "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&core.routine_to) == PA_RUN_DELAY, "Correct delay");
 	fu_loop(1);
 	check_user(&tuser, NULL, NULL, NULL);
 	check_ldp_flags(ldp, false, false, false, false);
@@ -878,8 +931,8 @@ void pa_core_norule() {
 	//Accept a prefix
 	advp1_01.link = &l1;
 	pa_advp_update(&core, &advp1_01);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY, "Correct delay");
+	sput_fail_unless(ldp->routine_pending, "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&core.routine_to) == PA_RUN_DELAY, "Correct delay");
 	fu_loop(1);
 	check_user(&tuser, ldp, NULL, NULL);
 	check_ldp_flags(ldp, 1, 0, 0, 0);
@@ -892,18 +945,18 @@ void pa_core_norule() {
 
 	//Remove adv2_01
 	pa_advp_del(&core, &advp2_01);
-	sput_fail_if(ldp->routine_to.pending, "Not routine pending");
+	sput_fail_if(ldp->routine_pending, "Not routine pending");
 
 	//Remove and add adv1_01 again
 	pa_advp_del(&core, &advp1_01);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
+	sput_fail_unless(ldp->routine_pending, "Routine pending");
 	check_user(&tuser, NULL, NULL, NULL);
 	check_ldp_flags(ldp, 1, 0, 0, 0);
 
 	set_time(hnetd_time() + 1);
 	pa_advp_add(&core, &advp1_01);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY - 1, "Correct delay");
+	sput_fail_unless(ldp->routine_pending, "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&core.routine_to) == PA_RUN_DELAY - 1, "Correct delay");
 	fu_loop(1);
 	check_user(&tuser, NULL, NULL, NULL);
 	check_ldp_flags(ldp, 1, 0, 0, 0);
@@ -989,7 +1042,7 @@ void pa_core_norule() {
 
 	//Remove the link from core
 	pa_link_del(&l1);
-	sput_fail_if(ldp->routine_to.pending, "Not routine pending");
+	sput_fail_if(ldp->routine_pending, "Not routine pending");
 	sput_fail_if(fu_next(), "No pending timeout");
 	check_user(&tuser, ldp, NULL, NULL);
 
@@ -1095,6 +1148,74 @@ void pa_core_data() {
 	sput_fail_if(fu_next(), "No scheduled timer.");
 }
 
+static int pa_core_queued(struct pa_core *core)
+{
+	struct pa_ldp *ldp;
+	int i = 0;
+	list_for_each_entry(ldp, &core->routines, in_routines)
+		i++;
+	return i;
+}
+
+void pa_core_batch() {
+	fu_init();
+	struct pa_core core;
+	struct test_rule rule = {.rule = CUSTOM_RULE_INIT, .filter_accept = 1, .priority = 1};
+
+	core.node_id[0] = id1;
+	pa_core_init(&core);
+	pa_rule_add(&core, &rule.rule);
+	pa_link_add(&core, &l1);
+	pa_link_add(&core, &l2);
+	pa_dp_add(&core, &d1);
+	pa_dp_add(&core, &d2);
+
+	//Every pair is queued once, behind a single timer
+	sput_fail_unless(pa_core_queued(&core) == 4, "Four routines queued");
+	advp1_01.priority = 1;
+	advp1_01.link = NULL;
+	advp1_01.node_id[0] = id2;
+	pa_advp_add(&core, &advp1_01);
+	pa_rule_del(&core, &rule.rule);
+	pa_rule_add(&core, &rule.rule);
+	sput_fail_unless(pa_core_queued(&core) == 4, "Still four routines queued");
+	sput_fail_unless(fu_next() == &core.routine_to, "Routine timer");
+	sput_fail_unless(uloop_timeout_remaining(&core.routine_to) == PA_RUN_DELAY, "Correct delay");
+
+	//The whole queue is flushed by one timeout
+	fu_loop(1);
+	cr_check_ctr(&rule, 4, 4, 4);
+	sput_fail_unless(pa_core_queued(&core) == 0, "Queue flushed");
+	sput_fail_if(fu_next(), "No scheduled timer");
+
+	//Routines scheduled during a batch run in the next one
+	rule.target = PA_RULE_DESTROY;
+	pa_rule_del(&core, &rule.rule);
+	pa_rule_add(&core, &rule.rule);
+	fu_loop(1);
+	cr_check_ctr(&rule, 4, 4, 4);
+	sput_fail_unless(pa_core_queued(&core) == 4, "Next batch queued");
+	sput_fail_unless(fu_next() == &core.routine_to, "Routine timer rearmed");
+	sput_fail_unless(uloop_timeout_remaining(&core.routine_to) == PA_RUN_DELAY, "Correct delay");
+
+	//Pairs destroyed during a batch are removed from it
+	rule.target = PA_RULE_NO_MATCH;
+	rule.del_link = &l2;
+	fu_loop(1);
+	cr_check_ctr(&rule, 2, 2, 2);
+	sput_fail_unless(list_empty(&l2.ldps), "L2 pairs destroyed");
+	sput_fail_unless(pa_core_queued(&core) == 0, "Queue flushed");
+	sput_fail_if(fu_next(), "No scheduled timer");
+
+	pa_advp_del(&core, &advp1_01);
+	pa_rule_del(&core, &rule.rule);
+	pa_dp_del(&d1);
+	pa_dp_del(&d2);
+	pa_link_del(&l1);
+	fu_loop(1);
+	sput_fail_if(fu_next(), "No scheduled timer");
+}
+
 int main() {
 	fu_init();
 	sput_start_testing();
@@ -1102,8 +1223,10 @@ int main() {
 	sput_run_test(pa_core_data);
 	sput_run_test(pa_core_norule);
 	sput_run_test(pa_core_rule);
+	sput_run_test(pa_core_rule_bound);
 	sput_run_test(pa_core_hierarchical);
 	sput_run_test(pa_core_override);
+	sput_run_test(pa_core_batch);
 	sput_leave_suite(); /* optional */
 	sput_finish_testing();
 	return sput_get_return_value();
@@ -280,6 +280,7 @@ void pa_rules_random()
 	struct pa_advp advp = {.link = &link, .prefix = p1, .plen = 56};
 	struct pa_ldp ldp = {.core = &core, .dp = &dp, .link = &link, .prefix = p1, .plen = 2};
 	struct pa_rule_arg arg;
+	int i;
 
 	test_core_init(&core, 5);
 
@@ -312,8 +313,16 @@ void pa_rules_random()
 	fr_mask_md5 = true;
 	fr_mask_random = true;
 
-	random.pseudo_random_tentatives = 2;
-	random.random_set_size = 2; //two best only
+	uint32_t key[4];
+	pa_prefix t0, t1;
+	fr_md5_push(&p1); //md5 output is the pushed value
+	pa_rule_prandom_key(random.pseudo_random_seed, random.pseudo_random_seedlen, key);
+	sput_fail_unless(key[0] == 0x20010000 && key[1] == 0x00000100, "Key in network byte order");
+	pa_rule_prefix_prandom_nth(key, 0, &p1, 56, &t0, 60);
+	pa_rule_prefix_prandom_nth(key, 1, &p1, 56, &t1, 60);
+
+	random.pseudo_random_tentatives = 16;
+	random.random_set_size = 16; //Whole pool
 
 	dp.prefix = p1;
 	dp.plen = 56;
@@ -322,43 +331,47 @@ void pa_rules_random()
 	fr_md5_push(&p1);
 	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_PUBLISH);
 	test_rule_prio(&arg, 3);
-	test_rule_prefix(&arg, &p1, 60, 4);
+	test_rule_prefix(&arg, &t0, 60, 4);
 
-	fr_md5_push(&p12); //Outside the set
-	fr_md5_push(&p11); //In the set
+	//Same seed, same prefix
+	fr_md5_push(&p1);
 	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_PUBLISH);
-	test_rule_prio(&arg, 3);
-	test_rule_prefix(&arg, &p11, 60, 4);
+	test_rule_prefix(&arg, &t0, 60, 4);
+
+	//First tentative is taken
+	advp.prefix = t0;
+	advp.plen = 60;
+	test_advp_add(&core, &advp);
+	fr_md5_push(&p1);
+	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_PUBLISH);
+	test_rule_prefix(&arg, &t1, 60, 4);
+	test_advp_del(&core, &advp);
+
+	//Only tentatives in the set are accepted
+	random.random_set_size = 2; //two best only
+	for(i = 0; i < 16; i++) {
+		pa_rule_prefix_prandom_nth(key, i, &p1, 56, &t0, 60);
+		if(!pa_prefix_cmp(&t0, 60, &p1, 60) || !pa_prefix_cmp(&t0, 60, &p11, 60))
+			break;
+	}
+	fr_md5_push(&p1);
+	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_PUBLISH);
+	test_rule_prefix(&arg, &t0, 60, 4);
 
 	//Different plen
 	test_desired_plen = 64;
-	fr_md5_push(&p102);
-	fr_md5_push(&p101);
+	pa_rule_prefix_prandom_nth(key, 0, &p1, 56, &t0, 64);
+	random.random_set_size = 256;
+	fr_md5_push(&p1);
 	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_PUBLISH);
-	test_rule_prio(&arg, 3);
-	test_rule_prefix(&arg, &p101, 64, 4);
+	test_rule_prefix(&arg, &t0, 64, 4);
+	random.random_set_size = 2;
 
 	test_desired_plen = 60;
 	advp.prefix = p1;
 	advp.plen = 56;
 	test_advp_add(&core, &advp);
 	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_NO_MATCH);
-
-	test_advp_del(&core, &advp);
-	advp.prefix = p14;
-	advp.plen = 60;
-	test_advp_add(&core, &advp);
-	random.pseudo_random_tentatives = 6;
-	fr_md5_push(&p1);
-	fr_md5_push(&p11);
-	fr_md5_push(&p12);
-	fr_md5_push(&p14);
-	fr_md5_push(&p17);
-	fr_md5_push(&p15);
-	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_PUBLISH);
-	test_rule_prio(&arg, 3);
-	test_rule_prefix(&arg, &p15, 60, 4);
-
 	test_advp_del(&core, &advp);
 
 	//Test random
@@ -422,10 +435,36 @@ void pa_rules_adopt()
 	test_rule_prio(&arg, 3);
 }
 
+void pa_rules_permute()
+{
+	uint32_t key[4] = {1, 2, 3, 4};
+	uint8_t seen[1000];
+	uint64_t sizes[] = {1, 2, 3, 4, 5, 7, 16, 17, 255, 256, 1000};
+	size_t s;
+	uint32_t i, v;
+	int errors;
+
+	for(s = 0; s < ARRAY_SIZE(sizes); s++) {
+		errors = 0;
+		memset(seen, 0, sizeof(seen));
+		for(i = 0; i < sizes[s]; i++) {
+			v = pa_rule_permute(key, i, sizes[s]);
+			if(v >= sizes[s] || seen[v]++)
+				errors++;
+		}
+		sput_fail_unless(!errors, "Permutation");
+	}
+
+	//Large spaces
+	sput_fail_unless(pa_rule_permute(key, 0, ((uint64_t)1) << 32) !=
+			pa_rule_permute(key, 1, ((uint64_t)1) << 32), "Distinct values");
+}
+
 int main() {
 	openlog("hnetd", LOG_PERROR | LOG_PID, LOG_DAEMON);
 	sput_start_testing();
 	sput_enter_suite("Prefix Assignment Rules tests"); /* optional */
+	sput_run_test(pa_rules_permute);
 	sput_run_test(pa_rules_adopt);
 	sput_run_test(pa_rules_random);
 	sput_run_test(pa_rules_random_override);
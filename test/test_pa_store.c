@@ -741,6 +741,259 @@ void pa_store_cache_test()
 	pa_store_term(&store);
 }
 
+#define PA_STORE_TEST_LINKS 100
+#define PA_STORE_TEST_PREFIXES 10000
+
+void pa_store_index_test()
+{
+	fu_init();
+	struct pa_store store;
+	struct pa_link links[PA_STORE_TEST_LINKS];
+	struct pa_store_link slinks[PA_STORE_TEST_LINKS];
+	struct pa_store_prefix *sp;
+	char name[PA_STORE_NAMELEN];
+	pa_prefix px = p;
+	int i, errors = 0;
+
+	pa_store_init(&store, PA_STORE_TEST_PREFIXES);
+	for(i = 0; i < PA_STORE_TEST_LINKS; i++) {
+		sprintf(name, "L%d", i);
+		pa_store_link_init(&slinks[i], &links[i], name, 0);
+		pa_store_link_add(&store, &slinks[i]);
+	}
+
+	for(i = 0; i < PA_STORE_TEST_PREFIXES; i++) {
+		px.s6_addr[6] = i >> 8;
+		px.s6_addr[7] = i;
+		pa_store_cache(&store, &slinks[i % PA_STORE_TEST_LINKS], &px, 64);
+	}
+	sput_fail_unless(store.n_prefixes == PA_STORE_TEST_PREFIXES, "All prefixes cached");
+
+	for(i = 0; i < PA_STORE_TEST_PREFIXES; i++) {
+		px.s6_addr[6] = i >> 8;
+		px.s6_addr[7] = i;
+		if(pa_store_link_get(&store, &links[i % PA_STORE_TEST_LINKS]) != &slinks[i % PA_STORE_TEST_LINKS] ||
+				!(sp = pa_store_prefix_get(&slinks[i % PA_STORE_TEST_LINKS], &px, 64)) ||
+				pa_store_prefix_get(&slinks[(i + 1) % PA_STORE_TEST_LINKS], &px, 64) ||
+				pa_store_cache(&store, &slinks[i % PA_STORE_TEST_LINKS], &px, 64) ||
+				list_entry(store.prefixes.next, struct pa_store_prefix, in_store) != sp)
+			errors++;
+	}
+	sput_fail_unless(!errors, "Indexed lookups");
+	sput_fail_unless(store.n_prefixes == PA_STORE_TEST_PREFIXES, "No duplicates");
+	sput_fail_unless(pa_store_link_goc(&store, "L42", 0) == &slinks[42], "Link by name");
+	sput_fail_unless(!pa_store_link_goc(&store, "L100", 0), "Unknown link");
+
+	//Prefixes follow the link when removed and added again
+	pa_store_link_remove(&store, &slinks[42]);
+	sput_fail_unless(!pa_store_link_get(&store, &links[42]), "Link removed");
+	pa_store_link_add(&store, &slinks[42]);
+	px.s6_addr[6] = 0;
+	px.s6_addr[7] = 42;
+	sput_fail_unless(pa_store_prefix_get(&slinks[42], &px, 64), "Prefix moved back");
+
+	//Link names are unique, except for unnamed links
+	struct pa_link dlink, ulinks[2];
+	struct pa_store_link dup, unnamed[2];
+	pa_store_link_init(&dup, &dlink, "L42", 0);
+	sput_fail_unless(pa_store_link_add(&store, &dup) == -1, "Duplicated name");
+	sput_fail_unless(!pa_store_link_get(&store, &dlink), "Duplicate not added");
+	sput_fail_unless(pa_store_link_goc(&store, "L42", 0) == &slinks[42], "Link by name");
+	sput_fail_unless(pa_store_prefix_get(&slinks[42], &px, 64), "Prefix kept");
+	pa_store_link_remove(&store, &dup);
+	sput_fail_unless(pa_store_link_goc(&store, "L42", 0) == &slinks[42], "Link by name");
+	for(i = 0; i < 2; i++) {
+		pa_store_link_init(&unnamed[i], &ulinks[i], "", 0);
+		sput_fail_if(pa_store_link_add(&store, &unnamed[i]), "Unnamed link");
+		pa_store_cache(&store, &unnamed[i], &px, 64);
+	}
+	sput_fail_unless(unnamed[0].n_prefixes == 1 && unnamed[1].n_prefixes == 1, "Unnamed prefixes");
+	for(i = 0; i < 2; i++)
+		pa_store_link_remove(&store, &unnamed[i]);
+	sput_fail_unless(store.n_prefixes == PA_STORE_TEST_PREFIXES - 2, "Unnamed prefixes removed");
+
+	for(i = 0; i < PA_STORE_TEST_LINKS; i++)
+		pa_store_link_remove(&store, &slinks[i]);
+	pa_store_term(&store);
+}
+
+/* Checks that both stores contain the same prefixes, in the same order. */
+static int pa_store_journal_same(struct pa_store *s1, struct pa_store *s2)
+{
+	struct pa_store_link *l1, *l2;
+	struct list_head *e1, *e2;
+	if(s1->n_prefixes != s2->n_prefixes)
+		return 0;
+
+	list_for_each_entry(l1, &s1->links, le) {
+		if(!l1->n_prefixes)
+			continue;
+		if(!(l2 = pa_store_link_goc(s2, l1->name, 0)) || l1->n_prefixes != l2->n_prefixes)
+			return 0;
+		for(e1 = l1->prefixes.next, e2 = l2->prefixes.next;
+				e1 != &l1->prefixes; e1 = e1->next, e2 = e2->next) {
+			struct pa_store_prefix *p1 = list_entry(e1, struct pa_store_prefix, in_link);
+			struct pa_store_prefix *p2 = list_entry(e2, struct pa_store_prefix, in_link);
+			if(!pa_prefix_equals(&p1->prefix, p1->plen, &p2->prefix, p2->plen))
+				return 0;
+		}
+	}
+	for(e1 = s1->prefixes.next, e2 = s2->prefixes.next;
+			e1 != &s1->prefixes; e1 = e1->next, e2 = e2->next) {
+		struct pa_store_prefix *p1 = list_entry(e1, struct pa_store_prefix, in_store);
+		struct pa_store_prefix *p2 = list_entry(e2, struct pa_store_prefix, in_store);
+		if(!pa_prefix_equals(&p1->prefix, p1->plen, &p2->prefix, p2->plen) ||
+				strcmp(p1->link->name, p2->link->name))
+			return 0;
+	}
+	return 1;
+}
+
+/* Copies the prefixes of a list, in order. */
+static size_t pa_store_journal_order(struct list_head *l, int in_store,
+		struct pa_store_prefix **order, size_t max)
+{
+	struct list_head *e;
+	size_t n = 0;
+	for(e = l->next; e != l && n < max; e = e->next)
+		order[n++] = in_store?list_entry(e, struct pa_store_prefix, in_store):
+				list_entry(e, struct pa_store_prefix, in_link);
+	return n;
+}
+
+static off_t pa_store_journal_size(const char *filepath)
+{
+	struct stat st;
+	return stat(filepath, &st)?-1:st.st_size;
+}
+
+void pa_store_journal_test()
+{
+	fu_init();
+	fake_files = 0;
+
+	struct pa_store store, store2;
+	struct pa_store_link l1, l2;
+	const char *filepath = "/tmp/test_pa_store.journal";
+	const char *textpath = "/tmp/test_pa_store.store";
+	//Record lengths: type and length, then the payload
+	size_t vlen = 2 + 4, llen = 2 + 2 + 2, plen64 = 2 + 3 + 8;
+	int i;
+	unlink(filepath);
+	unlink(textpath);
+
+	pa_store_init(&store, 10);
+	pa_store_link_init(&l1, NULL, "L1", 3);
+	pa_store_link_init(&l2, NULL, "L2", 0);
+	pa_store_link_add(&store, &l1);
+	pa_store_link_add(&store, &l2);
+
+	sput_fail_if(pa_store_set_journal(&store, filepath, 1000, 1000), "Set journal");
+	sput_fail_unless(store.journal_path == filepath && !store.filepath, "Journal is used");
+	sput_fail_unless(store.token_count == PA_STORE_WTOKENS_DEFAULT, "Default tokens");
+	sput_fail_unless(store.journal_fd == -1, "Not compacted yet");
+
+	pa_store_cache(&store, &l1, PP(1), 64);
+	pa_store_cache(&store, &l2, PP(2), 64);
+	sput_fail_unless(store.journal_buf_len == 0, "No record before compaction");
+
+	//First save writes the cache content
+	sput_fail_if(pa_store_journal_flush(&store), "Compact");
+	sput_fail_unless(store.journal_fd != -1, "Journal open");
+	sput_fail_unless(store.journal_records == 6, "Header, token, 2 links and 2 prefixes");
+	sput_fail_unless(pa_store_journal_size(filepath) == (off_t)(2 * vlen + 2 * llen + 2 * plen64), "Journal size");
+
+	//Changes are appended
+	pa_store_cache(&store, &l1, PP(3), 64);
+	pa_store_cache(&store, &l1, PP(4), 64);
+	pa_store_cache(&store, &l1, PP(5), 64); //Removes PP(1)
+	sput_fail_unless(l1.n_prefixes == 3, "3 prefixes in L1");
+	sput_fail_unless(store.journal_buf_records == 4, "3 prefixes and a removal");
+	sput_fail_if(pa_store_journal_flush(&store), "Flush");
+	sput_fail_unless(store.journal_records == 11, "Appended records and token");
+	sput_fail_unless(pa_store_journal_size(filepath) == (off_t)(3 * vlen + 2 * llen + 6 * plen64), "Journal size");
+
+	pa_store_cache(&store, &l2, PP(3), 56);
+	pa_store_cache(&store, &l1, PP(3), 64); //Move to head
+	sput_fail_unless(store.journal_buf_records == 2, "2 prefixes");
+	pa_store_cache(&store, &l1, PP(3), 64); //Already at head
+	sput_fail_unless(store.journal_buf_records == 2, "Nothing to record");
+	store.token_count = 4;
+	sput_fail_if(pa_store_journal_flush(&store), "Flush");
+
+	//Replay
+	pa_store_init(&store2, 10);
+	sput_fail_if(pa_store_journal_load(&store2, filepath), "Load journal");
+	sput_fail_unless(pa_store_journal_same(&store, &store2), "Same content");
+	pa_store_term(&store2);
+
+	//Truncated records are ignored
+	int fd = open(filepath, O_WRONLY | O_APPEND, 0);
+	sput_fail_unless(write(fd, "garbage", 7) == 7, "Append garbage");
+	close(fd);
+	pa_store_init(&store2, 10);
+	sput_fail_if(pa_store_journal_load(&store2, filepath), "Load journal");
+	sput_fail_unless(pa_store_journal_same(&store, &store2), "Same content");
+	pa_store_term(&store2);
+
+	//An invalid record ends the journal
+	off_t size = pa_store_journal_size(filepath);
+	uint8_t bad[] = {0xff, 1, 0, PA_STORE_JOP_WTOKEN, 4, 0, 0, 0, 9};
+	fd = open(filepath, O_WRONLY, 0);
+	sput_fail_unless(ftruncate(fd, size - 7) == 0, "Remove garbage");
+	sput_fail_unless(pwrite(fd, bad, sizeof(bad), size - 7) == sizeof(bad), "Append invalid record");
+	close(fd);
+	pa_store_init(&store2, 10);
+	sput_fail_if(pa_store_journal_load(&store2, filepath), "Load journal");
+	sput_fail_unless(pa_store_journal_same(&store, &store2), "Same content");
+	pa_store_term(&store2);
+	sput_fail_unless(pa_store_journal_size(filepath) == size - 7 + (off_t)sizeof(bad), "Not truncated by load");
+
+	//Setting the journal loads it, and truncates the invalid tail
+	pa_store_init(&store2, 10);
+	sput_fail_if(pa_store_set_journal(&store2, filepath, 1000, 1000), "Set journal");
+	sput_fail_unless(pa_store_journal_same(&store, &store2), "Same content");
+	sput_fail_unless(store2.token_count == 4, "Token count was saved");
+	sput_fail_unless(pa_store_journal_size(filepath) == size - 7, "Truncated");
+	pa_store_term(&store2);
+
+	//Many changes trigger compaction, which does not change the order
+	struct pa_store_prefix *o1[10], *o2[10], *n1[10], *n2[10];
+	size_t c1, c2;
+	for(i = 0; i < 100; i++)
+		pa_store_cache(&store, &l1, PP(3 + (i % 3)), 64);
+	c1 = pa_store_journal_order(&store.prefixes, 1, o1, 10);
+	c2 = pa_store_journal_order(&l1.prefixes, 0, o2, 10);
+	sput_fail_if(pa_store_journal_flush(&store), "Compact");
+	sput_fail_unless(pa_store_journal_order(&store.prefixes, 1, n1, 10) == c1 &&
+			!memcmp(o1, n1, c1 * sizeof(*o1)), "Same store order");
+	sput_fail_unless(pa_store_journal_order(&l1.prefixes, 0, n2, 10) == c2 &&
+			!memcmp(o2, n2, c2 * sizeof(*o2)), "Same link order");
+	sput_fail_unless(store.journal_records == 2 + 2 + store.n_prefixes, "Compacted");
+	pa_store_init(&store2, 10);
+	sput_fail_if(pa_store_journal_load(&store2, filepath), "Load journal");
+	sput_fail_unless(pa_store_journal_same(&store, &store2), "Same content");
+	pa_store_term(&store2);
+
+	//Text export and import
+	store.filepath = textpath;
+	sput_fail_if(pa_store_save(&store), "Export");
+	store.filepath = NULL;
+	pa_store_init(&store2, 10);
+	sput_fail_if(pa_store_load(&store2, textpath), "Import");
+	sput_fail_unless(pa_store_journal_same(&store, &store2), "Same content");
+	pa_store_term(&store2);
+
+	//Invalid journal
+	sput_fail_unless(pa_store_journal_load(&store, textpath) == -1, "Invalid header");
+
+	pa_store_link_remove(&store, &l1);
+	pa_store_link_remove(&store, &l2);
+	pa_store_term(&store);
+	unlink(filepath);
+	unlink(textpath);
+}
+
 int main() {
 	sput_start_testing();
 	sput_enter_suite("Prefix Assignment Storage tests"); /* optional */
@@ -749,6 +1002,8 @@ int main() {
 	sput_run_test(pa_store_load_test);
 	sput_run_test(pa_store_saveload_test);
 	sput_run_test(pa_store_delays_test);
+	sput_run_test(pa_store_journal_test);
+	sput_run_test(pa_store_index_test);
 	sput_run_test(pa_store_rule_test);
 	sput_leave_suite(); /* optional */
 	sput_finish_testing();